@@ -0,0 +1,87 @@
+/**
+ * Compact hop addresses, as kept in path caches, graphs and archives.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "addr.h"
+#include "utils.h"
+
+void addr_set(struct tr_addr *addr, int family, const void *in) {
+  memset(addr, 0, sizeof(*addr));
+  addr->family = family;
+  if (family == AF_INET) {
+    memcpy(&addr->u.v4, in, sizeof(addr->u.v4));
+  } else if (family == AF_INET6) {
+    memcpy(&addr->u.v6, in, sizeof(addr->u.v6));
+  }
+}
+
+int addr_eq(const struct tr_addr *x, const struct tr_addr *y) {
+  return x->family == y->family && memcmp(&x->u, &y->u, sizeof(x->u)) == 0;
+}
+
+/**
+ * Formats `addr` like inet_ntop(), or as "*" for an unresponsive hop.
+ */
+const char *addr_ntop(const struct tr_addr *addr, char *s, socklen_t slen) {
+  if (addr->family == 0) {
+    snprintf(s, slen, "*");
+    return s;
+  }
+  return inet_ntop(addr->family, &addr->u, s, slen);
+}
+
+/**
+ * Parses an address written by addr_ntop().
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+int addr_pton(struct tr_addr *addr, const char *s) {
+  memset(addr, 0, sizeof(*addr));
+  if (strcmp(s, "*") == 0) {
+    return 0;
+  }
+  addr->family = strchr(s, ':') != NULL ? AF_INET6 : AF_INET;
+  return inet_pton(addr->family, s, &addr->u) == 1 ? 0 : -1;
+}
+
+/**
+ * Returns whether the first `len` bits of `addr` match those of `prefix`.
+ */
+int addr_in_prefix(const struct tr_addr *addr, const struct tr_addr *prefix,
+                   int len) {
+  const uint8_t *a = (const uint8_t *)&addr->u, *p = (const uint8_t *)&prefix->u;
+  int bytes = len / 8, bits = len % 8;
+
+  if (addr->family != prefix->family || memcmp(a, p, bytes) != 0) {
+    return 0;
+  }
+  return bits == 0 || ((a[bytes] ^ p[bytes]) & (0xff00 >> bits) & 0xff) == 0;
+}
+
+// Responders pick their own addresses, so the tables they go in are keyed
+// per process to keep them from being filled with collisions.
+static uint8_t hash_key[16];
+static int hash_keyed;
+
+/**
+ * Draws the key addr_hash() uses. Called before any threads are started,
+ * and otherwise on the first addr_hash().
+ */
+void addr_hash_init(void) {
+  random_key(hash_key, sizeof(hash_key));
+  hash_keyed = 1;
+}
+
+uint32_t addr_hash(const struct tr_addr *addr) {
+  if (!hash_keyed) {
+    addr_hash_init();
+  }
+  return siphash24(hash_key, addr, sizeof(*addr));
+}
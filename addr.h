@@ -0,0 +1,29 @@
+#ifndef ADDR_H
+#define ADDR_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * A hop address without the bulk of a sockaddr_storage.
+ * `family` is 0 for a hop that did not respond.
+ */
+struct tr_addr {
+  int family;
+  union {
+    struct in_addr v4;
+    struct in6_addr v6;
+  } u;
+};
+
+void addr_set(struct tr_addr *addr, int family, const void *in);
+int addr_eq(const struct tr_addr *x, const struct tr_addr *y);
+void addr_hash_init(void);
+uint32_t addr_hash(const struct tr_addr *addr);
+const char *addr_ntop(const struct tr_addr *addr, char *s, socklen_t slen);
+int addr_pton(struct tr_addr *addr, const char *s);
+int addr_in_prefix(const struct tr_addr *addr, const struct tr_addr *prefix,
+                   int len);
+
+#endif
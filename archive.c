@@ -0,0 +1,383 @@
+/**
+ * A columnar archive of probe outcomes.
+ *
+ * Records are buffered into chunks of ARCHIVE_CHUNK and each chunk is
+ * stored column by column: responders and targets as indexes into the
+ * chunk's address dictionary, times and RTTs as zigzag varint deltas and
+ * TTLs and ICMP types and codes as plain byte arrays. Chunk headers carry
+ * their time range and the dictionary doubles as an index of the addresses
+ * a chunk mentions, so a query can skip chunks without decoding them.
+ *
+ * Archives are only ever appended to and are read back with mmap().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "archive.h"
+
+#define ARCHIVE_ALIGN 8
+#define ARCHIVE_VARINT_MAX 10
+
+static uint64_t zigzag(int64_t x) {
+  return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+static int64_t unzigzag(uint64_t x) {
+  return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t x) {
+  while (x >= 0x80) {
+    *p++ = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+  *p++ = x;
+  return p;
+}
+
+/**
+ * Reads a varint from `*p`, which must not run past `end`.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *x) {
+  int shift;
+
+  *x = 0;
+  for (shift = 0; *p < end && shift < 64; shift += 7) {
+    *x |= (uint64_t)(**p & 0x7f) << shift;
+    if ((*(*p)++ & 0x80) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int archive_open(struct tr_archive_writer *w, const char *file) {
+  char magic[sizeof(ARCHIVE_MAGIC)];
+
+  memset(w, 0, sizeof(*w));
+  if ((w->records = malloc(ARCHIVE_CHUNK * sizeof(*w->records))) == NULL) {
+    return -1;
+  }
+  if ((w->f = fopen(file, "a+b")) == NULL || fseek(w->f, 0, SEEK_END) == -1) {
+    goto fail;
+  }
+
+  if (ftell(w->f) == 0) {
+    if (fwrite(ARCHIVE_MAGIC, sizeof(magic), 1, w->f) != 1) {
+      goto fail;
+    }
+    return 0;
+  }
+
+  rewind(w->f);
+  if (fread(magic, sizeof(magic), 1, w->f) != 1 ||
+      memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) != 0) {
+    errno = EINVAL;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if (w->f != NULL) {
+    fclose(w->f);
+  }
+  free(w->records);
+  return -1;
+}
+
+int archive_append(struct tr_archive_writer *w,
+                   const struct archive_record *record) {
+  w->records[w->nrecords++] = *record;
+  return w->nrecords == ARCHIVE_CHUNK ? archive_flush(w) : 0;
+}
+
+/**
+ * Interns `addr` into `dict`, using `slots` (of which there are `cap`,
+ * a power of two, with -1 marking an empty one) as a hash index.
+ *
+ * Returns the index of `addr` in `dict`.
+ */
+static uint32_t dict_intern(struct tr_addr *dict, uint32_t *ndict, int *slots,
+                            uint32_t cap, const struct tr_addr *addr) {
+  uint32_t i = addr_hash(addr) & (cap - 1);
+  while (slots[i] != -1 && !addr_eq(&dict[slots[i]], addr)) {
+    i = (i + 1) & (cap - 1);
+  }
+  if (slots[i] == -1) {
+    slots[i] = *ndict;
+    dict[(*ndict)++] = *addr;
+  }
+  return slots[i];
+}
+
+/**
+ * Writes the buffered records out as a chunk.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+int archive_flush(struct tr_archive_writer *w) {
+  static const uint8_t pad[ARCHIVE_ALIGN];
+  int i, c, *slots = NULL, rv = -1;
+  uint32_t n = w->nrecords, cap = 4 * ARCHIVE_CHUNK, len;
+  uint64_t time, rtt;
+  struct archive_chunk_header header;
+  struct tr_addr *dict = NULL;
+  uint8_t *cols[ARCHIVE_VARINT_COLS] = {NULL}, *p[ARCHIVE_VARINT_COLS];
+  uint8_t *bytes = NULL;
+  const struct archive_record *r;
+
+  if (n == 0) {
+    return 0;
+  }
+
+  if ((slots = malloc(cap * sizeof(*slots))) == NULL ||
+      (dict = malloc(2 * n * sizeof(*dict))) == NULL ||
+      (bytes = malloc(3 * n)) == NULL) {
+    goto done;
+  }
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    if ((cols[c] = malloc(n * ARCHIVE_VARINT_MAX)) == NULL) {
+      goto done;
+    }
+    p[c] = cols[c];
+  }
+  memset(slots, -1, cap * sizeof(*slots));
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ARCHIVE_CHUNK_MAGIC, sizeof(header.magic));
+  header.nrecords = n;
+  header.time_min = header.time_max = w->records[0].time_us;
+  for (i = 0; i < (int)n; i++) {
+    r = &w->records[i];
+    if (r->time_us < header.time_min) {
+      header.time_min = r->time_us;
+    }
+    if (r->time_us > header.time_max) {
+      header.time_max = r->time_us;
+    }
+  }
+
+  time = header.time_min;
+  rtt = 0;
+  for (i = 0; i < (int)n; i++) {
+    r = &w->records[i];
+    p[ARCHIVE_COL_TIME] = put_varint(p[ARCHIVE_COL_TIME],
+                                     zigzag((int64_t)(r->time_us - time)));
+    p[ARCHIVE_COL_TARGET] = put_varint(
+        p[ARCHIVE_COL_TARGET],
+        dict_intern(dict, &header.ndict, slots, cap, &r->target));
+    p[ARCHIVE_COL_RESPONDER] = put_varint(
+        p[ARCHIVE_COL_RESPONDER],
+        dict_intern(dict, &header.ndict, slots, cap, &r->responder));
+    p[ARCHIVE_COL_RTT] =
+        put_varint(p[ARCHIVE_COL_RTT], zigzag((int64_t)r->rtt_us - (int64_t)rtt));
+    bytes[i] = r->ttl;
+    bytes[n + i] = r->icmp_type;
+    bytes[2 * n + i] = r->icmp_code;
+    time = r->time_us;
+    rtt = r->rtt_us;
+  }
+
+  len = header.ndict * sizeof(*dict) + 3 * n;
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    header.col_len[c] = p[c] - cols[c];
+    len += header.col_len[c];
+  }
+  header.len = (len + ARCHIVE_ALIGN - 1) & ~(ARCHIVE_ALIGN - 1);
+
+  if (fwrite(&header, sizeof(header), 1, w->f) != 1 ||
+      fwrite(dict, sizeof(*dict), header.ndict, w->f) != header.ndict) {
+    goto done;
+  }
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    if (fwrite(cols[c], 1, header.col_len[c], w->f) != header.col_len[c]) {
+      goto done;
+    }
+  }
+  if (fwrite(bytes, 1, 3 * n, w->f) != 3 * n ||
+      fwrite(pad, 1, header.len - len, w->f) != header.len - len ||
+      fflush(w->f) == EOF) {
+    goto done;
+  }
+  w->nrecords = 0;
+  rv = 0;
+
+done:
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    free(cols[c]);
+  }
+  free(bytes);
+  free(dict);
+  free(slots);
+  return rv;
+}
+
+int archive_close(struct tr_archive_writer *w) {
+  int rv = archive_flush(w);
+  if (fclose(w->f) == EOF) {
+    rv = -1;
+  }
+  free(w->records);
+  return rv;
+}
+
+int archive_map(struct tr_archive *a, const char *file) {
+  int fd;
+  struct stat st;
+
+  if ((fd = open(file, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(ARCHIVE_MAGIC)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  a->len = st.st_size;
+  a->map = mmap(NULL, a->len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (a->map == MAP_FAILED) {
+    return -1;
+  }
+  if (memcmp(a->map, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0) {
+    munmap(a->map, a->len);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Locates the chunk at `*off` (0 for the first) and advances `*off` past it.
+ * Only the chunk's layout is checked; its columns are left undecoded.
+ *
+ * Returns 1 if a chunk was found, 0 at the end of the archive
+ * and -1 if the archive is corrupt.
+ */
+int archive_next_chunk(const struct tr_archive *a, size_t *off,
+                       struct archive_chunk *chunk) {
+  int c;
+  size_t len;
+  const uint8_t *p;
+  const struct archive_chunk_header *header;
+
+  if (*off == 0) {
+    *off = sizeof(ARCHIVE_MAGIC);
+  }
+  if (*off == a->len) {
+    return 0;
+  }
+
+  header = (const struct archive_chunk_header *)((const uint8_t *)a->map + *off);
+  if (a->len - *off < sizeof(*header) ||
+      memcmp(header->magic, ARCHIVE_CHUNK_MAGIC, sizeof(header->magic)) != 0 ||
+      a->len - *off - sizeof(*header) < header->len) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  len = (size_t)header->ndict * sizeof(struct tr_addr) +
+        3 * (size_t)header->nrecords;
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    len += header->col_len[c];
+  }
+  if (len > header->len) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  chunk->header = header;
+  chunk->dict = (const struct tr_addr *)(header + 1);
+  p = (const uint8_t *)(chunk->dict + header->ndict);
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    chunk->cols[c] = p;
+    p += header->col_len[c];
+  }
+  chunk->ttl = p;
+  chunk->icmp_type = p + header->nrecords;
+  chunk->icmp_code = p + 2 * header->nrecords;
+
+  *off += sizeof(*header) + header->len;
+  return 1;
+}
+
+/**
+ * Returns the dictionary index of `addr` in `chunk`, or -1 if no record
+ * in the chunk mentions it.
+ */
+int archive_dict_find(const struct archive_chunk *chunk,
+                      const struct tr_addr *addr) {
+  uint32_t i;
+  for (i = 0; i < chunk->header->ndict; i++) {
+    if (addr_eq(&chunk->dict[i], addr)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Decodes every record of `chunk` into `records`,
+ * which must have room for `chunk->header->nrecords`.
+ *
+ * Returns 0 on success and -1 if the chunk is corrupt.
+ */
+int archive_decode(const struct archive_chunk *chunk,
+                   struct archive_record *records) {
+  int c;
+  uint32_t i, n = chunk->header->nrecords;
+  uint64_t x[ARCHIVE_VARINT_COLS], time, rtt;
+  const uint8_t *p[ARCHIVE_VARINT_COLS], *end[ARCHIVE_VARINT_COLS];
+  struct archive_record *r;
+
+  for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+    p[c] = chunk->cols[c];
+    end[c] = p[c] + chunk->header->col_len[c];
+  }
+
+  time = chunk->header->time_min;
+  rtt = 0;
+  for (i = 0; i < n; i++) {
+    for (c = 0; c < ARCHIVE_VARINT_COLS; c++) {
+      if (get_varint(&p[c], end[c], &x[c]) == -1) {
+        errno = EINVAL;
+        return -1;
+      }
+    }
+    if (x[ARCHIVE_COL_TARGET] >= chunk->header->ndict ||
+        x[ARCHIVE_COL_RESPONDER] >= chunk->header->ndict) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    r = &records[i];
+    time += unzigzag(x[ARCHIVE_COL_TIME]);
+    rtt += unzigzag(x[ARCHIVE_COL_RTT]);
+    r->time_us = time;
+    r->rtt_us = rtt;
+    r->target = chunk->dict[x[ARCHIVE_COL_TARGET]];
+    r->responder = chunk->dict[x[ARCHIVE_COL_RESPONDER]];
+    r->ttl = chunk->ttl[i];
+    r->icmp_type = chunk->icmp_type[i];
+    r->icmp_code = chunk->icmp_code[i];
+  }
+  return 0;
+}
+
+void archive_unmap(struct tr_archive *a) { munmap(a->map, a->len); }
@@ -0,0 +1,88 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "addr.h"
+
+#define ARCHIVE_MAGIC "TRARCH1"
+#define ARCHIVE_CHUNK_MAGIC "TRCK"
+
+// Records per chunk; a chunk is the unit that queries can skip.
+#define ARCHIVE_CHUNK 4096
+
+// Varint columns, in the order they follow the dictionary.
+#define ARCHIVE_COL_TIME 0
+#define ARCHIVE_COL_TARGET 1
+#define ARCHIVE_COL_RESPONDER 2
+#define ARCHIVE_COL_RTT 3
+#define ARCHIVE_VARINT_COLS 4
+
+/**
+ * A single probe outcome.
+ * A probe that got no reply has a responder with family 0.
+ */
+struct archive_record {
+  uint64_t time_us; // Wall clock time the probe was sent.
+  struct tr_addr target;
+  struct tr_addr responder;
+  uint32_t rtt_us;
+  uint8_t ttl;
+  uint8_t icmp_type;
+  uint8_t icmp_code;
+};
+
+/**
+ * A chunk is this header, the chunk's address dictionary, the varint
+ * columns (zigzag deltas of times and RTTs; dictionary indexes of targets
+ * and responders) and byte columns of TTLs, ICMP types and codes,
+ * padded to 8 bytes. Integers are in host byte order.
+ */
+struct archive_chunk_header {
+  char magic[4];
+  uint32_t nrecords;
+  uint32_t ndict;
+  uint32_t len; // Bytes following this header.
+  uint64_t time_min;
+  uint64_t time_max;
+  uint32_t col_len[ARCHIVE_VARINT_COLS];
+};
+
+struct archive_chunk {
+  const struct archive_chunk_header *header;
+  const struct tr_addr *dict;
+  const uint8_t *cols[ARCHIVE_VARINT_COLS];
+  const uint8_t *ttl;
+  const uint8_t *icmp_type;
+  const uint8_t *icmp_code;
+};
+
+struct tr_archive_writer {
+  FILE *f;
+  struct archive_record *records;
+  int nrecords;
+};
+
+struct tr_archive {
+  void *map;
+  size_t len;
+};
+
+int archive_open(struct tr_archive_writer *w, const char *file);
+int archive_append(struct tr_archive_writer *w,
+                   const struct archive_record *record);
+int archive_flush(struct tr_archive_writer *w);
+int archive_close(struct tr_archive_writer *w);
+
+int archive_map(struct tr_archive *a, const char *file);
+int archive_next_chunk(const struct tr_archive *a, size_t *off,
+                       struct archive_chunk *chunk);
+int archive_dict_find(const struct archive_chunk *chunk,
+                      const struct tr_addr *addr);
+int archive_decode(const struct archive_chunk *chunk,
+                   struct archive_record *records);
+void archive_unmap(struct tr_archive *a);
+
+#endif
@@ -0,0 +1,644 @@
+/**
+ * Reading pcap and pcapng captures, and writing pcapng ones.
+ *
+ * Captures are memory-mapped and packets are handed out in place,
+ * so replaying one costs no copies or system calls per packet.
+ * Both formats may have been written on a machine of either byte order;
+ * pcapng files may also mix sections of each and interfaces of
+ * different link types and timestamp resolutions.
+ *
+ * Captures are written the same way round: into files preallocated to
+ * their full size and mapped, see struct tr_capture_writer.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+#define PCAP_HEADER_LEN 24
+#define PCAP_RECORD_LEN 16
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+// Lengths of the blocks a writer writes: a section header, an interface
+// of raw IP with nanosecond timestamps, and an enhanced packet block
+// with its direction less the packet itself.
+#define PCAPNG_SHB_LEN 28
+#define PCAPNG_IDB_LEN 32
+#define PCAPNG_EPB_LEN 44
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+static uint16_t get16(const struct tr_capture *c, const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return c->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t get32(const struct tr_capture *c, const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return c->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t get_be16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+/**
+ * Maps `file` and reads its header.
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (EINVAL if the file is not a capture).
+ */
+int capture_open(struct tr_capture *c, const char *file) {
+  int fd;
+  uint32_t magic;
+  struct stat st;
+
+  memset(c, 0, sizeof(*c));
+  if ((fd = open(file, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size < PCAP_HEADER_LEN) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  c->len = st.st_size;
+  c->map = mmap(NULL, c->len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (c->map == MAP_FAILED) {
+    return -1;
+  }
+  madvise((void *)c->map, c->len, MADV_SEQUENTIAL);
+
+  memcpy(&magic, c->map, sizeof(magic));
+  if (magic == PCAPNG_SHB) {
+    // The section header is read like any other block.
+    c->ng = 1;
+    return 0;
+  }
+  if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+    c->swapped = 0;
+  } else if (__builtin_bswap32(magic) == PCAP_MAGIC_US ||
+             __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+    c->swapped = 1;
+  } else {
+    capture_close(c);
+    errno = EINVAL;
+    return -1;
+  }
+  c->ns = get32(c, c->map) == PCAP_MAGIC_NS;
+  c->linktype = get32(c, c->map + 20) & 0xffff;
+  c->off = PCAP_HEADER_LEN;
+  return 0;
+}
+
+static int next_pcap(struct tr_capture *c, struct capture_packet *pkt) {
+  const uint8_t *r = c->map + c->off;
+  uint32_t len;
+
+  if (c->off == c->len) {
+    return 0;
+  }
+  if (c->len - c->off < PCAP_RECORD_LEN) {
+    return -1;
+  }
+  len = get32(c, r + 8);
+  if (len > c->len - c->off - PCAP_RECORD_LEN) {
+    return -1;
+  }
+  pkt->ts.tv_sec = get32(c, r);
+  pkt->ts.tv_nsec = get32(c, r + 4) * (c->ns ? 1 : 1000);
+  pkt->linktype = c->linktype;
+  pkt->data = r + PCAP_RECORD_LEN;
+  pkt->len = len;
+  c->off += PCAP_RECORD_LEN + len;
+  return 1;
+}
+
+/**
+ * Reads a section header block, which sets the byte order
+ * of the blocks that follow and forgets earlier interfaces.
+ */
+static int read_shb(struct tr_capture *c, const uint8_t *b, uint32_t len) {
+  uint32_t order;
+
+  if (len < 28) {
+    return -1;
+  }
+  memcpy(&order, b + 8, sizeof(order));
+  if (order == PCAPNG_BYTE_ORDER) {
+    c->swapped = 0;
+  } else if (__builtin_bswap32(order) == PCAPNG_BYTE_ORDER) {
+    c->swapped = 1;
+  } else {
+    return -1;
+  }
+  c->nifaces = 0;
+  return 0;
+}
+
+/**
+ * Reads an interface description block: its link type and, from its
+ * options, the resolution of its timestamps (microseconds by default).
+ */
+static int read_idb(struct tr_capture *c, const uint8_t *b, uint32_t len) {
+  int i;
+  uint8_t res;
+  uint16_t code, olen;
+  uint32_t off = 16;
+
+  if (len < 20 || c->nifaces == CAPTURE_IFACES) {
+    return -1;
+  }
+  i = c->nifaces++;
+  c->ifaces[i].linktype = get16(c, b + 8);
+  c->ifaces[i].units = 1000000;
+  while (off + 4 <= len - 4) {
+    code = get16(c, b + off);
+    olen = get16(c, b + off + 2);
+    if (code == PCAPNG_OPT_END || off + 4 + olen > len - 4) {
+      break;
+    }
+    if (code == PCAPNG_OPT_TSRESOL && olen >= 1) {
+      res = b[off + 4];
+      if (res & 0x80) {
+        c->ifaces[i].units = 1ULL << ((res & 0x7f) < 63 ? res & 0x7f : 63);
+      } else {
+        for (c->ifaces[i].units = 1; res > 0 && res <= 19; res--) {
+          c->ifaces[i].units *= 10;
+        }
+      }
+    }
+    off += 4 + ((olen + 3) & ~3);
+  }
+  return 0;
+}
+
+static int next_pcapng(struct tr_capture *c, struct capture_packet *pkt) {
+  const uint8_t *b;
+  uint32_t type, len, iface, caplen;
+  uint64_t ts, units;
+
+  while (c->off < c->len) {
+    b = c->map + c->off;
+    if (c->len - c->off < 12) {
+      return -1;
+    }
+    type = get32(c, b);
+    // A capture preallocated by a writer that never closed it.
+    if (type == 0 && get32(c, b + 4) == 0) {
+      return 0;
+    }
+    if (type == PCAPNG_SHB && read_shb(c, b, c->len - c->off) == -1) {
+      return -1;
+    }
+    len = get32(c, b + 4);
+    if (len < 12 || len % 4 != 0 || len > c->len - c->off) {
+      return -1;
+    }
+    c->off += len;
+
+    switch (type) {
+    case PCAPNG_IDB:
+      if (read_idb(c, b, len) == -1) {
+        return -1;
+      }
+      break;
+    case PCAPNG_EPB:
+      if (len < 32 || (iface = get32(c, b + 8)) >= (uint32_t)c->nifaces ||
+          (caplen = get32(c, b + 20)) > len - 32) {
+        return -1;
+      }
+      units = c->ifaces[iface].units;
+      ts = (uint64_t)get32(c, b + 12) << 32 | get32(c, b + 16);
+      pkt->ts.tv_sec = ts / units;
+      // Exactly, unless finer than nanoseconds.
+      pkt->ts.tv_nsec = units <= 1000000000
+                            ? (ts % units) * 1000000000 / units
+                            : (double)(ts % units) / units * 1e9;
+      pkt->linktype = c->ifaces[iface].linktype;
+      pkt->data = b + 28;
+      pkt->len = caplen;
+      return 1;
+    case PCAPNG_SPB:
+      // No timestamp, and always from the first interface.
+      if (len < 16 || c->nifaces == 0) {
+        return -1;
+      }
+      caplen = get32(c, b + 8);
+      pkt->ts.tv_sec = 0;
+      pkt->ts.tv_nsec = 0;
+      pkt->linktype = c->ifaces[0].linktype;
+      pkt->data = b + 12;
+      pkt->len = caplen < len - 16 ? caplen : len - 16;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads the next packet. Blocks other than packets are skipped.
+ *
+ * Returns 1 if a packet was read, 0 at the end of the capture
+ * and -1 if the capture is truncated or corrupt.
+ */
+int capture_next(struct tr_capture *c, struct capture_packet *pkt) {
+  return c->ng ? next_pcapng(c, pkt) : next_pcap(c, pkt);
+}
+
+/**
+ * Finds the IP header of a captured packet, below whichever link layer
+ * it was captured on.
+ *
+ * Returns a pointer to it with its address family in `*family` and the
+ * captured bytes from there on in `*len`, or NULL if it is not IP.
+ */
+const uint8_t *capture_ip(const struct capture_packet *pkt, int *family,
+                          uint32_t *len) {
+  const uint8_t *p = pkt->data;
+  uint32_t n = pkt->len, skip;
+  uint16_t type;
+
+  switch (pkt->linktype) {
+  case LINKTYPE_NULL:
+    skip = 4;
+    break;
+  case LINKTYPE_ETHERNET:
+    if (n < 14) {
+      return NULL;
+    }
+    skip = 12;
+    while ((type = get_be16(p + skip)) == ETHERTYPE_VLAN ||
+           type == ETHERTYPE_QINQ) {
+      if ((skip += 4) + 2 > n) {
+        return NULL;
+      }
+    }
+    if (type != ETHERTYPE_IPV4 && type != ETHERTYPE_IPV6) {
+      return NULL;
+    }
+    skip += 2;
+    break;
+  case LINKTYPE_LINUX_SLL:
+    skip = 16;
+    break;
+  case LINKTYPE_LINUX_SLL2:
+    skip = 20;
+    break;
+  case LINKTYPE_RAW:
+  case LINKTYPE_IPV4:
+  case LINKTYPE_IPV6:
+    skip = 0;
+    break;
+  default:
+    return NULL;
+  }
+  if (n <= skip) {
+    return NULL;
+  }
+  p += skip;
+  n -= skip;
+  switch (p[0] >> 4) {
+  case 4:
+    *family = AF_INET;
+    break;
+  case 6:
+    *family = AF_INET6;
+    break;
+  default:
+    return NULL;
+  }
+  *len = n;
+  return p;
+}
+
+/**
+ * Finds the transport header of the IP packet at `ip` of `len` bytes,
+ * skipping IPv4 options and IPv6 extension headers.
+ *
+ * Returns a pointer to it with its protocol in `*proto` and the bytes
+ * from there on in `*tlen`, or NULL if the packet is truncated
+ * or a non-first fragment.
+ */
+const uint8_t *capture_transport(const uint8_t *ip, int family, uint32_t len,
+                                 int *proto, uint32_t *tlen) {
+  uint32_t off, hlen;
+
+  if (family == AF_INET) {
+    if (len < 20 || (off = (ip[0] & 0x0f) * 4) < 20 || off > len ||
+        (get_be16(ip + 6) & 0x1fff) != 0) {
+      return NULL;
+    }
+    *proto = ip[9];
+  } else {
+    if (len < 40) {
+      return NULL;
+    }
+    *proto = ip[6];
+    for (off = 40;; off += hlen) {
+      if (*proto == IPPROTO_FRAGMENT) {
+        if (off + 8 > len || (get_be16(ip + off + 2) & 0xfff8) != 0) {
+          return NULL;
+        }
+        hlen = 8;
+      } else if (*proto == IPPROTO_HOPOPTS || *proto == IPPROTO_ROUTING ||
+                 *proto == IPPROTO_DSTOPTS) {
+        if (off + 8 > len) {
+          return NULL;
+        }
+        hlen = (ip[off + 1] + 1) * 8;
+      } else {
+        break;
+      }
+      *proto = ip[off];
+    }
+    if (off > len) {
+      return NULL;
+    }
+  }
+  *tlen = len - off;
+  return ip + off;
+}
+
+void capture_close(struct tr_capture *c) {
+  if (c->map != NULL && c->map != MAP_FAILED) {
+    munmap((void *)c->map, c->len);
+  }
+  c->map = NULL;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+/**
+ * Creates the next file of `w` in `f`, preallocated to w->size
+ * and mapped, with its section header and interface written.
+ */
+static int start_file(struct tr_capture_writer *w, struct capture_file *f) {
+  int err;
+  uint8_t *p;
+
+  if ((f->name = malloc(strlen(w->prefix) + 20)) == NULL) {
+    return -1;
+  }
+  sprintf(f->name, "%s.%u.pcapng", w->prefix, w->nfiles++);
+  if ((f->fd = open(f->name, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+    goto fail;
+  }
+  // Allocate the blocks now rather than on the first write to each,
+  // where the file system supports it.
+  if ((err = posix_fallocate(f->fd, 0, w->size)) != 0) {
+    if (err != EOPNOTSUPP && err != EINVAL) {
+      errno = err;
+      goto fail_file;
+    }
+    if (ftruncate(f->fd, w->size) == -1) {
+      goto fail_file;
+    }
+  }
+  if ((f->map = mmap(NULL, w->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd,
+                     0)) == MAP_FAILED) {
+    goto fail_file;
+  }
+#ifdef MADV_POPULATE_WRITE
+  // Fault the pages in now, not as packets are written to them.
+  madvise(f->map, w->size, MADV_POPULATE_WRITE);
+#endif
+
+  p = put32(f->map, PCAPNG_SHB);
+  p = put32(p, PCAPNG_SHB_LEN);
+  p = put32(p, PCAPNG_BYTE_ORDER);
+  p = put16(p, 1);
+  p = put16(p, 0);
+  memset(p, 0xff, 8); // Section length not known.
+  p = put32(p + 8, PCAPNG_SHB_LEN);
+
+  p = put32(p, PCAPNG_IDB);
+  p = put32(p, PCAPNG_IDB_LEN);
+  p = put16(p, LINKTYPE_RAW);
+  p = put16(p, 0);
+  p = put32(p, CAPTURE_SNAPLEN);
+  p = put16(p, PCAPNG_OPT_TSRESOL);
+  p = put16(p, 1);
+  p = put32(p, 9);
+  p = put32(p, PCAPNG_OPT_END);
+  put32(p, PCAPNG_IDB_LEN);
+  f->off = PCAPNG_SHB_LEN + PCAPNG_IDB_LEN;
+  return 0;
+
+fail_file:
+  err = errno;
+  close(f->fd);
+  unlink(f->name);
+  errno = err;
+fail:
+  free(f->name);
+  f->map = NULL;
+  return -1;
+}
+
+/**
+ * Trims `f` to what was written to it and closes it.
+ */
+static int end_file(struct tr_capture_writer *w, struct capture_file *f) {
+  int ret = 0;
+
+  munmap(f->map, w->size);
+  if (ftruncate(f->fd, f->off) == -1) {
+    ret = -1;
+  }
+  if (close(f->fd) == -1) {
+    ret = -1;
+  }
+  free(f->name);
+  f->map = NULL;
+  return ret;
+}
+
+static void *run_writer(void *arg) {
+  struct tr_capture_writer *w = arg;
+  struct capture_file *f;
+  int stop, ok;
+
+  pthread_mutex_lock(&w->lock);
+  do {
+    while (!w->pending && !w->stop) {
+      pthread_cond_wait(&w->wake, &w->lock);
+    }
+    stop = w->stop;
+    if (w->pending) {
+      pthread_mutex_unlock(&w->lock);
+      f = &w->files[!w->active];
+      ok = !((f->map != NULL && end_file(w, f) == -1) ||
+             (!stop && start_file(w, f) == -1));
+      if (!ok) {
+        w->error = errno;
+      }
+      pthread_mutex_lock(&w->lock);
+      // The request is cleared before the file is published, or one made
+      // as soon as it is (filling it up) would be cleared with it.
+      w->pending = 0;
+      if (ok && !stop) {
+        atomic_store_explicit(&w->ready, 1, memory_order_release);
+      }
+    }
+  } while (!stop);
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/**
+ * Starts writing a capture to files named after `prefix` of up to
+ * `size` bytes each.
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (EINVAL if `size` is under CAPTURE_FILE_MIN).
+ */
+int capture_writer_open(struct tr_capture_writer *w, const char *prefix,
+                        size_t size) {
+  int err;
+
+  memset(w, 0, sizeof(*w));
+  if (size < CAPTURE_FILE_MIN) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((w->prefix = strdup(prefix)) == NULL) {
+    return -1;
+  }
+  w->size = size;
+  if (start_file(w, &w->files[0]) == -1) {
+    free(w->prefix);
+    return -1;
+  }
+  // The thread starts on the next file straight away.
+  w->pending = 1;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+  if ((err = pthread_create(&w->thread, NULL, run_writer, w)) != 0) {
+    end_file(w, &w->files[0]);
+    free(w->prefix);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Writes `len` bytes of the IP packet at `data`, sent or received at
+ * `ts` (since the epoch) as `direction` says, without blocking.
+ *
+ * Returns 0 on success and -1 if it was dropped because the next file
+ * was not ready.
+ */
+int capture_write(struct tr_capture_writer *w, const struct timespec *ts,
+                  int direction, const void *data, uint32_t len) {
+  uint32_t caplen = len < CAPTURE_SNAPLEN ? len : CAPTURE_SNAPLEN;
+  uint32_t blen = PCAPNG_EPB_LEN + ((caplen + 3) & ~3);
+  uint64_t ns = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+  struct capture_file *f = &w->files[w->active];
+  uint8_t *p;
+
+  if (f->off + blen > w->size) {
+    if (!atomic_load_explicit(&w->ready, memory_order_acquire)) {
+      w->ndropped++;
+      return -1;
+    }
+    atomic_store_explicit(&w->ready, 0, memory_order_relaxed);
+    pthread_mutex_lock(&w->lock);
+    w->active = !w->active;
+    w->pending = 1;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    f = &w->files[w->active];
+  }
+
+  p = put32(f->map + f->off, PCAPNG_EPB);
+  p = put32(p, blen);
+  p = put32(p, 0);
+  p = put32(p, ns >> 32);
+  p = put32(p, ns);
+  p = put32(p, caplen);
+  p = put32(p, len);
+  memcpy(p, data, caplen);
+  memset(p + caplen, 0, (4 - caplen % 4) % 4);
+  p += (caplen + 3) & ~3;
+  p = put16(p, PCAPNG_OPT_EPB_FLAGS);
+  p = put16(p, 4);
+  p = put32(p, direction);
+  p = put32(p, PCAPNG_OPT_END);
+  put32(p, blen);
+  f->off += blen;
+  w->npackets++;
+  return 0;
+}
+
+/**
+ * Stops the writer's thread and trims and closes the file being written.
+ * The next file, if it was already made, is removed.
+ *
+ * Returns 0 on success and -1 if any file failed to be written,
+ * with errno set.
+ */
+int capture_writer_close(struct tr_capture_writer *w) {
+  struct capture_file *f;
+  int err;
+
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->wake);
+
+  err = w->error;
+  if (end_file(w, &w->files[w->active]) == -1) {
+    err = errno;
+  }
+  f = &w->files[!w->active];
+  if (f->map != NULL) {
+    munmap(f->map, w->size);
+    close(f->fd);
+    unlink(f->name);
+    free(f->name);
+    f->map = NULL;
+  }
+  free(w->prefix);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
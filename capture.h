@@ -0,0 +1,119 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 1
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+// Interfaces a pcapng section may describe.
+#define CAPTURE_IFACES 64
+
+// Bytes of a packet written to a capture, and the smallest size capture
+// files may be rotated at, which holds the headers and a packet of that.
+#define CAPTURE_SNAPLEN 65535
+#define CAPTURE_FILE_MIN 131072
+
+// Direction of a packet written to a capture.
+#define CAPTURE_IN 1
+#define CAPTURE_OUT 2
+
+/**
+ * A packet as captured, pointing into the mapped file.
+ */
+struct capture_packet {
+  struct timespec ts;
+  int linktype;
+  const uint8_t *data;
+  uint32_t len; // Captured bytes, which may be fewer than were on the wire.
+};
+
+/**
+ * A pcap or pcapng file, memory-mapped and read in place.
+ */
+struct tr_capture {
+  const uint8_t *map;
+  size_t len;
+  size_t off;
+  int ng;
+  int swapped; // Whether the file (or pcapng section) is foreign-endian.
+  int linktype; // pcap only.
+  int ns; // pcap only: nanosecond rather than microsecond timestamps.
+  int nifaces; // pcapng only, in the current section.
+  struct {
+    int linktype;
+    uint64_t units; // Timestamp units per second.
+  } ifaces[CAPTURE_IFACES];
+};
+
+/**
+ * A capture file being written, preallocated to its full size and mapped,
+ * of which `off` bytes are written.
+ */
+struct capture_file {
+  int fd;
+  uint8_t *map; // NULL if there is none.
+  size_t off;
+  char *name;
+};
+
+/**
+ * Writes packets to a series of pcapng files, prefix.0.pcapng,
+ * prefix.1.pcapng and so on, each rotated before it grows past `size`.
+ *
+ * Packets are copied into the mapped file being written, so writing one
+ * costs no system calls. A thread of the writer's own preallocates and
+ * maps the next file before it is needed, and trims and closes each file
+ * that filled up, so rotating only swaps one mapped file for the other.
+ * A packet that finds the next file not ready yet is dropped rather than
+ * waited for.
+ */
+struct tr_capture_writer {
+  char *prefix;
+  size_t size;
+  struct capture_file files[2];
+  int active; // Of files[], the one being written.
+  _Atomic int ready; // Whether the other one may be switched to.
+  uint64_t npackets;
+  uint64_t ndropped;
+  // Shared with the thread under `lock`.
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int pending; // Whether the other file is to be closed and replaced.
+  int stop;
+  int error; // errno of the thread's last failure, or 0.
+  uint32_t nfiles; // Files started so far.
+};
+
+int capture_open(struct tr_capture *c, const char *file);
+int capture_next(struct tr_capture *c, struct capture_packet *pkt);
+const uint8_t *capture_ip(const struct capture_packet *pkt, int *family,
+                          uint32_t *len);
+const uint8_t *capture_transport(const uint8_t *ip, int family, uint32_t len,
+                                 int *proto, uint32_t *tlen);
+void capture_close(struct tr_capture *c);
+int capture_writer_open(struct tr_capture_writer *w, const char *prefix,
+                        size_t size);
+int capture_write(struct tr_capture_writer *w, const struct timespec *ts,
+                  int direction, const void *data, uint32_t len);
+int capture_writer_close(struct tr_capture_writer *w);
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Campaign checkpoints.
+ *
+ * A checkpoint is small (a header and a bit per target) and is replaced
+ * atomically: it is written to a temporary file, synced and renamed over
+ * the previous one, so a campaign killed at any moment leaves either the
+ * old checkpoint or the new one behind, never a torn one.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define HEADER_LEN offsetof(struct tr_checkpoint, done)
+
+static size_t bitmap_len(uint64_t n) { return (n + 7) / 8; }
+
+/**
+ * Folds `len` bytes at `p` into the FNV-1a hash `h`
+ * (CHECKPOINT_HASH_INIT to start with).
+ */
+uint64_t checkpoint_hash(uint64_t h, const void *p, size_t len) {
+  const uint8_t *b = p;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ b[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/**
+ * Starts a checkpoint of a campaign over `ntargets` targets
+ * that has not done anything yet.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int checkpoint_init(struct tr_checkpoint *cp, uint64_t campaign,
+                    uint64_t ntargets) {
+  memset(cp, 0, sizeof(*cp));
+  memcpy(cp->magic, CHECKPOINT_MAGIC, sizeof(cp->magic));
+  cp->campaign = campaign;
+  cp->ntargets = ntargets;
+  if ((cp->done = calloc(bitmap_len(ntargets) + 1, 1)) == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Reads a checkpoint written by checkpoint_save().
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (EINVAL if the file is not a checkpoint).
+ */
+int checkpoint_load(struct tr_checkpoint *cp, const char *file) {
+  FILE *f;
+  int ok;
+
+  memset(cp, 0, sizeof(*cp));
+  if ((f = fopen(file, "r")) == NULL) {
+    return -1;
+  }
+  ok = fread(cp, HEADER_LEN, 1, f) == 1 &&
+       memcmp(cp->magic, CHECKPOINT_MAGIC, sizeof(cp->magic)) == 0 &&
+       (cp->done = calloc(bitmap_len(cp->ntargets) + 1, 1)) != NULL &&
+       fread(cp->done, 1, bitmap_len(cp->ntargets), f) ==
+           bitmap_len(cp->ntargets);
+  fclose(f);
+  if (!ok) {
+    checkpoint_free(cp);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Replaces `file` with `cp`, atomically.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int checkpoint_save(const struct tr_checkpoint *cp, const char *file) {
+  FILE *f;
+  char tmp[PATH_MAX];
+  int ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  if ((f = fopen(tmp, "w")) == NULL) {
+    return -1;
+  }
+  ok = fwrite(cp, HEADER_LEN, 1, f) == 1 &&
+       fwrite(cp->done, 1, bitmap_len(cp->ntargets), f) ==
+           bitmap_len(cp->ntargets) &&
+       fflush(f) == 0 && fsync(fileno(f)) == 0;
+  if (fclose(f) == EOF || !ok) {
+    unlink(tmp);
+    return -1;
+  }
+  return rename(tmp, file);
+}
+
+void checkpoint_set_done(struct tr_checkpoint *cp, uint64_t target) {
+  cp->done[target / 8] |= 1 << (target % 8);
+}
+
+int checkpoint_done(const struct tr_checkpoint *cp, uint64_t target) {
+  return target < cp->ntargets && (cp->done[target / 8] >> (target % 8)) & 1;
+}
+
+void checkpoint_free(struct tr_checkpoint *cp) {
+  free(cp->done);
+  cp->done = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_MAGIC "TRCKPT1"
+
+// Seconds between checkpoints at least, other than the last one.
+// Must be at least the probe timeout, see traceroute_stateless().
+#define CHECKPOINT_INTERVAL 10
+
+#define CHECKPOINT_HASH_INIT 0xcbf29ce484222325ULL
+
+/**
+ * How far a campaign has got: which targets were traced to completion,
+ * and for stateless campaigns how far the walk of the (target, TTL)
+ * space went, with the keys that walk and the probes' MACs depend on.
+ *
+ * On disk this is the struct up to `done`, followed by the bitmap.
+ */
+struct tr_checkpoint {
+  char magic[8];
+  uint64_t campaign; // Identifies the targets and options of the campaign.
+  uint64_t ntargets;
+  uint64_t position; // Probes of the stateless walk whose replies are in.
+  uint8_t perm_key[16];
+  uint8_t stateless_key[16];
+  uint8_t *done; // Bitmap of targets traced to completion.
+};
+
+uint64_t checkpoint_hash(uint64_t h, const void *p, size_t len);
+int checkpoint_init(struct tr_checkpoint *cp, uint64_t campaign,
+                    uint64_t ntargets);
+int checkpoint_load(struct tr_checkpoint *cp, const char *file);
+int checkpoint_save(const struct tr_checkpoint *cp, const char *file);
+void checkpoint_set_done(struct tr_checkpoint *cp, uint64_t target);
+int checkpoint_done(const struct tr_checkpoint *cp, uint64_t target);
+void checkpoint_free(struct tr_checkpoint *cp);
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * Estimates of how many hops away destinations are.
+ *
+ * Hosts send packets with an initial TTL of 64, 128 or 255 depending on
+ * their operating system, and every router on the way decrements it, so
+ * the TTL a reply from the destination arrives with tells how far away it
+ * is: the next of those values up, less the reply's TTL, plus one.
+ * Estimates are kept per destination, and per prefix for the destinations
+ * near it that were not probed themselves.
+ *
+ * Destinations that filter UDP may still answer an ICMP echo request,
+ * so one is sent where the UDP probe went unanswered.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/icmp6.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addr.h"
+#include "distance.h"
+
+static const int initial_ttls[] = {64, 128, 255};
+
+/**
+ * Returns how many hops away a host whose reply arrived with `reply_ttl`
+ * is, or 0 if it cannot tell.
+ */
+int distance_from_ttl(int reply_ttl) {
+  size_t i;
+
+  if (reply_ttl <= 0) {
+    return 0;
+  }
+  for (i = 0; i < sizeof(initial_ttls) / sizeof(*initial_ttls); i++) {
+    if (reply_ttl <= initial_ttls[i]) {
+      return initial_ttls[i] - reply_ttl + 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Puts an ICMP (or ICMPv6) echo request with `id` and `seq` together in
+ * `buf`, which must hold DISTANCE_ECHO_LEN bytes. The kernel checksums
+ * ICMPv6 itself, since the sum covers addresses it chooses.
+ *
+ * Returns its length.
+ */
+int distance_echo(int family, void *buf, u_short id, u_short seq) {
+  uint8_t *p = buf;
+  uint32_t sum = 0;
+  int i;
+
+  memset(p, 0, DISTANCE_ECHO_LEN);
+  p[0] = family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+  id = htons(id);
+  seq = htons(seq);
+  memcpy(p + 4, &id, sizeof(id));
+  memcpy(p + 6, &seq, sizeof(seq));
+  if (family != AF_INET6) {
+    for (i = 0; i < DISTANCE_ECHO_LEN; i += 2) {
+      sum += (p[i] << 8) | p[i + 1];
+    }
+    while (sum >> 16) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    p[2] = ~sum >> 8;
+    p[3] = ~sum;
+  }
+  return DISTANCE_ECHO_LEN;
+}
+
+/**
+ * Checks whether the `len` bytes of `buf` received on a raw ICMP socket
+ * (from the IPv4 header on) or ICMPv6 socket (from the ICMPv6 header on)
+ * are an echo reply with `id`.
+ *
+ * Returns its sequence number, or -1 if it is not.
+ */
+int distance_echo_reply(int family, const void *buf, int len, u_short id) {
+  const uint8_t *p = buf;
+  int hlen = 0;
+  u_short got, seq;
+
+  if (family != AF_INET6) {
+    if (len < (int)sizeof(struct ip)) {
+      return -1;
+    }
+    hlen = (p[0] & 0x0f) << 2;
+  }
+  if (len < hlen + DISTANCE_ECHO_LEN ||
+      p[hlen] != (family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY) ||
+      p[hlen + 1] != 0) {
+    return -1;
+  }
+  memcpy(&got, p + hlen + 4, sizeof(got));
+  memcpy(&seq, p + hlen + 6, sizeof(seq));
+  return ntohs(got) == id ? ntohs(seq) : -1;
+}
+
+void distances_init(struct tr_distances *d) { memset(d, 0, sizeof(*d)); }
+
+/**
+ * Zeroes the host bits of `addr` past the first `plen`.
+ */
+static struct tr_addr prefix_of(const struct tr_addr *addr, int plen) {
+  struct tr_addr prefix = *addr;
+  uint8_t *p = (uint8_t *)&prefix.u;
+  int len = addr->family == AF_INET6 ? 16 : 4;
+
+  if (plen % 8 != 0) {
+    p[plen / 8] &= 0xff00 >> (plen % 8);
+  }
+  if ((plen + 7) / 8 < len) {
+    memset(p + (plen + 7) / 8, 0, len - (plen + 7) / 8);
+  }
+  return prefix;
+}
+
+/**
+ * Finds the slot holding (`addr`, `plen`), or the empty slot it would go in.
+ */
+static struct tr_distance *distance_slot(const struct tr_distances *d,
+                                         const struct tr_addr *addr,
+                                         int plen) {
+  uint32_t i = (addr_hash(addr) + plen) & (d->cap - 1);
+  while (d->slots[i].addr.family != 0 &&
+         (d->slots[i].plen != plen || !addr_eq(&d->slots[i].addr, addr))) {
+    i = (i + 1) & (d->cap - 1);
+  }
+  return &d->slots[i];
+}
+
+static int distance_grow(struct tr_distances *d) {
+  struct tr_distances bigger;
+  uint32_t i;
+
+  bigger.cap = d->cap ? d->cap * 2 : 256;
+  bigger.n = d->n;
+  if ((bigger.slots = calloc(bigger.cap, sizeof(*bigger.slots))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < d->cap; i++) {
+    if (d->slots[i].addr.family != 0) {
+      *distance_slot(&bigger, &d->slots[i].addr, d->slots[i].plen) =
+          d->slots[i];
+    }
+  }
+  free(d->slots);
+  *d = bigger;
+  return 0;
+}
+
+static int distance_set(struct tr_distances *d, const struct tr_addr *addr,
+                        int plen, int hops) {
+  struct tr_distance *slot;
+
+  if ((d->n + 1) * 2 > d->cap && distance_grow(d) == -1) {
+    return -1;
+  }
+  slot = distance_slot(d, addr, plen);
+  if (slot->addr.family == 0) {
+    slot->addr = *addr;
+    slot->plen = plen;
+    d->n++;
+  } else if (plen > 0 && slot->hops >= hops) {
+    // A prefix is as far away as the furthest destination seen in it,
+    // so the margin past it is not cut short for the others.
+    return 0;
+  }
+  slot->hops = hops;
+  return 0;
+}
+
+/**
+ * Records that `dst`, which must be zeroed past its address as addr_set()
+ * leaves it, is `hops` hops away.
+ *
+ * Returns 0, or -1 if memory ran out.
+ */
+int distance_put(struct tr_distances *d, const struct tr_addr *dst, int hops) {
+  int plen = dst->family == AF_INET6 ? DISTANCE_PREFIX6 : DISTANCE_PREFIX4;
+  struct tr_addr prefix = prefix_of(dst, plen);
+
+  if (distance_set(d, dst, 0, hops) == -1) {
+    return -1;
+  }
+  return distance_set(d, &prefix, plen, hops);
+}
+
+/**
+ * Returns how many hops away `dst` is: as last recorded for it, or else for
+ * its prefix, or 0 if neither is known.
+ */
+int distance_get(const struct tr_distances *d, const struct tr_addr *dst) {
+  int plen = dst->family == AF_INET6 ? DISTANCE_PREFIX6 : DISTANCE_PREFIX4;
+  struct tr_addr prefix;
+  struct tr_distance *slot;
+
+  if (d->cap == 0) {
+    return 0;
+  }
+  if ((slot = distance_slot(d, dst, 0))->addr.family != 0) {
+    return slot->hops;
+  }
+  prefix = prefix_of(dst, plen);
+  return distance_slot(d, &prefix, plen)->hops;
+}
+
+void distances_free(struct tr_distances *d) {
+  free(d->slots);
+  memset(d, 0, sizeof(*d));
+}
@@ -0,0 +1,48 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "addr.h"
+
+// The TTL a probe is sent with to reach the destination however far it is.
+#define DISTANCE_TTL 255
+
+// Hops probed past the estimate, for routers that do not decrement the
+// TTL of what they send and paths that changed since.
+#define DISTANCE_MARGIN 2
+
+// Destinations in the same prefix of this length are taken to be about as
+// far away as each other.
+#define DISTANCE_PREFIX4 24
+#define DISTANCE_PREFIX6 48
+
+// ICMP echo requests carry no payload.
+#define DISTANCE_ECHO_LEN 8
+
+struct tr_distance {
+  struct tr_addr addr; // A destination, or a prefix with its host bits zeroed.
+  int plen; // 0 for a destination.
+  int hops;
+};
+
+/**
+ * Hop counts of destinations and of the prefixes they are in, in an open
+ * addressing table.
+ */
+struct tr_distances {
+  struct tr_distance *slots;
+  uint32_t n;
+  uint32_t cap;
+};
+
+int distance_from_ttl(int reply_ttl);
+int distance_echo(int family, void *buf, u_short id, u_short seq);
+int distance_echo_reply(int family, const void *buf, int len, u_short id);
+void distances_init(struct tr_distances *d);
+int distance_put(struct tr_distances *d, const struct tr_addr *dst, int hops);
+int distance_get(const struct tr_distances *d, const struct tr_addr *dst);
+void distances_free(struct tr_distances *d);
+
+#endif
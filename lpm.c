@@ -0,0 +1,261 @@
+/**
+ * Longest prefix match annotation of responder addresses.
+ *
+ * Prefix-to-AS dumps are compiled once by lpm_build() into a DIR-24-8 table
+ * that lpm_open() maps straight into memory, so start up costs nothing
+ * beyond the mmap() and lookups touch at most three cache lines.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lpm.h"
+
+static int record_cmp(const void *x, const void *y) {
+  const struct lpm_record *a = x, *b = y;
+  if (a->len != b->len) {
+    return a->len < b->len ? -1 : 1;
+  }
+  return a->prefix < b->prefix ? -1 : a->prefix > b->prefix;
+}
+
+/**
+ * Reads "prefix/len asn" or CAIDA pfx2as style "prefix len asn" lines.
+ * Blank lines and lines starting with '#' are skipped; for multi-origin
+ * prefixes (eg. "13335_4134") the first AS is kept.
+ *
+ * Returns the number of records read into `*records`, or -1 on error.
+ */
+static long read_records(FILE *f, struct lpm_record **records) {
+  char line[256], addr[64];
+  long n = 0, cap = 0;
+  int len;
+  unsigned int asn;
+  struct in_addr in;
+  struct lpm_record *r;
+
+  *records = NULL;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    if (sscanf(line, "%63[0-9.]%*[/ \t]%d %u", addr, &len, &asn) != 3 ||
+        inet_pton(AF_INET, addr, &in) != 1 || len < 0 || len > 32) {
+      errno = EINVAL;
+      free(*records);
+      return -1;
+    }
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      if ((r = realloc(*records, cap * sizeof(*r))) == NULL) {
+        free(*records);
+        return -1;
+      }
+      *records = r;
+    }
+    r = &(*records)[n++];
+    memset(r, 0, sizeof(*r));
+    r->len = len;
+    r->prefix = len == 0 ? 0 : ntohl(in.s_addr) & (0xffffffffu << (32 - len));
+    r->asn = asn;
+  }
+  return n;
+}
+
+/**
+ * Compiles the prefix-to-AS dump at `in` into a table at `out`.
+ *
+ * Prefixes are inserted shortest first, so each one simply overwrites
+ * the entries of the shorter prefixes it is more specific than.
+ *
+ * Returns 0 on success and -1 on failure (with errno set).
+ */
+int lpm_build(const char *in, const char *out) {
+  FILE *f;
+  long n, i;
+  uint32_t j, first, count, e, group, ntbl8 = 0, cap8 = 0;
+  uint32_t *tbl24 = NULL, *tbl8 = NULL, *t;
+  struct lpm_record *records;
+  struct lpm_header header;
+  int rv = -1;
+
+  if ((f = fopen(in, "r")) == NULL) {
+    return -1;
+  }
+  n = read_records(f, &records);
+  fclose(f);
+  if (n == -1) {
+    return -1;
+  }
+  qsort(records, n, sizeof(*records), record_cmp);
+
+  if ((tbl24 = calloc(LPM_TBL24_SIZE, sizeof(*tbl24))) == NULL) {
+    goto done;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (records[i].len <= 24) {
+      first = records[i].prefix >> 8;
+      count = 1u << (24 - records[i].len);
+      for (j = first; j < first + count; j++) {
+        tbl24[j] = i + 1;
+      }
+      continue;
+    }
+
+    // Longer prefixes expand a tbl24 entry into a group of 256,
+    // each inheriting the covering route.
+    e = tbl24[records[i].prefix >> 8];
+    if (e & LPM_TBL8) {
+      group = e & ~LPM_TBL8;
+    } else {
+      if (ntbl8 == cap8) {
+        cap8 = cap8 ? cap8 * 2 : 64;
+        if ((t = realloc(tbl8, cap8 * LPM_TBL8_GROUP * sizeof(*t))) == NULL) {
+          goto done;
+        }
+        tbl8 = t;
+      }
+      group = ntbl8++;
+      for (j = 0; j < LPM_TBL8_GROUP; j++) {
+        tbl8[group * LPM_TBL8_GROUP + j] = e;
+      }
+      tbl24[records[i].prefix >> 8] = group | LPM_TBL8;
+    }
+    first = group * LPM_TBL8_GROUP + (records[i].prefix & 0xff);
+    count = 1u << (32 - records[i].len);
+    for (j = first; j < first + count; j++) {
+      tbl8[j] = i + 1;
+    }
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LPM_MAGIC, sizeof(LPM_MAGIC));
+  header.nrecords = n;
+  header.ntbl8 = ntbl8;
+
+  if ((f = fopen(out, "w")) == NULL) {
+    goto done;
+  }
+  if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+      fwrite(tbl24, sizeof(*tbl24), LPM_TBL24_SIZE, f) != LPM_TBL24_SIZE ||
+      fwrite(tbl8, sizeof(*tbl8) * LPM_TBL8_GROUP, ntbl8, f) != ntbl8 ||
+      fwrite(records, sizeof(*records), n, f) != (size_t)n) {
+    fclose(f);
+    goto done;
+  }
+  if (fclose(f) == 0) {
+    rv = 0;
+  }
+
+done:
+  free(records);
+  free(tbl24);
+  free(tbl8);
+  return rv;
+}
+
+/**
+ * Checks that every entry of the tables refers to a record or tbl8 group
+ * that is there, so lookups can trust them. tbl8 entries only ever refer
+ * to records.
+ *
+ * Returns 0 if they all do and -1 otherwise.
+ */
+static int lpm_check(const struct tr_lpm *lpm, uint32_t ntbl8) {
+  size_t i;
+  uint32_t e;
+
+  for (i = 0; i < LPM_TBL24_SIZE; i++) {
+    e = lpm->tbl24[i];
+    if ((e & LPM_TBL8) ? (e & ~LPM_TBL8) >= ntbl8 : e > lpm->nrecords) {
+      return -1;
+    }
+  }
+  for (i = 0; i < (size_t)ntbl8 * LPM_TBL8_GROUP; i++) {
+    if (lpm->tbl8[i] > lpm->nrecords) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Maps the table at `path` built by lpm_build().
+ *
+ * Returns 0 on success and -1 on failure (with errno set).
+ */
+int lpm_open(struct tr_lpm *lpm, const char *path) {
+  int fd;
+  struct stat st;
+  const struct lpm_header *header;
+  size_t expected;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(*header)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  lpm->len = st.st_size;
+  lpm->map = mmap(NULL, lpm->len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (lpm->map == MAP_FAILED) {
+    return -1;
+  }
+
+  header = lpm->map;
+  expected = sizeof(*header) +
+             (LPM_TBL24_SIZE + (size_t)header->ntbl8 * LPM_TBL8_GROUP) *
+                 sizeof(uint32_t) +
+             (size_t)header->nrecords * sizeof(struct lpm_record);
+  if (memcmp(header->magic, LPM_MAGIC, sizeof(LPM_MAGIC)) != 0 ||
+      expected != lpm->len) {
+    munmap(lpm->map, lpm->len);
+    errno = EINVAL;
+    return -1;
+  }
+
+  lpm->tbl24 = (const uint32_t *)(header + 1);
+  lpm->tbl8 = lpm->tbl24 + LPM_TBL24_SIZE;
+  lpm->records = (const struct lpm_record *)(lpm->tbl8 + (size_t)header->ntbl8 *
+                                                             LPM_TBL8_GROUP);
+  lpm->nrecords = header->nrecords;
+  if (lpm_check(lpm, header->ntbl8) == -1) {
+    munmap(lpm->map, lpm->len);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Finds the longest prefix covering `addr` (in host byte order).
+ *
+ * Returns NULL if no prefix covers it.
+ */
+const struct lpm_record *lpm_lookup(const struct tr_lpm *lpm, uint32_t addr) {
+  uint32_t e = lpm->tbl24[addr >> 8];
+  if (e & LPM_TBL8) {
+    e = lpm->tbl8[(e & ~LPM_TBL8) * LPM_TBL8_GROUP + (addr & 0xff)];
+  }
+  return e == 0 ? NULL : &lpm->records[e - 1];
+}
+
+void lpm_close(struct tr_lpm *lpm) { munmap(lpm->map, lpm->len); }
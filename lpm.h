@@ -0,0 +1,52 @@
+#ifndef LPM_H
+#define LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LPM_MAGIC "TRLPM01"
+
+// tbl24 and tbl8 entries: either a record index (plus one, zero meaning
+// no route) or, with LPM_TBL8 set, the index of a group of 256 tbl8 entries.
+#define LPM_TBL8 0x80000000u
+#define LPM_TBL24_SIZE (1 << 24)
+#define LPM_TBL8_GROUP 256
+
+/**
+ * On-disk layout of a compiled routing table, mapped as is:
+ * header, tbl24, tbl8 groups, then the records the tables refer to.
+ * Integers are in host byte order; build tables on the machine using them.
+ */
+struct lpm_header {
+  char magic[8];
+  uint32_t nrecords;
+  uint32_t ntbl8;
+};
+
+struct lpm_record {
+  uint32_t prefix; // Host byte order.
+  uint32_t asn;
+  uint8_t len;
+  uint8_t pad[3];
+};
+
+/**
+ * A DIR-24-8 longest prefix match table for IPv4.
+ * Any lookup takes at most two dependent memory accesses
+ * (tbl24, then tbl8 for prefixes longer than /24) plus the record.
+ */
+struct tr_lpm {
+  void *map;
+  size_t len;
+  const uint32_t *tbl24;
+  const uint32_t *tbl8;
+  const struct lpm_record *records;
+  uint32_t nrecords;
+};
+
+int lpm_build(const char *in, const char *out);
+int lpm_open(struct tr_lpm *lpm, const char *path);
+const struct lpm_record *lpm_lookup(const struct tr_lpm *lpm, uint32_t addr);
+void lpm_close(struct tr_lpm *lpm);
+
+#endif
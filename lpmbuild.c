@@ -0,0 +1,23 @@
+/**
+ * lpmbuild dump table -- compile a prefix-to-AS dump for traceroute -A
+ *
+ * Reads "prefix/len asn" (or CAIDA pfx2as "prefix len asn") lines
+ * from `dump` and writes a table that traceroute maps at start up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lpm.h"
+#include "utils.h"
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: lpmbuild dump table\n");
+    exit(1);
+  }
+  if (lpm_build(argv[1], argv[2]) == -1) {
+    errorf("lpmbuild: failed to build %s from %s\n", argv[2], argv[1]);
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+/**
+ * A persistent cache of the last known path to each destination,
+ * so that re-traces only need to verify a path rather than rediscover it.
+ *
+ * The on-disk format is one line per destination:
+ *    dst hop1 hop2 ... hopN
+ * where an unresponsive hop is written as `*`.
+ */
+
+#define _GNU_SOURCE // required for getline() on older glibc.
+
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+
+/**
+ * Finds the slot holding `dst`, or the empty slot it would go in.
+ */
+static struct tr_path *path_cache_slot(const struct tr_path_cache *cache,
+                                       const struct tr_addr *dst) {
+  uint32_t i = addr_hash(dst) & (cache->cap - 1);
+  while (cache->paths[i].dst.family != 0 &&
+         !addr_eq(&cache->paths[i].dst, dst)) {
+    i = (i + 1) & (cache->cap - 1);
+  }
+  return &cache->paths[i];
+}
+
+static int path_cache_grow(struct tr_path_cache *cache) {
+  struct tr_path_cache bigger;
+  int i;
+
+  bigger.cap = cache->cap ? cache->cap * 2 : 64;
+  bigger.npaths = cache->npaths;
+  if ((bigger.paths = calloc(bigger.cap, sizeof(*bigger.paths))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < cache->cap; i++) {
+    if (cache->paths[i].dst.family != 0) {
+      *path_cache_slot(&bigger, &cache->paths[i].dst) = cache->paths[i];
+    }
+  }
+  free(cache->paths);
+  *cache = bigger;
+  return 0;
+}
+
+struct tr_path *path_cache_find(const struct tr_path_cache *cache,
+                                const struct tr_addr *dst) {
+  struct tr_path *path;
+  if (cache->cap == 0) {
+    return NULL;
+  }
+  path = path_cache_slot(cache, dst);
+  return path->dst.family == 0 ? NULL : path;
+}
+
+/**
+ * Stores a copy of `path`, replacing any path to the same destination.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int path_cache_put(struct tr_path_cache *cache, const struct tr_path *path) {
+  struct tr_path *slot;
+  struct tr_addr *hops;
+
+  if ((cache->npaths + 1) * 2 > cache->cap && path_cache_grow(cache) == -1) {
+    return -1;
+  }
+  if ((hops = malloc((path->nhops + 1) * sizeof(*hops))) == NULL) {
+    return -1;
+  }
+  memcpy(hops, path->hops, path->nhops * sizeof(*hops));
+
+  slot = path_cache_slot(cache, &path->dst);
+  if (slot->dst.family == 0) {
+    cache->npaths++;
+  } else {
+    free(slot->hops);
+  }
+  slot->dst = path->dst;
+  slot->nhops = path->nhops;
+  slot->hops = hops;
+  return 0;
+}
+
+/**
+ * Loads the cache from `file`. A missing file is an empty cache.
+ *
+ * Returns 0 on success and -1 on failure (with errno set).
+ */
+int path_cache_load(struct tr_path_cache *cache, const char *file) {
+  FILE *f;
+  char *line = NULL, *tok, *save;
+  size_t linecap = 0;
+  struct tr_path path;
+  struct tr_addr hops[UCHAR_MAX];
+  int rv = 0;
+
+  memset(cache, 0, sizeof(*cache));
+  if ((f = fopen(file, "r")) == NULL) {
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  path.hops = hops;
+  while (rv == 0 && getline(&line, &linecap, f) != -1) {
+    if ((tok = strtok_r(line, " \n", &save)) == NULL) {
+      continue;
+    }
+    if (addr_pton(&path.dst, tok) == -1 || path.dst.family == 0) {
+      errno = EINVAL;
+      rv = -1;
+      break;
+    }
+    path.nhops = 0;
+    while ((tok = strtok_r(NULL, " \n", &save)) != NULL &&
+           path.nhops < UCHAR_MAX) {
+      if (addr_pton(&hops[path.nhops++], tok) == -1) {
+        errno = EINVAL;
+        rv = -1;
+        break;
+      }
+    }
+    // No path we save is longer, so the file is not one of ours.
+    if (rv == 0 && tok != NULL) {
+      errno = EINVAL;
+      rv = -1;
+    }
+    if (rv == 0) {
+      rv = path_cache_put(cache, &path);
+    }
+  }
+
+  free(line);
+  fclose(f);
+  return rv;
+}
+
+/**
+ * Saves the cache to `file`, atomically replacing its previous contents.
+ *
+ * Returns 0 on success and -1 on failure (with errno set).
+ */
+int path_cache_save(const struct tr_path_cache *cache, const char *file) {
+  FILE *f;
+  char tmp[PATH_MAX], s[INET6_ADDRSTRLEN];
+  int i, j, ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  if ((f = fopen(tmp, "w")) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < cache->cap; i++) {
+    if (cache->paths[i].dst.family == 0) {
+      continue;
+    }
+    fputs(addr_ntop(&cache->paths[i].dst, s, sizeof(s)), f);
+    for (j = 0; j < cache->paths[i].nhops; j++) {
+      fputc(' ', f);
+      fputs(addr_ntop(&cache->paths[i].hops[j], s, sizeof(s)), f);
+    }
+    fputc('\n', f);
+  }
+  // Synced before it replaces the old cache, so a crash leaves one or
+  // the other rather than an empty file.
+  ok = !ferror(f) && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  if (fclose(f) == EOF || !ok) {
+    unlink(tmp);
+    return -1;
+  }
+  return rename(tmp, file);
+}
+
+void path_cache_free(struct tr_path_cache *cache) {
+  int i;
+  for (i = 0; i < cache->cap; i++) {
+    if (cache->paths[i].dst.family != 0) {
+      free(cache->paths[i].hops);
+    }
+  }
+  free(cache->paths);
+  memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * Returns 1 if the path ends at its destination and 0 otherwise.
+ */
+int path_reached(const struct tr_path *path) {
+  return path->nhops > 0 && addr_eq(&path->hops[path->nhops - 1], &path->dst);
+}
+
+/**
+ * Returns the first TTL at which two paths differ, or 0 if they are the same.
+ */
+int path_divergence(const struct tr_path *old, const struct tr_path *new) {
+  int i;
+  for (i = 0; i < old->nhops && i < new->nhops; i++) {
+    if (!addr_eq(&old->hops[i], &new->hops[i])) {
+      return i + 1;
+    }
+  }
+  return old->nhops == new->nhops ? 0 : i + 1;
+}
@@ -0,0 +1,37 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include "addr.h"
+
+// Number of intermediate hops checked, besides the last, to verify a path.
+#define PATH_SAMPLES 2
+
+/**
+ * The last known path to `dst`: hops[i] responded to TTL i + 1.
+ */
+struct tr_path {
+  struct tr_addr dst;
+  int nhops;
+  struct tr_addr *hops;
+};
+
+/**
+ * Known paths by destination, in an open addressing hash table.
+ */
+struct tr_path_cache {
+  struct tr_path *paths;
+  int npaths;
+  int cap; // Power of two; empty slots have a zero dst.family.
+};
+
+int path_cache_load(struct tr_path_cache *cache, const char *file);
+int path_cache_save(const struct tr_path_cache *cache, const char *file);
+struct tr_path *path_cache_find(const struct tr_path_cache *cache,
+                                const struct tr_addr *dst);
+int path_cache_put(struct tr_path_cache *cache, const struct tr_path *path);
+void path_cache_free(struct tr_path_cache *cache);
+
+int path_reached(const struct tr_path *path);
+int path_divergence(const struct tr_path *old, const struct tr_path *new);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Keyed pseudorandom permutations for scheduling probes.
+ *
+ * A balanced Feistel network with SipHash as its round function permutes
+ * the smallest even-width bit domain covering [0, n); values outside
+ * [0, n) are re-encrypted until they fall inside ("cycle walking").
+ * The bit domain is less than 4n, so this takes few iterations.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "permute.h"
+#include "utils.h"
+
+void perm_init(struct tr_perm *perm, const uint8_t key[16], uint64_t n) {
+  memcpy(perm->key, key, sizeof(perm->key));
+  perm->n = n;
+  perm->next = 0;
+  perm->half_bits = 1;
+  while (perm->half_bits < 32 && (1ULL << (2 * perm->half_bits)) < n) {
+    perm->half_bits++;
+  }
+}
+
+static uint64_t feistel(const struct tr_perm *perm, uint64_t x) {
+  uint64_t mask = (1ULL << perm->half_bits) - 1;
+  uint64_t l = x >> perm->half_bits, r = x & mask, t;
+  uint8_t in[9];
+  int round, i;
+
+  for (round = 0; round < PERMUTE_ROUNDS; round++) {
+    in[0] = round;
+    for (i = 0; i < 8; i++) {
+      in[i + 1] = r >> (8 * i);
+    }
+    t = r;
+    r = l ^ (siphash24(perm->key, in, sizeof(in)) & mask);
+    l = t;
+  }
+  return (l << perm->half_bits) | r;
+}
+
+/**
+ * Returns the element at position `i` of the permutation (i < n).
+ */
+uint64_t perm_at(const struct tr_perm *perm, uint64_t i) {
+  do {
+    i = feistel(perm, i);
+  } while (i >= perm->n);
+  return i;
+}
+
+/**
+ * Stores the next element of the permutation in `out`.
+ *
+ * Returns 1 on success and 0 once the permutation is exhausted.
+ */
+int perm_next(struct tr_perm *perm, uint64_t *out) {
+  if (perm->next >= perm->n) {
+    return 0;
+  }
+  *out = perm_at(perm, perm->next++);
+  return 1;
+}
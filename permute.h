@@ -0,0 +1,24 @@
+#ifndef PERMUTE_H
+#define PERMUTE_H
+
+#include <stdint.h>
+
+#define PERMUTE_ROUNDS 4
+
+/**
+ * A keyed pseudorandom permutation of [0, n), walked lazily.
+ * Only the key, the domain and a counter are stored,
+ * so memory is constant no matter how large the domain is.
+ */
+struct tr_perm {
+  uint8_t key[16];
+  uint64_t n;
+  int half_bits; // Each Feistel half covers this many bits.
+  uint64_t next; // Position of the next element to hand out.
+};
+
+void perm_init(struct tr_perm *perm, const uint8_t key[16], uint64_t n);
+uint64_t perm_at(const struct tr_perm *perm, uint64_t i);
+int perm_next(struct tr_perm *perm, uint64_t *out);
+
+#endif
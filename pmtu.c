@@ -0,0 +1,71 @@
+/**
+ * Path MTU search.
+ *
+ * Routers that report the next-hop MTU in their fragmentation needed
+ * (or packet too big) errors give the answer away in one round trip.
+ * For the rest, and for black holes that drop large packets silently,
+ * we binary search the RFC 1191 plateau table: real MTUs cluster on a
+ * handful of values, so a few probes pin one down where bisecting
+ * byte by byte would take a dozen.
+ */
+
+#include "pmtu.h"
+
+// RFC 1191 section 7, plus the common tunnel and PPPoE MTUs.
+static const int plateaus[] = {68,   296,  508,  1006, 1280,  1400,
+                               1420, 1460, 1480, 1492, 1500,  2002,
+                               4352, 8166, 9000, 17914, 32000, 65535};
+
+#define NPLATEAUS (int)(sizeof(plateaus) / sizeof(plateaus[0]))
+
+void pmtu_search_init(struct tr_pmtu_search *s, int lo, int hi) {
+  s->lo = lo;
+  s->hi = hi;
+  s->hint = 0;
+}
+
+/**
+ * Returns the next size to probe, or 0 once `s->lo` is known to be
+ * the largest plateau (or reported MTU) that passes.
+ */
+int pmtu_search_next(const struct tr_pmtu_search *s) {
+  int i, first = -1, last = -1;
+
+  if (s->hint > s->lo && s->hint < s->hi) {
+    return s->hint;
+  }
+  for (i = 0; i < NPLATEAUS; i++) {
+    if (plateaus[i] > s->lo && plateaus[i] < s->hi) {
+      if (first == -1) {
+        first = i;
+      }
+      last = i;
+    }
+  }
+  // Round up, so the search only takes the full log2 of the
+  // number of candidates when the answer is the smallest one.
+  return first == -1 ? 0 : plateaus[(first + last + 1) / 2];
+}
+
+/**
+ * Records whether a probe of `size` bytes passed. A failed probe may
+ * come with the next-hop `mtu` reported by the router it failed at, or 0.
+ */
+void pmtu_search_update(struct tr_pmtu_search *s, int size, int passed,
+                        int mtu) {
+  if (size == s->hint) {
+    s->hint = 0;
+  }
+  if (passed) {
+    if (size > s->lo) {
+      s->lo = size;
+    }
+  } else {
+    if (size < s->hi) {
+      s->hi = size;
+    }
+    if (mtu > s->lo && mtu < s->hi) {
+      s->hint = mtu;
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef PMTU_H
+#define PMTU_H
+
+// Smallest MTU a path may have (RFC 791 and RFC 8200).
+#define PMTU_MIN4 68
+#define PMTU_MIN6 1280
+
+/**
+ * A search for the largest packet size a path passes,
+ * knowing that `lo` passes and `hi` does not.
+ * `hint` is a next-hop MTU reported by a router, tried before anything else.
+ */
+struct tr_pmtu_search {
+  int lo;
+  int hi;
+  int hint;
+};
+
+void pmtu_search_init(struct tr_pmtu_search *s, int lo, int hi);
+int pmtu_search_next(const struct tr_pmtu_search *s);
+void pmtu_search_update(struct tr_pmtu_search *s, int size, int passed,
+                        int mtu);
+
+#endif
@@ -0,0 +1,44 @@
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "probe.h"
+
+void probe_table_init(struct tr_probe_table *table) {
+  memset(table, 0, sizeof(*table));
+}
+
+/**
+ * Records a sent probe in the slot for its sequence number.
+ * An older probe occupying the slot is overwritten; by the time the
+ * sequence space wraps around it has long since timed out.
+ *
+ * Returns the recorded probe.
+ */
+struct tr_probe *probe_add(struct tr_probe_table *table, int family,
+                           u_short seq, int ttl, const struct timespec *sent) {
+  struct tr_probe *probe = &table->probes[seq & (PROBE_TABLE_SIZE - 1)];
+  probe->family = family;
+  probe->seq = seq;
+  probe->ttl = ttl;
+  probe->state = PROBE_SENT;
+  probe->sent = *sent;
+  return probe;
+}
+
+/**
+ * Finds the outstanding probe matching a reply.
+ *
+ * Returns NULL if there is no such probe.
+ */
+struct tr_probe *probe_find(struct tr_probe_table *table, int family,
+                            u_short seq) {
+  struct tr_probe *probe = &table->probes[seq & (PROBE_TABLE_SIZE - 1)];
+  if (probe->state != PROBE_SENT || probe->family != family ||
+      probe->seq != seq) {
+    return NULL;
+  }
+  return probe;
+}
+
+void probe_remove(struct tr_probe *probe) { probe->state = PROBE_FREE; }
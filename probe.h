@@ -0,0 +1,38 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// Number of probes that can be outstanding at once.
+// Must be a power of two so that a sequence number maps to a slot with a mask.
+#define PROBE_TABLE_SIZE 1024
+
+#define PROBE_FREE 0
+#define PROBE_SENT 1
+
+/**
+ * A probe that has been sent and may still receive a reply.
+ * Probes from both IPv4 and IPv6 engines share one table;
+ * they are told apart by `family` and their sequence number.
+ */
+struct tr_probe {
+  int family;
+  u_short seq;
+  u_char ttl;
+  u_char state;
+  struct timespec sent;
+};
+
+struct tr_probe_table {
+  struct tr_probe probes[PROBE_TABLE_SIZE];
+};
+
+void probe_table_init(struct tr_probe_table *table);
+struct tr_probe *probe_add(struct tr_probe_table *table, int family,
+                           u_short seq, int ttl, const struct timespec *sent);
+struct tr_probe *probe_find(struct tr_probe_table *table, int family,
+                            u_short seq);
+void probe_remove(struct tr_probe *probe);
+
+#endif
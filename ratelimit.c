@@ -0,0 +1,212 @@
+/**
+ * Inference of the ICMP rate limits of responders.
+ *
+ * Routers limit how many ICMP errors they generate a second, so probing
+ * faster than that only makes a hop look lossy, wasting the retries spent
+ * on it and corrupting its loss statistics. We count, per responder, the
+ * probes expected to expire at it and the replies it sends over windows of
+ * at least RATELIMIT_MIN_PROBES probes. A window that loses too many has
+ * the responder paced at the rate it did answer at, and a window that
+ * keeps up with that pace has it raised, so the pace settles just under
+ * the limit (as TCP's congestion window settles under a link's capacity).
+ *
+ * A responder that loses probes however slowly it is sent them is not
+ * rate-limiting but lossy, and is not paced any longer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "addr.h"
+#include "ratelimit.h"
+
+void ratelimit_init(struct tr_ratelimit *rl) { memset(rl, 0, sizeof(*rl)); }
+
+static int ratelimit_grow_ids(struct tr_ratelimit *rl) {
+  uint32_t i, j, cap = rl->ids_cap ? rl->ids_cap * 2 : 256;
+  uint32_t *ids;
+
+  if ((ids = calloc(cap, sizeof(*ids))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < rl->nresponders; i++) {
+    j = addr_hash(&rl->responders[i].addr) & (cap - 1);
+    while (ids[j] != 0) {
+      j = (j + 1) & (cap - 1);
+    }
+    ids[j] = i + 1;
+  }
+  free(rl->ids);
+  rl->ids = ids;
+  rl->ids_cap = cap;
+  return 0;
+}
+
+/**
+ * Looks up the responder at `addr`, which must be zeroed past its
+ * address as addr_set() leaves it, adding it if it is new.
+ * An address of family 0 stands for ourselves, the hop before the first.
+ *
+ * Returns it, valid until the next call, or NULL if memory ran out.
+ */
+struct tr_responder *ratelimit_get(struct tr_ratelimit *rl,
+                                   const struct tr_addr *addr) {
+  uint32_t j;
+  struct tr_responder *responders, *r;
+
+  if ((rl->nresponders + 1) * 2 > rl->ids_cap &&
+      ratelimit_grow_ids(rl) == -1) {
+    return NULL;
+  }
+
+  j = addr_hash(addr) & (rl->ids_cap - 1);
+  while (rl->ids[j] != 0) {
+    r = &rl->responders[rl->ids[j] - 1];
+    if (addr_eq(&r->addr, addr)) {
+      return r;
+    }
+    j = (j + 1) & (rl->ids_cap - 1);
+  }
+
+  if (rl->nresponders == rl->cap) {
+    rl->cap = rl->cap ? rl->cap * 2 : 256;
+    if ((responders = realloc(rl->responders,
+                              rl->cap * sizeof(*responders))) == NULL) {
+      return NULL;
+    }
+    rl->responders = responders;
+  }
+  r = &rl->responders[rl->nresponders];
+  memset(r, 0, sizeof(*r));
+  r->addr = *addr;
+  rl->ids[j] = ++rl->nresponders;
+  return r;
+}
+
+/**
+ * Adjusts the pace of `r` by how the window that lasted `elapsed` µs went.
+ */
+static void judge(struct tr_responder *r, uint64_t elapsed) {
+  uint64_t got = (uint64_t)r->answered * 1000000 / elapsed;
+
+  if ((uint64_t)r->answered * 100 <
+      (uint64_t)r->sent * (100 - RATELIMIT_LOSS)) {
+    // Lost at the pace it was last found to keep up with.
+    if (r->limit > 0 && !r->growing &&
+        ++r->backoffs > RATELIMIT_BACKOFFS) {
+      r->lossy = 1;
+      r->limit = 0;
+      return;
+    }
+    // A raise it could not keep up with falls back to the pace it did.
+    r->limit = got > 0 ? got : 1;
+    if (r->growing && r->kept > r->limit) {
+      r->limit = r->kept;
+    }
+    r->growing = 0;
+    r->hold = RATELIMIT_HOLD;
+    r->settling = 1;
+    return;
+  }
+  r->backoffs = 0;
+  // Only a window sent at about its limit shows the limit is too low.
+  if (r->limit == 0 || (uint64_t)r->sent * 1000000 * 100 <
+                           elapsed * r->limit * (100 - RATELIMIT_LOSS)) {
+    return;
+  }
+  if (r->hold > 0) {
+    r->hold--;
+    return;
+  }
+  r->kept = r->limit;
+  r->limit += r->limit * RATELIMIT_GROWTH / 100 + 1;
+  r->growing = 1;
+  r->settling = 1;
+}
+
+/**
+ * Starts a window at the first probe after the last one, and ends it
+ * once it is long enough and has enough probes to judge it by.
+ */
+static void roll(struct tr_responder *r, uint64_t now_us) {
+  if (r->sent == 0 && r->answered == 0) {
+    r->window = now_us;
+  }
+  if (now_us - r->window < RATELIMIT_WINDOW_US ||
+      r->sent < RATELIMIT_MIN_PROBES) {
+    return;
+  }
+  // The window after a change of pace is sent at both paces.
+  if (r->settling) {
+    r->settling = 0;
+  } else if (!r->lossy) {
+    judge(r, now_us - r->window);
+  }
+  r->window = now_us;
+  r->sent = r->answered = 0;
+}
+
+/**
+ * Asks to send a probe expected to expire at `r` at `now_us`,
+ * and counts it if it may be sent.
+ *
+ * Returns 0 if it may, or how many µs to wait until it may.
+ */
+uint64_t ratelimit_admit(struct tr_responder *r, uint64_t now_us) {
+  roll(r, now_us);
+  if (r->limit > 0) {
+    if (now_us < r->next_us) {
+      return r->next_us - now_us;
+    }
+    r->next_us = now_us + 1000000 / r->limit;
+  }
+  r->sent++;
+  return 0;
+}
+
+/**
+ * Takes back a probe counted by ratelimit_admit() that was answered by
+ * another responder than expected.
+ */
+void ratelimit_uncount(struct tr_responder *r) {
+  if (r->sent > 0) {
+    r->sent--;
+  }
+}
+
+/**
+ * Counts a reply from `r` at `now_us`, and the probe it answers unless
+ * it was `counted` by ratelimit_admit().
+ */
+void ratelimit_answered(struct tr_responder *r, uint64_t now_us,
+                        int counted) {
+  roll(r, now_us);
+  if (!counted) {
+    r->sent++;
+  }
+  r->answered++;
+}
+
+/**
+ * Counts a probe to `r` that went unanswered by `now_us`, unless it was
+ * `counted` by ratelimit_admit() (it was not known to be bound for `r`).
+ *
+ * Returns whether it is put down to the rate limit of `r`.
+ */
+int ratelimit_lost(struct tr_responder *r, uint64_t now_us, int counted) {
+  if (!counted) {
+    roll(r, now_us);
+    r->sent++;
+  }
+  if (r->limit == 0) {
+    return 0;
+  }
+  r->nlimited++;
+  return 1;
+}
+
+void ratelimit_free(struct tr_ratelimit *rl) {
+  free(rl->responders);
+  free(rl->ids);
+  memset(rl, 0, sizeof(*rl));
+}
@@ -0,0 +1,65 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+#include "addr.h"
+
+// A responder is judged on windows of at least this long and this many
+// probes expected to expire at it, by whether more than RATELIMIT_LOSS
+// percent of them went unanswered.
+#define RATELIMIT_WINDOW_US 1000000
+#define RATELIMIT_MIN_PROBES 8
+#define RATELIMIT_LOSS 10
+
+// A limit that kept up is raised by RATELIMIT_GROWTH percent a window,
+// but not for RATELIMIT_HOLD windows after it was lowered. Lowering it
+// RATELIMIT_BACKOFFS windows in a row without one keeping up means the
+// responder loses probes however slowly it is sent them.
+#define RATELIMIT_GROWTH 25
+#define RATELIMIT_HOLD 8
+#define RATELIMIT_BACKOFFS 3
+
+/**
+ * What is known of the ICMP rate limit of one responder, from the probes
+ * expected to expire at it and the replies it sent.
+ */
+struct tr_responder {
+  struct tr_addr addr;
+  struct tr_addr next; // Last seen to answer one hop further, or family 0.
+  uint64_t window; // When the current window started, in µs.
+  uint32_t sent;
+  uint32_t answered;
+  uint32_t limit; // Replies a second it is paced at, or 0 if unlimited.
+  uint64_t next_us; // Earliest another probe may be sent to it, if limited.
+  uint32_t kept; // The limit before it was last raised.
+  int growing; // The limit was raised since it last lost probes.
+  int settling; // The pace changed during the current window.
+  int hold;
+  int backoffs;
+  int lossy; // Loses probes regardless of rate: never paced again.
+  uint64_t nlimited; // Probes lost to its limit.
+};
+
+/**
+ * Responders in the order first seen, with an open addressing table of
+ * their index + 1 (0 for an empty slot) by address.
+ */
+struct tr_ratelimit {
+  struct tr_responder *responders;
+  uint32_t nresponders;
+  uint32_t cap;
+  uint32_t *ids;
+  uint32_t ids_cap;
+};
+
+void ratelimit_init(struct tr_ratelimit *rl);
+struct tr_responder *ratelimit_get(struct tr_ratelimit *rl,
+                                   const struct tr_addr *addr);
+uint64_t ratelimit_admit(struct tr_responder *r, uint64_t now_us);
+void ratelimit_uncount(struct tr_responder *r);
+void ratelimit_answered(struct tr_responder *r, uint64_t now_us, int counted);
+int ratelimit_lost(struct tr_responder *r, uint64_t now_us, int counted);
+void ratelimit_free(struct tr_ratelimit *rl);
+
+#endif
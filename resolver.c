@@ -0,0 +1,590 @@
+/**
+ * Bulk forward resolution of target names.
+ *
+ * getaddrinfo() blocks for a full round trip to the nameserver per name,
+ * which for large target lists takes far longer than tracing them.
+ * Instead, A and AAAA queries for many names are kept in flight at once
+ * over a single non-blocking UDP socket, and answers are handed out in
+ * the order they arrive, so the caller can start tracing a target while
+ * the rest are still being resolved.
+ *
+ * Names are looked up as given (no search domains and no hosts file),
+ * and every name is only ever asked once per run.
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "resolver.h"
+#include "utils.h"
+
+#define DNS_HEADER_LEN 12
+#define DNS_MAX_NAME 255
+#define DNS_MAX_MESSAGE 512
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_RD 0x0100
+
+/**
+ * Reads the nameserver to use from /etc/resolv.conf,
+ * falling back to the loopback address like the libc resolver.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+int resolver_default_server(struct sockaddr_storage *server, socklen_t *len) {
+  FILE *f;
+  char line[256], addr[INET6_ADDRSTRLEN];
+  struct sockaddr_in *sin = (struct sockaddr_in *)server;
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)server;
+
+  memset(server, 0, sizeof(*server));
+  if ((f = fopen("/etc/resolv.conf", "r")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "nameserver %45s", addr) != 1) {
+        continue;
+      }
+      if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+        fclose(f);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(53);
+        *len = sizeof(*sin);
+        return 0;
+      }
+      if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+        fclose(f);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(53);
+        *len = sizeof(*sin6);
+        return 0;
+      }
+    }
+    fclose(f);
+  }
+
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin->sin_port = htons(53);
+  *len = sizeof(*sin);
+  return 0;
+}
+
+int resolver_init(struct tr_resolver *r, const struct sockaddr *server,
+                  socklen_t serverlen, int family) {
+  int i;
+
+  memset(r, 0, sizeof(*r));
+  r->family = family;
+  r->timeout_ms = RESOLVER_TIMEOUT_MS;
+  random_key(r->id_key, sizeof(r->id_key));
+  for (i = 0; i < RESOLVER_INFLIGHT; i++) {
+    r->queries[i].name = -1;
+  }
+
+  // Connecting means the kernel drops datagrams from anyone
+  // but the nameserver before we ever see them.
+  if ((r->fd = socket(server->sa_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+    return -1;
+  }
+  if (fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) | O_NONBLOCK) == -1 ||
+      connect(r->fd, server, serverlen) == -1) {
+    close(r->fd);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Encodes `name` as a sequence of DNS labels into `out`.
+ *
+ * Returns the encoded length, or -1 if `name` is not a valid domain name.
+ */
+static int encode_name(const char *name, uint8_t *out) {
+  int n = 0;
+  size_t len;
+  const char *dot;
+
+  while (*name != '\0') {
+    dot = strchr(name, '.');
+    len = dot != NULL ? (size_t)(dot - name) : strlen(name);
+    if (len == 0 || len > 63 || n + len + 2 > DNS_MAX_NAME) {
+      return -1;
+    }
+    out[n++] = len;
+    memcpy(out + n, name, len);
+    n += len;
+    name += len;
+    if (*name == '.') {
+      name++;
+    }
+  }
+  if (n == 0) {
+    return -1;
+  }
+  out[n++] = 0;
+  return n;
+}
+
+static uint32_t name_hash(const char *name) {
+  static const uint8_t key[16];
+  char lower[DNS_MAX_NAME + 1];
+  size_t i;
+
+  for (i = 0; name[i] != '\0' && i < DNS_MAX_NAME; i++) {
+    lower[i] = tolower((unsigned char)name[i]);
+  }
+  return siphash24(key, lower, i);
+}
+
+/**
+ * Grows the cache when it is half full.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+static int cache_reserve(struct tr_resolver *r) {
+  long i, j, cap, *cache;
+
+  if (2 * (r->nnames + 1) <= r->cache_cap) {
+    return 0;
+  }
+  cap = r->cache_cap ? r->cache_cap * 2 : 1024;
+  if ((cache = malloc(cap * sizeof(*cache))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < cap; i++) {
+    cache[i] = -1;
+  }
+  for (i = 0; i < r->cache_cap; i++) {
+    if (r->cache[i] == -1) {
+      continue;
+    }
+    j = name_hash(r->names[r->cache[i]].result.name) & (cap - 1);
+    while (cache[j] != -1) {
+      j = (j + 1) & (cap - 1);
+    }
+    cache[j] = r->cache[i];
+  }
+  free(r->cache);
+  r->cache = cache;
+  r->cache_cap = cap;
+  return 0;
+}
+
+/**
+ * Marks name `i` resolved, along with every repeat of it.
+ */
+static void name_resolved(struct tr_resolver *r, long i) {
+  struct tr_resolved *result = &r->names[i].result;
+  long j;
+
+  if (result->naddrs > 0) {
+    result->error = 0;
+  } else if (result->error == 0) {
+    result->error = RESOLVER_ENOADDR;
+  }
+  for (j = i; j != -1; j = r->names[j].same) {
+    if (j != i) {
+      r->names[j].result.error = result->error;
+      r->names[j].result.naddrs = result->naddrs;
+      memcpy(r->names[j].result.addrs, result->addrs,
+             result->naddrs * sizeof(result->addrs[0]));
+    }
+    r->names[j].pending = 0;
+    r->ready[r->nready++] = j;
+  }
+}
+
+static void add_addr(struct tr_resolved *result, int family, const void *in) {
+  int i = result->naddrs;
+
+  if (result->naddrs == RESOLVER_MAX_ADDRS) {
+    return;
+  }
+  // Keep IPv6 addresses ahead of IPv4 ones.
+  if (family == AF_INET6) {
+    for (; i > 0 && result->addrs[i - 1].family == AF_INET; i--) {
+      result->addrs[i] = result->addrs[i - 1];
+    }
+  }
+  addr_set(&result->addrs[i], family, in);
+  result->naddrs++;
+}
+
+/**
+ * Queues `name` for resolution. `name` must outlive the resolver.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+int resolver_add(struct tr_resolver *r, const char *name) {
+  long i, j, *p;
+  uint8_t qname[DNS_MAX_NAME];
+  struct resolver_name *n;
+  struct in6_addr in;
+
+  if (r->nnames == r->cap) {
+    r->cap = r->cap ? r->cap * 2 : 1024;
+    if ((n = realloc(r->names, r->cap * sizeof(*n))) == NULL) {
+      return -1;
+    }
+    r->names = n;
+    if ((p = realloc(r->ready, r->cap * sizeof(*p))) == NULL) {
+      return -1;
+    }
+    r->ready = p;
+    if ((p = realloc(r->unsent, 2 * r->cap * sizeof(*p))) == NULL) {
+      return -1;
+    }
+    r->unsent = p;
+  }
+  if (cache_reserve(r) == -1) {
+    return -1;
+  }
+
+  i = r->nnames++;
+  n = &r->names[i];
+  memset(n, 0, sizeof(*n));
+  n->result.name = name;
+  n->result.index = i;
+  n->same = -1;
+
+  // Look for an earlier occurrence of the same name.
+  j = name_hash(name) & (r->cache_cap - 1);
+  while (r->cache[j] != -1 &&
+         strcasecmp(r->names[r->cache[j]].result.name, name) != 0) {
+    j = (j + 1) & (r->cache_cap - 1);
+  }
+  if (r->cache[j] != -1) {
+    j = r->cache[j];
+    if (r->names[j].pending == 0) {
+      n->result = r->names[j].result;
+      n->result.name = name;
+      n->result.index = i;
+      r->ready[r->nready++] = i;
+    } else {
+      n->same = r->names[j].same;
+      n->pending = r->names[j].pending;
+      r->names[j].same = i;
+    }
+    return 0;
+  }
+  r->cache[j] = i;
+
+  // Literal addresses need no query.
+  if (inet_pton(AF_INET, name, &in) == 1) {
+    if (r->family != AF_INET6) {
+      add_addr(&n->result, AF_INET, &in);
+    }
+    name_resolved(r, i);
+    return 0;
+  }
+  if (inet_pton(AF_INET6, name, &in) == 1) {
+    if (r->family != AF_INET) {
+      add_addr(&n->result, AF_INET6, &in);
+    }
+    name_resolved(r, i);
+    return 0;
+  }
+  if (encode_name(name, qname) == -1) {
+    n->result.error = RESOLVER_EBADNAME;
+    name_resolved(r, i);
+    return 0;
+  }
+
+  if (r->family != AF_INET) {
+    r->unsent[r->nunsent++] = i * 2 + 1;
+    n->pending++;
+  }
+  if (r->family != AF_INET6) {
+    r->unsent[r->nunsent++] = i * 2;
+    n->pending++;
+  }
+  return 0;
+}
+
+static void send_query(struct tr_resolver *r, struct resolver_query *q) {
+  uint8_t buf[DNS_MAX_MESSAGE];
+  int len;
+
+  memset(buf, 0, DNS_HEADER_LEN);
+  buf[0] = q->id >> 8;
+  buf[1] = q->id & 0xff;
+  buf[2] = DNS_FLAG_RD >> 8;
+  buf[5] = 1; // QDCOUNT
+  len = DNS_HEADER_LEN +
+        encode_name(r->names[q->name].result.name, buf + DNS_HEADER_LEN);
+  buf[len++] = q->type >> 8;
+  buf[len++] = q->type & 0xff;
+  buf[len++] = 0;
+  buf[len++] = DNS_CLASS_IN;
+
+  // A failed send is retried like a lost datagram.
+  send(r->fd, buf, len, 0);
+  timespec_now(&q->sent);
+  q->tries++;
+}
+
+/**
+ * Retires the query in `q`, which got `rcode` (or a RESOLVER_E* error).
+ */
+static void query_done(struct tr_resolver *r, struct resolver_query *q,
+                       int rcode) {
+  struct resolver_name *n = &r->names[q->name];
+
+  if (rcode != 0 && n->result.error == 0) {
+    n->result.error = rcode;
+  }
+  if (--n->pending == 0) {
+    name_resolved(r, q->name);
+  }
+  q->name = -1;
+  r->ninflight--;
+}
+
+/**
+ * Retransmits or gives up on queries that timed out
+ * and sends new ones while there is room.
+ */
+static void send_queries(struct tr_resolver *r) {
+  int i;
+  long next;
+  struct timespec now, elapsed;
+  struct resolver_query *q;
+
+  timespec_now(&now);
+  for (i = 0; i < RESOLVER_INFLIGHT; i++) {
+    q = &r->queries[i];
+    if (q->name == -1 || timespec_diff(&now, &q->sent, &elapsed) == -1 ||
+        elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000 < r->timeout_ms) {
+      continue;
+    }
+    if (q->tries < RESOLVER_TRIES) {
+      send_query(r, q);
+    } else {
+      query_done(r, q, RESOLVER_ETIMEOUT);
+    }
+  }
+
+  for (i = 0; i < RESOLVER_INFLIGHT && r->next_unsent < r->nunsent; i++) {
+    q = &r->queries[i];
+    if (q->name != -1) {
+      continue;
+    }
+    next = r->unsent[r->next_unsent++];
+    q->name = next / 2;
+    q->type = next % 2 ? DNS_TYPE_AAAA : DNS_TYPE_A;
+    q->id = (siphash24(r->id_key, &r->nsent, sizeof(r->nsent)) & 0xff00) | i;
+    r->nsent++;
+    q->tries = 0;
+    r->ninflight++;
+    send_query(r, q);
+  }
+}
+
+/**
+ * Skips a possibly compressed name at `*p`.
+ *
+ * Returns 0 on success and -1 if it runs past `end`.
+ */
+static int skip_name(const uint8_t **p, const uint8_t *end) {
+  while (*p < end) {
+    if (**p == 0) {
+      (*p)++;
+      return 0;
+    }
+    if ((**p & 0xc0) == 0xc0) {
+      *p += 2;
+      return *p <= end ? 0 : -1;
+    }
+    *p += **p + 1;
+  }
+  return -1;
+}
+
+/**
+ * Matches a response to its query and collects the addresses it holds.
+ */
+static void handle_response(struct tr_resolver *r, const uint8_t *buf,
+                            int len) {
+  int i, qlen, flags, ancount, type, rdlen;
+  uint8_t qname[DNS_MAX_NAME];
+  const uint8_t *p = buf + DNS_HEADER_LEN, *end = buf + len;
+  struct resolver_query *q;
+  struct tr_resolved *result;
+
+  if (len < DNS_HEADER_LEN) {
+    return;
+  }
+  q = &r->queries[buf[1]];
+  flags = buf[2] << 8 | buf[3];
+  ancount = buf[6] << 8 | buf[7];
+  if (q->name == -1 || (buf[0] << 8 | buf[1]) != q->id ||
+      !(flags & DNS_FLAG_QR) || (buf[4] << 8 | buf[5]) != 1) {
+    return;
+  }
+
+  // The question must be ours, or this is a stale or forged response.
+  result = &r->names[q->name].result;
+  qlen = encode_name(result->name, qname);
+  if (end - p < qlen + 4 || strncasecmp((const char *)p, (const char *)qname,
+                                        qlen) != 0 ||
+      (p[qlen] << 8 | p[qlen + 1]) != q->type) {
+    return;
+  }
+  p += qlen + 4;
+
+  for (i = 0; i < ancount; i++) {
+    if (skip_name(&p, end) == -1 || end - p < 10) {
+      break;
+    }
+    type = p[0] << 8 | p[1];
+    rdlen = p[8] << 8 | p[9];
+    p += 10;
+    if (end - p < rdlen) {
+      break;
+    }
+    if (type == DNS_TYPE_A && q->type == DNS_TYPE_A && rdlen == 4) {
+      add_addr(result, AF_INET, p);
+    } else if (type == DNS_TYPE_AAAA && q->type == DNS_TYPE_AAAA &&
+               rdlen == 16) {
+      add_addr(result, AF_INET6, p);
+    }
+    p += rdlen;
+  }
+  query_done(r, q, flags & 0xf);
+}
+
+/**
+ * Handles every response that has arrived.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+static int receive_responses(struct tr_resolver *r) {
+  int len;
+  uint8_t buf[DNS_MAX_MESSAGE];
+
+  while ((len = recv(r->fd, buf, sizeof(buf), 0)) != -1) {
+    handle_response(r, buf, len);
+  }
+  // An ICMP port unreachable surfaces as ECONNREFUSED;
+  // the queries it concerns time out like any others.
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Handles the responses that have arrived, sends queries and waits up to
+ * `timeout_ms` (or indefinitely if negative) for more responses.
+ * Waiting ends early once a response arrives or a query needs retransmitting.
+ *
+ * Responses are taken in before anything is retransmitted, so a caller
+ * that was busy elsewhere for a while does not give up on queries
+ * whose answers are already waiting.
+ *
+ * Returns 0 on success and -1 otherwise.
+ */
+int resolver_poll(struct tr_resolver *r, int timeout_ms) {
+  fd_set fds;
+  struct timeval tv;
+
+  if (receive_responses(r) == -1) {
+    return -1;
+  }
+  send_queries(r);
+  if (r->ninflight == 0 || timeout_ms == 0) {
+    return 0;
+  }
+
+  if (timeout_ms < 0 || timeout_ms > r->timeout_ms) {
+    timeout_ms = r->timeout_ms;
+  }
+  FD_ZERO(&fds);
+  FD_SET(r->fd, &fds);
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = timeout_ms % 1000 * 1000;
+  if (select(r->fd + 1, &fds, NULL, NULL, &tv) == -1 && errno != EINTR) {
+    return -1;
+  }
+
+  if (receive_responses(r) == -1) {
+    return -1;
+  }
+  send_queries(r);
+  return 0;
+}
+
+/**
+ * Returns the next resolved name, or NULL if none is ready yet.
+ */
+const struct tr_resolved *resolver_next(struct tr_resolver *r) {
+  if (r->next_ready == r->nready) {
+    return NULL;
+  }
+  return &r->names[r->ready[r->next_ready++]].result;
+}
+
+/**
+ * Returns the number of names that resolver_next() has yet to return.
+ */
+long resolver_pending(const struct tr_resolver *r) {
+  return r->nnames - r->next_ready;
+}
+
+const char *resolver_strerror(int error) {
+  switch (error) {
+  case 0:
+    return "no error";
+  case RESOLVER_ETIMEOUT:
+    return "timed out";
+  case RESOLVER_ENOADDR:
+    return "no address";
+  case RESOLVER_EBADNAME:
+    return "invalid name";
+  case 2:
+    return "server failure";
+  case 3:
+    return "no such name";
+  case 5:
+    return "refused";
+  default:
+    return "query failed";
+  }
+}
+
+/**
+ * Forgets every name added so far, with the cache of their answers,
+ * so that a resolver fed an endless stream of names needs no more memory
+ * than one batch of them. Every name must have been handed out by
+ * resolver_next(); names added afterwards are indexed from 0 again.
+ */
+void resolver_reset(struct tr_resolver *r) {
+  long i;
+
+  r->nnames = r->nready = r->next_ready = 0;
+  r->nunsent = r->next_unsent = 0;
+  for (i = 0; i < r->cache_cap; i++) {
+    r->cache[i] = -1;
+  }
+}
+
+void resolver_free(struct tr_resolver *r) {
+  close(r->fd);
+  free(r->names);
+  free(r->cache);
+  free(r->ready);
+  free(r->unsent);
+}
@@ -0,0 +1,82 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "addr.h"
+
+// Queries that can be outstanding at once; the low byte of a query ID
+// is its slot, so this must not exceed 256.
+#define RESOLVER_INFLIGHT 256
+#define RESOLVER_TIMEOUT_MS 1000
+#define RESOLVER_TRIES 3
+#define RESOLVER_MAX_ADDRS 16
+
+// Errors besides DNS response codes (eg. 3 for NXDOMAIN).
+#define RESOLVER_ETIMEOUT -1
+#define RESOLVER_ENOADDR -2
+#define RESOLVER_EBADNAME -3
+
+/**
+ * The addresses a name resolved to, IPv6 first.
+ * `error` is 0 if there is at least one.
+ */
+struct tr_resolved {
+  const char *name;
+  long index; // Of the name among those added, from 0.
+  int error;
+  int naddrs;
+  struct tr_addr addrs[RESOLVER_MAX_ADDRS];
+};
+
+struct resolver_name {
+  struct tr_resolved result;
+  int pending; // Queries still to be answered.
+  long same; // Next name that is the same as this one (a cache hit), or -1.
+};
+
+struct resolver_query {
+  long name; // -1 if the slot is free.
+  uint16_t id;
+  uint16_t type;
+  int tries;
+  struct timespec sent;
+};
+
+/**
+ * A non-blocking stub resolver that keeps many queries in flight
+ * over a single UDP socket connected to a recursive nameserver.
+ */
+struct tr_resolver {
+  int fd;
+  int family; // AF_INET, AF_INET6 or AF_UNSPEC for both.
+  int timeout_ms;
+  struct resolver_name *names;
+  long nnames, cap;
+  long *cache; // Open addressing table of indexes into names, -1 if empty.
+  long cache_cap;
+  long *ready; // Resolved names, in the order they resolved.
+  long nready, next_ready;
+  long *unsent; // Queries still to be sent, as name index * 2 + (AAAA ? 1 : 0).
+  long nunsent, next_unsent;
+  struct resolver_query queries[RESOLVER_INFLIGHT];
+  int ninflight;
+  uint8_t id_key[16]; // Keys the unpredictable half of query IDs.
+  uint64_t nsent;
+};
+
+int resolver_default_server(struct sockaddr_storage *server, socklen_t *len);
+int resolver_init(struct tr_resolver *r, const struct sockaddr *server,
+                  socklen_t serverlen, int family);
+int resolver_add(struct tr_resolver *r, const char *name);
+int resolver_poll(struct tr_resolver *r, int timeout_ms);
+const struct tr_resolved *resolver_next(struct tr_resolver *r);
+long resolver_pending(const struct tr_resolver *r);
+const char *resolver_strerror(int error);
+void resolver_reset(struct tr_resolver *r);
+void resolver_free(struct tr_resolver *r);
+
+#endif
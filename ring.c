@@ -0,0 +1,81 @@
+/**
+ * Single-producer single-consumer rings.
+ *
+ * The producer publishes a record by storing the tail with release
+ * ordering after writing the slot, and the consumer frees a slot by
+ * storing the head after reading it, so each side's acquire load of the
+ * other's index is all the synchronization there is.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/**
+ * Makes `r` a ring of `cap` records (a power of two) of `size` bytes.
+ *
+ * Returns 0 on success and -1 on failure, with errno set.
+ */
+int ring_init(struct tr_ring *r, uint64_t cap, size_t size) {
+  memset(r, 0, sizeof(*r));
+  if (cap == 0 || (cap & (cap - 1)) != 0 || size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((r->slots = malloc(cap * size)) == NULL) {
+    return -1;
+  }
+  r->cap = cap;
+  r->size = size;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  return 0;
+}
+
+/**
+ * Copies `rec` into the ring. Producer only.
+ *
+ * Returns 0 on success and -1 if the ring is full, which is counted.
+ */
+int ring_push(struct tr_ring *r, const void *rec) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (tail - r->head_cached == r->cap) {
+    r->head_cached = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - r->head_cached == r->cap) {
+      r->full++;
+      return -1;
+    }
+  }
+  memcpy(r->slots + (tail & (r->cap - 1)) * r->size, rec, r->size);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * Copies the oldest record into `rec`. Consumer only.
+ *
+ * Returns 0 on success and -1 if the ring is empty.
+ */
+int ring_pop(struct tr_ring *r, void *rec) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  if (head == r->tail_cached) {
+    r->tail_cached = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == r->tail_cached) {
+      return -1;
+    }
+  }
+  memcpy(rec, r->slots + (head & (r->cap - 1)) * r->size, r->size);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 0;
+}
+
+void ring_free(struct tr_ring *r) {
+  free(r->slots);
+  r->slots = NULL;
+}
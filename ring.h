@@ -0,0 +1,37 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+/**
+ * A bounded queue of fixed-size records between exactly one producer
+ * thread and one consumer thread, without locks.
+ *
+ * Each side owns one index and only reads the other's, and keeps a cached
+ * copy of it so that it touches the other side's cache line only when
+ * the ring looks full (or empty) from what it last saw.
+ */
+struct tr_ring {
+  // Producer side.
+  _Alignas(RING_CACHE_LINE) _Atomic uint64_t tail;
+  uint64_t head_cached;
+  uint64_t full; // Pushes that found the ring full.
+  // Consumer side.
+  _Alignas(RING_CACHE_LINE) _Atomic uint64_t head;
+  uint64_t tail_cached;
+  // Shared, read-only after ring_init().
+  _Alignas(RING_CACHE_LINE) uint8_t *slots;
+  uint64_t cap; // Power of two.
+  size_t size;
+};
+
+int ring_init(struct tr_ring *r, uint64_t cap, size_t size);
+int ring_push(struct tr_ring *r, const void *rec);
+int ring_pop(struct tr_ring *r, void *rec);
+void ring_free(struct tr_ring *r);
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * Probe scheduling under a time and probe budget.
+ *
+ * Not every probe is worth the same when the budget runs out before the
+ * traces do: a hop nobody has heard from yet tells us more than a second
+ * RTT sample of a hop we know, and a near hop is more likely to answer
+ * (and to matter to every path through it) than a far one. So rather than
+ * finishing targets one after another, we keep every candidate probe of
+ * the batch in a priority queue and always send the best one, and what
+ * has been learned when the time is up is the best partial result.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedule.h"
+
+// Candidate classes, in the order they are sent.
+#define CLASS_FIRST 0
+#define CLASS_RETRY 1
+#define CLASS_REPEAT 2
+
+// Keys order by class, then attempts so far, then TTL, then target.
+#define KEY(class, count, ttl, target)                                        \
+  ((uint64_t)(class) << 56 | (uint64_t)(count) << 48 | (uint64_t)(ttl) << 32 | \
+   (uint32_t)(target))
+#define KEY_CLASS(key) ((int)((key) >> 56))
+#define KEY_TTL(key) ((int)((key) >> 32 & 0xff))
+#define KEY_TARGET(key) ((int)(uint32_t)(key))
+
+static struct schedule_hop *hop_at(const struct tr_schedule *s, int target,
+                                   int ttl) {
+  return &s->hops[(size_t)target * s->max_ttl + ttl - 1];
+}
+
+static void heap_push(struct tr_schedule *s, uint64_t key) {
+  uint32_t i = s->nheap++, parent;
+
+  for (; i > 0 && s->heap[parent = (i - 1) / 2] > key; i = parent) {
+    s->heap[i] = s->heap[parent];
+  }
+  s->heap[i] = key;
+}
+
+static uint64_t heap_pop(struct tr_schedule *s) {
+  uint64_t top = s->heap[0], last = s->heap[--s->nheap];
+  uint32_t i = 0, child;
+
+  while ((child = 2 * i + 1) < s->nheap) {
+    if (child + 1 < s->nheap && s->heap[child + 1] < s->heap[child]) {
+      child++;
+    }
+    if (s->heap[child] >= last) {
+      break;
+    }
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+  s->heap[i] = last;
+  return top;
+}
+
+/**
+ * Returns whether `ttl` of `t` may still be worth probing.
+ */
+static int eligible(const struct schedule_target *t, int ttl) {
+  return ttl <= t->max_ttl && (t->reached == 0 || ttl <= t->reached) &&
+         (t->capped || ttl <= t->last + SCHEDULE_GAP);
+}
+
+/**
+ * Queues the first probe of the next hop of `target`, if it is eligible.
+ */
+static void queue_first(struct tr_schedule *s, int target) {
+  struct schedule_target *t = &s->targets[target];
+
+  if (!t->queued && eligible(t, t->next_ttl)) {
+    heap_push(s, KEY(CLASS_FIRST, 0, t->next_ttl, target));
+    t->queued = 1;
+  }
+}
+
+/**
+ * Queues another attempt at a hop that has just been heard from (or not).
+ */
+static void queue_again(struct tr_schedule *s, int target, int ttl) {
+  struct schedule_hop *hop = hop_at(s, target, ttl);
+
+  if (hop->sent >= s->nprobes) {
+    return;
+  }
+  if (hop->answered > 0) {
+    heap_push(s, KEY(CLASS_REPEAT, hop->answered, ttl, target));
+  } else {
+    heap_push(s, KEY(CLASS_RETRY, hop->sent, ttl, target));
+  }
+}
+
+/**
+ * Prepares to schedule `ntargets` targets of up to `max_ttl` hops
+ * and `nprobes` probes per hop, sending no more than `budget` probes.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int schedule_init(struct tr_schedule *s, int ntargets, int max_ttl,
+                  int nprobes, uint64_t budget) {
+  int i;
+  size_t nhops = (size_t)ntargets * max_ttl;
+
+  memset(s, 0, sizeof(*s));
+  s->ntargets = ntargets;
+  s->max_ttl = max_ttl;
+  s->nprobes = nprobes;
+  s->budget = budget;
+  // Each hop is queued at most once at a time, and so is each target's next.
+  if ((s->targets = calloc(ntargets, sizeof(*s->targets))) == NULL ||
+      (s->hops = calloc(nhops, sizeof(*s->hops))) == NULL ||
+      (s->rtts = malloc(nhops * nprobes * sizeof(*s->rtts))) == NULL ||
+      (s->heap = malloc((nhops + ntargets) * sizeof(*s->heap))) == NULL) {
+    schedule_free(s);
+    return -1;
+  }
+  memset(s->rtts, 0xff, nhops * nprobes * sizeof(*s->rtts));
+  for (i = 0; i < ntargets; i++) {
+    s->targets[i].next_ttl = 1;
+    s->targets[i].max_ttl = max_ttl;
+    queue_first(s, i);
+  }
+  return 0;
+}
+
+/**
+ * Probes `target` no further than `max_ttl`, as far as it is known to be
+ * worth probing. Up to there its hops are probed without waiting for
+ * nearer ones to answer, however many of those did not.
+ */
+void schedule_cap(struct tr_schedule *s, int target, int max_ttl) {
+  struct schedule_target *t = &s->targets[target];
+
+  t->max_ttl = max_ttl < s->max_ttl ? max_ttl : s->max_ttl;
+  t->capped = 1;
+  queue_first(s, target);
+}
+
+/**
+ * Picks the next probe to send and counts it as sent. Candidates that
+ * s->admit holds back are passed over, up to SCHEDULE_DEFER_MAX of them.
+ *
+ * Returns its attempt number at the hop (from 0), SCHEDULE_DEFERRED if
+ * every candidate looked at was held back, or -1 if there is nothing
+ * worth sending until outstanding probes are answered or time out,
+ * or the budget is spent.
+ */
+int schedule_next(struct tr_schedule *s, int *target, int *ttl) {
+  int attempt = -1, ndeferred = 0;
+  uint64_t key, deferred[SCHEDULE_DEFER_MAX];
+  struct schedule_target *t;
+  struct schedule_hop *hop;
+
+  while (s->budget > 0 && s->nheap > 0) {
+    key = heap_pop(s);
+    *target = KEY_TARGET(key);
+    *ttl = KEY_TTL(key);
+    t = &s->targets[*target];
+    if (KEY_CLASS(key) == CLASS_FIRST && !eligible(t, *ttl)) {
+      // Until a further hop answers.
+      t->queued = 0;
+      continue;
+    }
+    if (KEY_CLASS(key) != CLASS_FIRST && t->reached != 0 &&
+        *ttl > t->reached) {
+      continue;
+    }
+    if (s->admit != NULL && !s->admit(s->arg, *target, *ttl)) {
+      deferred[ndeferred++] = key;
+      if (ndeferred == SCHEDULE_DEFER_MAX) {
+        break;
+      }
+      continue;
+    }
+    if (KEY_CLASS(key) == CLASS_FIRST) {
+      t->queued = 0;
+      t->next_ttl++;
+      queue_first(s, *target);
+    }
+    hop = hop_at(s, *target, *ttl);
+    hop->pending = 1;
+    s->budget--;
+    attempt = hop->sent++;
+    break;
+  }
+  if (attempt == -1 && ndeferred > 0) {
+    attempt = SCHEDULE_DEFERRED;
+  }
+  // Held back, not dropped: each is still queued once.
+  while (ndeferred > 0) {
+    heap_push(s, deferred[--ndeferred]);
+  }
+  return attempt;
+}
+
+/**
+ * Records that `attempt` at hop `ttl` of `target` was answered by
+ * `responder` after `rtt_us`, and whether the answer came from the
+ * destination itself.
+ */
+void schedule_answer(struct tr_schedule *s, int target, int ttl, int attempt,
+                     const struct tr_addr *responder, uint32_t rtt_us,
+                     int reached) {
+  struct schedule_target *t = &s->targets[target];
+  struct schedule_hop *hop = hop_at(s, target, ttl);
+
+  hop->pending = 0;
+  hop->answered++;
+  if (hop->responder.family == 0) {
+    hop->responder = *responder;
+  }
+  s->rtts[((size_t)target * s->max_ttl + ttl - 1) * s->nprobes + attempt] =
+      rtt_us;
+  if (reached && (t->reached == 0 || ttl < t->reached)) {
+    t->reached = ttl;
+  }
+  if (ttl > t->last) {
+    t->last = ttl;
+    queue_first(s, target);
+  }
+  queue_again(s, target, ttl);
+}
+
+/**
+ * Records that the outstanding attempt at hop `ttl` of `target`
+ * went unanswered.
+ */
+void schedule_timeout(struct tr_schedule *s, int target, int ttl) {
+  hop_at(s, target, ttl)->pending = 0;
+  queue_again(s, target, ttl);
+}
+
+/**
+ * Records that `attempt` at hop `ttl` of `target`, which went unanswered,
+ * is put down to the ICMP rate limit of the hop rather than lost.
+ */
+void schedule_limited(struct tr_schedule *s, int target, int ttl,
+                      int attempt) {
+  s->rtts[((size_t)target * s->max_ttl + ttl - 1) * s->nprobes + attempt] =
+      SCHEDULE_LIMITED_RTT;
+}
+
+const struct schedule_hop *schedule_hop(const struct tr_schedule *s,
+                                        int target, int ttl) {
+  return hop_at(s, target, ttl);
+}
+
+/**
+ * Returns the RTT of `attempt` at hop `ttl` of `target`,
+ * SCHEDULE_NO_RTT if it was not answered, or SCHEDULE_LIMITED_RTT
+ * if that was put down to a rate limit.
+ */
+uint32_t schedule_rtt(const struct tr_schedule *s, int target, int ttl,
+                      int attempt) {
+  return s->rtts[((size_t)target * s->max_ttl + ttl - 1) * s->nprobes +
+                 attempt];
+}
+
+/**
+ * Returns the number of hops of `target` there is something to say
+ * about: up to the destination if it answered, and otherwise up to
+ * the furthest hop probed.
+ */
+int schedule_nhops(const struct tr_schedule *s, int target) {
+  const struct schedule_target *t = &s->targets[target];
+
+  return t->reached != 0 ? t->reached : t->next_ttl - 1;
+}
+
+void schedule_free(struct tr_schedule *s) {
+  free(s->targets);
+  free(s->hops);
+  free(s->rtts);
+  free(s->heap);
+  memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,86 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "addr.h"
+
+// Unanswered hops probed past the last hop that answered
+// before a target is not probed any further out.
+#define SCHEDULE_GAP 5
+
+// RTT of an attempt that was not answered (or not sent),
+// and of one put down to the responder's ICMP rate limit.
+#define SCHEDULE_NO_RTT UINT32_MAX
+#define SCHEDULE_LIMITED_RTT (UINT32_MAX - 1)
+
+// Candidates held back by `admit` that schedule_next() looks past
+// before it gives up until later.
+#define SCHEDULE_DEFER_MAX 64
+
+// Returned by schedule_next() when every candidate it looked at was
+// held back.
+#define SCHEDULE_DEFERRED -2
+
+struct schedule_hop {
+  u_char sent;
+  u_char answered;
+  u_char pending; // Whether an attempt is outstanding.
+  struct tr_addr responder; // First to answer, family 0 until then.
+};
+
+struct schedule_target {
+  int next_ttl; // Smallest TTL whose first probe has not been sent.
+  int last; // Highest TTL that answered, or 0.
+  int reached; // Smallest TTL the destination answered at, or 0.
+  int queued; // Whether next_ttl is in the heap.
+  int max_ttl; // Highest TTL worth probing.
+  int capped; // Whether max_ttl was set by schedule_cap().
+};
+
+/**
+ * Decides which (target, TTL) to probe next for a batch of targets,
+ * highest expected information gain first: the first probe of every
+ * hop, breadth first across targets, then retries of hops that did not
+ * answer, fewest attempts and nearest first, then repeats of hops that
+ * did, for their RTTs. Hops past the destination, or more than
+ * SCHEDULE_GAP past the last hop that answered, are not probed.
+ *
+ * Candidates are kept in a binary heap of packed keys, so picking one
+ * costs a logarithm of the batch rather than a scan of it.
+ */
+struct tr_schedule {
+  int ntargets;
+  int max_ttl;
+  int nprobes;
+  uint64_t budget; // Probes left to send.
+  struct schedule_target *targets;
+  struct schedule_hop *hops; // max_ttl per target.
+  uint32_t *rtts; // nprobes per hop, in microseconds.
+  uint64_t *heap;
+  uint32_t nheap;
+  // Whether a probe of `ttl` to `target` may be sent now, or NULL if any
+  // may. Those held back stay candidates.
+  int (*admit)(void *arg, int target, int ttl);
+  void *arg;
+};
+
+int schedule_init(struct tr_schedule *s, int ntargets, int max_ttl,
+                  int nprobes, uint64_t budget);
+void schedule_cap(struct tr_schedule *s, int target, int max_ttl);
+int schedule_next(struct tr_schedule *s, int *target, int *ttl);
+void schedule_answer(struct tr_schedule *s, int target, int ttl, int attempt,
+                     const struct tr_addr *responder, uint32_t rtt_us,
+                     int reached);
+void schedule_timeout(struct tr_schedule *s, int target, int ttl);
+void schedule_limited(struct tr_schedule *s, int target, int ttl,
+                      int attempt);
+const struct schedule_hop *schedule_hop(const struct tr_schedule *s,
+                                        int target, int ttl);
+uint32_t schedule_rtt(const struct tr_schedule *s, int target, int ttl,
+                      int attempt);
+int schedule_nhops(const struct tr_schedule *s, int target);
+void schedule_free(struct tr_schedule *s);
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * Stateless (yarrp-style) probe encoding.
+ *
+ * Each probe carries its own TTL, send time and a keyed MAC in the fields
+ * an ICMP error quotes back, so a reply can be matched and timed
+ * without remembering anything about the probe that caused it.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "stateless.h"
+#include "utils.h"
+
+/**
+ * Adds `len` bytes to a running ones' complement sum of 16-bit words.
+ * `len` must be even.
+ */
+static uint32_t cksum_add(uint32_t sum, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  size_t i;
+  for (i = 0; i < len; i += 2) {
+    sum += (p[i] << 8) | p[i + 1];
+  }
+  return sum;
+}
+
+static uint16_t cksum_fold(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+/**
+ * Converts a monotonic timestamp to its tick encoding.
+ */
+uint16_t stateless_ticks(const struct timespec *t) {
+  uint64_t ticks = (uint64_t)t->tv_sec * (1000000000 / STATELESS_TICK_NSEC) +
+                   t->tv_nsec / STATELESS_TICK_NSEC;
+  return ticks % STATELESS_TICKS + 1;
+}
+
+/**
+ * Computes the round trip time between two tick encodings.
+ */
+void stateless_rtt(uint16_t sent, uint16_t received, struct timespec *rtt) {
+  long ticks = ((long)received - sent + STATELESS_TICKS) % STATELESS_TICKS;
+  rtt->tv_sec = ticks / (1000000000 / STATELESS_TICK_NSEC);
+  rtt->tv_nsec = ticks % (1000000000 / STATELESS_TICK_NSEC) * STATELESS_TICK_NSEC;
+}
+
+/**
+ * Keyed MAC binding a probe's destination, TTL and send time together.
+ * Never zero: Linux replaces a zero IP ID on IP_HDRINCL sockets.
+ */
+uint16_t stateless_mac(const uint8_t key[16], const void *dst, size_t dstlen,
+                       int ttl, uint16_t ticks) {
+  uint8_t in[sizeof(struct in6_addr) + 3];
+  uint16_t mac;
+
+  memcpy(in, dst, dstlen);
+  in[dstlen] = ttl;
+  in[dstlen + 1] = ticks >> 8;
+  in[dstlen + 2] = ticks & 0xff;
+  mac = siphash24(key, in, dstlen + 3);
+  return mac == 0 ? 1 : mac;
+}
+
+/**
+ * Builds a complete IPv4/UDP probe in `buf` for an IP_HDRINCL socket.
+ * `buf` must hold STATELESS_PROBE4_LEN bytes.
+ *
+ * The UDP checksum is forced to the send time by choosing the two payload
+ * bytes, so the probe still checksums correctly at the destination.
+ *
+ * Returns the length of the probe.
+ */
+int stateless_probe4(char *buf, const uint8_t key[16],
+                     const struct in_addr *src, const struct in_addr *dst,
+                     u_short sport, u_short dport, int ttl,
+                     const struct timespec *now) {
+  struct ip *ip = (struct ip *)buf;
+  struct udphdr *udp = (struct udphdr *)(ip + 1);
+  uint8_t *fudge = (uint8_t *)(udp + 1);
+  uint16_t ticks = stateless_ticks(now);
+  uint16_t ulen = sizeof(*udp) + sizeof(uint16_t);
+  uint8_t proto[2] = {0, IPPROTO_UDP};
+  uint32_t sum;
+  uint16_t f;
+
+  memset(buf, 0, STATELESS_PROBE4_LEN);
+  ip->ip_v = 4;
+  ip->ip_hl = sizeof(*ip) >> 2;
+#if defined(__APPLE__) || defined(__FreeBSD__)
+  // BSD raw sockets expect ip_len in host byte order.
+  ip->ip_len = STATELESS_PROBE4_LEN;
+#else
+  ip->ip_len = htons(STATELESS_PROBE4_LEN);
+#endif
+  ip->ip_id = htons(stateless_mac(key, dst, sizeof(*dst), ttl, ticks));
+  ip->ip_ttl = ttl;
+  ip->ip_p = IPPROTO_UDP;
+  ip->ip_src = *src;
+  ip->ip_dst = *dst;
+
+  udp->uh_sport = htons(sport);
+  udp->uh_dport = htons(dport + ttl);
+  udp->uh_ulen = htons(ulen);
+
+  // Sum the pseudo header and datagram with a zero checksum and fudge.
+  sum = cksum_add(0, src, sizeof(*src));
+  sum = cksum_add(sum, dst, sizeof(*dst));
+  sum = cksum_add(sum, proto, sizeof(proto));
+  sum += ulen;
+  sum = cksum_add(sum, udp, ulen);
+
+  // The checksum field holds the complement of the sum, so the fudge
+  // must bring the sum to ~ticks: fudge = ~ticks - sum.
+  f = cksum_fold((uint16_t)~ticks + (uint32_t)(uint16_t)~cksum_fold(sum));
+  fudge[0] = f >> 8;
+  fudge[1] = f & 0xff;
+  udp->uh_sum = htons(ticks);
+
+  return STATELESS_PROBE4_LEN;
+}
+
+/**
+ * Fills in the IP header checksum of a probe from stateless_probe4(),
+ * which a raw socket leaves to the kernel but a frame built by us
+ * must carry itself.
+ */
+void stateless_ip_sum4(char *buf) {
+  struct ip *ip = (struct ip *)buf;
+
+  ip->ip_sum = 0;
+  ip->ip_sum = htons((uint16_t)~cksum_fold(cksum_add(0, ip, sizeof(*ip))));
+}
+
+/**
+ * Recovers the stamp of an IPv4 probe from its quoted headers.
+ *
+ * Returns 0 if the stamp is authentic and -1 otherwise.
+ */
+int stateless_decode4(const uint8_t key[16], const struct ip *ip,
+                      const struct udphdr *udp, u_short dport,
+                      struct tr_stamp *stamp) {
+  stamp->dst = &ip->ip_dst;
+  stamp->ttl = (u_short)(ntohs(udp->uh_dport) - dport);
+  stamp->ticks = ntohs(udp->uh_sum);
+  stamp->mac = ntohs(ip->ip_id);
+
+  if (stamp->ttl < 1 || stamp->ttl > 255) {
+    return -1;
+  }
+  if (stamp->mac != stateless_mac(key, &ip->ip_dst, sizeof(ip->ip_dst),
+                                  stamp->ttl, stamp->ticks)) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Builds the UDP payload of an IPv6 probe in `buf` (4 bytes).
+ * The TTL is carried by the destination port as for IPv4.
+ *
+ * Returns the length of the payload.
+ */
+int stateless_payload6(char *buf, const uint8_t key[16],
+                       const struct in6_addr *dst, int ttl,
+                       const struct timespec *now) {
+  uint16_t ticks = stateless_ticks(now);
+  uint16_t mac = stateless_mac(key, dst, sizeof(*dst), ttl, ticks);
+
+  buf[0] = mac >> 8;
+  buf[1] = mac & 0xff;
+  buf[2] = ticks >> 8;
+  buf[3] = ticks & 0xff;
+  return 4;
+}
+
+/**
+ * Recovers the stamp of an IPv6 probe from its quoted headers.
+ * `len` is the number of quoted bytes following the UDP header.
+ *
+ * Returns 0 if the stamp is authentic and -1 otherwise.
+ */
+int stateless_decode6(const uint8_t key[16], const struct ip6_hdr *ip6,
+                      const struct udphdr *udp, int len, u_short dport,
+                      struct tr_stamp *stamp) {
+  const uint8_t *payload = (const uint8_t *)(udp + 1);
+
+  if (len < 4) {
+    return -1;
+  }
+
+  stamp->dst = &ip6->ip6_dst;
+  stamp->ttl = (u_short)(ntohs(udp->uh_dport) - dport);
+  stamp->mac = (payload[0] << 8) | payload[1];
+  stamp->ticks = (payload[2] << 8) | payload[3];
+
+  if (stamp->ttl < 1 || stamp->ttl > 255) {
+    return -1;
+  }
+  if (stamp->mac != stateless_mac(key, &ip6->ip6_dst, sizeof(ip6->ip6_dst),
+                                  stamp->ttl, stamp->ticks)) {
+    return -1;
+  }
+  return 0;
+}
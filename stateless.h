@@ -0,0 +1,57 @@
+#ifndef STATELESS_H
+#define STATELESS_H
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Send times are encoded as a 16-bit count of 100 microsecond ticks.
+// The counter runs modulo STATELESS_TICKS (not 2^16) so that an encoded
+// value is never zero, which a UDP checksum cannot carry over IPv4.
+// RTTs are therefore only recoverable for replies within ~6.5 seconds.
+#define STATELESS_TICK_NSEC 100000
+#define STATELESS_TICKS 0xffff
+
+// IPv4 probe: IP header, UDP header and two bytes to steer the checksum.
+#define STATELESS_PROBE4_LEN \
+  (sizeof(struct ip) + sizeof(struct udphdr) + sizeof(uint16_t))
+
+/**
+ * Everything a stateless probe carries about itself.
+ * IPv4 spreads this over the IP ID (mac), UDP destination port (ttl)
+ * and UDP checksum (ticks) since routers need only quote 8 bytes of UDP.
+ * IPv6 routers quote the whole probe, so the stamp rides in the payload.
+ */
+struct tr_stamp {
+  const void *dst; // The probe's destination address, within the reply.
+  int ttl;
+  uint16_t ticks;
+  uint16_t mac;
+};
+
+uint16_t stateless_ticks(const struct timespec *t);
+void stateless_rtt(uint16_t sent, uint16_t received, struct timespec *rtt);
+uint16_t stateless_mac(const uint8_t key[16], const void *dst, size_t dstlen,
+                       int ttl, uint16_t ticks);
+
+int stateless_probe4(char *buf, const uint8_t key[16],
+                     const struct in_addr *src, const struct in_addr *dst,
+                     u_short sport, u_short dport, int ttl,
+                     const struct timespec *now);
+void stateless_ip_sum4(char *buf);
+int stateless_decode4(const uint8_t key[16], const struct ip *ip,
+                      const struct udphdr *udp, u_short dport,
+                      struct tr_stamp *stamp);
+
+int stateless_payload6(char *buf, const uint8_t key[16],
+                       const struct in6_addr *dst, int ttl,
+                       const struct timespec *now);
+int stateless_decode6(const uint8_t key[16], const struct ip6_hdr *ip6,
+                      const struct udphdr *udp, int len, u_short dport,
+                      struct tr_stamp *stamp);
+
+#endif
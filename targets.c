@@ -0,0 +1,397 @@
+/**
+ * Streaming targets from a file.
+ *
+ * A targets file holds one target per line: an address, a name to resolve
+ * or a prefix, which stands for one target per block of a given length
+ * within it (every /24 of a /8, say). The file is memory-mapped and
+ * prefixes are expanded lazily, so a campaign over millions of targets
+ * needs no more memory than one over a handful, and reading the next
+ * target never waits on more than a page fault.
+ *
+ * Targets may be excluded by a list of prefixes, kept as sorted disjoint
+ * intervals so that a lookup is a binary search and an excluded range
+ * within a prefix is skipped in one step rather than block by block.
+ * Targets are numbered as they are read, after exclusions, and can be
+ * dealt out round-robin among several shards that read the same file.
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "targets.h"
+
+#define V4_MAPPED ((tr_uint128)0xffff << 32)
+
+static tr_uint128 mask(int bits) {
+  return bits >= 128 ? ~(tr_uint128)0 : ((tr_uint128)1 << bits) - 1;
+}
+
+tr_uint128 addr_to_uint128(const struct tr_addr *addr) {
+  const uint8_t *b = addr->u.v6.s6_addr;
+  tr_uint128 v = 0;
+  int i;
+
+  if (addr->family == AF_INET) {
+    return V4_MAPPED | ntohl(addr->u.v4.s_addr);
+  }
+  for (i = 0; i < 16; i++) {
+    v = v << 8 | b[i];
+  }
+  return v;
+}
+
+void addr_from_uint128(struct tr_addr *addr, int family, tr_uint128 v) {
+  int i;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->family = family;
+  if (family == AF_INET) {
+    addr->u.v4.s_addr = htonl((uint32_t)v);
+    return;
+  }
+  for (i = 15; i >= 0; i--) {
+    addr->u.v6.s6_addr[i] = v;
+    v >>= 8;
+  }
+}
+
+/**
+ * Parses "address" or "address/len" in `s` into the range it covers.
+ *
+ * Returns 0 on success and -1 if `s` is neither.
+ */
+static int parse_prefix(char *s, struct tr_addr *addr, int *len) {
+  char *slash, *end;
+  long n;
+  int bits;
+
+  if ((slash = strchr(s, '/')) != NULL) {
+    *slash = '\0';
+  }
+  if (addr_pton(addr, s) == -1 || addr->family == 0) {
+    return -1;
+  }
+  bits = addr->family == AF_INET6 ? 128 : 32;
+  *len = bits;
+  if (slash != NULL) {
+    errno = 0;
+    n = strtol(slash + 1, &end, 10);
+    if (errno != 0 || end == slash + 1 || *end != '\0' || n < 0 || n > bits) {
+      return -1;
+    }
+    *len = n;
+  }
+  return 0;
+}
+
+/**
+ * Copies the first word of the line at `p`, up to `end`, into `buf`,
+ * leaving out comments.
+ *
+ * Returns the word's length, 0 for a blank line and -1 if it is too long.
+ */
+static int first_word(const char *p, const char *end, char *buf,
+                      size_t size) {
+  size_t n = 0;
+
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  while (p + n < end && !isspace((unsigned char)p[n]) && p[n] != '#') {
+    if (n == size - 1) {
+      return -1;
+    }
+    buf[n] = p[n];
+    n++;
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+static int interval_cmp(const void *x, const void *y) {
+  const struct tr_interval *a = x, *b = y;
+  return a->lo < b->lo ? -1 : a->lo > b->lo;
+}
+
+/**
+ * Reads a list of addresses and prefixes to exclude, one per line,
+ * with blank lines and '#' comments skipped.
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (EINVAL if a line is neither).
+ */
+int exclusions_load(struct tr_exclusions *ex, const char *file) {
+  FILE *f;
+  char line[256], word[INET6_ADDRSTRLEN + 4];
+  long cap = 0, i, n;
+  int len, w;
+  tr_uint128 lo;
+  struct tr_addr addr;
+  struct tr_interval *iv;
+
+  memset(ex, 0, sizeof(*ex));
+  if ((f = fopen(file, "r")) == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if ((w = first_word(line, line + strlen(line), word, sizeof(word))) == 0) {
+      continue;
+    }
+    if (w == -1 || parse_prefix(word, &addr, &len) == -1) {
+      fclose(f);
+      exclusions_free(ex);
+      errno = EINVAL;
+      return -1;
+    }
+    if (ex->n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      if ((iv = realloc(ex->intervals, cap * sizeof(*iv))) == NULL) {
+        fclose(f);
+        exclusions_free(ex);
+        return -1;
+      }
+      ex->intervals = iv;
+    }
+    len = (addr.family == AF_INET ? 32 : 128) - len;
+    lo = addr_to_uint128(&addr) & ~mask(len);
+    ex->intervals[ex->n].lo = lo;
+    ex->intervals[ex->n].hi = lo | mask(len);
+    ex->n++;
+  }
+  fclose(f);
+
+  // Merge overlapping and adjacent intervals.
+  qsort(ex->intervals, ex->n, sizeof(*ex->intervals), interval_cmp);
+  for (i = 0, n = 0; i < ex->n; i++) {
+    iv = n > 0 ? &ex->intervals[n - 1] : NULL;
+    if (iv != NULL && (ex->intervals[i].lo <= iv->hi ||
+                       (iv->hi != ~(tr_uint128)0 &&
+                        ex->intervals[i].lo == iv->hi + 1))) {
+      if (ex->intervals[i].hi > iv->hi) {
+        iv->hi = ex->intervals[i].hi;
+      }
+    } else {
+      ex->intervals[n++] = ex->intervals[i];
+    }
+  }
+  ex->n = n;
+  return 0;
+}
+
+/**
+ * Returns the excluded interval `v` is in, or NULL if it is not excluded.
+ */
+const struct tr_interval *exclusions_find(const struct tr_exclusions *ex,
+                                          tr_uint128 v) {
+  long lo = 0, hi = ex->n, mid;
+
+  // Find the last interval starting at or before `v`.
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (ex->intervals[mid].lo <= v) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0 || ex->intervals[lo - 1].hi < v) {
+    return NULL;
+  }
+  return &ex->intervals[lo - 1];
+}
+
+void exclusions_free(struct tr_exclusions *ex) {
+  free(ex->intervals);
+  ex->intervals = NULL;
+  ex->n = 0;
+}
+
+/**
+ * Maps the targets file `file`. Prefixes of each family are expanded
+ * to one target per /`gran4` or /`gran6` block within them, the second
+ * address of the block if it has more than two (the .1 of a /24, say).
+ * Targets within `ex`, if not NULL, are skipped, and of the rest only
+ * those numbered `shard` modulo `nshards` are read.
+ *
+ * Returns 0 on success and -1 on failure, with errno set.
+ */
+int targets_open(struct tr_targets *t, const char *file, int gran4, int gran6,
+                 const struct tr_exclusions *ex, uint64_t shard,
+                 uint64_t nshards) {
+  int fd;
+  struct stat st;
+
+  memset(t, 0, sizeof(*t));
+  if (gran4 < 0 || gran4 > 32 || gran6 < 0 || gran6 > 128 || nshards == 0 ||
+      shard >= nshards) {
+    errno = EINVAL;
+    return -1;
+  }
+  t->gran4 = gran4;
+  t->gran6 = gran6;
+  t->exclusions = ex;
+  t->shard = shard;
+  t->nshards = nshards;
+
+  if ((fd = open(file, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  t->len = st.st_size;
+  if (t->len > 0) {
+    t->map = mmap(NULL, t->len, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (t->map == MAP_FAILED) {
+    t->map = NULL;
+    return -1;
+  }
+  if (t->map != NULL) {
+    madvise((void *)t->map, t->len, MADV_SEQUENTIAL);
+  }
+  return 0;
+}
+
+/**
+ * Starts expanding `addr`/`len` into its blocks.
+ */
+static void expand(struct tr_targets *t, const struct tr_addr *addr, int len) {
+  int bits = addr->family == AF_INET ? 32 : 128;
+  int gran = addr->family == AF_INET ? t->gran4 : t->gran6;
+  int host = bits - len, block = bits - (len > gran ? len : gran);
+  tr_uint128 base = addr_to_uint128(addr) & ~mask(host);
+  tr_uint128 off = block >= 2 ? 1 : 0;
+
+  t->expanding = 1;
+  t->family = addr->family;
+  t->step = block >= 128 ? 0 : (tr_uint128)1 << block;
+  t->next = base + off;
+  t->last = base + (mask(host) - mask(block)) + off;
+}
+
+/**
+ * Takes the next target of the prefix being expanded that is not excluded.
+ *
+ * Returns 1 if there is one, and 0 once the prefix is done.
+ */
+static int expand_next(struct tr_targets *t, tr_uint128 *v) {
+  const struct tr_interval *iv;
+
+  while (t->expanding) {
+    *v = t->next;
+    if (*v == t->last) {
+      t->expanding = 0;
+    } else {
+      t->next += t->step;
+    }
+    if (t->exclusions == NULL ||
+        (iv = exclusions_find(t->exclusions, *v)) == NULL) {
+      return 1;
+    }
+    // Skip every block whose target is in the same excluded interval.
+    if (iv->hi >= t->last) {
+      t->expanding = 0;
+    } else if (t->expanding) {
+      t->next = *v + ((iv->hi - *v) / t->step + 1) * t->step;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads the next line that holds a target into `t->name`.
+ *
+ * Returns 1 if there is one, 0 at the end of the file
+ * and -1 if the line is too long to hold one.
+ */
+static int next_line(struct tr_targets *t) {
+  const char *p, *end;
+  int n;
+
+  while (t->off < t->len) {
+    p = t->map + t->off;
+    if ((end = memchr(p, '\n', t->len - t->off)) == NULL) {
+      end = t->map + t->len;
+    }
+    t->off = end - t->map + (end < t->map + t->len);
+    t->line++;
+    if ((n = first_word(p, end, t->name, sizeof(t->name))) != 0) {
+      return n == -1 ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads the next target of our shard.
+ *
+ * Returns 1 if there is one, 0 at the end of the file and -1 if line
+ * `t->line` is malformed, with errno set to EINVAL.
+ */
+int targets_next(struct tr_targets *t, struct tr_target *target) {
+  tr_uint128 v;
+  int len, rv, prefix;
+
+  for (;;) {
+    if (expand_next(t, &v)) {
+      addr_from_uint128(&target->addr, t->family, v);
+      target->name = NULL;
+    } else {
+      if ((rv = next_line(t)) != 1) {
+        errno = EINVAL;
+        return rv;
+      }
+      prefix = strchr(t->name, '/') != NULL;
+      if (parse_prefix(t->name, &target->addr, &len) == -1) {
+        if (prefix) {
+          errno = EINVAL;
+          return -1;
+        }
+        target->name = t->name;
+      } else if (len < (target->addr.family == AF_INET ? 32 : 128)) {
+        expand(t, &target->addr, len);
+        continue;
+      } else {
+        // A single address is a target as is, even where a block
+        // of the expanded length would not have picked it.
+        if (targets_excluded(t, &target->addr)) {
+          continue;
+        }
+        target->name = NULL;
+      }
+    }
+    if (t->index++ % t->nshards == t->shard) {
+      return 1;
+    }
+  }
+}
+
+/**
+ * Returns whether `addr` is excluded, for addresses that names resolve to.
+ */
+int targets_excluded(const struct tr_targets *t, const struct tr_addr *addr) {
+  return t->exclusions != NULL &&
+         exclusions_find(t->exclusions, addr_to_uint128(addr)) != NULL;
+}
+
+void targets_close(struct tr_targets *t) {
+  if (t->map != NULL) {
+    munmap((void *)t->map, t->len);
+  }
+  t->map = NULL;
+}
@@ -0,0 +1,85 @@
+#ifndef TARGETS_H
+#define TARGETS_H
+
+#include <netdb.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+// Prefix lengths prefixes are expanded to one target per, by default.
+#define TARGETS_GRAN4 32
+#define TARGETS_GRAN6 64
+
+/**
+ * An address as an integer, IPv4 addresses mapped into ::ffff:0:0/96,
+ * so that addresses of either family order and add alike.
+ */
+typedef unsigned __int128 tr_uint128;
+
+/**
+ * A range of addresses, both ends included.
+ */
+struct tr_interval {
+  tr_uint128 lo;
+  tr_uint128 hi;
+};
+
+/**
+ * Addresses never to probe, as sorted, disjoint intervals.
+ */
+struct tr_exclusions {
+  struct tr_interval *intervals;
+  long n;
+};
+
+/**
+ * A target read from a targets file: an address, or a name to resolve
+ * when `name` is not NULL. `name` is valid until the next target is read.
+ */
+struct tr_target {
+  struct tr_addr addr;
+  const char *name;
+};
+
+/**
+ * A targets file, memory-mapped and read one target at a time,
+ * so reading one costs the same memory whatever its size.
+ */
+struct tr_targets {
+  const char *map;
+  size_t len;
+  size_t off;
+  long line; // Of the last line read, from 1.
+  int gran4;
+  int gran6;
+  const struct tr_exclusions *exclusions; // Or NULL.
+  uint64_t shard;
+  uint64_t nshards;
+  uint64_t index; // Of the next target, among those of every shard.
+  // The prefix being expanded, if `expanding`: targets are `next`
+  // then every `step` after it, up to `last`.
+  int expanding;
+  int family;
+  tr_uint128 next;
+  tr_uint128 step;
+  tr_uint128 last;
+  char name[NI_MAXHOST];
+};
+
+tr_uint128 addr_to_uint128(const struct tr_addr *addr);
+void addr_from_uint128(struct tr_addr *addr, int family, tr_uint128 v);
+
+int exclusions_load(struct tr_exclusions *ex, const char *file);
+const struct tr_interval *exclusions_find(const struct tr_exclusions *ex,
+                                          tr_uint128 v);
+void exclusions_free(struct tr_exclusions *ex);
+
+int targets_open(struct tr_targets *t, const char *file, int gran4, int gran6,
+                 const struct tr_exclusions *ex, uint64_t shard,
+                 uint64_t nshards);
+int targets_next(struct tr_targets *t, struct tr_target *target);
+int targets_excluded(const struct tr_targets *t, const struct tr_addr *addr);
+void targets_close(struct tr_targets *t);
+
+#endif
@@ -0,0 +1,64 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "addr.h"
+#include "minunit.h"
+
+static struct tr_addr addr(const char *s) {
+  struct tr_addr a;
+  addr_pton(&a, s);
+  return a;
+}
+
+MU_TEST(test_addr_ntop) {
+  struct tr_addr a;
+  char s[INET6_ADDRSTRLEN];
+
+  a = addr("192.0.2.1");
+  mu_assert_string_eq("192.0.2.1", addr_ntop(&a, s, sizeof(s)));
+  a = addr("2001:db8::1");
+  mu_assert_string_eq("2001:db8::1", addr_ntop(&a, s, sizeof(s)));
+  a = addr("*");
+  mu_assert_string_eq("*", addr_ntop(&a, s, sizeof(s)));
+}
+
+MU_TEST(test_addr_in_prefix) {
+  struct tr_addr a = addr("192.0.2.130"), p = addr("192.0.2.128");
+  struct tr_addr a6 = addr("2001:db8::1"), p6 = addr("2001:db8::");
+
+  mu_check(addr_in_prefix(&a, &p, 25));
+  mu_check(addr_in_prefix(&a, &p, 0));
+  mu_check(!addr_in_prefix(&a, &p, 31));
+  mu_check(!addr_in_prefix(&a, &p, 32));
+  mu_check(addr_in_prefix(&a6, &p6, 32));
+  mu_check(!addr_in_prefix(&a6, &p6, 128));
+  mu_check(!addr_in_prefix(&a6, &p, 0));
+}
+
+MU_TEST(test_addr_pton) {
+  struct tr_addr a, b;
+
+  mu_assert_int_eq(0, addr_pton(&a, "192.0.2.1"));
+  mu_assert_int_eq(AF_INET, a.family);
+  mu_assert_int_eq(0, addr_pton(&b, "192.0.2.1"));
+  mu_check(addr_eq(&a, &b));
+  mu_check(addr_hash(&a) == addr_hash(&b));
+  mu_assert_int_eq(0, addr_pton(&b, "2001:db8::1"));
+  mu_assert_int_eq(AF_INET6, b.family);
+  mu_check(!addr_eq(&a, &b));
+  mu_assert_int_eq(0, addr_pton(&b, "*"));
+  mu_assert_int_eq(0, b.family);
+  mu_assert_int_eq(-1, addr_pton(&b, "192.0.2"));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_addr_ntop);
+  MU_RUN_TEST(test_addr_in_prefix);
+  MU_RUN_TEST(test_addr_pton);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,159 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "archive.h"
+#include "minunit.h"
+
+static char file[] = "/tmp/test_archiveXXXXXX";
+static struct archive_record records[ARCHIVE_CHUNK];
+
+static struct tr_addr addr(uint32_t a) {
+  struct tr_addr addr;
+  struct in_addr in;
+  in.s_addr = htonl(a);
+  addr_set(&addr, AF_INET, &in);
+  return addr;
+}
+
+static struct archive_record record(int i) {
+  struct archive_record r;
+  memset(&r, 0, sizeof(r));
+  // Times and RTTs go backwards now and then.
+  r.time_us = 1500000000000000ULL + i * 1000 - (i % 7) * 3000;
+  r.target = addr(0x08080800 + i / 64);
+  r.ttl = i % 64 + 1;
+  if (i % 5 != 0) {
+    r.responder = addr(0x0a000000 + i % 100);
+    r.rtt_us = 1000 + (i % 13) * 977;
+    r.icmp_type = 11;
+  }
+  return r;
+}
+
+static void write_records(int from, int to) {
+  int i;
+  struct tr_archive_writer w;
+  struct archive_record r;
+
+  mu_assert_int_eq(0, archive_open(&w, file));
+  for (i = from; i < to; i++) {
+    r = record(i);
+    mu_assert_int_eq(0, archive_append(&w, &r));
+  }
+  mu_assert_int_eq(0, archive_close(&w));
+}
+
+static void setup() { close(mkstemp(file)); }
+
+static void teardown() { unlink(file); }
+
+MU_TEST(test_archive_round_trip) {
+  int i = 0, n = ARCHIVE_CHUNK + 100, chunks = 0;
+  uint32_t j;
+  size_t off = 0;
+  struct tr_archive a;
+  struct archive_chunk chunk;
+  struct archive_record r;
+
+  write_records(0, n);
+
+  mu_assert_int_eq(0, archive_map(&a, file));
+  while (archive_next_chunk(&a, &off, &chunk) == 1) {
+    chunks++;
+    mu_assert_int_eq(0, archive_decode(&chunk, records));
+    for (j = 0; j < chunk.header->nrecords; j++, i++) {
+      r = record(i);
+      mu_check(records[j].time_us == r.time_us);
+      mu_check(records[j].time_us >= chunk.header->time_min);
+      mu_check(records[j].time_us <= chunk.header->time_max);
+      mu_check(addr_eq(&records[j].target, &r.target));
+      mu_check(addr_eq(&records[j].responder, &r.responder));
+      mu_assert_int_eq(r.rtt_us, records[j].rtt_us);
+      mu_assert_int_eq(r.ttl, records[j].ttl);
+      mu_assert_int_eq(r.icmp_type, records[j].icmp_type);
+    }
+  }
+  mu_assert_int_eq(2, chunks);
+  mu_assert_int_eq(n, i);
+  archive_unmap(&a);
+}
+
+MU_TEST(test_archive_dict_find) {
+  size_t off = 0;
+  struct tr_archive a;
+  struct archive_chunk chunk;
+  struct tr_addr target = addr(0x08080800), other = addr(0x08080900);
+  struct tr_addr none;
+
+  write_records(0, 100);
+  addr_set(&none, 0, NULL);
+
+  mu_assert_int_eq(0, archive_map(&a, file));
+  mu_assert_int_eq(1, archive_next_chunk(&a, &off, &chunk));
+  mu_check(archive_dict_find(&chunk, &target) >= 0);
+  mu_check(archive_dict_find(&chunk, &none) >= 0);
+  mu_assert_int_eq(-1, archive_dict_find(&chunk, &other));
+  mu_assert_int_eq(0, archive_next_chunk(&a, &off, &chunk));
+  archive_unmap(&a);
+}
+
+MU_TEST(test_archive_append) {
+  int chunks = 0;
+  size_t off = 0;
+  struct tr_archive a;
+  struct archive_chunk chunk;
+
+  write_records(0, 10);
+  write_records(10, 30);
+
+  mu_assert_int_eq(0, archive_map(&a, file));
+  while (archive_next_chunk(&a, &off, &chunk) == 1) {
+    chunks++;
+  }
+  mu_assert_int_eq(2, chunks);
+  mu_assert_int_eq(0, archive_decode(&chunk, records));
+  mu_check(records[0].time_us == record(10).time_us);
+  archive_unmap(&a);
+}
+
+MU_TEST(test_archive_invalid) {
+  FILE *f;
+  size_t off = 0;
+  struct tr_archive a;
+  struct tr_archive_writer w;
+  struct archive_chunk chunk;
+
+  f = fopen(file, "w");
+  fprintf(f, "not an archive\n");
+  fclose(f);
+  mu_assert_int_eq(-1, archive_map(&a, file));
+  mu_assert_int_eq(-1, archive_open(&w, file));
+
+  // A truncated chunk is rejected rather than read past the end.
+  unlink(file);
+  write_records(0, 10);
+  truncate(file, sizeof(ARCHIVE_MAGIC) + sizeof(struct archive_chunk_header));
+  mu_assert_int_eq(0, archive_map(&a, file));
+  mu_assert_int_eq(-1, archive_next_chunk(&a, &off, &chunk));
+  archive_unmap(&a);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+  MU_RUN_TEST(test_archive_round_trip);
+  MU_RUN_TEST(test_archive_dict_find);
+  MU_RUN_TEST(test_archive_append);
+  MU_RUN_TEST(test_archive_invalid);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "minunit.h"
+
+static char file[] = "/tmp/test_capture.XXXXXX";
+static uint8_t buf[4096];
+static size_t len;
+static struct tr_capture c;
+
+// An IPv4 UDP probe to port 33434, without the link layer.
+static const uint8_t udp4[28] = {
+    0x45, 0, 0, 28, 0, 0, 0x40, 0, 1, IPPROTO_UDP, 0, 0, 10, 0, 0, 1,
+    10,   0, 0, 2,  0x82, 0x9a, 0x82, 0x9a, 0, 8, 0, 0};
+
+static void put(const void *p, size_t n) {
+  memcpy(buf + len, p, n);
+  len += n;
+}
+
+static void put16(uint16_t v, int swap) {
+  v = swap ? __builtin_bswap16(v) : v;
+  put(&v, sizeof(v));
+}
+
+static void put32(uint32_t v, int swap) {
+  v = swap ? __builtin_bswap32(v) : v;
+  put(&v, sizeof(v));
+}
+
+static void pcap_header(uint32_t magic, uint32_t linktype, int swap) {
+  put32(magic, swap);
+  put16(2, swap);
+  put16(4, swap);
+  put32(0, swap);
+  put32(0, swap);
+  put32(65535, swap);
+  put32(linktype, swap);
+}
+
+static void pcap_record(uint32_t sec, uint32_t frac, const void *p, uint32_t n,
+                        int swap) {
+  put32(sec, swap);
+  put32(frac, swap);
+  put32(n, swap);
+  put32(n, swap);
+  put(p, n);
+}
+
+static void pcapng_block(uint32_t type, const void *body, uint32_t n) {
+  uint32_t total = 12 + ((n + 3) & ~3);
+  static const uint8_t pad[4];
+
+  put32(type, 0);
+  put32(total, 0);
+  put(body, n);
+  put(pad, total - 12 - n);
+  put32(total, 0);
+}
+
+static void open_buf() {
+  int fd = mkstemp(file);
+  mu_check(write(fd, buf, len) == (ssize_t)len);
+  close(fd);
+  mu_assert_int_eq(0, capture_open(&c, file));
+}
+
+static void setup() {
+  len = 0;
+  strcpy(file, "/tmp/test_capture.XXXXXX");
+}
+
+static void teardown() {
+  capture_close(&c);
+  unlink(file);
+}
+
+MU_TEST(test_capture_pcap_ethernet) {
+  int family, proto;
+  uint32_t n, tlen;
+  const uint8_t *ip;
+  uint8_t frame[14 + 4 + sizeof(udp4)] = {0};
+  struct capture_packet pkt;
+
+  // A VLAN tagged IPv4 frame.
+  frame[12] = 0x81;
+  frame[16] = 0x08;
+  memcpy(frame + 18, udp4, sizeof(udp4));
+  pcap_header(PCAP_MAGIC_US, LINKTYPE_ETHERNET, 0);
+  pcap_record(1700000000, 250000, frame, sizeof(frame), 0);
+  open_buf();
+
+  mu_assert_int_eq(1, capture_next(&c, &pkt));
+  mu_assert_int_eq(1700000000, pkt.ts.tv_sec);
+  mu_assert_int_eq(250000000, pkt.ts.tv_nsec);
+  mu_check((ip = capture_ip(&pkt, &family, &n)) == pkt.data + 18);
+  mu_assert_int_eq(AF_INET, family);
+  mu_assert_int_eq(sizeof(udp4), n);
+  mu_check(capture_transport(ip, family, n, &proto, &tlen) == ip + 20);
+  mu_assert_int_eq(IPPROTO_UDP, proto);
+  mu_assert_int_eq(8, tlen);
+  mu_assert_int_eq(0, capture_next(&c, &pkt));
+}
+
+MU_TEST(test_capture_pcap_swapped) {
+  int family, proto;
+  uint32_t n, tlen;
+  const uint8_t *ip;
+  uint8_t ip6[40 + 8 + 8] = {0x60};
+  struct capture_packet pkt;
+
+  // An ICMPv6 message behind a hop-by-hop options header,
+  // in nanoseconds from a machine of the other byte order.
+  ip6[6] = IPPROTO_HOPOPTS;
+  ip6[40] = IPPROTO_ICMPV6;
+  pcap_header(PCAP_MAGIC_NS, LINKTYPE_RAW, 1);
+  pcap_record(1, 999999999, ip6, sizeof(ip6), 1);
+  open_buf();
+
+  mu_assert_int_eq(1, capture_next(&c, &pkt));
+  mu_assert_int_eq(1, pkt.ts.tv_sec);
+  mu_assert_int_eq(999999999, pkt.ts.tv_nsec);
+  mu_assert_int_eq(LINKTYPE_RAW, pkt.linktype);
+  mu_check((ip = capture_ip(&pkt, &family, &n)) == pkt.data);
+  mu_assert_int_eq(AF_INET6, family);
+  mu_check(capture_transport(ip, family, n, &proto, &tlen) == ip + 48);
+  mu_assert_int_eq(IPPROTO_ICMPV6, proto);
+  mu_assert_int_eq(8, tlen);
+
+  // Non-first fragments carry no transport header.
+  ip6[6] = IPPROTO_FRAGMENT;
+  ip6[40] = IPPROTO_UDP;
+  ip6[43] = 0x08;
+  mu_check(capture_transport(ip6, AF_INET6, sizeof(ip6), &proto, &tlen) ==
+           NULL);
+}
+
+MU_TEST(test_capture_pcapng) {
+  int family;
+  uint32_t n;
+  uint8_t shb[16] = {0}, idb[16] = {0}, epb[20 + 16 + sizeof(udp4)] = {0};
+  uint32_t v;
+  uint64_t ts;
+  struct capture_packet pkt;
+
+  v = PCAPNG_BYTE_ORDER;
+  memcpy(shb, &v, 4);
+  shb[4] = 1;
+  memset(shb + 8, 0xff, 8);
+  pcapng_block(PCAPNG_SHB, shb, sizeof(shb));
+
+  // Interface 0 is raw IP in nanoseconds, interface 1 Linux cooked
+  // in the default microseconds.
+  idb[0] = LINKTYPE_RAW;
+  idb[8] = 9;
+  idb[10] = 1;
+  idb[12] = 9;
+  pcapng_block(PCAPNG_IDB, idb, sizeof(idb));
+  memset(idb, 0, sizeof(idb));
+  idb[0] = LINKTYPE_LINUX_SLL;
+  pcapng_block(PCAPNG_IDB, idb, 8);
+
+  ts = 1500000000123456789ULL;
+  v = ts >> 32;
+  memcpy(epb + 4, &v, 4);
+  v = ts;
+  memcpy(epb + 8, &v, 4);
+  v = sizeof(udp4);
+  memcpy(epb + 12, &v, 4);
+  memcpy(epb + 16, &v, 4);
+  memcpy(epb + 20, udp4, sizeof(udp4));
+  pcapng_block(PCAPNG_EPB, epb, 20 + sizeof(udp4));
+
+  epb[0] = 1;
+  ts = 1500000000654321ULL;
+  v = ts >> 32;
+  memcpy(epb + 4, &v, 4);
+  v = ts;
+  memcpy(epb + 8, &v, 4);
+  v = 16 + sizeof(udp4);
+  memcpy(epb + 12, &v, 4);
+  memcpy(epb + 16, &v, 4);
+  memset(epb + 20, 0, 16);
+  memcpy(epb + 36, udp4, sizeof(udp4));
+  pcapng_block(PCAPNG_EPB, epb, sizeof(epb));
+  open_buf();
+
+  mu_assert_int_eq(1, capture_next(&c, &pkt));
+  mu_assert_int_eq(1500000000, pkt.ts.tv_sec);
+  mu_assert_int_eq(123456789, pkt.ts.tv_nsec);
+  mu_check(capture_ip(&pkt, &family, &n) == pkt.data);
+
+  mu_assert_int_eq(1, capture_next(&c, &pkt));
+  mu_assert_int_eq(1500000000, pkt.ts.tv_sec);
+  mu_assert_int_eq(654321000, pkt.ts.tv_nsec);
+  mu_assert_int_eq(LINKTYPE_LINUX_SLL, pkt.linktype);
+  mu_check(capture_ip(&pkt, &family, &n) == pkt.data + 16);
+  mu_assert_int_eq(AF_INET, family);
+
+  mu_assert_int_eq(0, capture_next(&c, &pkt));
+}
+
+MU_TEST(test_capture_corrupt) {
+  int fd;
+  struct capture_packet pkt;
+
+  pcap_header(PCAP_MAGIC_US, LINKTYPE_RAW, 0);
+  pcap_record(0, 0, udp4, sizeof(udp4), 0);
+  len -= 4;
+  open_buf();
+  mu_assert_int_eq(-1, capture_next(&c, &pkt));
+  capture_close(&c);
+  unlink(file);
+
+  strcpy(file, "/tmp/test_capture.XXXXXX");
+  memset(buf, 'x', 64);
+  len = 64;
+  fd = mkstemp(file);
+  mu_check(write(fd, buf, len) == (ssize_t)len);
+  close(fd);
+  mu_assert_int_eq(-1, capture_open(&c, file));
+  mu_assert_int_eq(EINVAL, errno);
+}
+
+MU_TEST(test_capture_writer) {
+  struct tr_capture_writer w;
+  struct capture_packet pkt;
+  struct timespec ts = {1500000000, 0};
+  struct stat st;
+  char prefix[64], name[80];
+  int i, n, family;
+  uint32_t iplen;
+
+  snprintf(prefix, sizeof(prefix), "/tmp/test_capture.%d", (int)getpid());
+  mu_assert_int_eq(0, capture_writer_open(&w, prefix, CAPTURE_FILE_MIN));
+  // About 1800 packets fit a file.
+  for (i = 0; i < 4000; i++) {
+    while (!atomic_load(&w.ready)) {
+      usleep(100);
+    }
+    ts.tv_nsec = i;
+    mu_assert_int_eq(0, capture_write(&w, &ts, i % 2 ? CAPTURE_IN : CAPTURE_OUT,
+                                      udp4, sizeof(udp4)));
+  }
+
+  // Until it is closed, the file being written ends where writing did.
+  snprintf(name, sizeof(name), "%s.2.pcapng", prefix);
+  mu_assert_int_eq(0, capture_open(&c, name));
+  mu_assert_int_eq(CAPTURE_FILE_MIN, c.len);
+  for (n = 0; capture_next(&c, &pkt) == 1; n++) {
+  }
+  mu_assert_int_eq(0, capture_next(&c, &pkt));
+  capture_close(&c);
+  mu_check(n > 0 && n < 4000);
+
+  mu_assert_int_eq(0, capture_writer_close(&w));
+  mu_assert_int_eq(4000, w.npackets);
+  mu_assert_int_eq(0, w.ndropped);
+  for (i = 0, n = 0; n < 3; n++) {
+    snprintf(name, sizeof(name), "%s.%d.pcapng", prefix, n);
+    mu_assert_int_eq(0, capture_open(&c, name));
+    mu_check(c.len <= CAPTURE_FILE_MIN);
+    for (; capture_next(&c, &pkt) == 1; i++) {
+      mu_assert_int_eq(1500000000, pkt.ts.tv_sec);
+      mu_assert_int_eq(i, pkt.ts.tv_nsec);
+      mu_check(capture_ip(&pkt, &family, &iplen) == pkt.data);
+      mu_assert_int_eq(AF_INET, family);
+      mu_assert_int_eq(sizeof(udp4), iplen);
+    }
+    capture_close(&c);
+    unlink(name);
+  }
+  mu_assert_int_eq(4000, i);
+  // The file made ahead of time for the next packets is removed.
+  snprintf(name, sizeof(name), "%s.3.pcapng", prefix);
+  mu_assert_int_eq(-1, stat(name, &st));
+
+  mu_assert_int_eq(-1, capture_writer_open(&w, prefix, 4096));
+  mu_assert_int_eq(EINVAL, errno);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+
+  MU_RUN_TEST(test_capture_pcap_ethernet);
+  MU_RUN_TEST(test_capture_pcap_swapped);
+  MU_RUN_TEST(test_capture_pcapng);
+  MU_RUN_TEST(test_capture_corrupt);
+  MU_RUN_TEST(test_capture_writer);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
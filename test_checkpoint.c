@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "minunit.h"
+
+static char file[] = "/tmp/test_checkpoint.XXXXXX";
+static char tmp[sizeof(file) + 4];
+static struct tr_checkpoint cp, loaded;
+
+static void setup() {
+  int fd;
+
+  strcpy(file, "/tmp/test_checkpoint.XXXXXX");
+  fd = mkstemp(file);
+  close(fd);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+}
+
+static void teardown() {
+  checkpoint_free(&cp);
+  checkpoint_free(&loaded);
+  unlink(file);
+}
+
+MU_TEST(test_checkpoint_done) {
+  mu_assert_int_eq(0, checkpoint_init(&cp, 42, 20));
+  mu_check(!checkpoint_done(&cp, 0));
+  checkpoint_set_done(&cp, 0);
+  checkpoint_set_done(&cp, 9);
+  checkpoint_set_done(&cp, 19);
+  mu_check(checkpoint_done(&cp, 0));
+  mu_check(!checkpoint_done(&cp, 1));
+  mu_check(!checkpoint_done(&cp, 8));
+  mu_check(checkpoint_done(&cp, 9));
+  mu_check(checkpoint_done(&cp, 19));
+  mu_check(!checkpoint_done(&cp, 20));
+}
+
+MU_TEST(test_checkpoint_round_trip) {
+  mu_assert_int_eq(0, checkpoint_init(&cp, 42, 1000));
+  cp.position = 123456;
+  memset(cp.perm_key, 0xab, sizeof(cp.perm_key));
+  memset(cp.stateless_key, 0xcd, sizeof(cp.stateless_key));
+  checkpoint_set_done(&cp, 999);
+  mu_assert_int_eq(0, checkpoint_save(&cp, file));
+  mu_check(access(tmp, F_OK) == -1);
+
+  mu_assert_int_eq(0, checkpoint_load(&loaded, file));
+  mu_assert_int_eq(42, loaded.campaign);
+  mu_assert_int_eq(1000, loaded.ntargets);
+  mu_assert_int_eq(123456, loaded.position);
+  mu_check(memcmp(loaded.perm_key, cp.perm_key, sizeof(cp.perm_key)) == 0);
+  mu_check(memcmp(loaded.stateless_key, cp.stateless_key,
+                  sizeof(cp.stateless_key)) == 0);
+  mu_check(checkpoint_done(&loaded, 999));
+  mu_check(!checkpoint_done(&loaded, 998));
+
+  // Saving again replaces the checkpoint.
+  cp.position = 234567;
+  mu_assert_int_eq(0, checkpoint_save(&cp, file));
+  checkpoint_free(&loaded);
+  mu_assert_int_eq(0, checkpoint_load(&loaded, file));
+  mu_assert_int_eq(234567, loaded.position);
+}
+
+MU_TEST(test_checkpoint_invalid) {
+  FILE *f;
+
+  f = fopen(file, "w");
+  fputs("not a checkpoint, but long enough to hold a header", f);
+  fclose(f);
+  mu_assert_int_eq(-1, checkpoint_load(&loaded, file));
+  mu_assert_int_eq(EINVAL, errno);
+  mu_check(loaded.done == NULL);
+
+  // A truncated bitmap.
+  mu_assert_int_eq(0, checkpoint_init(&cp, 1, 64));
+  mu_assert_int_eq(0, checkpoint_save(&cp, file));
+  mu_assert_int_eq(0, truncate(file, 60));
+  mu_assert_int_eq(-1, checkpoint_load(&loaded, file));
+  mu_assert_int_eq(EINVAL, errno);
+
+  unlink(file);
+  mu_assert_int_eq(-1, checkpoint_load(&loaded, file));
+  mu_assert_int_eq(ENOENT, errno);
+}
+
+MU_TEST(test_checkpoint_hash) {
+  uint64_t a, b;
+
+  a = checkpoint_hash(CHECKPOINT_HASH_INIT, "example.com", 11);
+  b = checkpoint_hash(CHECKPOINT_HASH_INIT, "example.org", 11);
+  mu_check(a != b);
+  mu_check(a == checkpoint_hash(CHECKPOINT_HASH_INIT, "example.com", 11));
+  mu_check(checkpoint_hash(a, "x", 1) != a);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+
+  MU_RUN_TEST(test_checkpoint_done);
+  MU_RUN_TEST(test_checkpoint_round_trip);
+  MU_RUN_TEST(test_checkpoint_invalid);
+  MU_RUN_TEST(test_checkpoint_hash);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
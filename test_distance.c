@@ -0,0 +1,137 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "addr.h"
+#include "distance.h"
+#include "minunit.h"
+
+static struct tr_distances d;
+
+static struct tr_addr addr(int family, const char *s) {
+  struct tr_addr addr;
+  struct in6_addr in;
+  inet_pton(family, s, &in);
+  addr_set(&addr, family, &in);
+  return addr;
+}
+
+static int get(int family, const char *s) {
+  struct tr_addr a = addr(family, s);
+  return distance_get(&d, &a);
+}
+
+static int put(int family, const char *s, int hops) {
+  struct tr_addr a = addr(family, s);
+  return distance_put(&d, &a, hops);
+}
+
+static void teardown() { distances_free(&d); }
+
+MU_TEST(test_distance_from_ttl) {
+  // The destination itself, one hop away, with each initial TTL.
+  mu_assert_int_eq(1, distance_from_ttl(64));
+  mu_assert_int_eq(1, distance_from_ttl(128));
+  mu_assert_int_eq(1, distance_from_ttl(255));
+  mu_assert_int_eq(5, distance_from_ttl(60));
+  mu_assert_int_eq(9, distance_from_ttl(120));
+  mu_assert_int_eq(6, distance_from_ttl(250));
+  mu_assert_int_eq(64, distance_from_ttl(1));
+  mu_assert_int_eq(0, distance_from_ttl(0));
+  mu_assert_int_eq(0, distance_from_ttl(256));
+}
+
+MU_TEST(test_distance_echo) {
+  uint8_t buf[20 + DISTANCE_ECHO_LEN];
+  uint32_t sum = 0;
+  int i;
+
+  // Checksummed as the kernel would.
+  mu_assert_int_eq(DISTANCE_ECHO_LEN,
+                   distance_echo(AF_INET, buf + 20, 0x8123, 7));
+  mu_assert_int_eq(8, buf[20]);
+  for (i = 20; i < 20 + DISTANCE_ECHO_LEN; i += 2) {
+    sum += (buf[i] << 8) | buf[i + 1];
+  }
+  mu_assert_int_eq(0xffff, (sum & 0xffff) + (sum >> 16));
+
+  // Its reply, as a raw socket delivers it after an IPv4 header.
+  memset(buf, 0, 20);
+  buf[0] = 0x45;
+  buf[20] = 0;
+  mu_assert_int_eq(7, distance_echo_reply(AF_INET, buf, sizeof(buf), 0x8123));
+  mu_assert_int_eq(-1, distance_echo_reply(AF_INET, buf, sizeof(buf), 0x8124));
+  mu_assert_int_eq(-1, distance_echo_reply(AF_INET, buf, sizeof(buf) - 1,
+                                           0x8123));
+  // Our own request, looped back, is not a reply.
+  buf[20] = 8;
+  mu_assert_int_eq(-1, distance_echo_reply(AF_INET, buf, sizeof(buf), 0x8123));
+
+  distance_echo(AF_INET6, buf, 0x8123, 65535);
+  mu_assert_int_eq(128, buf[0]);
+  buf[0] = 129;
+  mu_assert_int_eq(65535, distance_echo_reply(AF_INET6, buf,
+                                              DISTANCE_ECHO_LEN, 0x8123));
+}
+
+MU_TEST(test_distance_cache) {
+  struct tr_addr a = addr(AF_INET, "192.0.2.1"), b = addr(AF_INET, "192.0.2.9");
+  struct tr_addr c = addr(AF_INET, "192.0.3.1");
+
+  distances_init(&d);
+  mu_assert_int_eq(0, distance_get(&d, &a));
+  mu_assert_int_eq(0, distance_put(&d, &a, 7));
+  mu_assert_int_eq(7, distance_get(&d, &a));
+  // Its neighbours are taken to be as far, but not another prefix.
+  mu_assert_int_eq(7, distance_get(&d, &b));
+  mu_assert_int_eq(0, distance_get(&d, &c));
+
+  // The prefix keeps the furthest, each destination its own.
+  mu_assert_int_eq(0, distance_put(&d, &b, 9));
+  mu_assert_int_eq(0, distance_put(&d, &a, 6));
+  mu_assert_int_eq(6, distance_get(&d, &a));
+  mu_assert_int_eq(9, distance_get(&d, &b));
+  mu_assert_int_eq(9, get(AF_INET, "192.0.2.200"));
+}
+
+MU_TEST(test_distance_cache6) {
+  struct tr_addr a = addr(AF_INET6, "2001:db8:1:2::1");
+  struct tr_addr v4 = addr(AF_INET, "32.1.13.184");
+  char s[16];
+  int i;
+
+  distances_init(&d);
+  mu_assert_int_eq(0, distance_put(&d, &a, 12));
+  mu_assert_int_eq(12, get(AF_INET6, "2001:db8:1:ff::1"));
+  mu_assert_int_eq(0, get(AF_INET6, "2001:db8:2::1"));
+  // An IPv4 address with the same leading bytes is another destination.
+  mu_assert_int_eq(0, distance_get(&d, &v4));
+
+  // Through growing the table.
+  for (i = 0; i < 1000; i++) {
+    snprintf(s, sizeof(s), "10.%d.%d.1", i / 256, i % 256);
+    mu_assert_int_eq(0, put(AF_INET, s, i % 30 + 1));
+  }
+  for (i = 0; i < 1000; i++) {
+    snprintf(s, sizeof(s), "10.%d.%d.1", i / 256, i % 256);
+    mu_assert_int_eq(i % 30 + 1, get(AF_INET, s));
+  }
+  mu_assert_int_eq(12, distance_get(&d, &a));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_distance_from_ttl);
+  MU_RUN_TEST(test_distance_echo);
+  MU_RUN_TEST(test_distance_cache);
+  MU_RUN_TEST(test_distance_cache6);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
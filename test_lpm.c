@@ -0,0 +1,117 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lpm.h"
+#include "minunit.h"
+
+static char dump[] = "/tmp/test_lpm_dumpXXXXXX";
+static char table[] = "/tmp/test_lpm_tableXXXXXX";
+static struct tr_lpm lpm;
+
+static uint32_t addr(const char *s) {
+  struct in_addr in;
+  inet_pton(AF_INET, s, &in);
+  return ntohl(in.s_addr);
+}
+
+static void setup() {
+  FILE *f;
+
+  close(mkstemp(dump));
+  close(mkstemp(table));
+  f = fopen(dump, "w");
+  fprintf(f, "# prefix asn\n");
+  fprintf(f, "10.0.0.0/8 100\n");
+  fprintf(f, "10.1.0.0/16 200\n");
+  fprintf(f, "10.1.2.128/25 300\n");
+  fprintf(f, "10.1.2.192/26 400\n");
+  fprintf(f, "192.0.2.0\t24\t500_600\n");
+  fclose(f);
+
+  if (lpm_build(dump, table) == -1 || lpm_open(&lpm, table) == -1) {
+    perror("lpm");
+    exit(1);
+  }
+}
+
+static void teardown() {
+  lpm_close(&lpm);
+  unlink(dump);
+  unlink(table);
+}
+
+MU_TEST(test_lpm_longest) {
+  mu_assert_int_eq(100, lpm_lookup(&lpm, addr("10.200.0.1"))->asn);
+  mu_assert_int_eq(200, lpm_lookup(&lpm, addr("10.1.200.1"))->asn);
+  mu_assert_int_eq(16, lpm_lookup(&lpm, addr("10.1.200.1"))->len);
+  mu_check(addr("10.1.0.0") == lpm_lookup(&lpm, addr("10.1.200.1"))->prefix);
+}
+
+MU_TEST(test_lpm_tbl8) {
+  // Addresses in a /24 split by longer prefixes keep the covering route.
+  mu_assert_int_eq(200, lpm_lookup(&lpm, addr("10.1.2.1"))->asn);
+  mu_assert_int_eq(300, lpm_lookup(&lpm, addr("10.1.2.129"))->asn);
+  mu_assert_int_eq(400, lpm_lookup(&lpm, addr("10.1.2.200"))->asn);
+  mu_assert_int_eq(400, lpm_lookup(&lpm, addr("10.1.2.255"))->asn);
+  mu_assert_int_eq(200, lpm_lookup(&lpm, addr("10.1.3.0"))->asn);
+}
+
+MU_TEST(test_lpm_pfx2as) {
+  mu_assert_int_eq(500, lpm_lookup(&lpm, addr("192.0.2.77"))->asn);
+}
+
+MU_TEST(test_lpm_no_route) {
+  mu_check(lpm_lookup(&lpm, addr("11.0.0.1")) == NULL);
+  mu_check(lpm_lookup(&lpm, addr("192.0.3.1")) == NULL);
+}
+
+MU_TEST(test_lpm_open_invalid) {
+  struct tr_lpm bad;
+  mu_assert_int_eq(-1, lpm_open(&bad, dump));
+}
+
+/**
+ * Overwrites entry `i` of tbl24 in the table file with `e`.
+ */
+static void corrupt_tbl24(uint32_t i, uint32_t e) {
+  int fd = open(table, O_WRONLY);
+  pwrite(fd, &e, sizeof(e), sizeof(struct lpm_header) + i * sizeof(e));
+  close(fd);
+}
+
+MU_TEST(test_lpm_open_corrupt) {
+  struct tr_lpm bad;
+
+  // A record past the last, then a tbl8 group past the last.
+  corrupt_tbl24(0, 6);
+  mu_assert_int_eq(-1, lpm_open(&bad, table));
+  mu_assert_int_eq(EINVAL, errno);
+  corrupt_tbl24(0, LPM_TBL8 | 2);
+  mu_assert_int_eq(-1, lpm_open(&bad, table));
+  mu_assert_int_eq(EINVAL, errno);
+  corrupt_tbl24(0, 5);
+  mu_assert_int_eq(0, lpm_open(&bad, table));
+  lpm_close(&bad);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+  MU_RUN_TEST(test_lpm_longest);
+  MU_RUN_TEST(test_lpm_tbl8);
+  MU_RUN_TEST(test_lpm_pfx2as);
+  MU_RUN_TEST(test_lpm_no_route);
+  MU_RUN_TEST(test_lpm_open_invalid);
+  MU_RUN_TEST(test_lpm_open_corrupt);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
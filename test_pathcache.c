@@ -0,0 +1,170 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "pathcache.h"
+
+static struct tr_addr addr(const char *s) {
+  struct tr_addr a;
+  struct in6_addr in;
+  int family = strchr(s, ':') != NULL ? AF_INET6 : AF_INET;
+
+  if (strcmp(s, "*") == 0) {
+    addr_set(&a, 0, NULL);
+  } else {
+    inet_pton(family, s, &in);
+    addr_set(&a, family, &in);
+  }
+  return a;
+}
+
+static void make_path(struct tr_path *path, struct tr_addr *hops,
+                      const char *dst, const char **names, int n) {
+  int i;
+  path->dst = addr(dst);
+  path->hops = hops;
+  path->nhops = n;
+  for (i = 0; i < n; i++) {
+    hops[i] = addr(names[i]);
+  }
+}
+
+MU_TEST(test_path_cache_put_find) {
+  const char *names[] = {"10.0.0.1", "*", "192.0.2.1"};
+  struct tr_addr hops[3], dst;
+  struct tr_path path, *found;
+  struct tr_path_cache cache;
+
+  memset(&cache, 0, sizeof(cache));
+  make_path(&path, hops, "192.0.2.1", names, 3);
+  mu_assert_int_eq(0, path_cache_put(&cache, &path));
+
+  dst = addr("192.0.2.1");
+  mu_check((found = path_cache_find(&cache, &dst)) != NULL);
+  mu_assert_int_eq(3, found->nhops);
+  mu_check(found->hops != hops);
+  mu_check(path_reached(found));
+
+  // Replacing a path does not add a second entry.
+  path.nhops = 2;
+  mu_assert_int_eq(0, path_cache_put(&cache, &path));
+  mu_assert_int_eq(1, cache.npaths);
+  mu_assert_int_eq(2, path_cache_find(&cache, &dst)->nhops);
+  mu_check(!path_reached(path_cache_find(&cache, &dst)));
+
+  dst = addr("192.0.2.2");
+  mu_check(path_cache_find(&cache, &dst) == NULL);
+  path_cache_free(&cache);
+}
+
+MU_TEST(test_path_cache_grow) {
+  struct tr_addr hop;
+  struct tr_path path, *found;
+  struct tr_path_cache cache;
+  struct in_addr in;
+  int i, missing = 0;
+
+  memset(&cache, 0, sizeof(cache));
+  path.hops = &hop;
+  path.nhops = 1;
+  for (i = 0; i < 1000; i++) {
+    in.s_addr = htonl(0x0a000000 + i);
+    addr_set(&path.dst, AF_INET, &in);
+    hop = path.dst;
+    path_cache_put(&cache, &path);
+  }
+  mu_assert_int_eq(1000, cache.npaths);
+  for (i = 0; i < 1000; i++) {
+    in.s_addr = htonl(0x0a000000 + i);
+    addr_set(&path.dst, AF_INET, &in);
+    found = path_cache_find(&cache, &path.dst);
+    missing += found == NULL || !path_reached(found);
+  }
+  mu_assert_int_eq(0, missing);
+  path_cache_free(&cache);
+}
+
+MU_TEST(test_path_cache_save_load) {
+  const char *names4[] = {"10.0.0.1", "*", "192.0.2.1"};
+  const char *names6[] = {"2001:db8::ff", "2001:db8::1"};
+  char file[] = "/tmp/test_pathcacheXXXXXX";
+  struct tr_addr hops[3], dst;
+  struct tr_path path, *found;
+  struct tr_path_cache cache;
+  FILE *f;
+  int i;
+
+  close(mkstemp(file));
+  memset(&cache, 0, sizeof(cache));
+  make_path(&path, hops, "192.0.2.1", names4, 3);
+  path_cache_put(&cache, &path);
+  make_path(&path, hops, "2001:db8::1", names6, 2);
+  path_cache_put(&cache, &path);
+  mu_assert_int_eq(0, path_cache_save(&cache, file));
+  path_cache_free(&cache);
+
+  mu_assert_int_eq(0, path_cache_load(&cache, file));
+  mu_assert_int_eq(2, cache.npaths);
+  dst = addr("192.0.2.1");
+  found = path_cache_find(&cache, &dst);
+  mu_check(found != NULL);
+  mu_assert_int_eq(3, found->nhops);
+  mu_assert_int_eq(0, found->hops[1].family);
+  dst = addr("2001:db8::1");
+  mu_check(path_cache_find(&cache, &dst) != NULL);
+  path_cache_free(&cache);
+  unlink(file);
+
+  // A cache that does not exist yet is empty.
+  mu_assert_int_eq(0, path_cache_load(&cache, file));
+  mu_assert_int_eq(0, cache.npaths);
+
+  // A path longer than any we save is rejected, not cut short.
+  f = fopen(file, "w");
+  fputs("192.0.2.1", f);
+  for (i = 0; i <= UCHAR_MAX; i++) {
+    fputs(" 10.0.0.1", f);
+  }
+  fputs("\n", f);
+  fclose(f);
+  mu_assert_int_eq(-1, path_cache_load(&cache, file));
+  mu_assert_int_eq(EINVAL, errno);
+  path_cache_free(&cache);
+  unlink(file);
+}
+
+MU_TEST(test_path_divergence) {
+  const char *a[] = {"10.0.0.1", "10.0.0.2", "192.0.2.1"};
+  const char *b[] = {"10.0.0.1", "10.9.9.9", "192.0.2.1"};
+  const char *c[] = {"10.0.0.1", "10.0.0.2"};
+  struct tr_addr ha[3], hb[3], hc[2];
+  struct tr_path pa, pb, pc;
+
+  make_path(&pa, ha, "192.0.2.1", a, 3);
+  make_path(&pb, hb, "192.0.2.1", b, 3);
+  make_path(&pc, hc, "192.0.2.1", c, 2);
+
+  mu_assert_int_eq(0, path_divergence(&pa, &pa));
+  mu_assert_int_eq(2, path_divergence(&pa, &pb));
+  mu_assert_int_eq(3, path_divergence(&pa, &pc));
+  mu_assert_int_eq(3, path_divergence(&pc, &pa));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_path_cache_put_find);
+  MU_RUN_TEST(test_path_cache_grow);
+  MU_RUN_TEST(test_path_cache_save_load);
+  MU_RUN_TEST(test_path_divergence);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "minunit.h"
+#include "permute.h"
+
+static const uint8_t key[16] = {42};
+
+/**
+ * Checks that walking a permutation of [0, n) hits every element once.
+ */
+static int is_bijection(uint64_t n) {
+  static uint8_t seen[5000];
+  struct tr_perm perm;
+  uint64_t i, x, count = 0;
+
+  memset(seen, 0, sizeof(seen));
+  perm_init(&perm, key, n);
+  while (perm_next(&perm, &x)) {
+    if (x >= n || seen[x]) {
+      return 0;
+    }
+    seen[x] = 1;
+    count++;
+  }
+  for (i = 0; i < n; i++) {
+    if (!seen[i]) {
+      return 0;
+    }
+  }
+  return count == n;
+}
+
+MU_TEST(test_perm_bijection) {
+  mu_check(is_bijection(1));
+  mu_check(is_bijection(2));
+  mu_check(is_bijection(3));
+  mu_check(is_bijection(64));
+  mu_check(is_bijection(65));
+  mu_check(is_bijection(4999));
+}
+
+MU_TEST(test_perm_empty) {
+  struct tr_perm perm;
+  uint64_t x;
+
+  perm_init(&perm, key, 0);
+  mu_assert_int_eq(0, perm_next(&perm, &x));
+}
+
+MU_TEST(test_perm_keyed) {
+  struct tr_perm a, b;
+  uint8_t other[16] = {43};
+  int i, same = 0;
+
+  perm_init(&a, key, 1000);
+  perm_init(&b, other, 1000);
+  for (i = 0; i < 1000; i++) {
+    same += perm_at(&a, i) == perm_at(&b, i);
+  }
+  // Two random permutations agree in about one place.
+  mu_check(same < 10);
+}
+
+MU_TEST(test_perm_spreads_ttls) {
+  // With 100 targets x 30 TTLs, consecutive probes should rarely
+  // hit the same TTL (and so the same near-side routers).
+  struct tr_perm perm;
+  uint64_t x;
+  int prev = -1, repeats = 0;
+
+  perm_init(&perm, key, 100 * 30);
+  while (perm_next(&perm, &x)) {
+    if ((int)(x % 30) == prev) {
+      repeats++;
+    }
+    prev = x % 30;
+  }
+  mu_check(repeats < 3000 / 10);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_perm_bijection);
+  MU_RUN_TEST(test_perm_empty);
+  MU_RUN_TEST(test_perm_keyed);
+  MU_RUN_TEST(test_perm_spreads_ttls);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+
+#include "minunit.h"
+#include "pmtu.h"
+
+/**
+ * Runs a search against a path that passes packets of up to `mtu` bytes,
+ * with the failing hop reporting `reported` (or 0).
+ *
+ * Returns the MTU found, and the number of probes sent in `*probes`.
+ */
+static int search(int lo, int hi, int mtu, int reported, int *probes) {
+  int size;
+  struct tr_pmtu_search s;
+
+  pmtu_search_init(&s, lo, hi);
+  pmtu_search_update(&s, hi, 0, reported);
+  for (*probes = 0; (size = pmtu_search_next(&s)) != 0; (*probes)++) {
+    pmtu_search_update(&s, size, size <= mtu, size <= mtu ? 0 : reported);
+  }
+  return s.lo;
+}
+
+MU_TEST(test_pmtu_search_plateaus) {
+  int probes;
+
+  mu_assert_int_eq(1492, search(PMTU_MIN4, 1500, 1492, 0, &probes));
+  mu_assert_int_eq(1280, search(PMTU_MIN4, 1500, 1300, 0, &probes));
+  mu_assert_int_eq(68, search(PMTU_MIN4, 1500, 100, 0, &probes));
+  mu_assert_int_eq(1400, search(PMTU_MIN6, 9000, 1400, 0, &probes));
+  // Binary search over the plateaus, not a linear walk down them.
+  mu_check(probes <= 4);
+}
+
+MU_TEST(test_pmtu_search_hint) {
+  int probes;
+
+  // A reported MTU is tried first and settles the search at once
+  // when nothing lies between it and the next plateau up.
+  mu_assert_int_eq(1476, search(PMTU_MIN4, 1480, 1476, 1476, &probes));
+  mu_assert_int_eq(1, probes);
+
+  // A bogus report costs one probe.
+  mu_assert_int_eq(1280, search(PMTU_MIN4, 1500, 1280, 1450, &probes));
+}
+
+MU_TEST(test_pmtu_search_done) {
+  int probes;
+
+  mu_assert_int_eq(1280, search(1280, 1400, 1280, 0, &probes));
+  mu_assert_int_eq(0, probes);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_pmtu_search_plateaus);
+  MU_RUN_TEST(test_pmtu_search_hint);
+  MU_RUN_TEST(test_pmtu_search_done);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "minunit.h"
+#include "probe.h"
+
+static struct tr_probe_table table;
+
+MU_TEST(test_probe_add_find) {
+  struct tr_probe *probe;
+  struct timespec sent;
+  sent.tv_sec = 3;
+  sent.tv_nsec = 7;
+
+  probe_table_init(&table);
+  probe = probe_add(&table, AF_INET, 5, 2, &sent);
+
+  mu_check(probe == probe_find(&table, AF_INET, 5));
+  mu_assert_int_eq(2, probe->ttl);
+  mu_assert_int_eq(3, probe->sent.tv_sec);
+  mu_assert_int_eq(7, probe->sent.tv_nsec);
+  mu_check(probe_find(&table, AF_INET, 6) == NULL);
+}
+
+MU_TEST(test_probe_find_family) {
+  struct timespec sent = {0, 0};
+
+  probe_table_init(&table);
+  probe_add(&table, AF_INET6, 5, 1, &sent);
+
+  mu_check(probe_find(&table, AF_INET, 5) == NULL);
+  mu_check(probe_find(&table, AF_INET6, 5) != NULL);
+}
+
+MU_TEST(test_probe_remove) {
+  struct timespec sent = {0, 0};
+
+  probe_table_init(&table);
+  probe_remove(probe_add(&table, AF_INET, 5, 1, &sent));
+
+  mu_check(probe_find(&table, AF_INET, 5) == NULL);
+}
+
+MU_TEST(test_probe_wraparound) {
+  struct timespec sent = {0, 0};
+
+  probe_table_init(&table);
+  probe_add(&table, AF_INET, 5, 1, &sent);
+  probe_add(&table, AF_INET, 5 + PROBE_TABLE_SIZE, 9, &sent);
+
+  mu_check(probe_find(&table, AF_INET, 5) == NULL);
+  mu_assert_int_eq(9, probe_find(&table, AF_INET, 5 + PROBE_TABLE_SIZE)->ttl);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_probe_add_find);
+  MU_RUN_TEST(test_probe_find_family);
+  MU_RUN_TEST(test_probe_remove);
+  MU_RUN_TEST(test_probe_wraparound);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,156 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include "addr.h"
+#include "minunit.h"
+#include "ratelimit.h"
+
+static struct tr_ratelimit rl;
+
+static struct tr_addr addr(uint32_t a) {
+  struct tr_addr addr;
+  struct in_addr in;
+  in.s_addr = htonl(a);
+  addr_set(&addr, AF_INET, &in);
+  return addr;
+}
+
+static void teardown() { ratelimit_free(&rl); }
+
+/**
+ * Offers `r` `n` probes a second for `secs` seconds from `*now`, of which
+ * it answers up to `limit` a second (or all with 0), the first `burst`
+ * of them regardless.
+ *
+ * Returns how many were sent.
+ */
+static int offer(struct tr_responder *r, uint64_t *now, int n, int secs,
+                 int limit, int burst) {
+  int i, sent = 0;
+  uint64_t credit = (uint64_t)burst * 1000000, last = *now;
+  uint64_t depth = (uint64_t)(burst > 0 ? burst : 1) * 1000000;
+
+  for (i = 0; i < n * secs; i++, *now += 1000000 / n) {
+    if (ratelimit_admit(r, *now) != 0) {
+      continue;
+    }
+    sent++;
+    credit += limit > 0 ? (*now - last) * limit : 1000000;
+    credit = credit < depth ? credit : depth;
+    last = *now;
+    if (credit >= 1000000) {
+      credit -= 1000000;
+      ratelimit_answered(r, *now, 1);
+    } else {
+      ratelimit_lost(r, *now, 1);
+    }
+  }
+  return sent;
+}
+
+MU_TEST(test_ratelimit_get) {
+  struct tr_addr a = addr(1), origin = {0};
+  struct tr_responder *r;
+  uint32_t i;
+
+  ratelimit_init(&rl);
+  // Ourselves, as the hop before the first.
+  r = ratelimit_get(&rl, &origin);
+  r->next = a;
+  for (i = 2; i < 1000; i++) {
+    a = addr(i);
+    mu_check(addr_eq(&a, &ratelimit_get(&rl, &a)->addr));
+  }
+  mu_assert_int_eq(999, rl.nresponders);
+  a = addr(1);
+  mu_check(addr_eq(&a, &ratelimit_get(&rl, &origin)->next));
+}
+
+MU_TEST(test_ratelimit_unlimited) {
+  struct tr_addr a = addr(1);
+  struct tr_responder *r;
+  uint64_t now = 1000000;
+
+  ratelimit_init(&rl);
+  r = ratelimit_get(&rl, &a);
+  mu_assert_int_eq(1000, offer(r, &now, 100, 10, 0, 0));
+  mu_assert_int_eq(0, r->limit);
+  mu_assert_int_eq(0, ratelimit_lost(r, now, 1));
+}
+
+MU_TEST(test_ratelimit_converges) {
+  struct tr_addr a = addr(1);
+  struct tr_responder *r;
+  uint64_t now = 1000000;
+
+  ratelimit_init(&rl);
+  r = ratelimit_get(&rl, &a);
+  // Answers 10 a second, after a burst of 6 as Linux allows.
+  offer(r, &now, 100, 2, 10, 6);
+  mu_check(r->limit > 0 && r->limit <= 16);
+  ratelimit_admit(r, now);
+  mu_check(ratelimit_admit(r, now) > 0);
+
+  // Paced, it settles about the limit and loses little.
+  offer(r, &now, 100, 60, 10, 0);
+  r->nlimited = 0;
+  mu_check(offer(r, &now, 100, 60, 10, 0) > 480);
+  mu_check(r->limit >= 8 && r->limit <= 14);
+  mu_check(r->nlimited < 60);
+  mu_assert_int_eq(0, r->lossy);
+}
+
+MU_TEST(test_ratelimit_lossy) {
+  int i, sent = 0;
+  struct tr_addr a = addr(1);
+  struct tr_responder *r;
+  uint64_t now = 1000000;
+
+  ratelimit_init(&rl);
+  r = ratelimit_get(&rl, &a);
+  // Loses every other probe however slowly it is sent them.
+  for (i = 0; i < 2000; i++, now += 10000) {
+    if (ratelimit_admit(r, now) == 0 && sent++ % 2 == 0) {
+      ratelimit_answered(r, now, 1);
+    }
+  }
+  mu_assert_int_eq(1, r->lossy);
+  mu_assert_int_eq(0, r->limit);
+  mu_assert_int_eq(0, ratelimit_lost(r, now, 1));
+}
+
+MU_TEST(test_ratelimit_unexpected) {
+  struct tr_addr a = addr(1), b = addr(2);
+  struct tr_responder *r;
+  uint64_t now = 1000000;
+  int i;
+
+  ratelimit_init(&rl);
+  // Probes expected to expire at `a` but answered by `b` count for `b`.
+  for (i = 0; i < 100; i++, now += 10000) {
+    r = ratelimit_get(&rl, &a);
+    mu_check(ratelimit_admit(r, now) == 0);
+    ratelimit_uncount(r);
+    ratelimit_answered(ratelimit_get(&rl, &b), now, 0);
+  }
+  mu_assert_int_eq(0, ratelimit_get(&rl, &a)->limit);
+  mu_assert_int_eq(0, ratelimit_get(&rl, &b)->limit);
+  mu_assert_int_eq(0, ratelimit_get(&rl, &b)->lossy);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_ratelimit_get);
+  MU_RUN_TEST(test_ratelimit_unlimited);
+  MU_RUN_TEST(test_ratelimit_converges);
+  MU_RUN_TEST(test_ratelimit_lossy);
+  MU_RUN_TEST(test_ratelimit_unexpected);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,241 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "resolver.h"
+
+// A stub nameserver on the loopback interface.
+static int stub;
+static struct sockaddr_in stub_addr;
+static int nqueries;
+static int slow_drops;
+
+static struct tr_resolver r;
+static const struct tr_resolved *results[16];
+static int nresults;
+
+static int put_answer(uint8_t *p, int type, const char *addr) {
+  uint8_t in[16];
+  int len = type == 1 ? 4 : 16;
+
+  inet_pton(type == 1 ? AF_INET : AF_INET6, addr, in);
+  // Pointer to the question name, type, class IN, TTL 60, rdata.
+  uint8_t rr[12] = {0xc0, 12, 0, type, 0, 1, 0, 0, 0, 60, 0, len};
+  memcpy(p, rr, sizeof(rr));
+  memcpy(p + sizeof(rr), in, len);
+  return sizeof(rr) + len;
+}
+
+/**
+ * Answers every query waiting at the stub.
+ */
+static void serve() {
+  uint8_t buf[512];
+  char name[256];
+  int len, type, n, ancount, rcode;
+  struct sockaddr_storage from;
+  socklen_t fromlen = sizeof(from);
+
+  while ((len = recvfrom(stub, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                         &fromlen)) > 0) {
+    nqueries++;
+    // Decode the question name.
+    n = 0;
+    for (uint8_t *p = buf + 12; *p != 0; p += *p + 1) {
+      memcpy(name + n, p + 1, *p);
+      n += *p;
+      name[n++] = '.';
+    }
+    name[n - 1] = '\0';
+    type = buf[len - 3];
+
+    ancount = 0;
+    rcode = 0;
+    if (strcasecmp(name, "a.test") == 0) {
+      if (type == 1) {
+        len += put_answer(buf + len, 1, "192.0.2.1");
+        len += put_answer(buf + len, 1, "192.0.2.2");
+        ancount = 2;
+      } else {
+        len += put_answer(buf + len, 28, "2001:db8::1");
+        ancount = 1;
+      }
+    } else if (strcmp(name, "v4only.test") == 0) {
+      if (type == 1) {
+        len += put_answer(buf + len, 1, "192.0.2.3");
+        ancount = 1;
+      }
+    } else if (strcmp(name, "slow.test") == 0) {
+      if (slow_drops-- > 0) {
+        continue;
+      }
+      if (type == 1) {
+        len += put_answer(buf + len, 1, "192.0.2.4");
+        ancount = 1;
+      }
+    } else if (strcmp(name, "dead.test") == 0) {
+      continue;
+    } else {
+      rcode = 3;
+    }
+
+    buf[2] = 0x81;
+    buf[3] = 0x80 | rcode;
+    buf[7] = ancount;
+    sendto(stub, buf, len, 0, (struct sockaddr *)&from, fromlen);
+  }
+}
+
+/**
+ * Resolves everything queued in `r` against the stub.
+ */
+static void resolve_all() {
+  const struct tr_resolved *res;
+
+  nresults = 0;
+  while (resolver_pending(&r) > 0) {
+    if ((res = resolver_next(&r)) != NULL) {
+      results[nresults++] = res;
+      continue;
+    }
+    resolver_poll(&r, 5);
+    serve();
+  }
+}
+
+static const struct tr_resolved *result(const char *name) {
+  int i;
+  for (i = 0; i < nresults; i++) {
+    if (strcmp(results[i]->name, name) == 0) {
+      return results[i];
+    }
+  }
+  return NULL;
+}
+
+static void start(int family) {
+  mu_assert_int_eq(0, resolver_init(&r, (struct sockaddr *)&stub_addr,
+                                    sizeof(stub_addr), family));
+  r.timeout_ms = 20;
+}
+
+static void setup() {
+  socklen_t len = sizeof(stub_addr);
+
+  stub = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  memset(&stub_addr, 0, sizeof(stub_addr));
+  stub_addr.sin_family = AF_INET;
+  stub_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(stub, (struct sockaddr *)&stub_addr, sizeof(stub_addr));
+  getsockname(stub, (struct sockaddr *)&stub_addr, &len);
+  fcntl(stub, F_SETFL, O_NONBLOCK);
+  nqueries = 0;
+  slow_drops = 0;
+}
+
+static void teardown() {
+  resolver_free(&r);
+  close(stub);
+}
+
+MU_TEST(test_resolver_answers) {
+  const struct tr_resolved *res;
+  char s[INET6_ADDRSTRLEN];
+
+  start(AF_UNSPEC);
+  resolver_add(&r, "a.test");
+  resolver_add(&r, "v4only.test");
+  resolver_add(&r, "nx.test");
+  resolver_add(&r, "192.0.2.9");
+  resolve_all();
+  mu_assert_int_eq(4, nresults);
+
+  mu_check((res = result("a.test")) != NULL);
+  mu_assert_int_eq(0, res->error);
+  mu_assert_int_eq(3, res->naddrs);
+  mu_assert_string_eq("2001:db8::1", addr_ntop(&res->addrs[0], s, sizeof(s)));
+  mu_assert_string_eq("192.0.2.2", addr_ntop(&res->addrs[2], s, sizeof(s)));
+
+  mu_check((res = result("v4only.test")) != NULL);
+  mu_assert_int_eq(1, res->naddrs);
+  mu_assert_string_eq("192.0.2.3", addr_ntop(&res->addrs[0], s, sizeof(s)));
+
+  mu_check((res = result("nx.test")) != NULL);
+  mu_assert_int_eq(3, res->error);
+  mu_assert_int_eq(0, res->naddrs);
+
+  // Literals resolve without a query, and before anything else.
+  mu_check(results[0] == result("192.0.2.9"));
+  mu_assert_int_eq(1, results[0]->naddrs);
+  mu_assert_int_eq(3, results[0]->index);
+  mu_assert_int_eq(6, nqueries);
+}
+
+MU_TEST(test_resolver_family) {
+  start(AF_INET);
+  resolver_add(&r, "a.test");
+  resolver_add(&r, "2001:db8::2");
+  resolve_all();
+  mu_assert_int_eq(2, result("a.test")->naddrs);
+  mu_assert_int_eq(AF_INET, result("a.test")->addrs[0].family);
+  mu_assert_int_eq(RESOLVER_ENOADDR, result("2001:db8::2")->error);
+  mu_assert_int_eq(1, nqueries);
+}
+
+MU_TEST(test_resolver_cache) {
+  start(AF_INET);
+  resolver_add(&r, "a.test");
+  resolver_add(&r, "A.TEST");
+  resolve_all();
+  mu_assert_int_eq(2, nresults);
+  mu_assert_int_eq(2, result("A.TEST")->naddrs);
+  mu_assert_int_eq(1, result("A.TEST")->index);
+
+  // Names resolved earlier are answered at once.
+  resolver_add(&r, "a.test");
+  mu_check(resolver_next(&r) != NULL);
+  mu_assert_int_eq(0, resolver_pending(&r));
+  mu_assert_int_eq(1, nqueries);
+
+  // Until the resolver is reset.
+  resolver_reset(&r);
+  resolver_add(&r, "a.test");
+  resolve_all();
+  mu_assert_int_eq(1, nresults);
+  mu_assert_int_eq(0, results[0]->index);
+  mu_assert_int_eq(2, nqueries);
+}
+
+MU_TEST(test_resolver_retransmit) {
+  start(AF_INET);
+  slow_drops = 1;
+  resolver_add(&r, "slow.test");
+  resolver_add(&r, "dead.test");
+  resolver_add(&r, "bad..name");
+  resolve_all();
+  mu_assert_int_eq(1, result("slow.test")->naddrs);
+  mu_assert_int_eq(RESOLVER_ETIMEOUT, result("dead.test")->error);
+  mu_assert_int_eq(RESOLVER_EBADNAME, result("bad..name")->error);
+  mu_assert_int_eq(2 + RESOLVER_TRIES, nqueries);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+  MU_RUN_TEST(test_resolver_answers);
+  MU_RUN_TEST(test_resolver_family);
+  MU_RUN_TEST(test_resolver_cache);
+  MU_RUN_TEST(test_resolver_retransmit);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
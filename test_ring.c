@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "minunit.h"
+#include "ring.h"
+
+#define STRESS_N 100000
+
+static struct tr_ring r;
+
+static void teardown() { ring_free(&r); }
+
+MU_TEST(test_ring_fifo) {
+  uint32_t i, v;
+
+  mu_assert_int_eq(0, ring_init(&r, 4, sizeof(uint32_t)));
+  mu_assert_int_eq(-1, ring_pop(&r, &v));
+  // Around the end of the slots a few times over.
+  for (i = 0; i < 10; i++) {
+    mu_assert_int_eq(0, ring_push(&r, &i));
+    mu_assert_int_eq(0, ring_pop(&r, &v));
+    mu_assert_int_eq(i, v);
+  }
+  for (i = 0; i < 4; i++) {
+    mu_assert_int_eq(0, ring_push(&r, &i));
+  }
+  mu_assert_int_eq(-1, ring_push(&r, &i));
+  mu_assert_int_eq(1, r.full);
+  for (i = 0; i < 4; i++) {
+    mu_assert_int_eq(0, ring_pop(&r, &v));
+    mu_assert_int_eq(i, v);
+  }
+  mu_assert_int_eq(-1, ring_pop(&r, &v));
+}
+
+MU_TEST(test_ring_invalid) {
+  mu_assert_int_eq(-1, ring_init(&r, 6, 8));
+  mu_assert_int_eq(EINVAL, errno);
+  mu_assert_int_eq(-1, ring_init(&r, 0, 8));
+}
+
+static void *produce(void *arg) {
+  uint64_t i;
+
+  (void)arg;
+  for (i = 0; i < STRESS_N; i++) {
+    while (ring_push(&r, &i) == -1) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+MU_TEST(test_ring_threads) {
+  uint64_t i, v, bad = 0;
+  pthread_t producer;
+
+  mu_assert_int_eq(0, ring_init(&r, 1024, sizeof(uint64_t)));
+  mu_assert_int_eq(0, pthread_create(&producer, NULL, produce, NULL));
+  for (i = 0; i < STRESS_N; i++) {
+    while (ring_pop(&r, &v) == -1) {
+      sched_yield();
+    }
+    bad += v != i;
+  }
+  pthread_join(producer, NULL);
+  mu_assert_int_eq(0, bad);
+  mu_assert_int_eq(-1, ring_pop(&r, &v));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_ring_fifo);
+  MU_RUN_TEST(test_ring_invalid);
+  MU_RUN_TEST(test_ring_threads);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
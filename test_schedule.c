@@ -0,0 +1,190 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+
+#include "addr.h"
+#include "minunit.h"
+#include "schedule.h"
+
+static struct tr_schedule s;
+
+static struct tr_addr addr(uint32_t a) {
+  struct tr_addr addr;
+  struct in_addr in;
+  in.s_addr = htonl(a);
+  addr_set(&addr, AF_INET, &in);
+  return addr;
+}
+
+static void teardown() { schedule_free(&s); }
+
+/**
+ * Checks that the next probe is attempt `attempt` at hop `ttl` of `target`.
+ */
+#define mu_assert_next(target, ttl, attempt)                                   \
+  do {                                                                         \
+    int t_, h_;                                                                \
+    mu_assert_int_eq((attempt), schedule_next(&s, &t_, &h_));                  \
+    mu_assert_int_eq((target), t_);                                            \
+    mu_assert_int_eq((ttl), h_);                                               \
+  } while (0)
+
+MU_TEST(test_schedule_breadth_first) {
+  int target, ttl;
+
+  mu_assert_int_eq(0, schedule_init(&s, 2, 3, 2, UINT64_MAX));
+  // The first probe of every hop, nearest first across targets.
+  mu_assert_next(0, 1, 0);
+  mu_assert_next(1, 1, 0);
+  mu_assert_next(0, 2, 0);
+  mu_assert_next(1, 2, 0);
+  mu_assert_next(0, 3, 0);
+  mu_assert_next(1, 3, 0);
+  // Then nothing until outstanding probes are heard of.
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+
+  // Nearer hops are retried first.
+  schedule_timeout(&s, 0, 3);
+  schedule_timeout(&s, 1, 2);
+  mu_assert_next(1, 2, 1);
+  mu_assert_next(0, 3, 1);
+  // Every hop gets nprobes attempts at most.
+  schedule_timeout(&s, 1, 2);
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+}
+
+MU_TEST(test_schedule_retries_before_repeats) {
+  struct tr_addr a = addr(1);
+
+  mu_assert_int_eq(0, schedule_init(&s, 2, 1, 3, UINT64_MAX));
+  mu_assert_next(0, 1, 0);
+  mu_assert_next(1, 1, 0);
+
+  // A hop that answered is probed again only after one that did not.
+  schedule_answer(&s, 0, 1, 0, &a, 100, 0);
+  schedule_timeout(&s, 1, 1);
+  mu_assert_next(1, 1, 1);
+  mu_assert_next(0, 1, 1);
+}
+
+MU_TEST(test_schedule_gap) {
+  int target, ttl;
+  struct tr_addr a = addr(1);
+
+  mu_assert_int_eq(0, schedule_init(&s, 1, 30, 1, UINT64_MAX));
+  for (ttl = 1; ttl <= SCHEDULE_GAP; ttl++) {
+    mu_assert_next(0, ttl, 0);
+  }
+  // Too far past the last hop that answered.
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+
+  // Until a further hop answers.
+  schedule_answer(&s, 0, 2, 0, &a, 100, 0);
+  mu_assert_next(0, SCHEDULE_GAP + 1, 0);
+  mu_assert_next(0, SCHEDULE_GAP + 2, 0);
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+}
+
+MU_TEST(test_schedule_cap) {
+  int target, ttl;
+
+  mu_assert_int_eq(0, schedule_init(&s, 2, 30, 1, UINT64_MAX));
+  schedule_cap(&s, 0, 8);
+  schedule_cap(&s, 1, 40);
+  // Every hop up to the cap at once, however many did not answer.
+  for (ttl = 1; ttl <= 8; ttl++) {
+    mu_assert_next(0, ttl, 0);
+    mu_assert_next(1, ttl, 0);
+  }
+  // Then no further than that, or than max_ttl.
+  for (ttl = 9; ttl <= 30; ttl++) {
+    mu_assert_next(1, ttl, 0);
+  }
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+  mu_assert_int_eq(8, schedule_nhops(&s, 0));
+}
+
+MU_TEST(test_schedule_destination) {
+  int target, ttl;
+  struct tr_addr a = addr(1), d = addr(2);
+
+  mu_assert_int_eq(0, schedule_init(&s, 1, 30, 2, UINT64_MAX));
+  for (ttl = 1; ttl <= SCHEDULE_GAP; ttl++) {
+    mu_assert_next(0, ttl, 0);
+  }
+  schedule_answer(&s, 0, 1, 0, &a, 100, 0);
+  schedule_answer(&s, 0, 3, 0, &d, 300, 1);
+  schedule_timeout(&s, 0, 4);
+  schedule_timeout(&s, 0, 2);
+
+  // Nothing past the destination is probed, not even a first probe
+  // that the answer from hop 3 would otherwise allow.
+  mu_assert_next(0, 2, 1);
+  mu_assert_next(0, 1, 1);
+  mu_assert_next(0, 3, 1);
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+  mu_assert_int_eq(3, schedule_nhops(&s, 0));
+
+  mu_check(addr_eq(&d, &schedule_hop(&s, 0, 3)->responder));
+  mu_assert_int_eq(0, schedule_hop(&s, 0, 2)->responder.family);
+  mu_assert_int_eq(300, schedule_rtt(&s, 0, 3, 0));
+  mu_check(schedule_rtt(&s, 0, 3, 1) == SCHEDULE_NO_RTT);
+}
+
+MU_TEST(test_schedule_budget) {
+  int i, target, ttl;
+
+  mu_assert_int_eq(0, schedule_init(&s, 4, 8, 3, 5));
+  for (i = 0; i < 5; i++) {
+    mu_check(schedule_next(&s, &target, &ttl) == 0);
+  }
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+  mu_assert_int_eq(2, schedule_nhops(&s, 0));
+  mu_assert_int_eq(1, schedule_nhops(&s, 1));
+}
+
+// Holds back every probe to target 0.
+static int admit_not_0(void *arg, int target, int ttl) {
+  (void)arg;
+  (void)ttl;
+  return target != 0;
+}
+
+MU_TEST(test_schedule_deferred) {
+  int target, ttl;
+
+  mu_assert_int_eq(0, schedule_init(&s, 2, 2, 2, UINT64_MAX));
+  s.admit = admit_not_0;
+  mu_assert_next(1, 1, 0);
+  mu_assert_next(1, 2, 0);
+  mu_assert_int_eq(SCHEDULE_DEFERRED, schedule_next(&s, &target, &ttl));
+
+  // Held back probes are sent once they are let through, in order.
+  s.admit = NULL;
+  mu_assert_next(0, 1, 0);
+  mu_assert_next(0, 2, 0);
+  mu_assert_int_eq(-1, schedule_next(&s, &target, &ttl));
+
+  schedule_timeout(&s, 0, 2);
+  schedule_limited(&s, 0, 2, 0);
+  mu_check(schedule_rtt(&s, 0, 2, 0) == SCHEDULE_LIMITED_RTT);
+  mu_assert_next(0, 2, 1);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_schedule_breadth_first);
+  MU_RUN_TEST(test_schedule_retries_before_repeats);
+  MU_RUN_TEST(test_schedule_gap);
+  MU_RUN_TEST(test_schedule_cap);
+  MU_RUN_TEST(test_schedule_destination);
+  MU_RUN_TEST(test_schedule_budget);
+  MU_RUN_TEST(test_schedule_deferred);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
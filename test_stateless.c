@@ -0,0 +1,182 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "minunit.h"
+#include "stateless.h"
+
+static const uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8,
+                                9, 10, 11, 12, 13, 14, 15, 16};
+
+/**
+ * Verifies a UDP/IPv4 datagram the way its destination would.
+ */
+static uint16_t udp4_verify(const struct ip *ip) {
+  const uint8_t *p = (const uint8_t *)(ip + 1);
+  const uint8_t *a = (const uint8_t *)&ip->ip_src;
+  int ulen = ntohs(((const struct udphdr *)p)->uh_ulen);
+  uint32_t sum = IPPROTO_UDP + ulen;
+  int i;
+
+  for (i = 0; i < 8; i += 2) {
+    sum += (a[i] << 8) | a[i + 1];
+  }
+  for (i = 0; i < ulen; i += 2) {
+    sum += (p[i] << 8) | p[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+MU_TEST(test_stateless_ticks) {
+  struct timespec t, rtt;
+  uint16_t sent;
+
+  t.tv_sec = 12;
+  t.tv_nsec = 345678901;
+  sent = stateless_ticks(&t);
+  mu_check(sent != 0);
+
+  t.tv_nsec += 25 * STATELESS_TICK_NSEC;
+  stateless_rtt(sent, stateless_ticks(&t), &rtt);
+  mu_assert_int_eq(0, rtt.tv_sec);
+  mu_assert_int_eq(25 * STATELESS_TICK_NSEC, rtt.tv_nsec);
+}
+
+MU_TEST(test_stateless_ticks_wrap) {
+  struct timespec rtt;
+
+  stateless_rtt(STATELESS_TICKS - 5, 10, &rtt);
+  mu_assert_int_eq(0, rtt.tv_sec);
+  mu_assert_int_eq(15 * STATELESS_TICK_NSEC, rtt.tv_nsec);
+}
+
+/**
+ * Verifies an IPv4 header checksum the way a router would.
+ */
+static uint16_t ip4_verify(const struct ip *ip) {
+  const uint8_t *p = (const uint8_t *)ip;
+  uint32_t sum = 0;
+  int i;
+
+  for (i = 0; i < (int)sizeof(*ip); i += 2) {
+    sum += (p[i] << 8) | p[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+MU_TEST(test_stateless_probe4) {
+  char buf[STATELESS_PROBE4_LEN];
+  struct ip *ip = (struct ip *)buf;
+  struct udphdr *udp = (struct udphdr *)(ip + 1);
+  struct in_addr src, dst;
+  struct tr_stamp stamp;
+  struct timespec now = {100, 5000000};
+
+  inet_pton(AF_INET, "192.0.2.1", &src);
+  inet_pton(AF_INET, "198.51.100.7", &dst);
+
+  mu_assert_int_eq(STATELESS_PROBE4_LEN,
+                   stateless_probe4(buf, key, &src, &dst, 40000, 33434, 7,
+                                    &now));
+  mu_assert_int_eq(0xffff, udp4_verify(ip));
+  mu_assert_int_eq(stateless_ticks(&now), ntohs(udp->uh_sum));
+
+  mu_assert_int_eq(0, stateless_decode4(key, ip, udp, 33434, &stamp));
+  mu_assert_int_eq(7, stamp.ttl);
+  mu_assert_int_eq(stateless_ticks(&now), stamp.ticks);
+
+  // The header checksum is left to the kernel unless asked for.
+  mu_assert_int_eq(0, ip->ip_sum);
+  stateless_ip_sum4(buf);
+  mu_assert_int_eq(0xffff, ip4_verify(ip));
+  mu_assert_int_eq(0, stateless_decode4(key, ip, udp, 33434, &stamp));
+}
+
+MU_TEST(test_stateless_probe4_every_tick) {
+  char buf[STATELESS_PROBE4_LEN];
+  struct in_addr src, dst;
+  struct timespec now = {0, 0};
+  int i, bad = 0;
+
+  inet_pton(AF_INET, "10.0.0.1", &src);
+  inet_pton(AF_INET, "10.9.8.7", &dst);
+
+  for (i = 0; i < STATELESS_TICKS; i++) {
+    now.tv_sec = i / (1000000000 / STATELESS_TICK_NSEC);
+    now.tv_nsec = i % (1000000000 / STATELESS_TICK_NSEC) * STATELESS_TICK_NSEC;
+    stateless_probe4(buf, key, &src, &dst, 40000, 33434, 1, &now);
+    bad += udp4_verify((struct ip *)buf) != 0xffff;
+  }
+  mu_assert_int_eq(0, bad);
+}
+
+MU_TEST(test_stateless_decode4_forged) {
+  char buf[STATELESS_PROBE4_LEN];
+  struct ip *ip = (struct ip *)buf;
+  struct udphdr *udp = (struct udphdr *)(ip + 1);
+  struct in_addr src, dst;
+  struct tr_stamp stamp;
+  struct timespec now = {100, 5000000};
+  uint8_t other[16] = {0};
+
+  inet_pton(AF_INET, "192.0.2.1", &src);
+  inet_pton(AF_INET, "198.51.100.7", &dst);
+  stateless_probe4(buf, key, &src, &dst, 40000, 33434, 7, &now);
+
+  mu_assert_int_eq(-1, stateless_decode4(other, ip, udp, 33434, &stamp));
+
+  udp->uh_sum = htons(ntohs(udp->uh_sum) + 1);
+  mu_assert_int_eq(-1, stateless_decode4(key, ip, udp, 33434, &stamp));
+}
+
+MU_TEST(test_stateless_payload6) {
+  char buf[sizeof(struct ip6_hdr) + sizeof(struct udphdr) + 4];
+  struct ip6_hdr *ip6 = (struct ip6_hdr *)buf;
+  struct udphdr *udp = (struct udphdr *)(ip6 + 1);
+  struct tr_stamp stamp;
+  struct timespec now = {7, 123456789};
+
+  memset(buf, 0, sizeof(buf));
+  inet_pton(AF_INET6, "2001:db8::1", &ip6->ip6_dst);
+  udp->uh_dport = htons(33434 + 12);
+
+  mu_assert_int_eq(4, stateless_payload6((char *)(udp + 1), key,
+                                         &ip6->ip6_dst, 12, &now));
+  mu_assert_int_eq(0, stateless_decode6(key, ip6, udp, 4, 33434, &stamp));
+  mu_assert_int_eq(12, stamp.ttl);
+  mu_assert_int_eq(stateless_ticks(&now), stamp.ticks);
+
+  // Quoted payload was truncated.
+  mu_assert_int_eq(-1, stateless_decode6(key, ip6, udp, 3, 33434, &stamp));
+
+  // Reply quotes a probe to a different destination.
+  inet_pton(AF_INET6, "2001:db8::2", &ip6->ip6_dst);
+  mu_assert_int_eq(-1, stateless_decode6(key, ip6, udp, 4, 33434, &stamp));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_RUN_TEST(test_stateless_ticks);
+  MU_RUN_TEST(test_stateless_ticks_wrap);
+  MU_RUN_TEST(test_stateless_probe4);
+  MU_RUN_TEST(test_stateless_probe4_every_tick);
+  MU_RUN_TEST(test_stateless_decode4_forged);
+  MU_RUN_TEST(test_stateless_payload6);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
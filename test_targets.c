@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "targets.h"
+
+static char file[] = "/tmp/test_targets.XXXXXX";
+static char exfile[] = "/tmp/test_targets_ex.XXXXXX";
+static struct tr_targets t;
+static struct tr_exclusions ex;
+
+static void write_file(char *name, const char *template, const char *s) {
+  int fd;
+
+  strcpy(name, template);
+  fd = mkstemp(name);
+  mu_check(write(fd, s, strlen(s)) == (ssize_t)strlen(s));
+  close(fd);
+}
+
+/**
+ * Reads every target left into `out`, names as they are and addresses
+ * formatted, separated by spaces.
+ */
+static int read_all(char *out, size_t size) {
+  struct tr_target target;
+  char s[INET6_ADDRSTRLEN];
+  int rv;
+
+  out[0] = '\0';
+  while ((rv = targets_next(&t, &target)) == 1) {
+    snprintf(out + strlen(out), size - strlen(out), "%s%s", out[0] ? " " : "",
+             target.name != NULL ? target.name
+                                 : addr_ntop(&target.addr, s, sizeof(s)));
+  }
+  return rv;
+}
+
+static void setup() {
+  file[0] = exfile[0] = '\0';
+  memset(&ex, 0, sizeof(ex));
+}
+
+static void teardown() {
+  targets_close(&t);
+  exclusions_free(&ex);
+  if (file[0] != '\0') {
+    unlink(file);
+  }
+  if (exfile[0] != '\0') {
+    unlink(exfile);
+  }
+}
+
+MU_TEST(test_targets_expand) {
+  char out[1024];
+
+  write_file(file, "/tmp/test_targets.XXXXXX",
+             "10.0.0.0/22\n"
+             "# a comment\n"
+             "\n"
+             "  192.0.2.7   # with a comment\n"
+             "example.com\n"
+             "192.0.2.0/31\n"
+             "2001:db8::/62");
+  mu_assert_int_eq(0, targets_open(&t, file, 24, 64, NULL, 0, 1));
+  mu_assert_int_eq(0, read_all(out, sizeof(out)));
+  mu_assert_string_eq("10.0.0.1 10.0.1.1 10.0.2.1 10.0.3.1 192.0.2.7 "
+                      "example.com 192.0.2.0 2001:db8::1 2001:db8:0:1::1 "
+                      "2001:db8:0:2::1 2001:db8:0:3::1",
+                      out);
+  mu_assert_int_eq(11, t.index);
+}
+
+MU_TEST(test_targets_whole_space) {
+  char out[256];
+
+  write_file(file, "/tmp/test_targets.XXXXXX", "0.0.0.0/0\n::/0\n");
+  mu_assert_int_eq(0, targets_open(&t, file, 1, 0, NULL, 0, 1));
+  mu_assert_int_eq(0, read_all(out, sizeof(out)));
+  mu_assert_string_eq("0.0.0.1 128.0.0.1 ::1", out);
+}
+
+MU_TEST(test_targets_exclusions) {
+  char out[1024], s[INET6_ADDRSTRLEN];
+  tr_uint128 v;
+  struct tr_addr addr;
+  struct tr_target target;
+
+  write_file(exfile, "/tmp/test_targets_ex.XXXXXX",
+             "10.0.2.0/23\n"
+             "10.0.1.0/24\n"
+             "# comment\n"
+             "192.0.2.7\n"
+             "172.16.0.0/13\n");
+  mu_assert_int_eq(0, exclusions_load(&ex, exfile));
+  // 10.0.1.0/24 and 10.0.2.0/23 are adjacent, so merged.
+  mu_assert_int_eq(3, ex.n);
+  addr_pton(&addr, "10.0.1.255");
+  v = addr_to_uint128(&addr);
+  mu_check(exclusions_find(&ex, v) == &ex.intervals[0]);
+  mu_check(exclusions_find(&ex, v + 0x201) == NULL);
+  mu_check(exclusions_find(&ex, v - 0x200) == NULL);
+
+  write_file(file, "/tmp/test_targets.XXXXXX",
+             "10.0.0.0/22\n192.0.2.7\n192.0.2.8\n172.16.0.0/12\n");
+  mu_assert_int_eq(0, targets_open(&t, file, 24, 64, &ex, 0, 1));
+  mu_assert_int_eq(1, targets_next(&t, &target));
+  mu_assert_string_eq("10.0.0.1", addr_ntop(&target.addr, s, sizeof(s)));
+  mu_assert_int_eq(1, targets_next(&t, &target));
+  mu_assert_string_eq("192.0.2.8", addr_ntop(&target.addr, s, sizeof(s)));
+  // The excluded half of the /12 is skipped in one step.
+  mu_assert_int_eq(1, targets_next(&t, &target));
+  mu_assert_string_eq("172.24.0.1", addr_ntop(&target.addr, s, sizeof(s)));
+  mu_assert_int_eq(0, read_all(out, sizeof(out)));
+  mu_assert_int_eq(2 + (1 << 11), t.index);
+
+  addr_pton(&addr, "192.0.2.7");
+  mu_check(targets_excluded(&t, &addr));
+  addr_pton(&addr, "2001:db8::1");
+  mu_check(!targets_excluded(&t, &addr));
+}
+
+MU_TEST(test_targets_shards) {
+  int shard, n = 0;
+  char out[1024], all[1024] = "";
+
+  write_file(file, "/tmp/test_targets.XXXXXX", "10.0.0.0/29\nexample.com\n");
+  for (shard = 0; shard < 3; shard++) {
+    mu_assert_int_eq(0, targets_open(&t, file, 32, 64, NULL, shard, 3));
+    mu_assert_int_eq(0, read_all(out, sizeof(out)));
+    if (shard == 1) {
+      mu_assert_string_eq("10.0.0.1 10.0.0.4 10.0.0.7", out);
+    }
+    n += t.index;
+    strcat(all, out);
+    strcat(all, " ");
+    targets_close(&t);
+  }
+  // Every target is read by exactly one shard.
+  mu_assert_int_eq(27, n);
+  mu_check(strstr(all, "example.com") != NULL);
+  mu_check(strstr(strstr(all, "example.com") + 1, "example.com") == NULL);
+
+  mu_assert_int_eq(-1, targets_open(&t, file, 32, 64, NULL, 3, 3));
+  mu_assert_int_eq(EINVAL, errno);
+}
+
+MU_TEST(test_targets_malformed) {
+  char out[256];
+
+  write_file(file, "/tmp/test_targets.XXXXXX",
+             "192.0.2.1\n\n10.0.0.0/33\n192.0.2.2\n");
+  mu_assert_int_eq(0, targets_open(&t, file, 32, 64, NULL, 0, 1));
+  mu_assert_int_eq(-1, read_all(out, sizeof(out)));
+  mu_assert_int_eq(EINVAL, errno);
+  mu_assert_int_eq(3, t.line);
+  mu_assert_string_eq("192.0.2.1", out);
+  targets_close(&t);
+  unlink(file);
+
+  write_file(file, "/tmp/test_targets.XXXXXX", "");
+  mu_assert_int_eq(0, targets_open(&t, file, 32, 64, NULL, 0, 1));
+  mu_assert_int_eq(0, read_all(out, sizeof(out)));
+  mu_assert_string_eq("", out);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+
+  MU_RUN_TEST(test_targets_expand);
+  MU_RUN_TEST(test_targets_whole_space);
+  MU_RUN_TEST(test_targets_exclusions);
+  MU_RUN_TEST(test_targets_shards);
+  MU_RUN_TEST(test_targets_malformed);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
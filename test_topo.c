@@ -0,0 +1,193 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "minunit.h"
+#include "topo.h"
+
+static struct tr_topo topo;
+
+static struct tr_addr addr(uint32_t a) {
+  struct tr_addr addr;
+  struct in_addr in;
+  in.s_addr = htonl(a);
+  addr_set(&addr, AF_INET, &in);
+  return addr;
+}
+
+static void setup() { topo_init(&topo); }
+
+static void teardown() { topo_free(&topo); }
+
+MU_TEST(test_topo_intern) {
+  struct tr_addr a = addr(1), b = addr(2);
+  uint32_t id;
+
+  mu_assert_int_eq(0, topo_intern(&topo, &a, &id));
+  mu_assert_int_eq(0, id);
+  mu_assert_int_eq(0, topo_intern(&topo, &b, &id));
+  mu_assert_int_eq(1, id);
+  mu_assert_int_eq(0, topo_intern(&topo, &a, &id));
+  mu_assert_int_eq(0, id);
+  mu_assert_int_eq(2, topo.nnodes);
+}
+
+MU_TEST(test_topo_observe) {
+  struct tr_addr a = addr(1), b = addr(2), c = addr(3);
+  const struct topo_stats *s;
+
+  topo_observe(&topo, &a, &b, 100);
+  topo_observe(&topo, &a, &b, 300);
+  topo_observe(&topo, &b, &c, 500);
+  topo_observe(&topo, &a, &c, 700);
+  mu_assert_int_eq(0, topo_compact(&topo));
+
+  mu_assert_int_eq(3, topo.nedges);
+  mu_check((s = topo_edge(&topo, 0, 1)) != NULL);
+  mu_assert_int_eq(2, s->count);
+  mu_assert_int_eq(100, s->rtt_min_us);
+  mu_assert_int_eq(400, s->rtt_sum_us);
+  mu_check(topo_edge(&topo, 1, 0) == NULL);
+  mu_check(topo_edge(&topo, 0, 2) != NULL);
+
+  // Rows are sorted by destination.
+  mu_assert_int_eq(1, topo.col[topo.row[0]]);
+  mu_assert_int_eq(2, topo.col[topo.row[0] + 1]);
+}
+
+MU_TEST(test_topo_merge) {
+  struct tr_addr a = addr(1), b = addr(2), c = addr(3), d = addr(4);
+  const struct topo_stats *s;
+
+  topo_observe(&topo, &a, &c, 10);
+  topo_observe(&topo, &b, &c, 10);
+  topo_compact(&topo);
+
+  topo_observe(&topo, &a, &b, 20);
+  topo_observe(&topo, &a, &c, 5);
+  topo_observe(&topo, &d, &a, 30);
+  topo_compact(&topo);
+
+  mu_assert_int_eq(4, topo.nedges);
+  mu_check((s = topo_edge(&topo, 0, 1)) != NULL);
+  mu_assert_int_eq(2, s->count);
+  mu_assert_int_eq(5, s->rtt_min_us);
+  mu_check(topo_edge(&topo, 0, 2) != NULL);
+  mu_check(topo_edge(&topo, 2, 1) != NULL);
+  mu_check(topo_edge(&topo, 3, 0) != NULL);
+}
+
+MU_TEST(test_topo_auto_compact) {
+  struct tr_addr a, b;
+  uint32_t i, missing = 0;
+
+  for (i = 0; i < TOPO_STAGED_MAX + 10; i++) {
+    a = addr(i);
+    b = addr(i + 1);
+    topo_observe(&topo, &a, &b, i);
+  }
+  mu_check(topo.nstaged < TOPO_STAGED_MAX);
+  topo_compact(&topo);
+  mu_assert_int_eq(TOPO_STAGED_MAX + 10, topo.nedges);
+  for (i = 0; i < TOPO_STAGED_MAX + 10; i++) {
+    missing += topo_edge(&topo, i, i + 1) == NULL;
+  }
+  mu_assert_int_eq(0, missing);
+}
+
+MU_TEST(test_topo_save_load) {
+  char file[] = "/tmp/test_topoXXXXXX";
+  struct tr_addr a = addr(1), b = addr(2), c = addr(3);
+  struct tr_topo loaded;
+  uint32_t id;
+
+  close(mkstemp(file));
+  topo_observe(&topo, &a, &b, 100);
+  topo_observe(&topo, &b, &c, 200);
+  mu_assert_int_eq(0, topo_save(&topo, file));
+
+  topo_init(&loaded);
+  mu_assert_int_eq(0, topo_load(&loaded, file));
+  mu_assert_int_eq(3, loaded.nnodes);
+  mu_assert_int_eq(2, loaded.nedges);
+  mu_assert_int_eq(200, topo_edge(&loaded, 1, 2)->rtt_sum_us);
+
+  // Further observations merge into the loaded graph.
+  topo_intern(&loaded, &c, &id);
+  mu_assert_int_eq(2, id);
+  topo_observe(&loaded, &a, &b, 50);
+  topo_compact(&loaded);
+  mu_assert_int_eq(2, topo_edge(&loaded, 0, 1)->count);
+
+  topo_free(&loaded);
+  unlink(file);
+}
+
+/**
+ * Overwrites the 32-bit word at `off` in `file` with `v`.
+ */
+static void corrupt(const char *file, long off, uint32_t v) {
+  FILE *f = fopen(file, "r+");
+  fseek(f, off, SEEK_SET);
+  fwrite(&v, sizeof(v), 1, f);
+  fclose(f);
+}
+
+MU_TEST(test_topo_load_corrupt) {
+  char file[] = "/tmp/test_topoXXXXXX";
+  struct tr_addr a = addr(1), b = addr(2), c = addr(3);
+  struct tr_topo loaded;
+  // Past the magic, counts and 3 addresses: 4 row offsets, then 2 columns.
+  long row = 16 + 3 * sizeof(struct tr_addr), col = row + 4 * sizeof(uint32_t);
+
+  close(mkstemp(file));
+  topo_observe(&topo, &a, &b, 100);
+  topo_observe(&topo, &b, &c, 200);
+  mu_assert_int_eq(0, topo_save(&topo, file));
+
+  // A column that is not a node.
+  corrupt(file, col, 3);
+  topo_init(&loaded);
+  mu_assert_int_eq(-1, topo_load(&loaded, file));
+  mu_assert_int_eq(EINVAL, errno);
+  topo_free(&loaded);
+  corrupt(file, col, 1);
+
+  // Rows that go back, or do not end at the last edge.
+  corrupt(file, row + 2 * sizeof(uint32_t), 0);
+  topo_init(&loaded);
+  mu_assert_int_eq(-1, topo_load(&loaded, file));
+  topo_free(&loaded);
+  corrupt(file, row + 2 * sizeof(uint32_t), 2);
+  corrupt(file, row + 3 * sizeof(uint32_t), 5);
+  topo_init(&loaded);
+  mu_assert_int_eq(-1, topo_load(&loaded, file));
+  topo_free(&loaded);
+  corrupt(file, row + 3 * sizeof(uint32_t), 2);
+
+  topo_init(&loaded);
+  mu_assert_int_eq(0, topo_load(&loaded, file));
+  mu_assert_int_eq(200, topo_edge(&loaded, 1, 2)->rtt_sum_us);
+  topo_free(&loaded);
+  unlink(file);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(&setup, &teardown);
+  MU_RUN_TEST(test_topo_intern);
+  MU_RUN_TEST(test_topo_observe);
+  MU_RUN_TEST(test_topo_merge);
+  MU_RUN_TEST(test_topo_auto_compact);
+  MU_RUN_TEST(test_topo_save_load);
+  MU_RUN_TEST(test_topo_load_corrupt);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -168,6 +168,21 @@ MU_TEST(test_socket_utils) {
   // TODO: Test socket utils (socklen, get_in_addr, sock_set_port).
 }
 
+MU_TEST(test_siphash24) {
+  // Reference vectors from the SipHash paper (key 00..0f, input 00..n-1).
+  uint8_t key[16], in[15];
+  int i;
+  for (i = 0; i < 16; i++) {
+    key[i] = i;
+  }
+  for (i = 0; i < 15; i++) {
+    in[i] = i;
+  }
+  mu_check(siphash24(key, in, 0) == 0x726fdb47dd0e0e31ULL);
+  mu_check(siphash24(key, in, 15) == 0xa129ca6149be45e5ULL);
+  mu_check(siphash24(key, in, 8) == 0x93f5f5799a932462ULL);
+}
+
 MU_TEST_SUITE(test_suite) {
   MU_RUN_TEST(test_timespec_cmp);
   MU_RUN_TEST(test_timespec_ge);
@@ -179,6 +194,7 @@ MU_TEST_SUITE(test_suite) {
   MU_RUN_TEST(test_timespec_diff_safe_update_minuend);
   MU_RUN_TEST(test_timespec_diff_safe_update_subtrahend);
   MU_RUN_TEST(test_timespec_now_dumb);
+  MU_RUN_TEST(test_siphash24);
 }
 
 int main() {
@@ -0,0 +1,253 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "work.h"
+
+static struct tr_work w;
+
+static void teardown() { work_free(&w); }
+
+MU_TEST(test_work_assign) {
+  struct tr_range r;
+  int a, b, victim;
+  uint64_t mid;
+
+  work_init(&w, 25, 10);
+  a = work_join(&w);
+  b = work_join(&w);
+  mu_assert_int_eq(0, a);
+  mu_assert_int_eq(1, b);
+
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(0, r.first);
+  mu_assert_int_eq(10, r.end);
+  // Only idle workers are handed anything.
+  mu_assert_int_eq(WORK_WAIT, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, b, &r, &victim, &mid));
+  mu_assert_int_eq(10, r.first);
+  mu_assert_int_eq(20, r.end);
+
+  work_done(&w, a);
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(20, r.first);
+  mu_assert_int_eq(25, r.end);
+
+  work_done(&w, a);
+  mu_assert_int_eq(0, work_finished(&w));
+  work_done(&w, b);
+  mu_assert_int_eq(1, work_finished(&w));
+  mu_assert_int_eq(WORK_FINISHED, work_next(&w, a, &r, &victim, &mid));
+}
+
+MU_TEST(test_work_leave) {
+  struct tr_range r;
+  int a, b, victim;
+  uint64_t mid;
+
+  work_init(&w, 20, 10);
+  a = work_join(&w);
+  b = work_join(&w);
+  work_next(&w, a, &r, &victim, &mid);
+  work_next(&w, b, &r, &victim, &mid);
+
+  // Targets reported traced are not handed out again.
+  mu_assert_int_eq(0, work_traced(&w, a, 3));
+  mu_assert_int_eq(-1, work_traced(&w, a, 1));
+  mu_assert_int_eq(-1, work_leave(&w, a));
+  work_done(&w, b);
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, b, &r, &victim, &mid));
+  mu_assert_int_eq(4, r.first);
+  mu_assert_int_eq(10, r.end);
+
+  // Its slot is taken by the next worker to join.
+  mu_assert_int_eq(a, work_join(&w));
+  mu_assert_int_eq(WORK_STEAL_FROM, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(b, victim);
+  mu_assert_int_eq(7, mid);
+
+  // A victim that leaves hands its range to its thief.
+  mu_assert_int_eq(a, work_leave(&w, b));
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(4, r.first);
+  mu_assert_int_eq(10, r.end);
+}
+
+MU_TEST(test_work_steal) {
+  struct tr_range r;
+  int a, b, c, victim;
+  uint64_t mid;
+
+  work_init(&w, 10, 10);
+  a = work_join(&w);
+  b = work_join(&w);
+  c = work_join(&w);
+  work_next(&w, a, &r, &victim, &mid);
+
+  work_traced(&w, a, 1);
+  mu_assert_int_eq(WORK_STEAL_FROM, work_next(&w, b, &r, &victim, &mid));
+  mu_assert_int_eq(a, victim);
+  mu_assert_int_eq(6, mid);
+  // One steal from a worker at a time.
+  mu_assert_int_eq(WORK_WAIT, work_next(&w, c, &r, &victim, &mid));
+
+  // The victim got further than asked before it heard.
+  work_traced(&w, a, 6);
+  mu_assert_int_eq(b, work_truncated(&w, a, 8, &r));
+  mu_assert_int_eq(8, r.first);
+  mu_assert_int_eq(10, r.end);
+  mu_assert_int_eq(WORKER_BUSY, w.workers[b].state);
+
+  // Nothing left worth stealing: only the target being traced.
+  work_traced(&w, b, 8);
+  work_traced(&w, a, 7);
+  work_done(&w, a);
+  mu_assert_int_eq(WORK_WAIT, work_next(&w, c, &r, &victim, &mid));
+  work_done(&w, b);
+  mu_assert_int_eq(WORK_FINISHED, work_next(&w, c, &r, &victim, &mid));
+}
+
+MU_TEST(test_work_steal_late) {
+  struct tr_range r;
+  int a, b, c, victim;
+  uint64_t mid;
+
+  work_init(&w, 10, 10);
+  a = work_join(&w);
+  b = work_join(&w);
+  c = work_join(&w);
+  work_next(&w, a, &r, &victim, &mid);
+  mu_assert_int_eq(WORK_STEAL_FROM, work_next(&w, b, &r, &victim, &mid));
+
+  // The victim finished its range before it heard.
+  work_done(&w, a);
+  mu_assert_int_eq(WORK_WAIT, work_next(&w, a, &r, &victim, &mid));
+  mu_assert_int_eq(b, work_truncated(&w, a, UINT64_MAX, &r));
+  mu_assert_int_eq(0, r.end - r.first);
+  mu_assert_int_eq(WORKER_IDLE, w.workers[b].state);
+  mu_assert_int_eq(WORK_FINISHED, work_next(&w, b, &r, &victim, &mid));
+
+  // A thief that left before its victim answered.
+  work_free(&w);
+  work_init(&w, 10, 10);
+  a = work_join(&w);
+  b = work_join(&w);
+  c = work_join(&w);
+  work_next(&w, a, &r, &victim, &mid);
+  work_next(&w, b, &r, &victim, &mid);
+  mu_assert_int_eq(-1, work_leave(&w, b));
+  mu_assert_int_eq(WORK_WAIT, work_next(&w, c, &r, &victim, &mid));
+  mu_assert_int_eq(-1, work_truncated(&w, a, 5, &r));
+  mu_assert_int_eq(WORK_ASSIGN, work_next(&w, c, &r, &victim, &mid));
+  mu_assert_int_eq(5, r.first);
+  mu_assert_int_eq(10, r.end);
+}
+
+MU_TEST(test_work_pack) {
+  uint8_t buf[3 * WORK_RECORD_MAX];
+  struct archive_record in[3], out;
+  size_t len = 0, n, off;
+  int i;
+
+  memset(in, 0, sizeof(in));
+  in[0].time_us = 1700000000123456;
+  in[0].target.family = AF_INET;
+  inet_pton(AF_INET, "10.2.0.2", &in[0].target.u.v4);
+  in[0].responder.family = AF_INET;
+  inet_pton(AF_INET, "10.1.0.2", &in[0].responder.u.v4);
+  in[0].rtt_us = 1234;
+  in[0].ttl = 1;
+  in[0].icmp_type = 11;
+  in[1].target.family = AF_INET6;
+  inet_pton(AF_INET6, "fd02::2", &in[1].target.u.v6);
+  in[1].responder.family = AF_INET6;
+  inet_pton(AF_INET6, "fd02::2", &in[1].responder.u.v6);
+  in[1].ttl = 2;
+  in[1].icmp_type = 1;
+  in[1].icmp_code = 4;
+  // A probe that timed out has no responder.
+  in[2] = in[0];
+  memset(&in[2].responder, 0, sizeof(in[2].responder));
+  in[2].ttl = 3;
+
+  for (i = 0; i < 3; i++) {
+    n = work_pack(buf + len, &in[i]);
+    mu_check(n <= WORK_RECORD_MAX);
+    len += n;
+  }
+  for (i = 0, off = 0; i < 3; i++) {
+    n = work_unpack(buf + off, len - off, &out);
+    mu_check(n > 0);
+    off += n;
+    mu_check(memcmp(&in[i], &out, sizeof(out)) == 0);
+  }
+  mu_assert_int_eq(len, off);
+
+  // Cut short anywhere, or with an unknown family.
+  len = work_pack(buf, &in[1]);
+  for (n = 0; n < len; n++) {
+    mu_assert_int_eq(0, work_unpack(buf, n, &out));
+  }
+  buf[8] = 5;
+  mu_assert_int_eq(0, work_unpack(buf, sizeof(buf), &out));
+}
+
+MU_TEST(test_work_messages) {
+  int fd[2];
+  char body[8];
+  struct work_header h;
+
+  mu_check(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+  mu_assert_int_eq(0, work_send(fd[0], WORK_HELLO, "abcdef", 6));
+  mu_assert_int_eq(0, work_send(fd[0], WORK_DONE, NULL, 0));
+  mu_assert_int_eq(0, work_send(fd[0], WORK_RESULTS, "123456789", 9));
+
+  mu_assert_int_eq(0, work_recv(fd[1], &h, body, sizeof(body)));
+  mu_assert_int_eq(WORK_HELLO, h.type);
+  mu_assert_int_eq(6, h.len);
+  mu_check(memcmp(body, "abcdef", 6) == 0);
+  mu_assert_int_eq(0, work_recv(fd[1], &h, body, sizeof(body)));
+  mu_assert_int_eq(WORK_DONE, h.type);
+  mu_assert_int_eq(0, h.len);
+  mu_assert_int_eq(-1, work_recv(fd[1], &h, body, sizeof(body)));
+  mu_assert_int_eq(EMSGSIZE, errno);
+  close(fd[0]);
+  close(fd[1]);
+}
+
+MU_TEST(test_work_eof) {
+  int fd[2];
+  char body[8];
+  struct work_header h;
+
+  mu_check(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+  close(fd[0]);
+  mu_assert_int_eq(-1, work_recv(fd[1], &h, body, sizeof(body)));
+  mu_assert_int_eq(ECONNRESET, errno);
+  // Without a SIGPIPE for the other way around.
+  mu_assert_int_eq(-1, work_send(fd[1], WORK_DONE, NULL, 0));
+  mu_assert_int_eq(EPIPE, errno);
+  close(fd[1]);
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_work_assign);
+  MU_RUN_TEST(test_work_leave);
+  MU_RUN_TEST(test_work_steal);
+  MU_RUN_TEST(test_work_steal_late);
+  MU_RUN_TEST(test_work_pack);
+  MU_RUN_TEST(test_work_messages);
+  MU_RUN_TEST(test_work_eof);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
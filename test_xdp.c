@@ -0,0 +1,106 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "xdp.h"
+
+static char file[] = "/tmp/test_xdp.XXXXXX";
+
+static void write_file(const char *s) {
+  int fd;
+
+  strcpy(file, "/tmp/test_xdp.XXXXXX");
+  fd = mkstemp(file);
+  mu_check(write(fd, s, strlen(s)) == (ssize_t)strlen(s));
+  close(fd);
+}
+
+static void teardown() { unlink(file); }
+
+MU_TEST(test_xdp_route) {
+  char ifname[IF_NAMESIZE];
+  struct in_addr dst, hop;
+
+  // Addresses and masks as the kernel prints them, in network byte order.
+  write_file("Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask"
+             "\t\tMTU\tWindow\tIRTT\n"
+             "eth0\t00000000\t010200C0\t0003\t0\t0\t0\t00000000\t0\t0\t0\n"
+             "va\t0000010A\t00000000\t0001\t0\t0\t0\t00FFFFFF\t0\t0\t0\n"
+             "vb\t0000020A\t0200010A\t0003\t0\t0\t10\t00FFFFFF\t0\t0\t0\n"
+             "vc\t0000020A\t0300010A\t0003\t0\t0\t5\t00FFFFFF\t0\t0\t0\n"
+             "vd\t0000000A\t00000000\t0000\t0\t0\t0\t00FFFFFF\t0\t0\t0\n");
+
+  // A directly connected destination is its own next hop.
+  inet_pton(AF_INET, "10.1.0.9", &dst);
+  mu_assert_int_eq(0, xdp_route(file, &dst, ifname, &hop));
+  mu_assert_string_eq("va", ifname);
+  mu_check(hop.s_addr == dst.s_addr);
+
+  // The most specific route wins, then the lowest metric.
+  inet_pton(AF_INET, "10.2.0.2", &dst);
+  mu_assert_int_eq(0, xdp_route(file, &dst, ifname, &hop));
+  mu_assert_string_eq("vc", ifname);
+  mu_assert_string_eq("10.1.0.3", inet_ntoa(hop));
+
+  inet_pton(AF_INET, "198.51.100.1", &dst);
+  mu_assert_int_eq(0, xdp_route(file, &dst, ifname, &hop));
+  mu_assert_string_eq("eth0", ifname);
+  mu_assert_string_eq("192.0.2.1", inet_ntoa(hop));
+}
+
+MU_TEST(test_xdp_route_unreachable) {
+  char ifname[IF_NAMESIZE];
+  struct in_addr dst, hop;
+
+  // Routes that are down do not count.
+  write_file("Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask"
+             "\t\tMTU\tWindow\tIRTT\n"
+             "va\t0000010A\t00000000\t0000\t0\t0\t0\t00FFFFFF\t0\t0\t0\n");
+  inet_pton(AF_INET, "10.1.0.9", &dst);
+  mu_assert_int_eq(-1, xdp_route(file, &dst, ifname, &hop));
+  mu_assert_int_eq(ENETUNREACH, errno);
+}
+
+MU_TEST(test_xdp_neighbor) {
+  uint8_t mac[6];
+  const uint8_t want[6] = {0xfa, 0x38, 0x8d, 0xf5, 0x07, 0xec};
+  struct in_addr addr;
+
+  write_file("IP address       HW type     Flags       HW address            "
+             "Mask     Device\n"
+             "10.1.0.2         0x1         0x2         fa:38:8d:f5:07:ec     "
+             "*        va\n"
+             "10.1.0.3         0x1         0x0         00:00:00:00:00:00     "
+             "*        va\n"
+             "192.0.2.1        0x1         0x2         02:fc:00:00:00:05     "
+             "*        eth0\n");
+
+  inet_pton(AF_INET, "10.1.0.2", &addr);
+  mu_assert_int_eq(0, xdp_neighbor(file, "va", &addr, mac));
+  mu_check(memcmp(mac, want, sizeof(want)) == 0);
+
+  // On another interface, or still being resolved.
+  mu_assert_int_eq(-1, xdp_neighbor(file, "eth0", &addr, mac));
+  mu_assert_int_eq(ENOENT, errno);
+  inet_pton(AF_INET, "10.1.0.3", &addr);
+  mu_assert_int_eq(-1, xdp_neighbor(file, "va", &addr, mac));
+}
+
+MU_TEST_SUITE(test_suite) {
+  MU_SUITE_CONFIGURE(NULL, &teardown);
+
+  MU_RUN_TEST(test_xdp_route);
+  MU_RUN_TEST(test_xdp_route_unreachable);
+  MU_RUN_TEST(test_xdp_neighbor);
+}
+
+int main() {
+  MU_RUN_SUITE(test_suite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,342 @@
+/**
+ * Aggregation of traces into a router-level topology graph.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addr.h"
+#include "topo.h"
+#include "utils.h"
+
+#define TOPO_STAGED_SLOTS (2 * TOPO_STAGED_MAX)
+
+void topo_init(struct tr_topo *topo) { memset(topo, 0, sizeof(*topo)); }
+
+static int topo_grow_ids(struct tr_topo *topo) {
+  uint32_t i, j, cap = topo->ids_cap ? topo->ids_cap * 2 : 1024;
+  uint32_t *ids;
+
+  if ((ids = calloc(cap, sizeof(*ids))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < topo->nnodes; i++) {
+    j = addr_hash(&topo->nodes[i]) & (cap - 1);
+    while (ids[j] != 0) {
+      j = (j + 1) & (cap - 1);
+    }
+    ids[j] = i + 1;
+  }
+  free(topo->ids);
+  topo->ids = ids;
+  topo->ids_cap = cap;
+  return 0;
+}
+
+/**
+ * Looks up the dense id of `addr`, assigning the next one if it is new.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int topo_intern(struct tr_topo *topo, const struct tr_addr *addr,
+                uint32_t *id) {
+  uint32_t j;
+  struct tr_addr *nodes;
+
+  if ((topo->nnodes + 1) * 2 > topo->ids_cap && topo_grow_ids(topo) == -1) {
+    return -1;
+  }
+
+  j = addr_hash(addr) & (topo->ids_cap - 1);
+  while (topo->ids[j] != 0) {
+    if (addr_eq(&topo->nodes[topo->ids[j] - 1], addr)) {
+      *id = topo->ids[j] - 1;
+      return 0;
+    }
+    j = (j + 1) & (topo->ids_cap - 1);
+  }
+
+  if (topo->nnodes == topo->nodes_cap) {
+    topo->nodes_cap = topo->nodes_cap ? topo->nodes_cap * 2 : 1024;
+    if ((nodes = realloc(topo->nodes,
+                         topo->nodes_cap * sizeof(*nodes))) == NULL) {
+      return -1;
+    }
+    topo->nodes = nodes;
+  }
+  topo->nodes[topo->nnodes] = *addr;
+  topo->ids[j] = ++topo->nnodes;
+  *id = topo->nnodes - 1;
+  return 0;
+}
+
+static void stats_add(struct topo_stats *into, const struct topo_stats *s) {
+  if (into->count == 0 || s->rtt_min_us < into->rtt_min_us) {
+    into->rtt_min_us = s->rtt_min_us;
+  }
+  into->count += s->count;
+  into->rtt_sum_us += s->rtt_sum_us;
+}
+
+/**
+ * Records that `to` responded one hop after `from`,
+ * `rtt_us` microseconds after its probe was sent.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int topo_observe(struct tr_topo *topo, const struct tr_addr *from,
+                 const struct tr_addr *to, uint32_t rtt_us) {
+  uint32_t u, v, j;
+  uint64_t key;
+  struct topo_stats s;
+
+  if (topo_intern(topo, from, &u) == -1 || topo_intern(topo, to, &v) == -1) {
+    return -1;
+  }
+  if (topo->staged == NULL &&
+      (topo->staged = calloc(TOPO_STAGED_SLOTS, sizeof(*topo->staged))) ==
+          NULL) {
+    return -1;
+  }
+
+  key = (uint64_t)u << 32 | v;
+  j = (uint32_t)(key * 0x9e3779b97f4a7c15ULL >> 32) & (TOPO_STAGED_SLOTS - 1);
+  while (topo->staged[j].stats.count != 0 && topo->staged[j].key != key) {
+    j = (j + 1) & (TOPO_STAGED_SLOTS - 1);
+  }
+  if (topo->staged[j].stats.count == 0) {
+    topo->staged[j].key = key;
+    topo->nstaged++;
+  }
+  s.count = 1;
+  s.rtt_min_us = rtt_us;
+  s.rtt_sum_us = rtt_us;
+  stats_add(&topo->staged[j].stats, &s);
+
+  if (topo->nstaged >= TOPO_STAGED_MAX) {
+    return topo_compact(topo);
+  }
+  return 0;
+}
+
+static int staged_cmp(const void *x, const void *y) {
+  const struct topo_staged *a = x, *b = y;
+  return a->key < b->key ? -1 : a->key > b->key;
+}
+
+/**
+ * Merges the staged edges into the CSR graph.
+ * Both are sorted by (from, to), so this is a single linear merge.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int topo_compact(struct tr_topo *topo) {
+  uint32_t i, j, n, u, k = 0, e, end, v;
+  uint32_t *row = NULL, *col = NULL;
+  struct topo_stats *stats = NULL;
+  struct topo_staged *staged;
+
+  if (topo->nstaged == 0 && topo->nrows == topo->nnodes) {
+    return 0;
+  }
+
+  n = topo->nstaged;
+  if ((row = malloc((topo->nnodes + 1) * sizeof(*row))) == NULL ||
+      (col = malloc((topo->nedges + n + 1) * sizeof(*col))) == NULL ||
+      (stats = malloc((topo->nedges + n + 1) * sizeof(*stats))) == NULL) {
+    free(row);
+    free(col);
+    return -1;
+  }
+
+  // Pack the staged edges at the front of their table and sort them.
+  staged = topo->staged;
+  for (i = 0, n = 0; staged != NULL && i < TOPO_STAGED_SLOTS; i++) {
+    if (staged[i].stats.count != 0) {
+      staged[n++] = staged[i];
+    }
+  }
+  qsort(staged, n, sizeof(*staged), staged_cmp);
+
+  for (u = 0, j = 0; u < topo->nnodes; u++) {
+    row[u] = k;
+    e = u < topo->nrows ? topo->row[u] : 0;
+    end = u < topo->nrows ? topo->row[u + 1] : 0;
+    while (e < end || (j < n && staged[j].key >> 32 == u)) {
+      v = j < n && staged[j].key >> 32 == u ? (uint32_t)staged[j].key
+                                            : UINT32_MAX;
+      if (e < end && topo->col[e] <= v) {
+        col[k] = topo->col[e];
+        stats[k] = topo->stats[e++];
+        if (col[k] == v) {
+          stats_add(&stats[k], &staged[j++].stats);
+        }
+      } else {
+        col[k] = v;
+        stats[k] = staged[j++].stats;
+      }
+      k++;
+    }
+  }
+  row[topo->nnodes] = k;
+
+  free(topo->row);
+  free(topo->col);
+  free(topo->stats);
+  topo->row = row;
+  topo->col = col;
+  topo->stats = stats;
+  topo->nrows = topo->nnodes;
+  topo->nedges = k;
+
+  if (staged != NULL) {
+    memset(staged, 0, TOPO_STAGED_SLOTS * sizeof(*staged));
+  }
+  topo->nstaged = 0;
+  return 0;
+}
+
+/**
+ * Finds the edge from `from` to `to` in the compacted graph.
+ *
+ * Returns NULL if there is no such edge.
+ */
+const struct topo_stats *topo_edge(const struct tr_topo *topo, uint32_t from,
+                                   uint32_t to) {
+  uint32_t lo, hi, mid;
+
+  if (from >= topo->nrows) {
+    return NULL;
+  }
+  lo = topo->row[from];
+  hi = topo->row[from + 1];
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (topo->col[mid] < to) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < topo->row[from + 1] && topo->col[lo] == to ? &topo->stats[lo]
+                                                         : NULL;
+}
+
+/**
+ * Writes the graph to `file`:
+ *    magic, nnodes, nedges, nodes, row, col, stats
+ * with integers in host byte order.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int topo_save(struct tr_topo *topo, const char *file) {
+  FILE *f;
+  char magic[8] = TOPO_MAGIC;
+  char tmp[PATH_MAX];
+  int ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  if (topo_compact(topo) == -1 || (f = fopen(tmp, "w")) == NULL) {
+    return -1;
+  }
+  ok = fwrite(magic, sizeof(magic), 1, f) == 1 &&
+       fwrite(&topo->nnodes, sizeof(topo->nnodes), 1, f) == 1 &&
+       fwrite(&topo->nedges, sizeof(topo->nedges), 1, f) == 1 &&
+       fwrite(topo->nodes, sizeof(*topo->nodes), topo->nnodes, f) ==
+           topo->nnodes &&
+       (topo->nnodes == 0 ||
+        fwrite(topo->row, sizeof(*topo->row), topo->nnodes + 1, f) ==
+            topo->nnodes + 1) &&
+       fwrite(topo->col, sizeof(*topo->col), topo->nedges, f) ==
+           topo->nedges &&
+       fwrite(topo->stats, sizeof(*topo->stats), topo->nedges, f) ==
+           topo->nedges;
+  if (fclose(f) == EOF || !ok) {
+    return -1;
+  }
+  return rename(tmp, file);
+}
+
+/**
+ * Returns whether the rows and columns read into `topo` make a graph of
+ * its nodes: offsets into the columns that start at 0, never go back and
+ * end at the last edge, and columns that are all nodes.
+ */
+static int topo_check(const struct tr_topo *topo) {
+  uint32_t i;
+
+  if (topo->row[0] != 0 || topo->row[topo->nrows] != topo->nedges) {
+    return 0;
+  }
+  for (i = 0; i < topo->nrows; i++) {
+    if (topo->row[i] > topo->row[i + 1]) {
+      return 0;
+    }
+  }
+  for (i = 0; i < topo->nedges; i++) {
+    if (topo->col[i] >= topo->nrows) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Reads a graph written by topo_save() into an initialized, empty `topo`,
+ * so that more traces can be merged into it.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int topo_load(struct tr_topo *topo, const char *file) {
+  FILE *f;
+  char magic[8];
+  uint32_t i, id, nnodes, nedges;
+  struct tr_addr addr;
+  int ok;
+
+  if ((f = fopen(file, "r")) == NULL) {
+    return -1;
+  }
+  ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+       memcmp(magic, TOPO_MAGIC, sizeof(magic)) == 0 &&
+       fread(&nnodes, sizeof(nnodes), 1, f) == 1 &&
+       fread(&nedges, sizeof(nedges), 1, f) == 1;
+
+  for (i = 0; ok && i < nnodes; i++) {
+    ok = fread(&addr, sizeof(addr), 1, f) == 1 &&
+         topo_intern(topo, &addr, &id) == 0 && id == i;
+  }
+  if (ok && nnodes > 0) {
+    ok = (topo->row = malloc((nnodes + 1) * sizeof(*topo->row))) != NULL &&
+         (topo->col = malloc((nedges + 1) * sizeof(*topo->col))) != NULL &&
+         (topo->stats = malloc((nedges + 1) * sizeof(*topo->stats))) != NULL &&
+         fread(topo->row, sizeof(*topo->row), nnodes + 1, f) == nnodes + 1 &&
+         fread(topo->col, sizeof(*topo->col), nedges, f) == nedges &&
+         fread(topo->stats, sizeof(*topo->stats), nedges, f) == nedges;
+    topo->nrows = nnodes;
+    topo->nedges = nedges;
+    ok = ok && topo_check(topo);
+  } else if (ok) {
+    ok = nedges == 0;
+  }
+  fclose(f);
+  if (!ok) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void topo_free(struct tr_topo *topo) {
+  free(topo->nodes);
+  free(topo->ids);
+  free(topo->row);
+  free(topo->col);
+  free(topo->stats);
+  free(topo->staged);
+  topo_init(topo);
+}
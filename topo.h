@@ -0,0 +1,63 @@
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <stdint.h>
+
+#include "addr.h"
+
+#define TOPO_MAGIC "TRTOPO1"
+
+// Staged edges are merged into the CSR graph once there are this many.
+#define TOPO_STAGED_MAX (1 << 16)
+
+struct topo_stats {
+  uint32_t count;
+  uint32_t rtt_min_us;
+  uint64_t rtt_sum_us;
+};
+
+struct topo_staged {
+  uint64_t key; // from << 32 | to
+  struct topo_stats stats;
+};
+
+/**
+ * A router-level graph aggregated from many traces.
+ *
+ * Responder addresses are interned into dense node ids. New (hop, next hop)
+ * observations are accumulated in a small hash table of staged edges,
+ * which is periodically merged into a compressed sparse row graph:
+ * the edges leaving node u are col[row[u]] to col[row[u + 1] - 1],
+ * sorted by destination. Memory follows the number of unique nodes
+ * and edges, not the number of probes.
+ */
+struct tr_topo {
+  struct tr_addr *nodes;
+  uint32_t nnodes;
+  uint32_t nodes_cap;
+  uint32_t *ids; // Hash slots holding node id + 1, or 0 when empty.
+  uint32_t ids_cap;
+
+  uint32_t *row;
+  uint32_t *col;
+  struct topo_stats *stats;
+  uint32_t nrows; // Nodes covered by row; later nodes have no edges yet.
+  uint32_t nedges;
+
+  struct topo_staged *staged;
+  uint32_t nstaged;
+};
+
+void topo_init(struct tr_topo *topo);
+int topo_intern(struct tr_topo *topo, const struct tr_addr *addr,
+                uint32_t *id);
+int topo_observe(struct tr_topo *topo, const struct tr_addr *from,
+                 const struct tr_addr *to, uint32_t rtt_us);
+int topo_compact(struct tr_topo *topo);
+const struct topo_stats *topo_edge(const struct tr_topo *topo, uint32_t from,
+                                   uint32_t to);
+int topo_save(struct tr_topo *topo, const char *file);
+int topo_load(struct tr_topo *topo, const char *file);
+void topo_free(struct tr_topo *topo);
+
+#endif
@@ -12,74 +12,327 @@
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <ifaddrs.h>
+#include <limits.h>
+#include <net/if.h>
 #include <netdb.h>
+#include <netinet/icmp6.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "archive.h"
+#include "capture.h"
+#include "checkpoint.h"
+#include "distance.h"
+#include "lpm.h"
+#include "pathcache.h"
+#include "permute.h"
+#include "pmtu.h"
+#include "probe.h"
+#include "ratelimit.h"
+#include "resolver.h"
+#include "ring.h"
+#include "schedule.h"
+#include "stateless.h"
+#include "targets.h"
+#include "topo.h"
 #include "traceroute.h"
 #include "utils.h"
+#include "work.h"
+#include "xdp.h"
 
-static int assess_icmp_message4(const struct tr_opts *opts, u_short seq);
-static int receive_icmp_message(struct timespec *timeout);
-static int get_probe_response4(const struct tr_opts *opts, u_short seq);
-static void send_probe4(int ttl, u_short seq, const struct tr_opts *opts);
-static void recv_socket4();
-static void send_socket4(u_short *sport, const struct tr_opts *opts);
-
-static struct tr_send {
+struct tr_send {
   int fd;
   struct addrinfo *ai;
-} tr_send;
+};
 
-static struct tr_recv {
+struct tr_recv {
   int fd;
   int bytes;
-  char buf[MAXDATASIZE4];
-  struct addrinfo *ai;
-} tr_recv;
+  char buf[MAXDATASIZE];
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct timespec received;
+  u_char type, code; // ICMP type and code of a reply to one of our probes.
+  int mtu; // Next-hop MTU reported by a fragmentation needed reply, or 0.
+  int hlim; // Hop limit an ICMPv6 message arrived with, or -1 if not known.
+  struct tr_xdp *xdp; // Replies are read from this instead, if not NULL.
+};
+
+/**
+ * The parts of a reply that quote our probe back to us.
+ */
+struct tr_reply {
+  u_short seq;
+  const void *ip;
+  const struct udphdr *udp;
+  int len; // Quoted bytes following the UDP header.
+};
+
+/**
+ * The address family specific parts of the probing engine.
+ * Everything else (probe table, scheduling, output) is shared.
+ */
+struct tr_proto {
+  int family;
+  struct tr_send *send;
+  struct tr_recv *recv;
+  void (*recv_socket)(void);
+  void (*send_socket)(const struct tr_opts *opts);
+  void (*send_probe)(int ttl, u_short seq, int len,
+                     const struct tr_opts *opts);
+  int (*assess)(const struct tr_opts *opts, struct tr_reply *reply);
+  void (*stateless_socket)(const struct sockaddr *dst);
+  void (*send_stateless)(const struct sockaddr *dst, int ttl,
+                         const struct tr_opts *opts);
+  int (*decode_stateless)(const struct tr_opts *opts,
+                          const struct tr_reply *reply, struct tr_stamp *stamp);
+};
+
+static int assess_icmp_message4(const struct tr_opts *opts,
+                                struct tr_reply *reply);
+static int assess_icmp_message6(const struct tr_opts *opts,
+                                struct tr_reply *reply);
+static int try_receive(struct tr_recv *recv);
+static int receive_icmp_message(struct tr_recv *recv,
+                                struct timespec *timeout);
+static int get_probe_response(const struct tr_proto *proto,
+                              const struct tr_opts *opts, u_short seq,
+                              struct timespec *rtt);
+static void send_probe4(int ttl, u_short seq, int len,
+                        const struct tr_opts *opts);
+static void send_probe6(int ttl, u_short seq, int len,
+                        const struct tr_opts *opts);
+static void send_stateless4(const struct sockaddr *dst, int ttl,
+                            const struct tr_opts *opts);
+static void send_stateless6(const struct sockaddr *dst, int ttl,
+                            const struct tr_opts *opts);
+static int decode_stateless4(const struct tr_opts *opts,
+                             const struct tr_reply *reply,
+                             struct tr_stamp *stamp);
+static int decode_stateless6(const struct tr_opts *opts,
+                             const struct tr_reply *reply,
+                             struct tr_stamp *stamp);
+static void stateless_socket4(const struct sockaddr *dst);
+static void stateless_socket_xdp4(const struct sockaddr *dst);
+static void send_stateless_xdp4(const struct sockaddr *dst, int ttl,
+                                const struct tr_opts *opts);
+static void recv_socket4();
+static void recv_socket_xdp4();
+static void recv_socket6();
+static void send_socket4(const struct tr_opts *opts);
+static void send_socket6(const struct tr_opts *opts);
+
+static struct tr_send tr_send4, tr_send6;
+static struct tr_recv tr_recv4, tr_recv6;
+
+static const struct tr_proto tr_proto4 = {
+    AF_INET,           &tr_send4,       &tr_recv4,
+    recv_socket4,      send_socket4,    send_probe4,
+    assess_icmp_message4, stateless_socket4, send_stateless4,
+    decode_stateless4,
+};
+
+// IPv4 with stateless probes sent and replies received through AF_XDP.
+static const struct tr_proto tr_proto4_xdp = {
+    AF_INET,           &tr_send4,       &tr_recv4,
+    recv_socket_xdp4,  send_socket4,    send_probe4,
+    assess_icmp_message4, stateless_socket_xdp4, send_stateless_xdp4,
+    decode_stateless4,
+};
+
+static const struct tr_proto tr_proto6 = {
+    AF_INET6,          &tr_send6,       &tr_recv6,
+    recv_socket6,      send_socket6,    send_probe6,
+    assess_icmp_message6, NULL,         send_stateless6,
+    decode_stateless6,
+};
+
+// Protocols whose sockets are open, in the order they were opened.
+static const struct tr_proto *protos[2];
+static int nprotos;
+
+// Raw socket and source address used to craft stateless IPv4 probes.
+static struct tr_raw4 {
+  int fd;
+  struct in_addr src;
+} tr_raw4;
+
+// Routing table used to annotate responders, if one was given.
+static struct tr_lpm lpm;
+static int annotate;
+
+// Router-level graph that traces are aggregated into, if requested.
+static struct tr_topo topo;
+static int aggregate;
+
+// Archive that probe outcomes are appended to, if requested.
+static struct tr_archive_writer archive;
+static int archiving;
+
+// The outcome of a stateless or replayed probe, as it travels from the
+// receive loop through annotation to the output stage.
+struct tr_result {
+  struct archive_record rec;
+  struct timespec rtt;
+  const struct lpm_record *route; // Filled in by the annotation stage.
+};
+
+// Stages of the reply pipeline: the receive loop hands results to the
+// annotation stage, if annotating, which hands them to the output stage,
+// each through a ring of its own.
+static struct tr_stage {
+  struct tr_ring in;
+  pthread_t thread;
+  _Atomic int done; // Nothing more will be pushed.
+  _Atomic uint64_t handled; // Results taken out of the pipeline.
+} annotator, printer;
+static int piping;
+static uint64_t npiped;
+
+// Every probe sent and ICMP message received, written to opts->capture
+// (-O) stamped with the times we took, moved from the monotonic clock to
+// the epoch by `capture_epoch`. Packets are put together in `capture_buf`.
+static struct tr_capture_writer capture_out;
+static int capturing;
+static struct timespec capture_epoch;
+static uint8_t capture_buf[CAPTURE_SNAPLEN];
+
+// Key authenticating stateless probes, chosen afresh for every run.
+static uint8_t stateless_key[16];
+
+// AF_XDP socket that stateless IPv4 probes go through instead (-Z).
+static struct tr_xdp xdp;
+static int xdp_enabled;
+
+// Whether to spin on the receive sockets rather than sleep (-B),
+// and what sending probes has cost in that mode.
+static int busy_poll;
+static struct timespec send_overhead;
+static long nsent;
+
+// Progress of the campaign, saved to opts->checkpoint (-K) at most
+// every CHECKPOINT_INTERVAL seconds and when it ends.
+static struct tr_checkpoint checkpoint;
+static int checkpointing;
+static struct timespec checkpointed;
+
+// Targets streamed from opts->targets_file (-f), read ahead into a window
+// in order, so that a stream is walked the same way every time, while the
+// names among them resolve. Names are kept until the resolver is reset.
+static struct tr_targets source;
+static struct tr_exclusions exclusions;
+static struct tr_resolver feed_resolver;
+static struct feed_item {
+  uint64_t index; // Of the target in the targets file (see targets_next()).
+  struct tr_addr addr;
+  char *name; // NULL for an address.
+  long query; // Index of the name in feed_resolver.
+  int resolved;
+  int next; // Of res.addrs to hand out next.
+  struct tr_resolved res;
+} feed[FEED_WINDOW];
+static long feed_head, feed_tail;
+static int feed_eof;
+static char *feed_names[FEED_BATCH];
+static int nfeed_names, feed_names_held;
+
+// Stateless probing walks a stream a chunk at a time,
+// reading the next chunk into `spare` in between probes.
+static struct tr_addr *spare;
+static uint64_t nspare, nskipped;
+static int feeding;
+
+// A campaign handed out to worker processes (-L), each connected on
+// work_fds[] under its id, and what became of it.
+static struct tr_work work;
+static int work_fds[WORK_MAX_WORKERS];
+static int nworkers, nleft;
+static uint64_t nstolen, nhanded_back;
+
+// Working for a coordinator (-J): the results of the target being
+// traced are packed here to send back, rather than archived, and
+// `nread` targets of the stream have been read.
+static uint8_t *results;
+static uint32_t nresults;
+static int working;
+static uint64_t nread;
 
-// TODO: remove this once the message is dynamic
-// and based on the number of bytes desired.
-static char *message = "message";
+// ICMP rate limits of the responders seen in scheduled mode. A probe
+// admitted at `paced_now` is expected to expire at `admitted`, and one
+// held back may be sent at `paced_until` at the earliest (µs, or 0).
+// None is admitted before `port_free`, when the port the next probe
+// goes to stops expecting replies to the last probe sent there.
+static struct tr_ratelimit ratelimit;
+static struct tr_addr admitted;
+static uint64_t paced_now, paced_until, port_free;
+
+// How many hops away destinations, and the prefixes they are in, were
+// found to be (-d): estimated from the TTL of a reply to a probe sent to
+// reach them, then as far as a trace reached them.
+static struct tr_distances distances;
+
+// Set on SIGINT or SIGTERM: no more probes are sent, but those
+// in flight are waited for and the campaign checkpointed.
+static volatile sig_atomic_t stopping;
+
+// Path MTU found so far for the current target in PMTU mode.
+static int pmtu;
+
+static struct tr_probe_table probes;
+
+// Probe payloads are the first `len` bytes of this.
+static char payload[IP_MAXPACKET] = "message";
 
 /**
  * Asseses a received ICMP error response to determine
  * how the caller should proceed.
+ * On a response to one of our probes, the quoted probe is stored in `reply`.
  *
  * Returns:
+ *    -4 on ICMP fragmentation needed (the next-hop MTU is in tr_recv4.mtu)
  *    -3 on an indeterminate result (caller should try to receive again)
  *	  -2 on ICMP time exceeded in transit (caller should continue)
  *	  -1 on ICMP port unreachable (caller is done)
  *  >= 0 return value is some other ICMP unreachable code
  */
-static int assess_icmp_message4(const struct tr_opts *opts, u_short seq) {
+static int assess_icmp_message4(const struct tr_opts *opts,
+                                struct tr_reply *reply) {
   int iphlen;
   struct ip *ip;
   struct icmp *icmp;
   struct udphdr *udp;
 
-  ip = (struct ip *)tr_recv.buf;
+  ip = (struct ip *)tr_recv4.buf;
   // ip_hl is the length of the IP header in 32-bit words
   // so we multiply by 4 to convert to bytes.
   iphlen = ip->ip_hl << 2;
 
-  if (tr_recv.bytes < iphlen + ICMP_MINLEN) {
+  if (tr_recv4.bytes < iphlen + ICMP_MINLEN) {
     return -3;
   }
 
-  icmp = (struct icmp *)(tr_recv.buf + iphlen);
+  icmp = (struct icmp *)(tr_recv4.buf + iphlen);
 
   if (!((icmp->icmp_type == ICMP_TIMXCEED &&
          icmp->icmp_code == ICMP_TIMXCEED_INTRANS) ||
@@ -88,7 +341,7 @@ static int assess_icmp_message4(const struct tr_opts *opts, u_short seq) {
   }
 
   // Size of the ICMP error (advice) message (including IP options).
-  if (tr_recv.bytes < iphlen + ICMP_ADVLEN(icmp)) {
+  if (tr_recv4.bytes < iphlen + ICMP_ADVLEN(icmp)) {
     return -3;
   }
 
@@ -97,10 +350,72 @@ static int assess_icmp_message4(const struct tr_opts *opts, u_short seq) {
 
   // Ensure ICMP response is for this traceroute process.
   if (icmp->icmp_ip.ip_p == IPPROTO_UDP &&
-      udp->uh_sport == htons(opts->sport) &&
-      udp->uh_dport == htons(opts->dport + seq)) {
+      udp->uh_sport == htons(opts->sport)) {
+    tr_recv4.type = icmp->icmp_type;
+    tr_recv4.code = icmp->icmp_code;
+    reply->seq = ntohs(udp->uh_dport) - opts->dport;
+    reply->ip = &icmp->icmp_ip;
+    reply->udp = udp;
+    reply->len = tr_recv4.bytes - ((char *)(udp + 1) - tr_recv4.buf);
     if (icmp->icmp_code == ICMP_UNREACH_PORT) {
       return -1;
+    } else if (icmp->icmp_type == ICMP_UNREACH &&
+               icmp->icmp_code == ICMP_UNREACH_NEEDFRAG) {
+      // Routers predating RFC 1191 leave the MTU zeroed.
+      tr_recv4.mtu = ntohs(icmp->icmp_nextmtu);
+      return -4;
+    } else {
+      return -2;
+    }
+  }
+  return -3;
+}
+
+/**
+ * The IPv6 counterpart of assess_icmp_message4().
+ * The kernel has already discarded ICMPv6 types other than time exceeded,
+ * destination unreachable and packet too big (see recv_socket6()).
+ */
+static int assess_icmp_message6(const struct tr_opts *opts,
+                                struct tr_reply *reply) {
+  struct icmp6_hdr *icmp6;
+  struct ip6_hdr *ip6;
+  struct udphdr *udp;
+
+  // ICMPv6 errors quote as much of the probe as fits in the minimum MTU,
+  // so a short read can only mean a malformed or foreign message.
+  if (tr_recv6.bytes < (int)MAXDATASIZE6) {
+    return -3;
+  }
+
+  icmp6 = (struct icmp6_hdr *)tr_recv6.buf;
+
+  if (!((icmp6->icmp6_type == ICMP6_TIME_EXCEEDED &&
+         icmp6->icmp6_code == ICMP6_TIME_EXCEED_TRANSIT) ||
+        (icmp6->icmp6_type == ICMP6_DST_UNREACH) ||
+        (icmp6->icmp6_type == ICMP6_PACKET_TOO_BIG))) {
+    return -3;
+  }
+
+  // Probes are sent without extension headers,
+  // so the UDP header immediately follows the quoted IPv6 header.
+  ip6 = (struct ip6_hdr *)(icmp6 + 1);
+  udp = (struct udphdr *)(ip6 + 1);
+
+  // Ensure ICMPv6 response is for this traceroute process.
+  if (ip6->ip6_nxt == IPPROTO_UDP && udp->uh_sport == htons(opts->sport)) {
+    tr_recv6.type = icmp6->icmp6_type;
+    tr_recv6.code = icmp6->icmp6_code;
+    reply->seq = ntohs(udp->uh_dport) - opts->dport;
+    reply->ip = ip6;
+    reply->udp = udp;
+    reply->len = tr_recv6.bytes - ((char *)(udp + 1) - tr_recv6.buf);
+    if (icmp6->icmp6_type == ICMP6_DST_UNREACH &&
+        icmp6->icmp6_code == ICMP6_DST_UNREACH_NOPORT) {
+      return -1;
+    } else if (icmp6->icmp6_type == ICMP6_PACKET_TOO_BIG) {
+      tr_recv6.mtu = ntohl(icmp6->icmp6_mtu);
+      return -4;
     } else {
       return -2;
     }
@@ -108,46 +423,270 @@ static int assess_icmp_message4(const struct tr_opts *opts, u_short seq) {
   return -3;
 }
 
+/**
+ * Returns whether the probe quoted in `reply` was sent to `dst`, which has
+ * the family of `proto`. Sequence numbers start over with every target,
+ * and scheduled probes take the same ports in turn, so a late reply for
+ * another target may carry the number we wait for.
+ */
+static int reply_quotes_dst(const struct tr_proto *proto,
+                            const struct tr_reply *reply,
+                            const struct sockaddr *dst) {
+  if (proto->family == AF_INET6) {
+    return memcmp(&((const struct ip6_hdr *)reply->ip)->ip6_dst,
+                  &((const struct sockaddr_in6 *)dst)->sin6_addr,
+                  sizeof(struct in6_addr)) == 0;
+  }
+  return ((const struct ip *)reply->ip)->ip_dst.s_addr ==
+         ((const struct sockaddr_in *)dst)->sin_addr.s_addr;
+}
+
+/**
+ * Writes an IP packet of `len` bytes sent or received at `ts`
+ * to the capture.
+ */
+static void capture_packet(const struct timespec *ts, int direction,
+                           const void *data, uint32_t len) {
+  struct timespec at;
+
+  at.tv_sec = capture_epoch.tv_sec + ts->tv_sec;
+  at.tv_nsec = capture_epoch.tv_nsec + ts->tv_nsec;
+  if (at.tv_nsec >= 1000000000) {
+    at.tv_sec++;
+    at.tv_nsec -= 1000000000;
+  }
+  // Dropped (and counted) rather than waited for if the capture lags.
+  capture_write(&capture_out, &at, direction, data, len);
+}
+
+/**
+ * Puts the IP header of a packet of `len` bytes of `proto` sent to `dst`
+ * with `ttl` together in capture_buf, as the kernel would but for the
+ * source address and the checksum, which are left zero.
+ *
+ * Returns its length.
+ */
+static int capture_header(const struct tr_opts *opts,
+                          const struct sockaddr *dst, int ttl, int proto,
+                          int len) {
+  int hlen;
+  struct ip *ip = (struct ip *)capture_buf;
+  struct ip6_hdr *ip6 = (struct ip6_hdr *)capture_buf;
+
+  hlen = dst->sa_family == AF_INET ? sizeof(*ip) : sizeof(*ip6);
+  memset(capture_buf, 0, hlen);
+  if (dst->sa_family == AF_INET) {
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(*ip) >> 2;
+    ip->ip_len = htons(hlen + len);
+    ip->ip_off = opts->pmtu && proto == IPPROTO_UDP ? htons(IP_DF) : 0;
+    ip->ip_ttl = ttl;
+    ip->ip_p = proto;
+    ip->ip_dst = ((const struct sockaddr_in *)dst)->sin_addr;
+  } else {
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(len);
+    ip6->ip6_nxt = proto;
+    ip6->ip6_hlim = ttl;
+    ip6->ip6_dst = ((const struct sockaddr_in6 *)dst)->sin6_addr;
+  }
+  return hlen;
+}
+
+/**
+ * Captures a UDP probe of `len` bytes of `data` sent to `port` of `dst`
+ * with `ttl` at `ts`. The kernel puts its headers together, so they are
+ * put together here the same way, but for the source address and the
+ * checksums, which are left zero.
+ */
+static void capture_udp(const struct tr_opts *opts, const struct sockaddr *dst,
+                        int ttl, u_short port, const void *data, int len,
+                        const struct timespec *ts) {
+  int hlen;
+  struct udphdr *udp;
+
+  hlen = dst->sa_family == AF_INET ? sizeof(struct ip)
+                                   : sizeof(struct ip6_hdr);
+  if (len > (int)(sizeof(capture_buf) - hlen - sizeof(*udp))) {
+    len = sizeof(capture_buf) - hlen - sizeof(*udp);
+  }
+  capture_header(opts, dst, ttl, IPPROTO_UDP, sizeof(*udp) + len);
+  udp = (struct udphdr *)(capture_buf + hlen);
+  memset(udp, 0, sizeof(*udp));
+  udp->uh_sport = htons(opts->sport);
+  udp->uh_dport = htons(port);
+  udp->uh_ulen = htons(sizeof(*udp) + len);
+  memcpy(udp + 1, data, len);
+  capture_packet(ts, CAPTURE_OUT, capture_buf, hlen + sizeof(*udp) + len);
+}
+
+/**
+ * Captures the ICMP message just received on `recv`, whether or not it
+ * turns out to be a reply to us. Raw ICMPv6 sockets leave out the IPv6
+ * header, so one is put together, with our own address left zero.
+ */
+static void capture_received(const struct tr_recv *recv) {
+  struct ip6_hdr *ip6 = (struct ip6_hdr *)capture_buf;
+
+  if (recv != &tr_recv6) {
+    capture_packet(&recv->received, CAPTURE_IN, recv->buf, recv->bytes);
+    return;
+  }
+  memset(ip6, 0, sizeof(*ip6));
+  ip6->ip6_flow = htonl(6 << 28);
+  ip6->ip6_plen = htons(recv->bytes);
+  ip6->ip6_nxt = IPPROTO_ICMPV6;
+  ip6->ip6_src = ((const struct sockaddr_in6 *)&recv->addr)->sin6_addr;
+  memcpy(ip6 + 1, recv->buf, recv->bytes);
+  capture_packet(&recv->received, CAPTURE_IN, capture_buf,
+                 sizeof(*ip6) + recv->bytes);
+}
+
+/**
+ * Reads an ICMP message into `recv` as recvfrom() would, along with the
+ * hop limit it arrived with if the socket asks for it (see
+ * distance_socket()).
+ *
+ * Returns the same as recvfrom().
+ */
+static ssize_t read_message(struct tr_recv *recv, int flags) {
+  ssize_t n;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char control[CMSG_SPACE(sizeof(int))];
+
+  iov.iov_base = recv->buf;
+  iov.iov_len = sizeof(recv->buf);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &recv->addr;
+  msg.msg_namelen = sizeof(recv->addr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  recv->hlim = -1;
+  if ((n = recvmsg(recv->fd, &msg, flags)) == -1) {
+    return -1;
+  }
+  recv->addrlen = msg.msg_namelen;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT) {
+      memcpy(&recv->hlim, CMSG_DATA(cmsg), sizeof(recv->hlim));
+    }
+  }
+  return n;
+}
+
+/**
+ * Receives an ICMP message if one is waiting, without blocking.
+ *
+ * Returns -1 if there was none and 0 otherwise.
+ */
+static int try_receive(struct tr_recv *recv) {
+  struct in_addr from;
+
+  if (recv->xdp != NULL) {
+    if ((recv->bytes = xdp_recv(recv->xdp, recv->buf, sizeof(recv->buf),
+                                &from)) == -1) {
+      return -1;
+    }
+    memset(&recv->addr, 0, sizeof(recv->addr));
+    ((struct sockaddr_in *)&recv->addr)->sin_family = AF_INET;
+    ((struct sockaddr_in *)&recv->addr)->sin_addr = from;
+    recv->addrlen = sizeof(struct sockaddr_in);
+    timespec_now(&recv->received);
+    if (capturing) {
+      capture_received(recv);
+    }
+    return 0;
+  }
+
+  if ((recv->bytes = read_message(recv, MSG_DONTWAIT)) == -1) {
+    if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+      return -1;
+    }
+    errorf("recvmsg: failed to receive ICMP message\n");
+  }
+  timespec_now(&recv->received);
+  if (capturing) {
+    capture_received(recv);
+  }
+  return 0;
+}
+
 /**
  * Waits `timeout` to receive an ICMP message.
  * Returns as soon as data is available.
  *
+ * When busy polling, this spins on try_receive() instead of sleeping
+ * in recvmsg(), so a reply is timestamped as soon as it is queued
+ * rather than after the scheduler gets around to waking us up.
+ *
  * Returns -1 on timeout and 0 otherwise.
  */
-static int receive_icmp_message(struct timespec *timeout) {
+static int receive_icmp_message(struct tr_recv *recv,
+                                struct timespec *timeout) {
   struct timeval tv_timeout;
+  struct timespec start, now, elapsed;
+
+  if (busy_poll) {
+    timespec_now(&start);
+    do {
+      if (try_receive(recv) == 0) {
+        return 0;
+      }
+      timespec_now(&now);
+      timespec_diff(&now, &start, &elapsed);
+    } while (!timespec_ge(&elapsed, timeout));
+    return -1;
+  }
 
   // setsockopt() expects a timeval.
   TIMESPEC_TO_TIMEVAL(&tv_timeout, timeout);
-  if (setsockopt(tr_recv.fd, SOL_SOCKET, SO_RCVTIMEO, &tv_timeout,
+  if (setsockopt(recv->fd, SOL_SOCKET, SO_RCVTIMEO, &tv_timeout,
                  sizeof(tv_timeout)) == -1) {
-    errorf("socket: failed to set recvfrom timeout\n");
+    errorf("socket: failed to set receive timeout\n");
   }
 
-  if ((tr_recv.bytes =
-           recvfrom(tr_recv.fd, tr_recv.buf, sizeof(tr_recv.buf), 0,
-                    tr_recv.ai->ai_addr, &tr_recv.ai->ai_addrlen)) == -1) {
+  do {
+    recv->bytes = read_message(recv, 0);
+    // A signal to stop still lets the probe in flight be answered.
+  } while (recv->bytes == -1 && errno == EINTR);
+  if (recv->bytes == -1) {
     if (errno == EWOULDBLOCK || errno == EAGAIN) {
       return -1;
     } else {
-      errorf("recvfrom: failed to recvfrom ICMP message\n");
+      errorf("recvmsg: failed to receive ICMP message\n");
     }
   }
+  timespec_now(&recv->received);
+  if (capturing) {
+    capture_received(recv);
+  }
 
   return 0;
 }
 
 /**
  * Attempts to receive a response to the probe.
+ * On a response, the round trip time is stored in `rtt`.
  *
  * Returns:
+ *    -4 on ICMP fragmentation needed (the next-hop MTU is in recv->mtu)
  *    -3 on timeout
  *	  -2 on ICMP time exceeded in transit (caller should continue)
  *	  -1 on ICMP port unreachable (caller is done)
  *  >= 0 return value is some other ICMP unreachable code
  */
-static int get_probe_response4(const struct tr_opts *opts, u_short seq) {
+static int get_probe_response(const struct tr_proto *proto,
+                              const struct tr_opts *opts, u_short seq,
+                              struct timespec *rtt) {
   int result;
+  struct tr_reply reply;
+  struct tr_probe *probe;
   struct timespec timeout, start, end, delta;
 
   timeout.tv_sec = opts->timeout;
@@ -156,10 +695,14 @@ static int get_probe_response4(const struct tr_opts *opts, u_short seq) {
   do {
     timespec_now(&start);
 
-    if (receive_icmp_message(&timeout) == -1) {
+    if (receive_icmp_message(proto->recv, &timeout) == -1) {
       return -3;
     }
-    if ((result = assess_icmp_message4(opts, seq)) != -3) {
+    if ((result = proto->assess(opts, &reply)) != -3 && reply.seq == seq &&
+        reply_quotes_dst(proto, &reply, proto->send->ai->ai_addr) &&
+        (probe = probe_find(&probes, proto->family, reply.seq)) != NULL) {
+      assert(timespec_diff(&proto->recv->received, &probe->sent, rtt) == 1);
+      probe_remove(probe);
       return result;
     }
 
@@ -177,155 +720,3829 @@ static int get_probe_response4(const struct tr_opts *opts, u_short seq) {
 }
 
 /**
- * Sends a probe with the provided TTL.
+ * Sends a probe of `len` payload bytes with the provided TTL.
  */
-static void send_probe4(int ttl, u_short seq, const struct tr_opts *opts) {
-  // TODO: create message depending on opts->probe_size
-  sock_set_port(tr_send.ai->ai_addr, htons(opts->dport + seq));
-  if (setsockopt(tr_send.fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) == -1) {
+static void send_probe4(int ttl, u_short seq, int len,
+                        const struct tr_opts *opts) {
+  sock_set_port(tr_send4.ai->ai_addr, htons(opts->dport + seq));
+  if (setsockopt(tr_send4.fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) == -1) {
     errorf("setsockopt: failed to set time-to-live");
   }
-  if (sendto(tr_send.fd, message, sizeof(message), 0, tr_send.ai->ai_addr,
-             tr_send.ai->ai_addrlen) == -1) {
+  if (sendto(tr_send4.fd, payload, len, 0, tr_send4.ai->ai_addr,
+             tr_send4.ai->ai_addrlen) == -1) {
     errorf("sendto: failed to send packet with TTL %d\n", ttl);
   }
 }
 
 /**
- * Initializes the global tr_recv struct used to receive ICMP messages.
+ * Sends `len` bytes of `payload` to `port` of `dst`
+ * with the provided hop limit.
+ * The hop limit travels as ancillary data with the probe itself,
+ * which saves a setsockopt() system call per probe.
  */
-static void recv_socket4() {
-  int rv;
-  struct addrinfo hints;
+static void send_payload6(const struct sockaddr *dst, int ttl, u_short port,
+                          void *payload, size_t len) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  struct sockaddr_in6 to;
+  char control[CMSG_SPACE(sizeof(ttl))];
 
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_RAW;
-  hints.ai_protocol = IPPROTO_ICMP;
+  memcpy(&to, dst, sizeof(to));
+  to.sin6_port = htons(port);
+
+  iov.iov_base = payload;
+  iov.iov_len = len;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_name = &to;
+  msg.msg_namelen = sizeof(to);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = IPPROTO_IPV6;
+  cmsg->cmsg_type = IPV6_HOPLIMIT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(ttl));
+  memcpy(CMSG_DATA(cmsg), &ttl, sizeof(ttl));
+
+  if (sendmsg(tr_send6.fd, &msg, 0) == -1) {
+    errorf("sendmsg: failed to send packet with hop limit %d\n", ttl);
+  }
+}
+
+/**
+ * Sends a probe of `len` payload bytes with the provided hop limit.
+ */
+static void send_probe6(int ttl, u_short seq, int len,
+                        const struct tr_opts *opts) {
+  send_payload6(tr_send6.ai->ai_addr, ttl, opts->dport + seq, payload, len);
+}
+
+/**
+ * Sends a stateless probe to `dst` with the provided TTL,
+ * stamped with the current time.
+ */
+static void send_stateless4(const struct sockaddr *dst, int ttl,
+                            const struct tr_opts *opts) {
+  int len;
+  char buf[STATELESS_PROBE4_LEN];
+  struct timespec now;
 
-  if ((rv = getaddrinfo("localhost", NULL, &hints, &tr_recv.ai)) != 0) {
-    errorf("getaddrinfo: %s\n", gai_strerror(rv));
+  timespec_now(&now);
+  len = stateless_probe4(buf, stateless_key, &tr_raw4.src,
+                         &((const struct sockaddr_in *)dst)->sin_addr,
+                         opts->sport, opts->dport, ttl, &now);
+  if (sendto(tr_raw4.fd, buf, len, 0, dst, sizeof(struct sockaddr_in)) == -1) {
+    errorf("sendto: failed to send packet with TTL %d\n", ttl);
   }
+  if (capturing) {
+    // As the kernel sent it.
+    stateless_ip_sum4(buf);
+    capture_packet(&now, CAPTURE_OUT, buf, len);
+  }
+}
 
-  if ((tr_recv.fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) == -1) {
-    errorf("socket: failed to create ICMP socket\n");
+/**
+ * Sends a stateless probe to `dst` with the provided TTL through AF_XDP,
+ * built straight into the frame it goes out in.
+ */
+static void send_stateless_xdp4(const struct sockaddr *dst, int ttl,
+                                const struct tr_opts *opts) {
+  int len;
+  uint8_t *frame = xdp_frame(&xdp);
+  struct timespec now;
+
+  timespec_now(&now);
+  len = stateless_probe4((char *)frame, stateless_key, &tr_raw4.src,
+                         &((const struct sockaddr_in *)dst)->sin_addr,
+                         opts->sport, opts->dport, ttl, &now);
+  stateless_ip_sum4((char *)frame);
+  if (capturing) {
+    capture_packet(&now, CAPTURE_OUT, frame, len);
   }
+  xdp_send(&xdp, frame, len);
+}
 
-  // Special permissions only required to open raw socket.
-  setuid(getuid());
+/**
+ * Sends a stateless probe to `dst` with the provided hop limit,
+ * stamped with the current time.
+ */
+static void send_stateless6(const struct sockaddr *dst, int ttl,
+                            const struct tr_opts *opts) {
+  int len;
+  char buf[4];
+  struct timespec now;
+
+  timespec_now(&now);
+  len = stateless_payload6(buf, stateless_key,
+                           &((const struct sockaddr_in6 *)dst)->sin6_addr, ttl,
+                           &now);
+  send_payload6(dst, ttl, opts->dport + ttl, buf, len);
+  if (capturing) {
+    capture_udp(opts, dst, ttl, opts->dport + ttl, buf, len, &now);
+  }
+}
+
+static int decode_stateless4(const struct tr_opts *opts,
+                             const struct tr_reply *reply,
+                             struct tr_stamp *stamp) {
+  return stateless_decode4(stateless_key, reply->ip, reply->udp, opts->dport,
+                           stamp);
+}
+
+static int decode_stateless6(const struct tr_opts *opts,
+                             const struct tr_reply *reply,
+                             struct tr_stamp *stamp) {
+  return stateless_decode6(stateless_key, reply->ip, reply->udp, reply->len,
+                           opts->dport, stamp);
 }
 
 /**
- * Initializes the global tr_send struct used to send messages.
+ * Initializes the global tr_recv4 struct used to receive ICMP messages.
  */
-static void send_socket4(u_short *sport, const struct tr_opts *opts) {
-  int rv;
-  struct addrinfo hints;
-  struct sockaddr_in sabind;
+static void recv_socket4() {
+  if ((tr_recv4.fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) == -1) {
+    errorf("socket: failed to create ICMP socket\n");
+  }
+}
 
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_DGRAM;
-  hints.ai_flags = AI_PASSIVE;
+/**
+ * Replies are received on the AF_XDP socket, which stateless_socket_xdp4()
+ * opens once the interface towards the targets is known.
+ */
+static void recv_socket_xdp4() {}
+
+/**
+ * Initializes the global tr_recv6 struct used to receive ICMPv6 messages.
+ */
+static void recv_socket6() {
+  struct icmp6_filter filter;
+
+  if ((tr_recv6.fd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) == -1) {
+    errorf("socket: failed to create ICMPv6 socket\n");
+  }
+
+  // Have the kernel drop everything but the errors our probes elicit,
+  // rather than waking us up for every neighbour discovery
+  // or router advertisement on the link.
+  ICMP6_FILTER_SETBLOCKALL(&filter);
+  ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter);
+  ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+  ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+  if (setsockopt(tr_recv6.fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter,
+                 sizeof(filter)) == -1) {
+    errorf("setsockopt: failed to set ICMPv6 filter\n");
+  }
+}
+
+/**
+ * Readies the receive socket of `proto` for estimating distances (-d):
+ * to send ICMP echo requests with DISTANCE_TTL, and to receive their
+ * replies along with the hop limit they arrive with, which the IPv4
+ * header tells of itself.
+ */
+static void distance_socket(const struct tr_proto *proto) {
+  int ttl = DISTANCE_TTL, on = 1;
+  struct icmp6_filter filter;
+  socklen_t len = sizeof(filter);
 
-  if ((rv = getaddrinfo(opts->hostname, NULL, &hints, &tr_send.ai)) != 0) {
-    errorf("getaddrinfo: %s\n", gai_strerror(rv));
+  if (proto->family == AF_INET) {
+    if (setsockopt(proto->recv->fd, IPPROTO_IP, IP_TTL, &ttl,
+                   sizeof(ttl)) == -1) {
+      errorf("setsockopt: failed to set time-to-live\n");
+    }
+    return;
+  }
+  if (getsockopt(proto->recv->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter,
+                 &len) == -1) {
+    errorf("getsockopt: failed to get ICMPv6 filter\n");
   }
+  ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+  if (setsockopt(proto->recv->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter,
+                 sizeof(filter)) == -1 ||
+      setsockopt(proto->recv->fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl,
+                 sizeof(ttl)) == -1 ||
+      setsockopt(proto->recv->fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on,
+                 sizeof(on)) == -1) {
+    errorf("setsockopt: failed to ready ICMPv6 socket for echo requests\n");
+  }
+}
+
+/**
+ * Initializes the global tr_send4 struct used to send messages.
+ * tr_send4.ai must already hold the resolved destination.
+ */
+static void send_socket4(const struct tr_opts *opts) {
+  int rv, val;
+  struct sockaddr_in sabind;
 
-  if ((tr_send.fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+  if ((tr_send4.fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
     errorf("socket: failed to create UDP socket\n");
   }
 
+  if (opts->pmtu) {
+#ifdef IP_MTU_DISCOVER
+    // Set DF but ignore the path MTU the kernel has cached,
+    // which would otherwise cap the probes we can send.
+    val = IP_PMTUDISC_PROBE;
+    rv = setsockopt(tr_send4.fd, IPPROTO_IP, IP_MTU_DISCOVER, &val,
+                    sizeof(val));
+#else
+    val = 1;
+    rv = setsockopt(tr_send4.fd, IPPROTO_IP, IP_DONTFRAG, &val, sizeof(val));
+#endif
+    if (rv == -1) {
+      errorf("setsockopt: failed to set don't fragment\n");
+    }
+  }
+
   // Bind to a particular local port in order to identify
   // responses meant for this traceroute process.
-  *sport = (getpid() & 0xffff) | 0x8000;
   memset(&sabind, 0, sizeof(sabind));
   sabind.sin_family = AF_INET;
   sabind.sin_addr.s_addr = htonl(INADDR_ANY);
-  sabind.sin_port = htons(*sport);
-  if (bind(tr_send.fd, (struct sockaddr *)&sabind, sizeof(sabind)) == -1) {
+  sabind.sin_port = htons(opts->sport);
+  if (bind(tr_send4.fd, (struct sockaddr *)&sabind, sizeof(sabind)) == -1) {
     errorf("bind: failed to bind local port\n");
   }
 }
 
-void traceroute4(struct tr_opts *opts) {
-  double rtt;
-  u_short seq, ttl;
-  int probe, done, response;
-  struct timespec start, end, delta;
-  char s[INET_ADDRSTRLEN];
-  char h[NI_MAXHOST];
+/**
+ * Initializes the global tr_send6 struct used to send messages.
+ * tr_send6.ai must already hold the resolved destination.
+ */
+static void send_socket6(const struct tr_opts *opts) {
+  int on = 1, val;
+  struct sockaddr_in6 sabind;
 
-  // Setup raw socket for receiving ICMP responses.
-  recv_socket4();
+  if ((tr_send6.fd = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+    errorf("socket: failed to create UDP socket\n");
+  }
 
-  // Setup socket for sending messages.
-  send_socket4(&opts->sport, opts);
+  // Without this the bind below would also claim the IPv4 port
+  // and collide with send_socket4() in a dual-stack run.
+  if (setsockopt(tr_send6.fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) ==
+      -1) {
+    errorf("setsockopt: failed to set IPV6_V6ONLY\n");
+  }
 
-  inet_ntop(tr_send.ai->ai_family, get_in_addr(tr_send.ai->ai_addr), s,
-            sizeof(s));
-  printf("traceroute to %s (%s), %d hops max, %d byte packets\n",
-         opts->hostname, s, opts->max_ttl, opts->probe_size);
-  fflush(stdout);
+  if (opts->pmtu) {
+#ifdef IPV6_MTU_DISCOVER
+    // See send_socket4().
+    val = IPV6_PMTUDISC_PROBE;
+    if (setsockopt(tr_send6.fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val,
+                   sizeof(val)) == -1) {
+      errorf("setsockopt: failed to set don't fragment\n");
+    }
+#endif
+    val = 1;
+    if (setsockopt(tr_send6.fd, IPPROTO_IPV6, IPV6_DONTFRAG, &val,
+                   sizeof(val)) == -1) {
+      errorf("setsockopt: failed to set don't fragment\n");
+    }
+  }
 
-  seq = 0;
-  done = 0;
-  for (ttl = 1; ttl <= opts->max_ttl && !done; ttl++) {
-    printf("%2d  ", ttl);
-    fflush(stdout);
+  memset(&sabind, 0, sizeof(sabind));
+  sabind.sin6_family = AF_INET6;
+  sabind.sin6_addr = in6addr_any;
+  sabind.sin6_port = htons(opts->sport);
+  if (bind(tr_send6.fd, (struct sockaddr *)&sabind, sizeof(sabind)) == -1) {
+    errorf("bind: failed to bind local port\n");
+  }
+}
 
-    for (probe = 0; probe < opts->nprobes; probe++, seq++) {
-      if (probe != 0) {
-        printf("    ");
-      }
-      // TODO: group probe responses by IP
-      timespec_now(&start);
-      send_probe4(ttl, seq, opts);
-      switch ((response = get_probe_response4(opts, seq))) {
-      case -3:
-        printf("* ");
-        break;
-      case -2:
-      case -1:
-        timespec_now(&end);
-        assert(timespec_diff(&end, &start, &delta) == 1);
-        rtt = delta.tv_sec * 1000.0 + (delta.tv_nsec / 1000.0 / 1000.0);
-        get_host_name(tr_recv.ai->ai_addr, h, sizeof(h));
-        inet_ntop(tr_recv.ai->ai_family, get_in_addr(tr_recv.ai->ai_addr), s,
-                  sizeof(s));
-        printf("%s (%s) %.3f ms", h, s, rtt);
-        if (response == -1) {
-          done = 1;
-        }
-        break;
-      default:
-        errorf("ICMP Unreachable code %d\n", response);
-        break;
-      }
-      fflush(stdout);
-      printf("\n");
-    }
+/**
+ * Returns the source address the kernel would use to reach `dst`.
+ */
+static struct in_addr source_address4(const struct sockaddr *dst) {
+  int fd;
+  struct sockaddr_in src;
+  socklen_t srclen = sizeof(src);
+
+  // The UDP checksum covers the source address, so ask the kernel
+  // which one it would use by connecting a throwaway socket.
+  if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+    errorf("socket: failed to create UDP socket\n");
+  }
+  if (connect(fd, dst, sizeof(struct sockaddr_in)) == -1 ||
+      getsockname(fd, (struct sockaddr *)&src, &srclen) == -1) {
+    errorf("connect: failed to find a source address\n");
   }
+  close(fd);
+  return src.sin_addr;
 }
 
-int main(int argc, char *argv[]) {
-  struct tr_opts opts;
-  opts.nprobes = 3;
-  opts.timeout = 5;
-  opts.max_ttl = 64;
-  opts.probe_size = sizeof(message);
-  opts.dport = 33434;
+/**
+ * Initializes the global tr_raw4 struct used to send stateless probes.
+ * The source address is the one the kernel would use to reach `dst`.
+ */
+static void stateless_socket4(const struct sockaddr *dst) {
+  int on = 1;
 
-  // TODO: getopts()
+  if ((tr_raw4.fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1) {
+    errorf("socket: failed to create raw IP socket\n");
+  }
+  if (setsockopt(tr_raw4.fd, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on)) == -1) {
+    errorf("setsockopt: failed to set IP_HDRINCL\n");
+  }
+  tr_raw4.src = source_address4(dst);
+}
+
+/**
+ * Finds the link-layer address of `next_hop` on `ifname`, nudging the
+ * kernel into resolving it if it has not already.
+ */
+static void next_hop_mac(const char *ifname, const struct in_addr *next_hop,
+                         uint8_t mac[6]) {
+  int fd, i;
+  struct sockaddr_in sin;
+  struct timespec wait = {0, 10000000};
 
-  if (argc != 2) {
-    fprintf(stderr, "usage: hostname\n");
-    exit(1);
+  if (xdp_neighbor(XDP_NEIGHBORS, ifname, next_hop, mac) == 0) {
+    return;
+  }
+  // An empty datagram to the discard port makes the kernel ask.
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr = *next_hop;
+  sin.sin_port = htons(9);
+  if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+    errorf("socket: failed to create UDP socket\n");
   }
+  sendto(fd, "", 0, 0, (struct sockaddr *)&sin, sizeof(sin));
+  close(fd);
+  for (i = 0; i < 100; i++) {
+    nanosleep(&wait, NULL);
+    if (xdp_neighbor(XDP_NEIGHBORS, ifname, next_hop, mac) == 0) {
+      return;
+    }
+  }
+  errorf("xdp: failed to resolve next hop %s on %s\n", inet_ntoa(*next_hop),
+         ifname);
+}
 
-  opts.hostname = argv[1];
+/**
+ * Opens the AF_XDP socket that stateless IPv4 probes are sent and their
+ * replies received through, on the interface of the route to `dst`,
+ * with frames addressed to the next hop on that route. Every IPv4 target
+ * is assumed to be reached through the same next hop, as it is assumed
+ * to be from the same source address.
+ */
+static void stateless_socket_xdp4(const struct sockaddr *dst) {
+  char ifname[IF_NAMESIZE];
+  uint8_t mac[6];
+  struct in_addr next_hop;
 
-  traceroute4(&opts);
-  return 0;
+  if (xdp_route(XDP_ROUTES, &((const struct sockaddr_in *)dst)->sin_addr,
+                ifname, &next_hop) == -1) {
+    errorf("xdp: no route to the first target\n");
+  }
+  next_hop_mac(ifname, &next_hop, mac);
+  tr_raw4.src = source_address4(dst);
+  if (xdp_open(&xdp, ifname, &tr_raw4.src, mac) == -1) {
+    errorf("xdp: failed to open an AF_XDP socket on %s\n", ifname);
+  }
+  tr_recv4.fd = xdp.fd;
+  tr_recv4.xdp = &xdp;
+  fprintf(stderr, "xdp: %s queue 0, %s mode%s\n", ifname,
+          xdp.generic ? "generic" : "native", xdp.zerocopy ? ", zero-copy" : "");
 }
 
+/**
+ * Resolves `hostname` within `family`.
+ */
+static struct addrinfo *resolve(const char *hostname, int family) {
+  int rv;
+  struct addrinfo hints, *ai;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+
+  if ((rv = getaddrinfo(hostname, NULL, &hints, &ai)) != 0) {
+    errorf("getaddrinfo: %s: %s\n", hostname, gai_strerror(rv));
+  }
+  return ai;
+}
+
+static const struct tr_proto *proto_for(int family) {
+  if (family == AF_INET6) {
+    return &tr_proto6;
+  }
+  return xdp_enabled ? &tr_proto4_xdp : &tr_proto4;
+}
+
+/**
+ * Waits up to `timeout` for an ICMP message on any open receive socket.
+ *
+ * Returns the protocol whose socket received it, or NULL on timeout.
+ */
+static const struct tr_proto *poll_icmp_message(struct timespec *timeout) {
+  int i, maxfd = -1;
+  fd_set fds;
+  struct timeval tv_timeout;
+  struct timespec start, now, elapsed;
+
+  if (busy_poll) {
+    timespec_now(&start);
+    do {
+      for (i = 0; i < nprotos; i++) {
+        if (try_receive(protos[i]->recv) == 0) {
+          return protos[i];
+        }
+      }
+      timespec_now(&now);
+      timespec_diff(&now, &start, &elapsed);
+    } while (!timespec_ge(&elapsed, timeout));
+    return NULL;
+  }
+
+  FD_ZERO(&fds);
+  for (i = 0; i < nprotos; i++) {
+    FD_SET(protos[i]->recv->fd, &fds);
+    if (protos[i]->recv->fd > maxfd) {
+      maxfd = protos[i]->recv->fd;
+    }
+  }
+
+  // select() expects a timeval.
+  TIMESPEC_TO_TIMEVAL(&tv_timeout, timeout);
+  if (select(maxfd + 1, &fds, NULL, NULL, &tv_timeout) == -1) {
+    if (errno == EINTR) {
+      return NULL;
+    }
+    errorf("select: failed to wait for ICMP messages\n");
+  }
+
+  for (i = 0; i < nprotos; i++) {
+    if (FD_ISSET(protos[i]->recv->fd, &fds) &&
+        try_receive(protos[i]->recv) == 0) {
+      return protos[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Prints the origin AS and covering prefix `r` of a responder,
+ * NULL if none covers it.
+ */
+static void print_route(const struct lpm_record *r) {
+  struct in_addr prefix;
+  char s[INET_ADDRSTRLEN];
+
+  if (r == NULL) {
+    printf(" [*]");
+    return;
+  }
+  prefix.s_addr = htonl(r->prefix);
+  inet_ntop(AF_INET, &prefix, s, sizeof(s));
+  printf(" [AS%u %s/%d]", r->asn, s, r->len);
+}
+
+/**
+ * Prints the origin AS and covering prefix of a responder
+ * if annotation is enabled. Only IPv4 tables are supported.
+ */
+static void print_annotation(int family, const void *addr) {
+  if (!annotate || family != AF_INET) {
+    return;
+  }
+  print_route(
+      lpm_lookup(&lpm, ntohl(((const struct in_addr *)addr)->s_addr)));
+}
+
+/**
+ * Fills in the archive record of a probe to `dst`. `responder` is NULL
+ * for a probe that went unanswered, in which case `rtt` is how long the
+ * reply was waited for.
+ */
+static void fill_record(struct archive_record *r,
+                        const struct tr_proto *proto, const void *dst,
+                        int ttl, const void *responder,
+                        const struct timespec *rtt) {
+  uint64_t waited;
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  waited = rtt->tv_sec * 1000000 + rtt->tv_nsec / 1000;
+  memset(r, 0, sizeof(*r));
+  r->time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_usec - waited;
+  addr_set(&r->target, proto->family, dst);
+  r->ttl = ttl;
+  if (responder != NULL) {
+    addr_set(&r->responder, proto->family, responder);
+    r->rtt_us = waited;
+    r->icmp_type = proto->recv->type;
+    r->icmp_code = proto->recv->code;
+  }
+}
+
+/**
+ * Appends the outcome of a probe to `dst` to the archive, if one is being
+ * written, as fill_record() describes it. A worker packs it into the
+ * results of its target instead.
+ */
+static void archive_probe(const struct tr_proto *proto, const void *dst,
+                          int ttl, const void *responder,
+                          const struct timespec *rtt) {
+  struct archive_record r;
+
+  if (!archiving && !working) {
+    return;
+  }
+  fill_record(&r, proto, dst, ttl, responder, rtt);
+  if (working) {
+    if (nresults + WORK_RECORD_MAX > WORK_MAX_MSG) {
+      errorf("work: too many results for one target\n");
+    }
+    nresults += work_pack(results + nresults, &r);
+    return;
+  }
+  if (archive_append(&archive, &r) == -1) {
+    errorf("archive: failed to append record\n");
+  }
+}
+
+/**
+ * Waits a little for the other end of a ring, yielding the CPU at first
+ * and then sleeping, so an idle stage costs next to nothing.
+ */
+static void stage_idle(int *spins) {
+  struct timespec nap;
+
+  if (++*spins < PIPELINE_SPINS) {
+    sched_yield();
+    return;
+  }
+  nap.tv_sec = 0;
+  nap.tv_nsec = PIPELINE_IDLE_USEC * 1000;
+  nanosleep(&nap, NULL);
+}
+
+/**
+ * Hands `res` to `stage`, waiting while its ring is full.
+ * Every push that finds it full is counted in `stage->in.full`.
+ */
+static void stage_push(struct tr_stage *stage, const struct tr_result *res) {
+  while (ring_push(&stage->in, res) == -1) {
+    sched_yield();
+  }
+}
+
+/**
+ * Takes the next result handed to `stage`, waiting for one, and with
+ * `flush` flushing stdout whenever there is none yet.
+ *
+ * Returns 1 if there is one, and 0 once there will be no more.
+ */
+static int stage_pop(struct tr_stage *stage, struct tr_result *res,
+                     int flush) {
+  int spins = 0;
+
+  while (ring_pop(&stage->in, res) == -1) {
+    if (flush && spins == 0) {
+      fflush(stdout);
+    }
+    // Pushes before `done` was set are visible once it is.
+    if (atomic_load(&stage->done)) {
+      return ring_pop(&stage->in, res) == 0;
+    }
+    stage_idle(&spins);
+  }
+  return 1;
+}
+
+/**
+ * The annotation stage: looks up the route covering each responder.
+ */
+static void *annotate_results(void *arg) {
+  struct tr_result res;
+
+  (void)arg;
+  while (stage_pop(&annotator, &res, 0)) {
+    if (res.rec.responder.family == AF_INET) {
+      res.route = lpm_lookup(&lpm, ntohl(res.rec.responder.u.v4.s_addr));
+    }
+    stage_push(&printer, &res);
+  }
+  return NULL;
+}
+
+/**
+ * Prints the outcome of a probe in the format of stateless replies,
+ * with `route` covering the responder if annotating.
+ */
+static void print_record(const struct archive_record *rec,
+                         const struct timespec *rtt,
+                         const struct lpm_record *route) {
+  char d[INET6_ADDRSTRLEN], s[INET6_ADDRSTRLEN];
+
+  addr_ntop(&rec->target, d, sizeof(d));
+  if (rec->responder.family == 0) {
+    printf("%s %2d  *\n", d, rec->ttl);
+    return;
+  }
+  printf("%s %2d  %s", d, rec->ttl, addr_ntop(&rec->responder, s, sizeof(s)));
+  if (annotate && rec->responder.family == AF_INET) {
+    print_route(route);
+  }
+  printf(" %.3f ms\n", rtt->tv_sec * 1000.0 + rtt->tv_nsec / 1000.0 / 1000.0);
+}
+
+/**
+ * The output stage: prints each result and archives it.
+ */
+static void *print_results(void *arg) {
+  struct tr_result res;
+
+  (void)arg;
+  while (stage_pop(&printer, &res, 1)) {
+    print_record(&res.rec, &res.rtt, res.route);
+    if (archiving && archive_append(&archive, &res.rec) == -1) {
+      errorf("archive: failed to append record\n");
+    }
+    atomic_fetch_add_explicit(&printer.handled, 1, memory_order_release);
+  }
+  fflush(stdout);
+  return NULL;
+}
+
+/**
+ * Passes the outcome of a probe to `dst` down the pipeline,
+ * as fill_record() describes it.
+ */
+static void pipe_result(const struct tr_proto *proto, const void *dst,
+                        int ttl, const void *responder,
+                        const struct timespec *rtt) {
+  struct tr_result res;
+
+  fill_record(&res.rec, proto, dst, ttl, responder, rtt);
+  res.rtt = *rtt;
+  res.route = NULL;
+  npiped++;
+  stage_push(annotate ? &annotator : &printer, &res);
+}
+
+/**
+ * Waits until every result passed down the pipeline is printed and
+ * archived, so the archive can be flushed from this thread.
+ */
+static void pipeline_sync(void) {
+  int spins = 0;
+
+  while (atomic_load_explicit(&printer.handled, memory_order_acquire) !=
+         npiped) {
+    stage_idle(&spins);
+  }
+}
+
+/**
+ * Keeps `thread` off the CPU the receive loop spins on, if there is another.
+ */
+static void avoid_busy_cpu(const struct tr_opts *opts, pthread_t thread) {
+#ifdef __linux__
+  int i;
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  for (i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; i++) {
+    if (i != opts->busy_cpu) {
+      CPU_SET(i, &cpus);
+    }
+  }
+  if (CPU_COUNT(&cpus) > 0) {
+    pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+  }
+#else
+  (void)opts;
+  (void)thread;
+#endif
+}
+
+static void start_stage(const struct tr_opts *opts, struct tr_stage *stage,
+                        void *(*run)(void *)) {
+  if (ring_init(&stage->in, PIPELINE_RING, sizeof(struct tr_result)) == -1) {
+    errorf("malloc: failed to allocate pipeline\n");
+  }
+  atomic_init(&stage->done, 0);
+  atomic_init(&stage->handled, 0);
+  if ((errno = pthread_create(&stage->thread, NULL, run, NULL)) != 0) {
+    errorf("pthread_create: failed to start pipeline\n");
+  }
+  if (busy_poll) {
+    avoid_busy_cpu(opts, stage->thread);
+  }
+}
+
+/**
+ * Starts the threads that annotate, print and archive the results of
+ * stateless and replayed probes, so the receive loop only matches and
+ * times replies, and a slow terminal or disk never delays the next one.
+ * Signals are left to the main thread.
+ */
+static void start_pipeline(const struct tr_opts *opts) {
+  sigset_t signals, saved;
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &saved);
+  start_stage(opts, &printer, print_results);
+  if (annotate) {
+    start_stage(opts, &annotator, annotate_results);
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  npiped = 0;
+  piping = 1;
+}
+
+static void stop_stage(struct tr_stage *stage) {
+  atomic_store(&stage->done, 1);
+  pthread_join(stage->thread, NULL);
+  ring_free(&stage->in);
+}
+
+/**
+ * Drains the pipeline and reports how often a stage found the next one's
+ * ring full and had to wait for it.
+ */
+static void stop_pipeline(void) {
+  if (annotate) {
+    stop_stage(&annotator);
+  }
+  stop_stage(&printer);
+  piping = 0;
+  if (annotator.in.full > 0 || printer.in.full > 0) {
+    fprintf(stderr,
+            "pipeline: annotation ring full %llu times, output ring full "
+            "%llu times\n",
+            (unsigned long long)annotator.in.full,
+            (unsigned long long)printer.in.full);
+  }
+}
+
+/**
+ * Passes the message just received by `proto` down the pipeline
+ * if it answers a stateless probe.
+ */
+static void pipe_stateless_reply(const struct tr_proto *proto,
+                                 const struct tr_opts *opts) {
+  struct tr_reply reply;
+  struct tr_stamp stamp;
+  struct timespec rtt;
+
+  if (proto->assess(opts, &reply) == -3 ||
+      proto->decode_stateless(opts, &reply, &stamp) == -1) {
+    return;
+  }
+
+  stateless_rtt(stamp.ticks, stateless_ticks(&proto->recv->received), &rtt);
+  pipe_result(proto, stamp.dst, stamp.ttl,
+              get_in_addr((struct sockaddr *)&proto->recv->addr), &rtt);
+}
+
+/**
+ * Handles stateless replies until `until` has passed
+ * and no more replies are waiting.
+ */
+static void drain_stateless_replies(const struct tr_opts *opts,
+                                    const struct timespec *until) {
+  const struct tr_proto *proto;
+  struct timespec now, wait;
+
+  do {
+    timespec_now(&now);
+    if (timespec_diff(until, &now, &wait) == -1) {
+      wait.tv_sec = 0;
+      wait.tv_nsec = 0;
+    }
+    if ((proto = poll_icmp_message(&wait)) != NULL) {
+      pipe_stateless_reply(proto, opts);
+    } else if (wait.tv_sec == 0 && wait.tv_nsec == 0) {
+      return;
+    }
+  } while (1);
+}
+
+/**
+ * Returns whether CHECKPOINT_INTERVAL has passed since the last checkpoint.
+ */
+static int checkpoint_due(void) {
+  struct timespec now, elapsed;
+
+  timespec_now(&now);
+  timespec_diff(&now, &checkpointed, &elapsed);
+  return elapsed.tv_sec >= CHECKPOINT_INTERVAL;
+}
+
+/**
+ * Saves the campaign's progress. Everything the checkpoint vouches for
+ * (archived probes, cached paths and the graph) is saved before it.
+ */
+static void save_checkpoint(const struct tr_opts *opts,
+                            struct tr_path_cache *cache) {
+  if (piping) {
+    pipeline_sync();
+  }
+  if (archiving && archive_flush(&archive) == -1) {
+    errorf("archive: failed to write %s\n", opts->archive);
+  }
+  if (cache != NULL && path_cache_save(cache, opts->path_cache) == -1) {
+    errorf("path cache: failed to save %s\n", opts->path_cache);
+  }
+  if (aggregate && topo_save(&topo, opts->graph) == -1) {
+    errorf("topo: failed to save %s\n", opts->graph);
+  }
+  if (checkpoint_save(&checkpoint, opts->checkpoint) == -1) {
+    errorf("checkpoint: failed to save %s\n", opts->checkpoint);
+  }
+  timespec_now(&checkpointed);
+}
+
+/**
+ * Marks target `i` done, checkpointing if it is time to.
+ */
+static void target_done(const struct tr_opts *opts, long i,
+                        struct tr_path_cache *cache) {
+  if (!checkpointing) {
+    return;
+  }
+  checkpoint_set_done(&checkpoint, i);
+  if (checkpoint_due()) {
+    save_checkpoint(opts, cache);
+  }
+}
+
+/**
+ * Reads `source` from the start of opts->targets_file.
+ */
+static void open_targets(const struct tr_opts *opts) {
+  if (targets_open(&source, opts->targets_file, opts->gran4, opts->gran6,
+                   opts->exclude != NULL ? &exclusions : NULL, opts->shard,
+                   opts->nshards) == -1) {
+    errorf("targets: failed to open %s\n", opts->targets_file);
+  }
+}
+
+/**
+ * Starts reading targets from opts->targets_file.
+ */
+static void start_feed(const struct tr_opts *opts) {
+  struct sockaddr_storage server;
+  socklen_t len;
+
+  if (opts->exclude != NULL && exclusions_load(&exclusions, opts->exclude) ==
+                                   -1) {
+    errorf("targets: failed to load exclusions from %s\n", opts->exclude);
+  }
+  open_targets(opts);
+  resolver_default_server(&server, &len);
+  if (resolver_init(&feed_resolver, (struct sockaddr *)&server, len,
+                    opts->family) == -1) {
+    errorf("resolver: failed to open socket to nameserver\n");
+  }
+}
+
+/**
+ * Reads ahead from the targets file while the window has room,
+ * queueing names for resolution, and takes whatever names resolved.
+ */
+static void fill_feed(const struct tr_opts *opts) {
+  int rv;
+  long i;
+  struct tr_target target;
+  struct feed_item *item;
+  const struct tr_resolved *res;
+
+  // The resolver is reset once a batch of names is done with,
+  // so it remembers no more than one batch however many there are.
+  if (nfeed_names == FEED_BATCH && feed_names_held == 0) {
+    resolver_reset(&feed_resolver);
+    for (i = 0; i < nfeed_names; i++) {
+      free(feed_names[i]);
+    }
+    nfeed_names = 0;
+  }
+
+  while (!feed_eof && feed_tail - feed_head < FEED_WINDOW &&
+         nfeed_names < FEED_BATCH) {
+    if ((rv = targets_next(&source, &target)) == -1) {
+      errorf("targets: %s:%ld: not a target\n", opts->targets_file,
+             source.line);
+    }
+    if (rv == 0) {
+      feed_eof = 1;
+      break;
+    }
+    item = &feed[feed_tail++ % FEED_WINDOW];
+    item->index = source.index - 1;
+    item->addr = target.addr;
+    item->name = NULL;
+    if (target.name != NULL) {
+      if ((item->name = strdup(target.name)) == NULL ||
+          resolver_add(&feed_resolver, item->name) == -1) {
+        errorf("resolver: failed to queue %s\n", target.name);
+      }
+      item->query = nfeed_names;
+      item->resolved = 0;
+      item->next = 0;
+      feed_names[nfeed_names++] = item->name;
+      feed_names_held++;
+    }
+  }
+
+  if (resolver_pending(&feed_resolver) == 0) {
+    return;
+  }
+  if (resolver_poll(&feed_resolver, 0) == -1) {
+    errorf("resolver: failed to query nameserver\n");
+  }
+  while ((res = resolver_next(&feed_resolver)) != NULL) {
+    for (i = feed_head; i < feed_tail; i++) {
+      item = &feed[i % FEED_WINDOW];
+      if (item->name != NULL && !item->resolved && item->query == res->index) {
+        item->res = *res;
+        item->resolved = 1;
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * Takes the next target from the targets file into `addr`, with the name
+ * it resolved from in `*name` (NULL for an address), valid until the next
+ * call. Names that resolve to nothing are reported and skipped, as are
+ * excluded addresses they resolve to. The index of the line it came from
+ * among the file's targets goes in `index`, and whether it is the last
+ * address handed out for that line in `last`.
+ *
+ * Returns 1 if there is one, 0 if it is still resolving and `wait` is
+ * unset, and -1 once the file is done.
+ */
+static int next_feed(const struct tr_opts *opts, struct tr_addr *addr,
+                     const char **name, uint64_t *index, int *last,
+                     int wait) {
+  struct feed_item *item;
+  int naddrs;
+
+  for (;;) {
+    fill_feed(opts);
+    if (feed_head == feed_tail) {
+      return -1;
+    }
+    item = &feed[feed_head % FEED_WINDOW];
+    *index = item->index;
+    if (item->name == NULL) {
+      feed_head++;
+      *addr = item->addr;
+      *name = NULL;
+      *last = 1;
+      return 1;
+    }
+    if (!item->resolved) {
+      if (!wait) {
+        return 0;
+      }
+      if (resolver_poll(&feed_resolver, -1) == -1) {
+        errorf("resolver: failed to query nameserver\n");
+      }
+      continue;
+    }
+    if (item->res.error != 0) {
+      fflush(stdout);
+      fprintf(stderr, "resolver: %s: %s\n", item->name,
+              resolver_strerror(item->res.error));
+    }
+    naddrs = opts->all_addrs ? item->res.naddrs : (item->res.naddrs > 0);
+    if (item->next == naddrs) {
+      feed_head++;
+      feed_names_held--;
+      continue;
+    }
+    *addr = item->res.addrs[item->next++];
+    if (!targets_excluded(&source, addr)) {
+      *name = item->name;
+      *last = item->next == naddrs;
+      return 1;
+    }
+  }
+}
+
+static void stop_feed(const struct tr_opts *opts) {
+  int i;
+
+  for (i = 0; i < nfeed_names; i++) {
+    free(feed_names[i]);
+  }
+  nfeed_names = feed_names_held = 0;
+  feed_head = feed_tail = 0;
+  feed_eof = 0;
+  resolver_free(&feed_resolver);
+  targets_close(&source);
+  if (opts->exclude != NULL) {
+    exclusions_free(&exclusions);
+  }
+}
+
+/**
+ * Returns whether sockets were opened for `family`.
+ */
+static int proto_opened(int family) {
+  int i;
+
+  for (i = 0; i < nprotos; i++) {
+    if (protos[i]->family == family) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads targets into `spare` until it holds a chunk, waiting for names
+ * to resolve with `wait`, or else only the one target (if it is ready),
+ * which keeps a walk through the previous chunk ahead of the reading.
+ * Once sockets are open, targets of a family none were opened for are
+ * skipped.
+ */
+static void fill_chunk(const struct tr_opts *opts, int wait) {
+  int n = wait ? STREAM_CHUNK : 1, last;
+  uint64_t index;
+  const char *name;
+
+  while (n-- > 0 && nspare < STREAM_CHUNK &&
+         next_feed(opts, &spare[nspare], &name, &index, &last, wait) == 1) {
+    if (nprotos > 0 && !proto_opened(spare[nspare].family)) {
+      nskipped++;
+      continue;
+    }
+    nspare++;
+  }
+}
+
+/**
+ * Writes `addr` as a sockaddr into `ss`.
+ *
+ * Returns the length of the sockaddr.
+ */
+static socklen_t sockaddr_for(const struct tr_addr *addr,
+                              struct sockaddr_storage *ss) {
+  struct sockaddr_in *sin;
+  struct sockaddr_in6 *sin6;
+
+  memset(ss, 0, sizeof(*ss));
+  if (addr->family == AF_INET) {
+    sin = (struct sockaddr_in *)ss;
+    sin->sin_family = AF_INET;
+    sin->sin_addr = addr->u.v4;
+    return sizeof(*sin);
+  }
+  sin6 = (struct sockaddr_in6 *)ss;
+  sin6->sin6_family = AF_INET6;
+  sin6->sin6_addr = addr->u.v6;
+  return sizeof(*sin6);
+}
+
+/**
+ * Where a stateless walk of the (target, TTL) space is. Probes are
+ * numbered from the start of the campaign, which a stream of targets
+ * walks a chunk at a time.
+ */
+struct tr_walk {
+  uint8_t perm_key[16];
+  uint64_t first; // Probe the walk started, or resumed, from.
+  uint64_t sent;
+  uint64_t settled; // Probes whose replies are in by the next checkpoint.
+  uint64_t interval; // Nanoseconds between probes, or 0 for no limit.
+  struct timespec start;
+};
+
+static void walk_init(const struct tr_opts *opts, struct tr_walk *walk) {
+  memset(walk, 0, sizeof(*walk));
+  if (opts->rate > 0) {
+    walk->interval = 1000000000ULL / opts->rate;
+  }
+  // A resumed walk must be the same walk.
+  if (checkpointing) {
+    memcpy(walk->perm_key, checkpoint.perm_key, sizeof(walk->perm_key));
+    walk->first = walk->sent = walk->settled = checkpoint.position;
+  } else {
+    random_key(walk->perm_key, sizeof(walk->perm_key));
+  }
+  timespec_now(&walk->start);
+}
+
+/**
+ * The stateless counterpart of the probing loop in traceroute_target().
+ * Probes for every (target, TTL) pair of `ntargets` targets, numbered
+ * from `base` in the campaign, are sent at `opts->rate` and replies are
+ * printed as they arrive, matched and timed from what they quote rather
+ * than the probe table.
+ *
+ * With `opts->permute` the probe space is walked in a keyed pseudorandom
+ * order, spreading the load on routers shared by many paths (and hence
+ * their ICMP rate limits) evenly over the campaign, rather than probing
+ * each target's first hops back to back.
+ */
+static void walk_stateless(const struct tr_opts *opts, struct tr_walk *walk,
+                           const struct tr_addr *targets, uint64_t ntargets,
+                           uint64_t base) {
+  int ttl;
+  uint64_t i, n, per_target;
+  struct tr_perm perm;
+  const struct tr_addr *target;
+  struct sockaddr_storage dst;
+  struct timespec next;
+
+  per_target = (uint64_t)opts->max_ttl * opts->nprobes;
+  n = per_target * ntargets;
+  perm_init(&perm, walk->perm_key, n);
+  perm.next = walk->sent - base;
+
+  for (; walk->sent < base + n && !stopping; walk->sent++) {
+    if (opts->permute) {
+      perm_next(&perm, &i);
+    } else {
+      i = walk->sent - base;
+    }
+    target = &targets[i / per_target];
+    ttl = (i % per_target) / opts->nprobes + 1;
+
+    // Replies to probes sent since the last checkpoint may still be on
+    // their way, but those sent before it have had CHECKPOINT_INTERVAL.
+    if (checkpointing && walk->sent % 1024 == 0 && checkpoint_due()) {
+      checkpoint.position = walk->settled;
+      walk->settled = walk->sent;
+      save_checkpoint(opts, NULL);
+    }
+    if (feeding) {
+      fill_chunk(opts, 0);
+    }
+
+    // Receive while waiting for our turn to send.
+    next.tv_sec = walk->start.tv_sec +
+                  (walk->sent - walk->first) * walk->interval / 1000000000;
+    next.tv_nsec = walk->start.tv_nsec +
+                   (walk->sent - walk->first) * walk->interval % 1000000000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    drain_stateless_replies(opts, &next);
+
+    sockaddr_for(target, &dst);
+    proto_for(target->family)->send_stateless((struct sockaddr *)&dst, ttl,
+                                              opts);
+  }
+}
+
+/**
+ * Waits out the replies to the last probes of a walk.
+ */
+static void walk_done(const struct tr_opts *opts, struct tr_walk *walk) {
+  struct timespec until;
+
+  timespec_now(&until);
+  until.tv_sec += opts->timeout;
+  drain_stateless_replies(opts, &until);
+  checkpoint.position = walk->sent;
+}
+
+static void traceroute_stateless(const struct tr_opts *opts,
+                                 struct addrinfo **targets, int ntargets) {
+  int i;
+  struct tr_addr *addrs;
+  struct tr_walk walk;
+
+  if ((addrs = malloc(ntargets * sizeof(*addrs))) == NULL) {
+    errorf("malloc: failed to allocate targets\n");
+  }
+  for (i = 0; i < ntargets; i++) {
+    addr_set(&addrs[i], targets[i]->ai_family,
+             get_in_addr(targets[i]->ai_addr));
+  }
+  walk_init(opts, &walk);
+  walk_stateless(opts, &walk, addrs, ntargets, 0);
+  walk_done(opts, &walk);
+  free(addrs);
+}
+
+/**
+ * Stateless probing of the targets in opts->targets_file, STREAM_CHUNK
+ * of them at a time: each chunk is walked like targets given up front,
+ * permuted within itself, while the next is read in between probes,
+ * so the walk never waits on reading targets or resolving them.
+ * The first chunk must already be in `spare`.
+ *
+ * A resumed walk reads the chunks it had walked again, without probing.
+ */
+static void traceroute_streamed(const struct tr_opts *opts) {
+  uint64_t base = 0, n, nchunk;
+  struct tr_addr *chunk, *t;
+  struct tr_walk walk;
+
+  if ((chunk = malloc(STREAM_CHUNK * sizeof(*chunk))) == NULL) {
+    errorf("malloc: failed to allocate targets\n");
+  }
+  walk_init(opts, &walk);
+  feeding = 1;
+  while (nspare > 0 && !stopping) {
+    t = chunk;
+    chunk = spare;
+    spare = t;
+    nchunk = nspare;
+    nspare = 0;
+
+    n = nchunk * opts->max_ttl * opts->nprobes;
+    if (walk.sent < base + n) {
+      walk_stateless(opts, &walk, chunk, nchunk, base);
+    }
+    base += n;
+    fill_chunk(opts, 1);
+  }
+  feeding = 0;
+  walk_done(opts, &walk);
+  free(chunk);
+}
+
+/**
+ * Returns the bytes of IP and UDP header that probes of `proto` carry.
+ */
+static int probe_overhead(const struct tr_proto *proto) {
+  return (proto->family == AF_INET6 ? sizeof(struct ip6_hdr)
+                                    : sizeof(struct ip)) +
+         sizeof(struct udphdr);
+}
+
+/**
+ * Returns the payload length of the next probe: in PMTU mode,
+ * probes fill the path MTU found so far.
+ */
+static int probe_len(const struct tr_proto *proto,
+                     const struct tr_opts *opts) {
+  return opts->pmtu ? pmtu - probe_overhead(proto) : opts->probe_size;
+}
+
+/**
+ * Returns the MTU of the interface the route to `ai` leaves through,
+ * where a PMTU search starts from. The path MTU the kernel may have
+ * cached for the route is deliberately not used: it could be stale.
+ */
+static int local_mtu(const struct addrinfo *ai) {
+  int fd, mtu = 1500;
+  struct sockaddr_storage src;
+  socklen_t srclen = sizeof(src);
+  struct ifaddrs *ifaddrs, *ifa;
+  struct ifreq ifr;
+
+  if ((fd = socket(ai->ai_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+    errorf("socket: failed to create UDP socket\n");
+  }
+  if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1 ||
+      getsockname(fd, (struct sockaddr *)&src, &srclen) == -1 ||
+      getifaddrs(&ifaddrs) == -1) {
+    close(fd);
+    return mtu;
+  }
+
+  for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != ai->ai_family ||
+        memcmp(get_in_addr(ifa->ifa_addr), get_in_addr((struct sockaddr *)&src),
+               ai->ai_family == AF_INET6 ? sizeof(struct in6_addr)
+                                         : sizeof(struct in_addr)) != 0) {
+      continue;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifa->ifa_name, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(fd, SIOCGIFMTU, &ifr) == 0) {
+      mtu = ifr.ifr_mtu;
+    }
+    break;
+  }
+  freeifaddrs(ifaddrs);
+  close(fd);
+  return mtu < IP_MAXPACKET ? mtu : IP_MAXPACKET;
+}
+
+/**
+ * Sends a single probe and waits for its response.
+ * On a response, the round trip time is stored in `rtt`
+ * and the responder's address is in proto->recv->addr.
+ *
+ * Returns the same values as get_probe_response().
+ */
+static int probe_once(const struct tr_proto *proto, const struct tr_opts *opts,
+                      int ttl, u_short seq, int len, struct timespec *rtt) {
+  int response;
+  struct timespec sent, waited, now, delta;
+  const void *dst = get_in_addr(proto->send->ai->ai_addr);
+
+  timespec_now(&sent);
+  proto->send_probe(ttl, seq, len, opts);
+  probe_add(&probes, proto->family, seq, ttl, &sent);
+  if (capturing) {
+    capture_udp(opts, proto->send->ai->ai_addr, ttl, opts->dport + seq,
+                payload, len, &sent);
+  }
+  if (busy_poll) {
+    // RTTs are measured from before the send, so they include this.
+    timespec_now(&now);
+    timespec_diff(&now, &sent, &delta);
+    send_overhead.tv_sec += delta.tv_sec;
+    send_overhead.tv_nsec += delta.tv_nsec;
+    nsent++;
+  }
+  if ((response = get_probe_response(proto, opts, seq, rtt)) == -3) {
+    probe_remove(probe_find(&probes, proto->family, seq));
+    waited.tv_sec = opts->timeout;
+    waited.tv_nsec = 0;
+    archive_probe(proto, dst, ttl, NULL, &waited);
+  } else {
+    archive_probe(proto, dst, ttl,
+                  get_in_addr((struct sockaddr *)&proto->recv->addr), rtt);
+  }
+  return response;
+}
+
+/**
+ * Searches for the largest packet that gets past hop `ttl` when `failed`
+ * bytes did not, and `mtu` (or 0) is what the hop reported,
+ * and makes it the path MTU.
+ */
+static void search_pmtu(const struct tr_proto *proto,
+                        const struct tr_opts *opts, int ttl, u_short *seq,
+                        int failed, int mtu) {
+  int size, response;
+  struct tr_pmtu_search search;
+  struct timespec rtt;
+
+  pmtu_search_init(&search,
+                   proto->family == AF_INET6 ? PMTU_MIN6 : PMTU_MIN4, failed);
+  pmtu_search_update(&search, failed, 0, mtu);
+  while ((size = pmtu_search_next(&search)) != 0) {
+    response = probe_once(proto, opts, ttl, (*seq)++,
+                          size - probe_overhead(proto), &rtt);
+    pmtu_search_update(&search, size, response != -3 && response != -4,
+                       response == -4 ? proto->recv->mtu : 0);
+  }
+  pmtu = search.lo;
+}
+
+/**
+ * Checks whether a hop that ignored every probe at the path MTU found
+ * so far answers a minimum size one, ie. whether it sits behind a link
+ * that drops larger packets without a word. If so, the path MTU is
+ * searched for.
+ *
+ * Returns 1 if the hop is a black hole, and 0 otherwise.
+ */
+static int check_black_hole(const struct tr_proto *proto,
+                            const struct tr_opts *opts, int ttl,
+                            u_short *seq) {
+  int min = proto->family == AF_INET6 ? PMTU_MIN6 : PMTU_MIN4;
+  struct timespec rtt;
+
+  if (pmtu <= min || probe_once(proto, opts, ttl, (*seq)++,
+                                min - probe_overhead(proto), &rtt) == -3) {
+    return 0;
+  }
+  search_pmtu(proto, opts, ttl, seq, pmtu, 0);
+  return 1;
+}
+
+/**
+ * Probes hops from TTL `first` until the destination responds or
+ * `max_ttl` is passed, printing every response and recording the first
+ * responder of each hop in `path`.
+ *
+ * In PMTU mode every probe is as large as the path MTU found so far,
+ * so the MTU is discovered by the same probes that discover hops.
+ * A hop that reports fragmentation needed lowers the path MTU for
+ * the probes that follow, after a search if it did not say how far,
+ * and the first hop to go silent is probed again at the lower MTU if
+ * it turns out to be a black hole.
+ */
+static void trace_hops(const struct tr_proto *proto,
+                       const struct tr_opts *opts, int first, int max_ttl,
+                       u_short *seq, struct tr_path *path) {
+  double rtt_ms;
+  u_short ttl;
+  int probe, done, response, answered, size, last;
+  void *addr;
+  struct timespec rtt;
+  char s[INET6_ADDRSTRLEN];
+  char h[NI_MAXHOST];
+
+  done = 0;
+  last = first - 1;
+  for (ttl = first; ttl <= max_ttl && !done && !stopping; ttl++) {
+    printf("%2d  ", ttl);
+    fflush(stdout);
+    addr_set(&path->hops[ttl - 1], 0, NULL);
+    path->nhops = ttl;
+    answered = 0;
+
+    for (probe = 0; probe < opts->nprobes && !stopping; probe++, (*seq)++) {
+      if (probe != 0) {
+        printf("    ");
+      }
+      size = pmtu;
+      // TODO: group probe responses by IP
+      switch ((response = probe_once(proto, opts, ttl, *seq,
+                                     probe_len(proto, opts), &rtt))) {
+      case -4:
+      case -2:
+      case -1:
+        answered++;
+        rtt_ms = rtt.tv_sec * 1000.0 + (rtt.tv_nsec / 1000.0 / 1000.0);
+        addr = get_in_addr((struct sockaddr *)&proto->recv->addr);
+        get_host_name((struct sockaddr *)&proto->recv->addr, h, sizeof(h));
+        inet_ntop(proto->family, addr, s, sizeof(s));
+        printf("%s (%s)", h, s);
+        print_annotation(proto->family, addr);
+        printf(" %.3f ms", rtt_ms);
+        if (path->hops[ttl - 1].family == 0) {
+          addr_set(&path->hops[ttl - 1], proto->family, addr);
+          if (aggregate && ttl > 1 && path->hops[ttl - 2].family != 0 &&
+              topo_observe(&topo, &path->hops[ttl - 2], &path->hops[ttl - 1],
+                           rtt.tv_sec * 1000000 + rtt.tv_nsec / 1000) == -1) {
+            errorf("topo: failed to record edge\n");
+          }
+        }
+        if (response == -1) {
+          done = 1;
+        }
+        if (response == -4) {
+          printf(" !F-%d", proto->recv->mtu);
+        }
+        if (response == -4 && opts->pmtu) {
+          if (proto->recv->mtu > 0 && proto->recv->mtu < size) {
+            pmtu = proto->recv->mtu;
+          } else {
+            (*seq)++;
+            search_pmtu(proto, opts, ttl, seq, size, 0);
+          }
+        }
+        break;
+      default:
+        // Timed out, or a reply we do not know what to make of.
+        printf("* ");
+        break;
+      }
+      fflush(stdout);
+      printf("\n");
+      if (pmtu < size) {
+        printf("    pmtu %d\n", pmtu);
+      }
+    }
+
+    if (answered != 0) {
+      last = ttl;
+    } else if (opts->pmtu && ttl == last + 1) {
+      // Past a black hole no hop answers, so only the first silent hop
+      // after the last one that did is worth the extra probe.
+      size = pmtu;
+      if (check_black_hole(proto, opts, ttl, seq)) {
+        printf("    pmtu %d (black hole)\n", pmtu);
+        // The hop only failed to answer because of the MTU, so ask again.
+        if (pmtu < size) {
+          ttl--;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Probes a single hop of `path` until it responds (up to opts->nprobes times)
+ * and compares the responder with the one on record.
+ * Only the destination may answer the last hop with port unreachable,
+ * so a path that got shorter or longer does not pass for the old one.
+ *
+ * Returns 1 if the hop is unchanged, 0 if it changed and -1 if it
+ * did not respond.
+ */
+static int verify_hop(const struct tr_proto *proto, const struct tr_opts *opts,
+                      const struct tr_path *path, int ttl, u_short *seq) {
+  int probe, response;
+  struct tr_addr responder;
+  struct timespec rtt;
+
+  for (probe = 0; probe < opts->nprobes; probe++, (*seq)++) {
+    if ((response = probe_once(proto, opts, ttl, *seq, probe_len(proto, opts),
+                               &rtt)) == -3) {
+      continue;
+    }
+    (*seq)++;
+    addr_set(&responder, proto->family,
+             get_in_addr((struct sockaddr *)&proto->recv->addr));
+    return addr_eq(&responder, &path->hops[ttl - 1]) &&
+           (response == -1) == (ttl == path->nhops);
+  }
+  return -1;
+}
+
+/**
+ * Checks that a cached path still holds by probing its last hop
+ * and PATH_SAMPLES responsive intermediate hops picked at random.
+ * On a mismatch, the hops between the last confirmed hop and the
+ * mismatch are probed to find where the path first diverges.
+ * Intermediate hops that do not respond are given the benefit of the doubt.
+ *
+ * Returns 0 if the path holds and otherwise the first TTL that changed.
+ */
+static int verify_path(const struct tr_proto *proto,
+                       const struct tr_opts *opts, const struct tr_path *path,
+                       u_short *seq) {
+  int i, j, t, ttl, last = 0, nsamples = 0, ncandidates = 0;
+  int samples[PATH_SAMPLES + 1], candidates[UCHAR_MAX];
+
+  for (i = 0; i < path->nhops - 1; i++) {
+    if (path->hops[i].family != 0) {
+      candidates[ncandidates++] = i + 1;
+    }
+  }
+  // Responsive hops without replacement, by a partial Fisher-Yates shuffle.
+  for (i = 0; i < PATH_SAMPLES && i < ncandidates; i++) {
+    j = i + random() % (ncandidates - i);
+    t = candidates[j];
+    candidates[j] = candidates[i];
+    candidates[i] = t;
+    samples[nsamples++] = t;
+  }
+  samples[nsamples++] = path->nhops;
+
+  // Probe samples in increasing TTL order so a change is localized
+  // between the last hop that matched and the first that did not.
+  for (i = 1; i < nsamples; i++) {
+    for (j = i; j > 0 && samples[j - 1] > samples[j]; j--) {
+      t = samples[j];
+      samples[j] = samples[j - 1];
+      samples[j - 1] = t;
+    }
+  }
+
+  for (i = 0; i < nsamples; i++) {
+    ttl = samples[i];
+    switch (verify_hop(proto, opts, path, ttl, seq)) {
+    case 1:
+      last = ttl;
+      break;
+    case -1:
+      // The destination must always answer.
+      if (ttl != path->nhops) {
+        break;
+      }
+      /* fall through */
+    case 0:
+      for (t = last + 1; t < ttl; t++) {
+        if (path->hops[t - 1].family != 0 &&
+            verify_hop(proto, opts, path, t, seq) == 0) {
+          return t;
+        }
+      }
+      return ttl;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Prints hops 1 to `n` of a cached path.
+ */
+static void print_cached_hops(const struct tr_path *path, int n) {
+  int i;
+  char s[INET6_ADDRSTRLEN];
+
+  for (i = 0; i < n; i++) {
+    printf("%2d  %s (cached)\n", i + 1,
+           addr_ntop(&path->hops[i], s, sizeof(s)));
+  }
+}
+
+/**
+ * Prints how `new` differs from `old`, hop by hop.
+ */
+static void print_path_diff(const struct tr_path *old,
+                            const struct tr_path *new) {
+  int i, first;
+  char o[INET6_ADDRSTRLEN], n[INET6_ADDRSTRLEN];
+
+  if ((first = path_divergence(old, new)) == 0) {
+    printf("route unchanged\n");
+    return;
+  }
+  printf("route changed at hop %d:\n", first);
+  for (i = first - 1; i < old->nhops || i < new->nhops; i++) {
+    if (i < old->nhops && i < new->nhops &&
+        addr_eq(&old->hops[i], &new->hops[i])) {
+      continue;
+    }
+    printf("%2d  %s -> %s\n", i + 1,
+           i < old->nhops ? addr_ntop(&old->hops[i], o, sizeof(o)) : "-",
+           i < new->nhops ? addr_ntop(&new->hops[i], n, sizeof(n)) : "-");
+  }
+}
+
+/**
+ * Returns the TTL (or hop limit) the ICMP message just received by
+ * `proto` arrived with, or -1 if it is not known.
+ */
+static int reply_ttl(const struct tr_proto *proto) {
+  if (proto->family == AF_INET6) {
+    return proto->recv->hlim;
+  }
+  return ((const struct ip *)proto->recv->buf)->ip_ttl;
+}
+
+/**
+ * Sends an ICMP echo request numbered `seq` to `ai` with DISTANCE_TTL,
+ * through the raw socket replies are received on.
+ */
+static void send_echo(const struct tr_proto *proto, const struct tr_opts *opts,
+                      const struct addrinfo *ai, u_short seq) {
+  int len, hlen;
+  char buf[DISTANCE_ECHO_LEN];
+  struct sockaddr_storage to;
+  struct timespec now;
+
+  len = distance_echo(proto->family, buf, opts->sport, seq);
+  // Raw IPv6 sockets take a port as the protocol, which must be ours.
+  memcpy(&to, ai->ai_addr, ai->ai_addrlen);
+  sock_set_port((struct sockaddr *)&to, 0);
+  timespec_now(&now);
+  if (sendto(proto->recv->fd, buf, len, 0, (struct sockaddr *)&to,
+             ai->ai_addrlen) == -1) {
+    errorf("sendto: failed to send echo request\n");
+  }
+  if (capturing) {
+    hlen = capture_header(opts, ai->ai_addr, DISTANCE_TTL,
+                          proto->family == AF_INET6 ? IPPROTO_ICMPV6
+                                                    : IPPROTO_ICMP,
+                          len);
+    memcpy(capture_buf + hlen, buf, len);
+    capture_packet(&now, CAPTURE_OUT, capture_buf, hlen + len);
+  }
+}
+
+/**
+ * Sends a UDP probe numbered `seq` to `ai` with DISTANCE_TTL.
+ */
+static void send_distance_probe(const struct tr_proto *proto,
+                                const struct tr_opts *opts,
+                                struct addrinfo *ai, u_short seq) {
+  struct timespec now;
+
+  proto->send->ai = ai;
+  timespec_now(&now);
+  proto->send_probe(DISTANCE_TTL, seq, opts->probe_size, opts);
+  if (capturing) {
+    capture_udp(opts, ai->ai_addr, DISTANCE_TTL, opts->dport + seq, payload,
+                opts->probe_size, &now);
+  }
+}
+
+/**
+ * Checks whether the ICMP message just received by `proto` comes from one
+ * of the `n` targets in `ais`, whose probes are sent with PORT_SEQ()
+ * numbers from `seq` on, in answer to its UDP probe or echo request, and
+ * if so estimates how far away it is into `hops` and `distances`.
+ *
+ * Returns 1 if it did, and 0 otherwise.
+ */
+static int take_distance(const struct tr_proto *proto,
+                         const struct tr_opts *opts, struct addrinfo **ais,
+                         int n, u_short seq, int *hops) {
+  int i, echo;
+  struct tr_reply reply;
+  struct tr_addr dst;
+
+  if ((echo = distance_echo_reply(proto->family, proto->recv->buf,
+                                  proto->recv->bytes, opts->sport)) != -1 &&
+      echo < PROBE_PORT_SPAN) {
+    i = PORT_SEQ(echo + PROBE_PORT_SPAN - seq);
+  } else if (echo == -1 && proto->assess(opts, &reply) != -3 &&
+             reply.seq < PROBE_PORT_SPAN) {
+    i = PORT_SEQ(reply.seq + PROBE_PORT_SPAN - seq);
+  } else {
+    return 0;
+  }
+  // Only the destination itself tells how far away it is: anything else
+  // answering its probe is on the way, or filtering it.
+  if (i >= n || hops[i] != 0 || ais[i]->ai_family != proto->family ||
+      memcmp(get_in_addr(ais[i]->ai_addr),
+             get_in_addr((struct sockaddr *)&proto->recv->addr),
+             proto->family == AF_INET6 ? sizeof(struct in6_addr)
+                                       : sizeof(struct in_addr)) != 0 ||
+      (hops[i] = distance_from_ttl(reply_ttl(proto))) == 0) {
+    return 0;
+  }
+  addr_set(&dst, proto->family, get_in_addr(ais[i]->ai_addr));
+  if (distance_put(&distances, &dst, hops[i]) == -1) {
+    errorf("malloc: failed to allocate distance\n");
+  }
+  return 1;
+}
+
+/**
+ * Estimates how many hops away each of the `n` targets in `ais` is into
+ * `hops` (0 where it cannot tell) from the TTL its reply to a probe sent
+ * with DISTANCE_TTL arrives with, DISTANCE_BATCH targets at a time: a UDP
+ * probe to each at once, then an ICMP echo request to those whose UDP probe
+ * the destination itself did not answer, with opts->timeout for replies
+ * after each. Targets already in `distances`, or in a prefix that is,
+ * are not probed. Target i's probes are numbered `seq` + i, and sent with
+ * its PORT_SEQ(), which a batch never uses twice.
+ *
+ * Returns how many probes were sent.
+ */
+static int estimate_distances(const struct tr_opts *opts,
+                              struct addrinfo **ais, int n, uint32_t seq,
+                              int *hops) {
+  int i, first, last, echo, pending, nsent = 0;
+  struct tr_addr dst;
+  const struct tr_proto *proto;
+  struct timespec end, now, wait;
+
+  for (first = 0; first < n && !stopping; first = last) {
+    last = n - first < DISTANCE_BATCH ? n : first + DISTANCE_BATCH;
+    for (echo = 0; echo < 2 && !stopping; echo++) {
+      pending = 0;
+      for (i = first; i < last; i++) {
+        if (!echo) {
+          addr_set(&dst, ais[i]->ai_family, get_in_addr(ais[i]->ai_addr));
+          hops[i] = distance_get(&distances, &dst);
+        }
+        if (hops[i] != 0) {
+          continue;
+        }
+        if (echo) {
+          send_echo(proto_for(ais[i]->ai_family), opts, ais[i],
+                    PORT_SEQ(seq + i));
+        } else {
+          send_distance_probe(proto_for(ais[i]->ai_family), opts, ais[i],
+                              PORT_SEQ(seq + i));
+        }
+        pending++;
+        nsent++;
+      }
+
+      timespec_now(&end);
+      end.tv_sec += opts->timeout;
+      while (pending > 0 && !stopping) {
+        timespec_now(&now);
+        if (timespec_diff(&end, &now, &wait) == -1) {
+          break;
+        }
+        if ((proto = poll_icmp_message(&wait)) != NULL &&
+            take_distance(proto, opts, ais + first, last - first,
+                          PORT_SEQ(seq + first), hops + first)) {
+          pending--;
+        }
+      }
+    }
+  }
+  return nsent;
+}
+
+/**
+ * Returns how far to probe a target found to be `hops` hops away,
+ * or opts->max_ttl if that is not known.
+ */
+static int capped_ttl(const struct tr_opts *opts, int hops) {
+  if (hops == 0 || hops + DISTANCE_MARGIN >= opts->max_ttl) {
+    return opts->max_ttl;
+  }
+  return hops + DISTANCE_MARGIN;
+}
+
+/**
+ * Traces the route to a single target, one probe at a time.
+ *
+ * With a path cache, a known path is only verified (see verify_path())
+ * and re-traced from the first hop that changed. Otherwise, when
+ * estimating distances, hops are probed no further than DISTANCE_MARGIN
+ * past how far away the target is estimated to be.
+ *
+ * Returns 0 once the target is done and -1 if it was stopped short.
+ */
+static int traceroute_target(const struct tr_opts *opts,
+                              const char *hostname, struct addrinfo *ai,
+                              struct tr_path_cache *cache) {
+  u_short seq;
+  int first, distance, max_ttl;
+  const struct tr_proto *proto;
+  const struct tr_path *old = NULL;
+  struct tr_path path;
+  struct tr_addr hops[UCHAR_MAX];
+  char s[INET6_ADDRSTRLEN];
+
+  proto = proto_for(ai->ai_family);
+  proto->send->ai = ai;
+
+  if (opts->pmtu) {
+    pmtu = local_mtu(ai);
+  }
+
+  addr_set(&path.dst, ai->ai_family, get_in_addr(ai->ai_addr));
+  path.hops = hops;
+  path.nhops = 0;
+
+  seq = 0;
+  first = 1;
+  max_ttl = opts->max_ttl;
+  if (cache == NULL || (old = path_cache_find(cache, &path.dst)) == NULL ||
+      old->nhops == 0 || old->nhops > opts->max_ttl) {
+    old = NULL;
+  }
+  if (opts->distance && old == NULL) {
+    // Its late replies are told apart from the trace's by their number.
+    estimate_distances(opts, &ai, 1, seq++, &distance);
+    max_ttl = capped_ttl(opts, distance);
+  }
+
+  inet_ntop(ai->ai_family, get_in_addr(ai->ai_addr), s, sizeof(s));
+  printf("traceroute to %s (%s), %d hops max, %d byte packets\n", hostname,
+         s, max_ttl, opts->pmtu ? pmtu : opts->probe_size);
+  fflush(stdout);
+
+  if (old != NULL) {
+    if ((first = verify_path(proto, opts, old, &seq)) == 0) {
+      print_cached_hops(old, old->nhops);
+      printf("route unchanged, verified with %d probes\n", seq);
+      return 0;
+    }
+    print_cached_hops(old, first - 1);
+    memcpy(hops, old->hops, (first - 1) * sizeof(*hops));
+  }
+
+  trace_hops(proto, opts, first, max_ttl, &seq, &path);
+  if (stopping) {
+    printf("stopped\n");
+    return -1;
+  }
+  if (opts->pmtu) {
+    printf("path MTU %d\n", pmtu);
+  }
+  // How far the trace reached it beats an estimate, for its neighbours too.
+  if (opts->distance && path.nhops > 0 &&
+      addr_eq(&path.hops[path.nhops - 1], &path.dst) &&
+      distance_put(&distances, &path.dst, path.nhops) == -1) {
+    errorf("malloc: failed to allocate distance\n");
+  }
+
+  if (cache != NULL) {
+    if (old != NULL) {
+      print_path_diff(old, &path);
+    }
+    if (path_cache_put(cache, &path) == -1) {
+      errorf("path cache: failed to store path to %s\n", hostname);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Prints what a scheduled batch learned about one target, one line per hop:
+ * the first responder and the RTT of every attempt sent, in the order sent.
+ */
+static void print_scheduled(const struct tr_opts *opts,
+                            const struct tr_schedule *sched, int target,
+                            const char *hostname, const struct addrinfo *ai) {
+  int ttl, attempt;
+  uint32_t rtt_us;
+  const struct schedule_hop *hop, *prev = NULL;
+  char s[INET6_ADDRSTRLEN];
+
+  inet_ntop(ai->ai_family, get_in_addr(ai->ai_addr), s, sizeof(s));
+  printf("traceroute to %s (%s), %d hops max, %d byte packets\n",
+         hostname != NULL ? hostname : s, s, sched->targets[target].max_ttl,
+         opts->probe_size);
+
+  for (ttl = 1; ttl <= schedule_nhops(sched, target); ttl++) {
+    hop = schedule_hop(sched, target, ttl);
+    printf("%2d ", ttl);
+    if (hop->responder.family != 0) {
+      printf(" %s", addr_ntop(&hop->responder, s, sizeof(s)));
+      print_annotation(hop->responder.family, &hop->responder.u);
+    }
+    for (attempt = 0; attempt < hop->sent; attempt++) {
+      if ((rtt_us = schedule_rtt(sched, target, ttl, attempt)) ==
+          SCHEDULE_NO_RTT) {
+        printf(" *");
+      } else if (rtt_us == SCHEDULE_LIMITED_RTT) {
+        printf(" rate-limited");
+      } else {
+        printf(" %.3f ms", rtt_us / 1000.0);
+        if (aggregate && prev != NULL && prev->responder.family != 0 &&
+            hop->responder.family != 0 &&
+            topo_observe(&topo, &prev->responder, &hop->responder, rtt_us) ==
+                -1) {
+          errorf("topo: failed to record edge\n");
+        }
+      }
+    }
+    printf("\n");
+    prev = hop;
+  }
+  fflush(stdout);
+}
+
+/**
+ * Returns the rate limit state of the responder at `addr`, valid until
+ * the next call.
+ */
+static struct tr_responder *responder_at(const struct tr_addr *addr) {
+  struct tr_responder *r;
+
+  if ((r = ratelimit_get(&ratelimit, addr)) == NULL) {
+    errorf("malloc: failed to allocate responder\n");
+  }
+  return r;
+}
+
+/**
+ * Returns the hop before `ttl` on the path to `target`, with family 0
+ * for ourselves before the first, or NULL if it is not known.
+ */
+static const struct tr_addr *hop_before(const struct tr_schedule *sched,
+                                        int target, int ttl) {
+  static const struct tr_addr origin;
+  const struct tr_addr *prev;
+
+  if (ttl == 1) {
+    return &origin;
+  }
+  prev = &schedule_hop(sched, target, ttl - 1)->responder;
+  return prev->family != 0 ? prev : NULL;
+}
+
+/**
+ * Sets `via` to the responder a probe of `ttl` to `target` is expected to
+ * expire at, family 0 if not known: the hop's first responder, or else
+ * whoever last answered one hop further than the hop before it (which the
+ * first hop of most targets shares).
+ */
+static void expected_at(const struct tr_schedule *sched, int target, int ttl,
+                        struct tr_addr *via) {
+  const struct tr_addr *prev;
+
+  *via = schedule_hop(sched, target, ttl)->responder;
+  if (via->family == 0 && (prev = hop_before(sched, target, ttl)) != NULL) {
+    *via = responder_at(prev)->next;
+  }
+}
+
+/**
+ * Admits a probe of `ttl` to `target` if its port is free and the
+ * responder it is expected to expire at is not known, or its rate limit
+ * allows it, and sets `admitted` to that responder.
+ */
+static int admit_paced(void *arg, int target, int ttl) {
+  uint64_t wait;
+
+  if (paced_now < port_free) {
+    paced_until = port_free;
+    return 0;
+  }
+  expected_at(arg, target, ttl, &admitted);
+  if (admitted.family == 0 ||
+      (wait = ratelimit_admit(responder_at(&admitted), paced_now)) == 0) {
+    return 1;
+  }
+  if (paced_until == 0 || paced_now + wait < paced_until) {
+    paced_until = paced_now + wait;
+  }
+  return 0;
+}
+
+/**
+ * Prints the responders found to limit their ICMP rate to stderr,
+ * and returns how many probes were lost to those limits.
+ */
+static uint64_t report_ratelimits() {
+  uint32_t i;
+  uint64_t nlimited = 0;
+  const struct tr_responder *r;
+  char s[INET6_ADDRSTRLEN];
+
+  for (i = 0; i < ratelimit.nresponders; i++) {
+    r = &ratelimit.responders[i];
+    nlimited += r->nlimited;
+    if (r->addr.family != 0 && r->limit > 0) {
+      fprintf(stderr, "ratelimit: %s answers about %u a second\n",
+              addr_ntop(&r->addr, s, sizeof(s)), r->limit);
+    }
+  }
+  return nlimited;
+}
+
+/**
+ * Traces a batch of targets within `opts->deadline` seconds and
+ * `opts->budget` probes, sending whichever probe tells us the most next
+ * (see schedule.c) with up to SCHEDULE_WINDOW of them outstanding.
+ * Probes are paced under the ICMP rate limits of the responders they are
+ * expected to expire at (see ratelimit.c), so that a hop which is only
+ * limited does not look lossy, and its unanswered probes are reported
+ * as rate-limited. When either runs out, what was learned is printed.
+ *
+ * When estimating distances, they are estimated for the whole batch
+ * before the deadline starts, and each target's hops are probed at once
+ * up to DISTANCE_MARGIN past its own.
+ */
+static void traceroute_scheduled(const struct tr_opts *opts,
+                                 struct addrinfo **targets, int ntargets,
+                                 char **hostnames) {
+  int i, target, ttl, attempt, result, ready, stopped = 0, interrupted = 0;
+  int *distance, nprobed, nestimated = 0;
+  uint32_t seq = 0, oldest = 0;
+  uint64_t sent = 0, interval = 0, now_us, nlimited;
+  static struct {
+    int target;
+    int attempt;
+    int family; // 0 if the port was never used.
+    uint64_t sent_us;
+    struct tr_addr via; // Expected to answer, or family 0 if not known.
+  } flight[PROBE_PORT_SPAN]; // By PORT_SEQ() of the probe's number.
+  struct tr_schedule sched;
+  struct tr_probe *probe;
+  struct tr_reply reply;
+  struct tr_addr responder, via;
+  const struct tr_addr *prev;
+  const struct tr_proto *proto;
+  struct timespec start, now, end, next, expiry, wait, elapsed, rtt, paced;
+
+  if (schedule_init(&sched, ntargets, opts->max_ttl, opts->nprobes,
+                    opts->budget > 0 ? (uint64_t)opts->budget : UINT64_MAX) ==
+      -1) {
+    errorf("malloc: failed to allocate schedule\n");
+  }
+  ratelimit_init(&ratelimit);
+  memset(flight, 0, sizeof(flight));
+  sched.admit = admit_paced;
+  sched.arg = &sched;
+  if (opts->rate > 0) {
+    interval = 1000000000ULL / opts->rate;
+  }
+  if (opts->distance) {
+    if ((distance = calloc(ntargets, sizeof(*distance))) == NULL) {
+      errorf("malloc: failed to allocate distances\n");
+    }
+    nprobed = estimate_distances(opts, targets, ntargets, seq, distance);
+    // The trace's probes are numbered on from theirs, so it starts on the
+    // ports they used longest ago.
+    seq = oldest = ntargets;
+    for (i = 0; i < ntargets; i++) {
+      if (distance[i] != 0) {
+        schedule_cap(&sched, i, capped_ttl(opts, distance[i]));
+        nestimated++;
+      }
+    }
+    fprintf(stderr, "distance: %d of %d targets estimated with %d probes\n",
+            nestimated, ntargets, nprobed);
+    free(distance);
+  }
+
+  timespec_now(&start);
+  end = start;
+  end.tv_sec += opts->deadline;
+  next = start;
+  do {
+    timespec_now(&now);
+    if (stopping) {
+      interrupted = 1;
+      break;
+    }
+    if (opts->deadline > 0 && timespec_ge(&now, &end)) {
+      stopped = 1;
+      break;
+    }
+
+    // Outstanding probes expire in the order they were sent.
+    for (; oldest != seq; oldest++) {
+      i = PORT_SEQ(oldest);
+      if ((probe = probe_find(&probes, flight[i].family, i)) == NULL) {
+        continue;
+      }
+      timespec_diff(&now, &probe->sent, &elapsed);
+      if (elapsed.tv_sec < opts->timeout) {
+        break;
+      }
+      schedule_timeout(&sched, flight[i].target, probe->ttl);
+      // Sent before it was known where to, it counts for where it is now.
+      if ((via = flight[i].via).family == 0) {
+        expected_at(&sched, flight[i].target, probe->ttl, &via);
+      }
+      now_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+      if (via.family != 0 &&
+          ratelimit_lost(responder_at(&via), now_us,
+                         flight[i].via.family != 0)) {
+        schedule_limited(&sched, flight[i].target, probe->ttl,
+                         flight[i].attempt);
+      }
+      archive_probe(proto_for(flight[i].family),
+                    get_in_addr(targets[flight[i].target]->ai_addr),
+                    probe->ttl, NULL, &elapsed);
+      probe_remove(probe);
+    }
+
+    ready = seq - oldest < SCHEDULE_WINDOW &&
+            timespec_ge(&now, &next);
+    attempt = -1;
+    if (ready) {
+      paced_now = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+      paced_until = 0;
+      // A reply to the port's last probe past twice the timeout is no
+      // longer expected, so it cannot be taken for one to the next.
+      i = PORT_SEQ(seq);
+      port_free = flight[i].family != 0
+                      ? flight[i].sent_us + 2000000ULL * opts->timeout
+                      : 0;
+      attempt = schedule_next(&sched, &target, &ttl);
+    }
+    if (attempt >= 0) {
+      proto = proto_for(targets[target]->ai_family);
+      proto->send->ai = targets[target];
+      i = PORT_SEQ(seq);
+      timespec_now(&now);
+      proto->send_probe(ttl, i, probe_len(proto, opts), opts);
+      probe_add(&probes, proto->family, i, ttl, &now);
+      if (capturing) {
+        capture_udp(opts, targets[target]->ai_addr, ttl, opts->dport + i,
+                    payload, probe_len(proto, opts), &now);
+      }
+      flight[i].target = target;
+      flight[i].attempt = attempt;
+      flight[i].family = proto->family;
+      flight[i].sent_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+      flight[i].via = admitted;
+      seq++;
+      sent++;
+      next.tv_sec = start.tv_sec + sent * interval / 1000000000;
+      next.tv_nsec = start.tv_nsec + sent * interval % 1000000000;
+      if (next.tv_nsec >= 1000000000) {
+        next.tv_sec++;
+        next.tv_nsec -= 1000000000;
+      }
+      continue;
+    }
+    if (attempt == -1 && ready && oldest == seq) {
+      // Nothing outstanding and nothing left worth sending.
+      break;
+    }
+
+    // Wait for a reply until the oldest probe expires, it is time to
+    // send again or the deadline passes, whichever comes first.
+    if (oldest == seq) {
+      expiry = next;
+    } else {
+      i = PORT_SEQ(oldest);
+      probe = probe_find(&probes, flight[i].family, i);
+      expiry = probe->sent;
+      expiry.tv_sec += opts->timeout;
+      if (!ready && seq - oldest < SCHEDULE_WINDOW &&
+          timespec_ge(&expiry, &next)) {
+        expiry = next;
+      }
+    }
+    if (attempt == SCHEDULE_DEFERRED) {
+      // Or until the first probe held back by a rate limit may be sent.
+      paced.tv_sec = paced_until / 1000000;
+      paced.tv_nsec = paced_until % 1000000 * 1000;
+      if (oldest == seq || timespec_ge(&expiry, &paced)) {
+        expiry = paced;
+      }
+    }
+    if (opts->deadline > 0 && timespec_ge(&expiry, &end)) {
+      expiry = end;
+    }
+    if (timespec_diff(&expiry, &now, &wait) == -1) {
+      wait.tv_sec = 0;
+      wait.tv_nsec = 0;
+    }
+    if ((proto = poll_icmp_message(&wait)) == NULL ||
+        (result = proto->assess(opts, &reply)) == -3 ||
+        reply.seq >= PROBE_PORT_SPAN ||
+        (probe = probe_find(&probes, proto->family, reply.seq)) == NULL ||
+        !reply_quotes_dst(proto, &reply,
+                          targets[flight[reply.seq].target]->ai_addr)) {
+      continue;
+    }
+    i = reply.seq;
+    timespec_diff(&proto->recv->received, &probe->sent, &rtt);
+    addr_set(&responder, proto->family,
+             get_in_addr((struct sockaddr *)&proto->recv->addr));
+    // A probe answered by another responder than expected counts for it.
+    now_us = proto->recv->received.tv_sec * 1000000ULL +
+             proto->recv->received.tv_nsec / 1000;
+    if (flight[i].via.family != 0 && !addr_eq(&flight[i].via, &responder)) {
+      ratelimit_uncount(responder_at(&flight[i].via));
+    }
+    ratelimit_answered(responder_at(&responder), now_us,
+                       addr_eq(&flight[i].via, &responder));
+    if ((prev = hop_before(&sched, flight[i].target, probe->ttl)) != NULL) {
+      responder_at(prev)->next = responder;
+    }
+    // Any unreachable but time exceeded ends the path where it was sent.
+    schedule_answer(&sched, flight[i].target, probe->ttl, flight[i].attempt,
+                    &responder, rtt.tv_sec * 1000000 + rtt.tv_nsec / 1000,
+                    result != -2 && result != -4);
+    archive_probe(proto, get_in_addr(targets[flight[i].target]->ai_addr),
+                  probe->ttl, &responder.u, &rtt);
+    probe_remove(probe);
+  } while (1);
+
+  // Whatever is still outstanding at the deadline counts as unanswered.
+  for (; oldest != seq; oldest++) {
+    i = PORT_SEQ(oldest);
+    if ((probe = probe_find(&probes, flight[i].family, i)) != NULL) {
+      probe_remove(probe);
+    }
+  }
+
+  for (i = 0; i < ntargets; i++) {
+    print_scheduled(opts, &sched, i, hostnames != NULL ? hostnames[i] : NULL,
+                    targets[i]);
+  }
+  timespec_now(&now);
+  timespec_diff(&now, &start, &elapsed);
+  nlimited = report_ratelimits();
+  printf("%llu probes in %.3f s%s", (unsigned long long)sent,
+         elapsed.tv_sec + elapsed.tv_nsec / 1e9,
+         interrupted                               ? ", interrupted"
+         : stopped                                 ? ", stopped at the deadline"
+         : opts->budget > 0 && sched.budget == 0 ? ", probe budget spent"
+                                                   : "");
+  if (nlimited > 0) {
+    printf(", %llu lost to rate limits", (unsigned long long)nlimited);
+  }
+  printf("\n");
+  ratelimit_free(&ratelimit);
+  schedule_free(&sched);
+}
+
+/**
+ * Reports a replayed probe that was never answered in time.
+ */
+static void expire_replayed(const struct tr_opts *opts, struct tr_probe *probe,
+                            const struct tr_addr *dst) {
+  struct timespec waited;
+
+  waited.tv_sec = opts->timeout;
+  waited.tv_nsec = 0;
+  pipe_result(proto_for(probe->family), &dst->u, probe->ttl, NULL, &waited);
+  probe_remove(probe);
+}
+
+/**
+ * Hands an ICMP message captured from `src` to `proto`
+ * as if it had just been received on its raw socket.
+ */
+static void inject_reply(const struct tr_proto *proto, const uint8_t *msg,
+                         uint32_t len, const void *src,
+                         const struct timespec *received) {
+  struct tr_recv *recv = proto->recv;
+
+  recv->bytes = len < sizeof(recv->buf) ? len : sizeof(recv->buf);
+  memcpy(recv->buf, msg, recv->bytes);
+  memset(&recv->addr, 0, sizeof(recv->addr));
+  recv->addr.ss_family = proto->family;
+  memcpy(get_in_addr((struct sockaddr *)&recv->addr), src,
+         proto->family == AF_INET6 ? sizeof(struct in6_addr)
+                                   : sizeof(struct in_addr));
+  recv->addrlen = socklen((struct sockaddr *)&recv->addr);
+  recv->received = *received;
+}
+
+/**
+ * Replays a capture of a run of ours through the same matching and
+ * parsing as live replies, as fast as it can be read or, with
+ * `opts->replay_timed`, at the pace it was recorded. Probes are taken
+ * from the UDP packets sent from our source port, which is learned from
+ * the first packet that looks like a probe, and replies from the ICMP
+ * messages quoting them. Each probe's outcome is printed once known.
+ */
+static void traceroute_replay(struct tr_opts *opts) {
+  int family, proto_num, result, ttl;
+  u_short sport, dport, seq;
+  uint32_t len, tlen;
+  uint64_t npackets = 0, nbytes = 0, nsent = 0, nmatched = 0;
+  const uint8_t *ip, *l4;
+  const struct tr_proto *proto;
+  struct tr_capture capture;
+  struct capture_packet pkt;
+  struct tr_reply reply;
+  struct tr_probe *probe;
+  struct tr_addr responder;
+  static struct tr_addr dsts[PROBE_TABLE_SIZE];
+  struct timespec start, now, first, offset, elapsed, rtt;
+
+  if (capture_open(&capture, opts->replay) == -1) {
+    errorf("capture: failed to open %s\n", opts->replay);
+  }
+  opts->sport = 0;
+
+  timespec_now(&start);
+  while (!stopping && (result = capture_next(&capture, &pkt)) == 1) {
+    if (npackets++ == 0) {
+      first = pkt.ts;
+    }
+    nbytes += pkt.len;
+    if (opts->replay_timed && timespec_diff(&pkt.ts, &first, &offset) == 1) {
+      timespec_now(&now);
+      timespec_diff(&now, &start, &elapsed);
+      if (timespec_diff(&offset, &elapsed, &offset) == 1) {
+        nanosleep(&offset, NULL);
+      }
+    }
+    if ((ip = capture_ip(&pkt, &family, &len)) == NULL ||
+        (l4 = capture_transport(ip, family, len, &proto_num, &tlen)) == NULL) {
+      continue;
+    }
+    proto = proto_for(family);
+
+    if (proto_num == IPPROTO_UDP && tlen >= sizeof(struct udphdr)) {
+      sport = ntohs(((const struct udphdr *)l4)->uh_sport);
+      dport = ntohs(((const struct udphdr *)l4)->uh_dport);
+      seq = dport - opts->dport;
+      if (opts->sport == 0 && seq < opts->max_ttl * opts->nprobes) {
+        opts->sport = sport;
+      }
+      if (sport != opts->sport) {
+        continue;
+      }
+      // A probe still waiting in the slot has long since timed out.
+      probe = &probes.probes[seq & (PROBE_TABLE_SIZE - 1)];
+      if (probe->state == PROBE_SENT) {
+        expire_replayed(opts, probe, &dsts[seq & (PROBE_TABLE_SIZE - 1)]);
+      }
+      ttl = family == AF_INET6 ? ((const struct ip6_hdr *)ip)->ip6_hlim
+                               : ((const struct ip *)ip)->ip_ttl;
+      probe_add(&probes, family, seq, ttl, &pkt.ts);
+      addr_set(&dsts[seq & (PROBE_TABLE_SIZE - 1)], family,
+               family == AF_INET6
+                   ? (const void *)&((const struct ip6_hdr *)ip)->ip6_dst
+                   : (const void *)&((const struct ip *)ip)->ip_dst);
+      nsent++;
+    } else if ((family == AF_INET && proto_num == IPPROTO_ICMP) ||
+               (family == AF_INET6 && proto_num == IPPROTO_ICMPV6)) {
+      // Raw IPv4 sockets deliver the IP header, raw ICMPv6 sockets do not.
+      inject_reply(proto, family == AF_INET6 ? l4 : ip,
+                   family == AF_INET6 ? tlen : len,
+                   family == AF_INET6
+                       ? (const void *)&((const struct ip6_hdr *)ip)->ip6_src
+                       : (const void *)&((const struct ip *)ip)->ip_src,
+                   &pkt.ts);
+      if (proto->assess(opts, &reply) == -3 ||
+          (probe = probe_find(&probes, family, reply.seq)) == NULL ||
+          timespec_diff(&pkt.ts, &probe->sent, &rtt) == -1 ||
+          rtt.tv_sec >= opts->timeout) {
+        continue;
+      }
+      addr_set(&responder, family,
+               get_in_addr((struct sockaddr *)&proto->recv->addr));
+      pipe_result(proto, &dsts[reply.seq & (PROBE_TABLE_SIZE - 1)].u,
+                  probe->ttl, &responder.u, &rtt);
+      probe_remove(probe);
+      nmatched++;
+    }
+  }
+  if (result == -1) {
+    errorf("capture: %s is truncated or corrupt\n", opts->replay);
+  }
+  for (seq = 0; seq < PROBE_TABLE_SIZE; seq++) {
+    if (probes.probes[seq].state == PROBE_SENT) {
+      expire_replayed(opts, &probes.probes[seq], &dsts[seq]);
+    }
+  }
+  capture_close(&capture);
+  pipeline_sync();
+
+  timespec_now(&now);
+  timespec_diff(&now, &start, &elapsed);
+  fflush(stdout);
+  fprintf(stderr,
+          "replay: %llu packets (%llu bytes), %llu probes, %llu replies in "
+          "%.3f s, %.0f packets/s\n",
+          (unsigned long long)npackets, (unsigned long long)nbytes,
+          (unsigned long long)nsent, (unsigned long long)nmatched,
+          elapsed.tv_sec + elapsed.tv_nsec / 1e9,
+          npackets / (elapsed.tv_sec + elapsed.tv_nsec / 1e9));
+}
+
+/**
+ * Asks the kernel to busy poll the device queue for `fd` when it is read,
+ * rather than waiting for an interrupt. Setting this needs CAP_NET_ADMIN
+ * (hence it is done before privileges are dropped) and a kernel and driver
+ * that support it; without it we still spin, just not as deep.
+ */
+static void set_busy_poll(int fd) {
+  int val;
+
+#ifdef SO_BUSY_POLL
+  val = BUSY_POLL_USEC;
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == -1) {
+    fprintf(stderr, "busy poll: SO_BUSY_POLL unavailable\n");
+  }
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+  val = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val)) ==
+      -1) {
+    fprintf(stderr, "busy poll: SO_PREFER_BUSY_POLL unavailable\n");
+  }
+#endif
+  (void)val;
+}
+
+/**
+ * Pins us to `opts->busy_cpu` and reports what reading the clock and
+ * one spin of the receive loop cost, which bound how finely replies
+ * can be timed.
+ */
+static void start_busy_poll(const struct tr_opts *opts) {
+  int i;
+  struct timespec start, end, clock_cost, spin_cost;
+  struct tr_recv *recv = protos[0]->recv;
+#ifdef __linux__
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  CPU_SET(opts->busy_cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+    errorf("sched_setaffinity: failed to pin to CPU %d\n", opts->busy_cpu);
+  }
+#endif
+
+  timespec_now(&start);
+  for (i = 0; i < BUSY_POLL_CALIBRATION; i++) {
+    timespec_now(&end);
+  }
+  timespec_diff(&end, &start, &clock_cost);
+
+  // Replies that arrive now would only skew the measurement a little,
+  // and a second receive socket costs the same to poll.
+  timespec_now(&start);
+  for (i = 0; i < BUSY_POLL_CALIBRATION; i++) {
+    recvfrom(recv->fd, recv->buf, sizeof(recv->buf), MSG_DONTWAIT, NULL, NULL);
+  }
+  timespec_now(&end);
+  timespec_diff(&end, &start, &spin_cost);
+
+  fprintf(stderr,
+          "busy poll: CPU %d, clock read %.0f ns, spin %.0f ns per socket\n",
+          opts->busy_cpu,
+          (clock_cost.tv_sec * 1e9 + clock_cost.tv_nsec) / BUSY_POLL_CALIBRATION,
+          (spin_cost.tv_sec * 1e9 + spin_cost.tv_nsec) / BUSY_POLL_CALIBRATION);
+  busy_poll = 1;
+}
+
+/**
+ * Reports the mean cost of sending a probe, which RTTs include.
+ */
+static void stop_busy_poll(void) {
+  fflush(stdout);
+  if (nsent > 0) {
+    fprintf(stderr, "busy poll: send %.0f ns per probe over %ld probes\n",
+            (send_overhead.tv_sec * 1e9 + send_overhead.tv_nsec) / nsent,
+            nsent);
+  }
+  busy_poll = 0;
+}
+
+/**
+ * Starts capturing every probe and ICMP message to opts->capture.
+ */
+static void start_capture(const struct tr_opts *opts) {
+  struct timespec now, epoch;
+
+  if (capture_writer_open(&capture_out, opts->capture,
+                          (size_t)opts->capture_mb << 20) == -1) {
+    errorf("capture: failed to open %s.0.pcapng\n", opts->capture);
+  }
+  timespec_now(&now);
+  clock_gettime(CLOCK_REALTIME, &epoch);
+  timespec_diff(&epoch, &now, &capture_epoch);
+  capturing = 1;
+}
+
+static void stop_capture(const struct tr_opts *opts) {
+  fflush(stdout);
+  fprintf(stderr, "capture: %llu packets, %llu dropped while rotating\n",
+          (unsigned long long)capture_out.npackets,
+          (unsigned long long)capture_out.ndropped);
+  if (capture_writer_close(&capture_out) == -1) {
+    errorf("capture: failed to write %s\n", opts->capture);
+  }
+  capturing = 0;
+}
+
+/**
+ * Opens the raw sockets of `proto` unless they are already open:
+ * for receiving ICMP responses and, for stateless probing, for sending
+ * probes sourced as if sent to `dst`.
+ */
+static void open_proto(const struct tr_opts *opts,
+                       const struct tr_proto *proto,
+                       const struct sockaddr *dst) {
+  int i;
+
+  for (i = 0; i < nprotos; i++) {
+    if (protos[i] == proto) {
+      return;
+    }
+  }
+  protos[nprotos++] = proto;
+
+  proto->recv_socket();
+  if (opts->stateless && proto->stateless_socket != NULL) {
+    proto->stateless_socket(dst);
+  }
+  if (opts->distance) {
+    distance_socket(proto);
+  }
+  if (opts->busy_cpu >= 0) {
+    set_busy_poll(proto->recv->fd);
+  }
+}
+
+/**
+ * Drops the privileges needed to open raw sockets,
+ * then opens the sockets for sending probes.
+ */
+static void open_send_sockets(struct tr_opts *opts) {
+  int i;
+
+  // Special permissions only required to open raw socket.
+  setuid(getuid());
+
+  // Setup sockets for sending messages.
+  opts->sport = (getpid() & 0xffff) | 0x8000;
+  for (i = 0; i < nprotos; i++) {
+    protos[i]->send_socket(opts);
+  }
+}
+
+/**
+ * Opens the sockets for every address family among `targets`,
+ * then drops the privileges needed to open raw sockets.
+ * Stateless probes are sourced as if sent to the first target.
+ */
+static void open_sockets(struct tr_opts *opts, struct addrinfo **targets,
+                         int ntargets) {
+  int i;
+
+  nprotos = 0;
+  for (i = 0; i < ntargets; i++) {
+    open_proto(opts, proto_for(targets[i]->ai_family), targets[i]->ai_addr);
+  }
+  open_send_sockets(opts);
+}
+
+/**
+ * Returns `addr` in a heap allocated addrinfo, as getaddrinfo() would.
+ * Free it with free().
+ */
+static struct addrinfo *addrinfo_for(const struct tr_addr *addr) {
+  struct {
+    struct addrinfo ai;
+    struct sockaddr_storage ss;
+  } *p;
+
+  if ((p = calloc(1, sizeof(*p))) == NULL) {
+    errorf("malloc: failed to allocate target\n");
+  }
+  p->ai.ai_family = addr->family;
+  p->ai.ai_socktype = SOCK_DGRAM;
+  p->ai.ai_protocol = IPPROTO_UDP;
+  p->ai.ai_addr = (struct sockaddr *)&p->ss;
+  p->ai.ai_addrlen = sockaddr_for(addr, &p->ss);
+  return &p->ai;
+}
+
+/**
+ * Queues every target for resolution through the nameserver
+ * in /etc/resolv.conf.
+ */
+static void start_resolver(const struct tr_opts *opts,
+                           struct tr_resolver *resolver) {
+  int i;
+  struct sockaddr_storage server;
+  socklen_t len;
+
+  resolver_default_server(&server, &len);
+  if (resolver_init(resolver, (struct sockaddr *)&server, len, opts->family) ==
+      -1) {
+    errorf("resolver: failed to open socket to nameserver\n");
+  }
+  for (i = 0; i < opts->nhostnames; i++) {
+    if (resolver_add(resolver, opts->hostnames[i]) == -1) {
+      errorf("resolver: failed to queue %s\n", opts->hostnames[i]);
+    }
+  }
+}
+
+/**
+ * Waits for the next target to resolve.
+ *
+ * Returns the number of its addresses to trace (all of them, or the first
+ * with `opts->all_addrs` unset), or 0 if it did not resolve.
+ * Returns -1 once every target has been handed out.
+ */
+static int next_resolved(const struct tr_opts *opts,
+                         struct tr_resolver *resolver,
+                         const struct tr_resolved **res) {
+  while ((*res = resolver_next(resolver)) == NULL) {
+    if (resolver_pending(resolver) == 0) {
+      return -1;
+    }
+    if (resolver_poll(resolver, -1) == -1) {
+      errorf("resolver: failed to query nameserver\n");
+    }
+  }
+  if ((*res)->error != 0) {
+    fprintf(stderr, "resolver: %s: %s\n", (*res)->name,
+            resolver_strerror((*res)->error));
+    return 0;
+  }
+  return opts->all_addrs ? (*res)->naddrs : 1;
+}
+
+/**
+ * Resolves every target before any is probed,
+ * as stateless probing needs the full list up front.
+ * Targets are stored in the order they were given, not the order they
+ * resolved in, so a checkpointed walk over them can be resumed.
+ *
+ * Returns the number of addresses stored in `*targets`.
+ */
+static int resolve_all(const struct tr_opts *opts,
+                       struct tr_resolver *resolver,
+                       struct addrinfo ***targets) {
+  int i, j, n, ntargets = 0, cap = 0;
+  int *counts;
+  const struct tr_resolved *res, **byname;
+
+  if ((byname = calloc(opts->nhostnames, sizeof(*byname))) == NULL ||
+      (counts = calloc(opts->nhostnames, sizeof(*counts))) == NULL) {
+    errorf("malloc: failed to allocate targets\n");
+  }
+  while ((n = next_resolved(opts, resolver, &res)) != -1) {
+    byname[res->index] = res;
+    counts[res->index] = n;
+  }
+
+  *targets = NULL;
+  for (j = 0; j < opts->nhostnames; j++) {
+    for (i = 0; i < counts[j]; i++) {
+      if (ntargets == cap) {
+        cap = cap ? cap * 2 : 1024;
+        if ((*targets = realloc(*targets, cap * sizeof(**targets))) == NULL) {
+          errorf("malloc: failed to allocate targets\n");
+        }
+      }
+      (*targets)[ntargets++] = addrinfo_for(&byname[j]->addrs[i]);
+    }
+  }
+  free(byname);
+  free(counts);
+  if (ntargets == 0) {
+    errorf("resolver: no target resolved\n");
+  }
+  return ntargets;
+}
+
+/**
+ * Traces targets in the order they resolve. Queries for the rest
+ * stay in flight while a target is traced, and their answers are
+ * taken in between targets, so DNS latency overlaps with probing.
+ */
+static void trace_as_resolved(const struct tr_opts *opts,
+                              struct tr_resolver *resolver,
+                              struct tr_path_cache *cache) {
+  int i, n;
+  const struct tr_resolved *res;
+  struct addrinfo *ai;
+
+  while (!stopping && (n = next_resolved(opts, resolver, &res)) != -1) {
+    if (checkpointing && checkpoint_done(&checkpoint, res->index)) {
+      continue;
+    }
+    for (i = 0; i < n && !stopping; i++) {
+      ai = addrinfo_for(&res->addrs[i]);
+      traceroute_target(opts, res->name, ai, cache);
+      free(ai);
+      if (resolver_poll(resolver, 0) == -1) {
+        errorf("resolver: failed to query nameserver\n");
+      }
+    }
+    if (!stopping) {
+      target_done(opts, res->index, cache);
+    }
+  }
+}
+
+/**
+ * Traces the targets in opts->targets_file one after another.
+ * Targets are read, and names resolved, ahead of the one being traced.
+ */
+static void trace_streamed(const struct tr_opts *opts,
+                           struct tr_path_cache *cache) {
+  int rv, last;
+  uint64_t index;
+  const char *name;
+  struct tr_addr addr;
+  struct addrinfo *ai;
+  char s[INET6_ADDRSTRLEN];
+
+  while (!stopping && next_feed(opts, &addr, &name, &index, &last, 1) == 1) {
+    // Targets are traced in the order of the file, so a checkpoint is how
+    // many of its targets were, whatever their names resolve to this time.
+    if (checkpointing && index < checkpoint.position) {
+      continue;
+    }
+    ai = addrinfo_for(&addr);
+    rv = traceroute_target(
+        opts, name != NULL ? name : addr_ntop(&addr, s, sizeof(s)), ai, cache);
+    free(ai);
+    if (rv == 0 && last && checkpointing) {
+      checkpoint.position = index + 1;
+      if (checkpoint_due()) {
+        save_checkpoint(opts, cache);
+      }
+    }
+  }
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+/**
+ * Makes SIGINT and SIGTERM stop the campaign gracefully; a second one
+ * kills us as usual.
+ */
+static void catch_signals(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sa.sa_flags = SA_RESETHAND | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGINT, &sa, NULL) == -1 ||
+      sigaction(SIGTERM, &sa, NULL) == -1) {
+    errorf("sigaction: failed to catch signals\n");
+  }
+}
+
+/**
+ * Returns a hash identifying the campaign: its targets and the options
+ * that decide which probes it sends.
+ */
+static uint64_t campaign_hash(const struct tr_opts *opts) {
+  int i;
+  uint64_t h = CHECKPOINT_HASH_INIT;
+
+  for (i = 0; i < opts->nhostnames; i++) {
+    h = checkpoint_hash(h, opts->hostnames[i], strlen(opts->hostnames[i]) + 1);
+  }
+  if (opts->targets_file != NULL) {
+    h = checkpoint_hash(h, opts->targets_file, strlen(opts->targets_file) + 1);
+    if (opts->exclude != NULL) {
+      h = checkpoint_hash(h, opts->exclude, strlen(opts->exclude) + 1);
+    }
+    h = checkpoint_hash(h, &opts->gran4, sizeof(opts->gran4));
+    h = checkpoint_hash(h, &opts->gran6, sizeof(opts->gran6));
+    h = checkpoint_hash(h, &opts->shard, sizeof(opts->shard));
+    h = checkpoint_hash(h, &opts->nshards, sizeof(opts->nshards));
+  }
+  h = checkpoint_hash(h, &opts->family, sizeof(opts->family));
+  h = checkpoint_hash(h, &opts->all_addrs, sizeof(opts->all_addrs));
+  h = checkpoint_hash(h, &opts->stateless, sizeof(opts->stateless));
+  h = checkpoint_hash(h, &opts->permute, sizeof(opts->permute));
+  h = checkpoint_hash(h, &opts->max_ttl, sizeof(opts->max_ttl));
+  h = checkpoint_hash(h, &opts->nprobes, sizeof(opts->nprobes));
+  return h;
+}
+
+/**
+ * Starts checkpointing the campaign over `ntargets` targets to
+ * opts->checkpoint, or with opts->resume picks it up from there.
+ * A checkpoint of another campaign is refused.
+ */
+static void start_checkpoint(const struct tr_opts *opts, long ntargets) {
+  uint64_t h = campaign_hash(opts);
+
+  if (opts->resume && checkpoint_load(&checkpoint, opts->checkpoint) == 0) {
+    if (checkpoint.campaign != h || checkpoint.ntargets != (uint64_t)ntargets) {
+      errorf("checkpoint: %s is of another campaign\n", opts->checkpoint);
+    }
+  } else if (opts->resume && errno != ENOENT) {
+    errorf("checkpoint: failed to load %s\n", opts->checkpoint);
+  } else {
+    // Nothing to resume yet.
+    if (checkpoint_init(&checkpoint, h, ntargets) == -1) {
+      errorf("malloc: failed to allocate checkpoint\n");
+    }
+    random_key(checkpoint.perm_key, sizeof(checkpoint.perm_key));
+    random_key(checkpoint.stateless_key, sizeof(checkpoint.stateless_key));
+  }
+  timespec_now(&checkpointed);
+  checkpointing = 1;
+}
+
+/**
+ * Drops worker `id`, handing what it had left of its range to whoever
+ * asks next.
+ */
+static void drop_worker(int id) {
+  const struct tr_work_slot *slot = &work.workers[id];
+
+  if (slot->state == WORKER_BUSY) {
+    nhanded_back += slot->end - slot->next;
+  }
+  close(work_fds[id]);
+  work_fds[id] = -1;
+  if (work_leave(&work, id) == -2) {
+    errorf("malloc: failed to hand back targets\n");
+  }
+  nleft++;
+}
+
+/**
+ * Hands idle worker `id` a range of its own to trace, or else asks
+ * the busiest worker for part of its range on its behalf.
+ */
+static void dispatch(int id) {
+  int victim;
+  uint64_t mid;
+  struct tr_range r;
+
+  switch (work_next(&work, id, &r, &victim, &mid)) {
+  case WORK_ASSIGN:
+    if (work_send(work_fds[id], WORK_UNIT, &r, sizeof(r)) == -1) {
+      drop_worker(id);
+    }
+    break;
+  case WORK_STEAL_FROM:
+    if (work_send(work_fds[victim], WORK_STEAL, &mid, sizeof(mid)) == -1) {
+      drop_worker(victim);
+    }
+    break;
+  }
+}
+
+/**
+ * Gives every idle worker something to do, if there is anything,
+ * until none drops out in the process.
+ */
+static void dispatch_all(void) {
+  int i, left;
+
+  do {
+    left = nleft;
+    for (i = 0; i < WORK_MAX_WORKERS; i++) {
+      if (work_fds[i] != -1) {
+        dispatch(i);
+      }
+    }
+  } while (nleft != left);
+}
+
+/**
+ * Takes on a worker connecting to `lfd` if it was started on the same
+ * campaign, identified by `hash`, and turns it away otherwise.
+ */
+static void welcome_worker(int lfd, uint64_t hash) {
+  int fd, id = -1;
+  uint64_t theirs;
+  struct work_header h;
+  struct timeval tv;
+
+  if ((fd = accept(lfd, NULL, NULL)) == -1) {
+    return;
+  }
+  // Nobody else is served until it says hello.
+  tv.tv_sec = WORK_HELLO_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (work_recv(fd, &h, &theirs, sizeof(theirs)) == -1 ||
+      h.type != WORK_HELLO || h.len != sizeof(theirs)) {
+    close(fd);
+    return;
+  }
+  if (theirs != hash) {
+    fprintf(stderr, "work: turned away a worker of another campaign\n");
+  } else if ((id = work_join(&work)) == -1) {
+    fprintf(stderr, "work: turned away a worker, %d are enough\n",
+            WORK_MAX_WORKERS);
+  }
+  if (id == -1) {
+    work_send(fd, WORK_BYE, NULL, 0);
+    close(fd);
+    return;
+  }
+  tv.tv_sec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  work_fds[id] = fd;
+  nworkers++;
+  if (work_send(fd, WORK_HELLO, NULL, 0) == -1) {
+    drop_worker(id);
+  }
+}
+
+/**
+ * Prints and archives the `len` bytes of records packed at `p`,
+ * once they have all been checked to unpack.
+ *
+ * Returns 0, or -1 if they do not.
+ */
+static int take_results(const uint8_t *p, uint32_t len) {
+  size_t n, off;
+  struct archive_record rec;
+  struct timespec rtt;
+  const struct lpm_record *route;
+
+  for (off = 0; off < len; off += n) {
+    if ((n = work_unpack(p + off, len - off, &rec)) == 0) {
+      return -1;
+    }
+  }
+  for (off = 0; off < len; off += n) {
+    n = work_unpack(p + off, len - off, &rec);
+    rtt.tv_sec = rec.rtt_us / 1000000;
+    rtt.tv_nsec = rec.rtt_us % 1000000 * 1000;
+    route = NULL;
+    if (annotate && rec.responder.family == AF_INET) {
+      route = lpm_lookup(&lpm, ntohl(rec.responder.u.v4.s_addr));
+    }
+    print_record(&rec, &rtt, route);
+    if (archiving && archive_append(&archive, &rec) == -1) {
+      errorf("archive: failed to append record\n");
+    }
+  }
+  return 0;
+}
+
+/**
+ * Takes a message from worker `id`. The results of a target are taken
+ * only from the worker it is handed to, and only once.
+ *
+ * Returns 0, or -1 if the worker went away or broke the protocol.
+ */
+static int serve_worker(int id) {
+  int thief;
+  uint64_t v;
+  struct tr_range r;
+  struct work_header h;
+
+  if (work_recv(work_fds[id], &h, results, WORK_MAX_MSG) == -1) {
+    return -1;
+  }
+  switch (h.type) {
+  case WORK_RESULTS:
+    if (h.len < sizeof(v)) {
+      return -1;
+    }
+    memcpy(&v, results, sizeof(v));
+    if (work_traced(&work, id, v) == -1) {
+      return 0;
+    }
+    return take_results(results + sizeof(v), h.len - sizeof(v));
+  case WORK_TRUNCATED:
+    if (h.len != sizeof(v)) {
+      return -1;
+    }
+    memcpy(&v, results, sizeof(v));
+    if ((thief = work_truncated(&work, id, v, &r)) == -2) {
+      errorf("malloc: failed to hand back targets\n");
+    }
+    if (r.first < r.end) {
+      nstolen += r.end - r.first;
+    }
+    if (thief >= 0 && r.first < r.end &&
+        work_send(work_fds[thief], WORK_UNIT, &r, sizeof(r)) == -1) {
+      drop_worker(thief);
+    }
+    return 0;
+  case WORK_DONE:
+    work_done(&work, id);
+    return 0;
+  }
+  return -1;
+}
+
+/**
+ * Coordinates the campaign over opts->targets_file from opts->coordinate:
+ * numbers its targets, hands them out to the workers that connect, and
+ * prints and archives their results as they come in (see work.c).
+ * Nothing is probed from here.
+ */
+static void coordinate(const struct tr_opts *opts) {
+  int i, n, rv, lfd;
+  int ids[1 + WORK_MAX_WORKERS];
+  uint64_t ntargets = 0, hash = campaign_hash(opts);
+  struct tr_target target;
+  struct pollfd fds[1 + WORK_MAX_WORKERS];
+
+  while ((rv = targets_next(&source, &target)) == 1) {
+    ntargets++;
+  }
+  if (rv == -1) {
+    errorf("targets: %s:%ld: not a target\n", opts->targets_file,
+           source.line);
+  }
+  if ((results = malloc(WORK_MAX_MSG)) == NULL) {
+    errorf("malloc: failed to allocate results\n");
+  }
+  if ((lfd = work_listen(opts->coordinate)) == -1) {
+    errorf("work: failed to listen on %s\n", opts->coordinate);
+  }
+  work_init(&work, ntargets, WORK_UNIT_TARGETS);
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    work_fds[i] = -1;
+  }
+  printf("traceroute to %llu targets in %s, %d hops max, %d byte packets\n",
+         (unsigned long long)ntargets, opts->targets_file, opts->max_ttl,
+         opts->probe_size);
+  fflush(stdout);
+
+  while (!stopping && !work_finished(&work)) {
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+    for (i = 0, n = 1; i < WORK_MAX_WORKERS; i++) {
+      if (work_fds[i] != -1) {
+        fds[n].fd = work_fds[i];
+        fds[n].events = POLLIN;
+        ids[n++] = i;
+      }
+    }
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      errorf("poll: failed to wait for workers\n");
+    }
+    for (i = 1; i < n; i++) {
+      if (fds[i].revents != 0 && work_fds[ids[i]] != -1 &&
+          serve_worker(ids[i]) == -1) {
+        drop_worker(ids[i]);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      welcome_worker(lfd, hash);
+    }
+    dispatch_all();
+    fflush(stdout);
+  }
+
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    if (work_fds[i] != -1) {
+      work_send(work_fds[i], WORK_BYE, NULL, 0);
+      close(work_fds[i]);
+    }
+  }
+  close(lfd);
+  if (strchr(opts->coordinate, '/') != NULL) {
+    unlink(opts->coordinate);
+  }
+  fprintf(stderr,
+          "work: %d workers, %d of which left early; %llu targets stolen "
+          "from stragglers, %llu handed back by workers that left\n",
+          nworkers, nleft, (unsigned long long)nstolen,
+          (unsigned long long)nhanded_back);
+  work_free(&work);
+  free(results);
+  results = NULL;
+}
+
+/**
+ * Traces target `i` of the stream, packing its results behind its index.
+ * The stream is read on from the last target traced, or from the start
+ * for one before it. A name that does not resolve, or resolves to an
+ * excluded address or one of a family not opened, has no results.
+ *
+ * Returns 0, or -1 if it was stopped short.
+ */
+static int trace_nth(const struct tr_opts *opts, uint64_t i) {
+  int rv = 0;
+  struct tr_target target;
+  struct tr_addr addr;
+  struct addrinfo hints, *ai;
+  char s[INET6_ADDRSTRLEN];
+
+  if (i < nread) {
+    targets_close(&source);
+    open_targets(opts);
+    nread = 0;
+  }
+  while (nread <= i) {
+    if (targets_next(&source, &target) != 1) {
+      errorf("targets: %s changed during the campaign\n", opts->targets_file);
+    }
+    nread++;
+  }
+  memcpy(results, &i, sizeof(i));
+  nresults = sizeof(i);
+
+  if (target.name == NULL) {
+    if (!proto_opened(target.addr.family)) {
+      return 0;
+    }
+    ai = addrinfo_for(&target.addr);
+    rv = traceroute_target(opts, addr_ntop(&target.addr, s, sizeof(s)), ai,
+                           NULL);
+    free(ai);
+    return rv;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = opts->family;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  if ((rv = getaddrinfo(target.name, NULL, &hints, &ai)) != 0) {
+    fflush(stdout);
+    fprintf(stderr, "getaddrinfo: %s: %s\n", target.name, gai_strerror(rv));
+    return 0;
+  }
+  addr_set(&addr, ai->ai_family, get_in_addr(ai->ai_addr));
+  if (!targets_excluded(&source, &addr) && proto_opened(addr.family)) {
+    rv = traceroute_target(opts, target.name, ai, NULL);
+  }
+  freeaddrinfo(ai);
+  return rv;
+}
+
+/**
+ * Traces targets [i, end) for the coordinator on `fd`, sending the
+ * results of each as it is done. Between targets, a coordinator asking
+ * for the rest of the range back is told where it will now end.
+ *
+ * Returns 0 once the range is done, and -1 if it was stopped short
+ * or the coordinator ended the campaign.
+ */
+static int trace_unit(const struct tr_opts *opts, int fd, uint64_t i,
+                      uint64_t end) {
+  uint64_t mid;
+  struct work_header h;
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  for (; i < end; i++) {
+    while (poll(&pfd, 1, 0) == 1) {
+      if (work_recv(fd, &h, &mid, sizeof(mid)) == -1) {
+        errorf("work: lost the coordinator\n");
+      }
+      if (h.type == WORK_BYE) {
+        return -1;
+      }
+      if (h.type != WORK_STEAL || h.len != sizeof(mid)) {
+        errorf("work: unexpected message from the coordinator\n");
+      }
+      if (mid < end) {
+        end = mid > i ? mid : i;
+      }
+      if (work_send(fd, WORK_TRUNCATED, &end, sizeof(end)) == -1) {
+        errorf("work: lost the coordinator\n");
+      }
+    }
+    if (i >= end) {
+      break;
+    }
+    if (trace_nth(opts, i) == -1) {
+      return -1;
+    }
+    if (work_send(fd, WORK_RESULTS, results, nresults) == -1) {
+      errorf("work: lost the coordinator\n");
+    }
+  }
+  if (work_send(fd, WORK_DONE, NULL, 0) == -1) {
+    errorf("work: lost the coordinator\n");
+  }
+  return 0;
+}
+
+/**
+ * Works on the campaign coordinated from opts->join, tracing the ranges
+ * of targets it is handed until the campaign is over.
+ */
+static void work_for(const struct tr_opts *opts) {
+  int fd;
+  uint64_t hash = campaign_hash(opts), end = UINT64_MAX;
+  struct tr_range r;
+  struct work_header h;
+  struct pollfd pfd;
+
+  if ((fd = work_connect(opts->join)) == -1) {
+    errorf("work: failed to connect to %s\n", opts->join);
+  }
+  if (work_send(fd, WORK_HELLO, &hash, sizeof(hash)) == -1 ||
+      work_recv(fd, &h, NULL, 0) == -1) {
+    errorf("work: lost the coordinator\n");
+  }
+  if (h.type != WORK_HELLO) {
+    errorf("work: turned away by %s\n", opts->join);
+  }
+  if ((results = malloc(WORK_MAX_MSG)) == NULL) {
+    errorf("malloc: failed to allocate results\n");
+  }
+  working = 1;
+  nread = 0;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (!stopping) {
+    if (poll(&pfd, 1, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      errorf("poll: failed to wait for the coordinator\n");
+    }
+    if (work_recv(fd, &h, &r, sizeof(r)) == -1) {
+      errorf("work: lost the coordinator\n");
+    }
+    if (h.type == WORK_BYE) {
+      break;
+    }
+    if (h.type == WORK_STEAL) {
+      // Already done with its range: nothing to give up.
+      if (work_send(fd, WORK_TRUNCATED, &end, sizeof(end)) == -1) {
+        errorf("work: lost the coordinator\n");
+      }
+      continue;
+    }
+    if (h.type != WORK_UNIT || h.len != sizeof(r)) {
+      errorf("work: unexpected message from the coordinator\n");
+    }
+    if (trace_unit(opts, fd, r.first, r.end) == -1) {
+      break;
+    }
+  }
+  close(fd);
+  working = 0;
+  free(results);
+  results = NULL;
+}
+
+void traceroute(struct tr_opts *opts) {
+  int i, ntargets = 0;
+  struct addrinfo **targets = NULL;
+  struct tr_path_cache cache;
+  struct tr_resolver resolver;
+  struct sockaddr_storage ss;
+  char s[INET6_ADDRSTRLEN];
+
+  catch_signals();
+  xdp_enabled = opts->xdp;
+  if (opts->bulk) {
+    start_resolver(opts, &resolver);
+  }
+  if (opts->replay != NULL) {
+    // Nothing is sent, so there is nothing to resolve or open.
+  } else if (opts->targets_file != NULL) {
+    start_feed(opts);
+    nprotos = 0;
+    if (opts->coordinate != NULL) {
+      // The workers probe, so there is nothing to open.
+    } else if (opts->stateless) {
+      // Stateless probes are sourced as if sent to the first target
+      // of their family, so read the first chunk before opening sockets.
+      if ((spare = malloc(STREAM_CHUNK * sizeof(*spare))) == NULL) {
+        errorf("malloc: failed to allocate targets\n");
+      }
+      fill_chunk(opts, 1);
+      for (i = 0; i < (int)nspare; i++) {
+        sockaddr_for(&spare[i], &ss);
+        open_proto(opts, proto_for(spare[i].family), (struct sockaddr *)&ss);
+      }
+      if (nprotos == 0) {
+        errorf("targets: no target in %s\n", opts->targets_file);
+      }
+    } else {
+      if (opts->family != AF_INET6) {
+        open_proto(opts, &tr_proto4, NULL);
+      }
+      if (opts->family != AF_INET) {
+        open_proto(opts, &tr_proto6, NULL);
+      }
+    }
+    if (opts->coordinate == NULL) {
+      open_send_sockets(opts);
+    }
+  } else if (opts->bulk && !opts->stateless && !SCHEDULED(opts)) {
+    // Targets are traced as they resolve, so open sockets for
+    // every family they might turn out to be in.
+    nprotos = 0;
+    if (opts->family != AF_INET6) {
+      open_proto(opts, &tr_proto4, NULL);
+    }
+    if (opts->family != AF_INET) {
+      open_proto(opts, &tr_proto6, NULL);
+    }
+    open_send_sockets(opts);
+  } else {
+    if (opts->bulk) {
+      ntargets = resolve_all(opts, &resolver, &targets);
+    } else {
+      if ((targets = malloc(opts->nhostnames * sizeof(*targets))) == NULL) {
+        errorf("malloc: failed to allocate targets\n");
+      }
+      for (i = 0; i < opts->nhostnames; i++) {
+        targets[i] = resolve(opts->hostnames[i], opts->family);
+      }
+      ntargets = opts->nhostnames;
+    }
+    open_sockets(opts, targets, ntargets);
+  }
+  probe_table_init(&probes);
+  if (opts->busy_cpu >= 0) {
+    start_busy_poll(opts);
+  }
+
+  if (opts->asn_table != NULL) {
+    if (lpm_open(&lpm, opts->asn_table) == -1) {
+      errorf("lpm: failed to open %s\n", opts->asn_table);
+    }
+    annotate = 1;
+  }
+  if (opts->archive != NULL) {
+    if (archive_open(&archive, opts->archive) == -1) {
+      errorf("archive: failed to open %s\n", opts->archive);
+    }
+    archiving = 1;
+  }
+  if (opts->capture != NULL) {
+    start_capture(opts);
+  }
+  if (opts->checkpoint != NULL) {
+    // Streamed targets are done in order, so only the position counts.
+    start_checkpoint(opts, opts->targets_file != NULL ? 0
+                           : opts->stateless         ? ntargets
+                                                     : opts->nhostnames);
+  }
+
+  if (opts->replay != NULL || opts->stateless) {
+    start_pipeline(opts);
+  }
+  if (opts->replay != NULL) {
+    traceroute_replay(opts);
+  } else if (opts->coordinate != NULL) {
+    coordinate(opts);
+  } else if (opts->stateless) {
+    if (opts->targets_file != NULL) {
+      printf("traceroute to targets in %s, %d hops max, %d byte packets\n",
+             opts->targets_file, opts->max_ttl, opts->probe_size);
+    } else if (ntargets == 1 && opts->nhostnames == 1) {
+      inet_ntop(targets[0]->ai_family, get_in_addr(targets[0]->ai_addr), s,
+                sizeof(s));
+      printf("traceroute to %s (%s), %d hops max, %d byte packets\n",
+             opts->hostnames[0], s, opts->max_ttl, opts->probe_size);
+    } else {
+      printf("traceroute to %d targets, %d hops max, %d byte packets\n",
+             ntargets, opts->max_ttl, opts->probe_size);
+    }
+    fflush(stdout);
+
+    if (checkpointing) {
+      memcpy(stateless_key, checkpoint.stateless_key, sizeof(stateless_key));
+    } else {
+      random_key(stateless_key, sizeof(stateless_key));
+    }
+    if (opts->targets_file != NULL) {
+      traceroute_streamed(opts);
+    } else {
+      traceroute_stateless(opts, targets, ntargets);
+    }
+  } else {
+    if (opts->graph != NULL) {
+      // Merge into the graph of earlier runs, if there is one.
+      topo_init(&topo);
+      if (topo_load(&topo, opts->graph) == -1 && errno != ENOENT) {
+        errorf("topo: failed to load %s\n", opts->graph);
+      }
+      aggregate = 1;
+    }
+    if (opts->path_cache != NULL) {
+      if (path_cache_load(&cache, opts->path_cache) == -1) {
+        errorf("path cache: failed to load %s\n", opts->path_cache);
+      }
+      srandom(time(NULL) ^ getpid());
+    }
+    if (SCHEDULED(opts)) {
+      traceroute_scheduled(opts, targets, ntargets,
+                           opts->bulk ? NULL : opts->hostnames);
+    } else if (opts->join != NULL) {
+      work_for(opts);
+    } else if (opts->targets_file != NULL) {
+      trace_streamed(opts, opts->path_cache != NULL ? &cache : NULL);
+    } else if (opts->bulk) {
+      trace_as_resolved(opts, &resolver,
+                        opts->path_cache != NULL ? &cache : NULL);
+    }
+    for (i = 0; i < ntargets && !SCHEDULED(opts) && !stopping; i++) {
+      if (checkpointing && checkpoint_done(&checkpoint, i)) {
+        continue;
+      }
+      if (traceroute_target(opts, opts->hostnames[i], targets[i],
+                            opts->path_cache != NULL ? &cache : NULL) == 0) {
+        target_done(opts, i, opts->path_cache != NULL ? &cache : NULL);
+      }
+    }
+    if (opts->path_cache != NULL) {
+      if (path_cache_save(&cache, opts->path_cache) == -1) {
+        errorf("path cache: failed to save %s\n", opts->path_cache);
+      }
+      path_cache_free(&cache);
+    }
+    if (opts->distance) {
+      distances_free(&distances);
+    }
+    if (aggregate) {
+      if (topo_save(&topo, opts->graph) == -1) {
+        errorf("topo: failed to save %s\n", opts->graph);
+      }
+      printf("graph: %u nodes, %u edges\n", topo.nnodes, topo.nedges);
+      topo_free(&topo);
+      aggregate = 0;
+    }
+  }
+  if (piping) {
+    stop_pipeline();
+  }
+
+  for (i = 0; i < ntargets; i++) {
+    if (opts->bulk) {
+      free(targets[i]);
+    } else {
+      freeaddrinfo(targets[i]);
+    }
+  }
+  free(targets);
+  if (opts->bulk) {
+    resolver_free(&resolver);
+  }
+  if (opts->targets_file != NULL) {
+    stop_feed(opts);
+    free(spare);
+    spare = NULL;
+    if (nskipped > 0) {
+      fprintf(stderr,
+              "targets: skipped %llu of a family not among the first %d\n",
+              (unsigned long long)nskipped, STREAM_CHUNK);
+    }
+  }
+  if (annotate) {
+    lpm_close(&lpm);
+    annotate = 0;
+  }
+  if (busy_poll) {
+    stop_busy_poll();
+  }
+  if (tr_recv4.xdp != NULL) {
+    fflush(stdout);
+    fprintf(stderr, "xdp: %llu probes sent, %llu replies received\n",
+            (unsigned long long)xdp.nsent, (unsigned long long)xdp.nreceived);
+    xdp_close(&xdp);
+    tr_recv4.xdp = NULL;
+  }
+  if (archiving) {
+    if (archive_close(&archive) == -1) {
+      errorf("archive: failed to write %s\n", opts->archive);
+    }
+    archiving = 0;
+  }
+  if (capturing) {
+    stop_capture(opts);
+  }
+  // Last, as it vouches for everything saved above.
+  if (checkpointing) {
+    if (checkpoint_save(&checkpoint, opts->checkpoint) == -1) {
+      errorf("checkpoint: failed to save %s\n", opts->checkpoint);
+    }
+    checkpoint_free(&checkpoint);
+    checkpointing = 0;
+  }
+  if (stopping) {
+    fflush(stdout);
+    fprintf(stderr, "traceroute: stopped%s\n",
+            opts->checkpoint != NULL ? ", resume with -k" : "");
+  }
+}
+
+void traceroute4(struct tr_opts *opts) {
+  opts->family = AF_INET;
+  traceroute(opts);
+}
+
+void traceroute6(struct tr_opts *opts) {
+  opts->family = AF_INET6;
+  traceroute(opts);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: traceroute [-46DMRSZad] [-A table] [-B cpu] [-C cache] "
+          "[-G graph] [-K checkpoint [-k]] [-O capture [-o MB]] "
+          "[-P probes] [-T seconds] [-r rate] [-W archive] "
+          "hostname [hostname ...]\n"
+          "       traceroute [-46MRSZad] [-A table] [-B cpu] [-C cache] "
+          "[-G graph] [-K checkpoint [-k]] [-O capture [-o MB]] [-r rate] "
+          "[-W archive] [-e exclude] [-g len[,len6]] [-n shard/shards] "
+          "-f targets\n"
+          "       traceroute [-46] [-A table] [-W archive] [-e exclude] "
+          "[-g len[,len6]] [-n shard/shards] -L address -f targets\n"
+          "       traceroute [-46Md] [-A table] [-B cpu] [-O capture [-o MB]] "
+          "[-e exclude] [-g len[,len6]] [-n shard/shards] "
+          "-J address -f targets\n"
+          "       traceroute [-x] [-A table] [-W archive] -X capture\n");
+  exit(1);
+}
+
+/**
+ * Parses the argument of option `opt` as a number from 0 to `max`,
+ * printing the usage if it is anything else.
+ */
+static long parse_number(int opt, const char *arg, long max) {
+  char *end;
+  long v;
+
+  errno = 0;
+  v = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || errno == ERANGE || v < 0 || v > max) {
+    fprintf(stderr, "traceroute: -%c %s is out of range or not a number\n",
+            opt, arg);
+    usage();
+  }
+  return v;
+}
+
+/**
+ * Prints the usage, after why, if `cond` holds.
+ */
+static void invalid(int cond, const char *why) {
+  if (cond) {
+    fprintf(stderr, "traceroute: %s\n", why);
+    usage();
+  }
+}
+
+/**
+ * Prints the usage if option `x` was given along with `y`.
+ */
+static void conflict(int has_x, const char *x, int has_y, const char *y) {
+  if (has_x && has_y) {
+    fprintf(stderr, "traceroute: %s cannot be combined with %s\n", x, y);
+    usage();
+  }
+}
+
+/**
+ * Prints the usage if option `x` was given without `y`.
+ */
+static void requires(int has_x, const char *x, int has_y, const char *y) {
+  if (has_x && !has_y) {
+    fprintf(stderr, "traceroute: %s requires %s\n", x, y);
+    usage();
+  }
+}
+
+/**
+ * Checks that the options parsed into `opts`, with `nhostnames` hostnames
+ * after them, make sense together, mode by mode.
+ */
+static void check_opts(const struct tr_opts *opts, int nhostnames) {
+  int scheduled = SCHEDULED(opts), campaign;
+  const char *role = opts->coordinate != NULL ? "-L" : "-J";
+
+  // What to trace: hostnames, a targets file or a capture to replay.
+  invalid(nhostnames < 1 && opts->replay == NULL && opts->targets_file == NULL,
+          "no hostname given");
+  invalid(nhostnames > 0 && (opts->replay != NULL || opts->targets_file != NULL),
+          "hostnames cannot be combined with -f or -X");
+  conflict(opts->replay != NULL, "-X", opts->targets_file != NULL, "-f");
+
+  invalid(opts->gran4 < 0 || opts->gran4 > 32 || opts->gran6 < 0 ||
+              opts->gran6 > 128,
+          "-g lengths must be within 0-32 and 0-128");
+  invalid(opts->nshards < 1 || opts->shard < 0 ||
+              opts->shard >= opts->nshards,
+          "-n must be shard/shards with shard < shards");
+  invalid(opts->capture_mb < 1, "-o must be at least 1");
+
+  // Stateless probing (-S).
+  requires(opts->permute, "-R", opts->stateless, "-S");
+  requires(opts->xdp, "-Z", opts->stateless, "-S");
+  requires(opts->rate && !scheduled, "-r", opts->stateless, "-S, -T or -P");
+  conflict(opts->stateless, "-S", opts->path_cache != NULL, "-C");
+  conflict(opts->stateless, "-S", opts->graph != NULL, "-G");
+  conflict(opts->stateless, "-S", opts->pmtu, "-M");
+  conflict(opts->stateless, "-S", opts->distance, "-d");
+
+  // Tracing on a deadline or budget (-T, -P).
+  conflict(scheduled, "-T or -P", opts->stateless, "-S");
+  conflict(scheduled, "-T or -P", opts->path_cache != NULL, "-C");
+  conflict(scheduled, "-T or -P", opts->pmtu, "-M");
+  conflict(scheduled, "-T or -P", opts->targets_file != NULL, "-f");
+  conflict(scheduled, "-T or -P", opts->checkpoint != NULL, "-K");
+
+  conflict(opts->pmtu, "-M", opts->path_cache != NULL, "-C");
+  requires(opts->all_addrs && opts->targets_file == NULL, "-a", opts->bulk,
+           "-D or -f");
+
+  // Targets files (-f).
+  conflict(opts->targets_file != NULL, "-f", opts->bulk, "-D");
+  requires(opts->exclude != NULL, "-e", opts->targets_file != NULL, "-f");
+  requires(opts->nshards != 1, "-n", opts->targets_file != NULL, "-f");
+  requires(opts->gran4 != TARGETS_GRAN4 || opts->gran6 != TARGETS_GRAN6, "-g",
+           opts->targets_file != NULL, "-f");
+
+  requires(opts->capture_mb != CAPTURE_ROTATE_MB, "-o", opts->capture != NULL,
+           "-O");
+  requires(opts->resume, "-k", opts->checkpoint != NULL, "-K");
+
+  // Campaigns coordinated between processes (-L, -J).
+  campaign = opts->coordinate != NULL || opts->join != NULL;
+  conflict(opts->coordinate != NULL, "-L", opts->join != NULL, "-J");
+  requires(campaign, role, opts->targets_file != NULL, "-f");
+  conflict(campaign, role, opts->stateless, "-S");
+  conflict(campaign, role, opts->checkpoint != NULL, "-K");
+  conflict(campaign, role, opts->path_cache != NULL, "-C");
+  conflict(campaign, role, opts->graph != NULL, "-G");
+  conflict(campaign, role, opts->all_addrs, "-a");
+  conflict(opts->coordinate != NULL, "-L", opts->distance, "-d");
+  conflict(opts->coordinate != NULL, "-L", opts->capture != NULL, "-O");
+  conflict(opts->join != NULL, "-J", opts->archive != NULL, "-W");
+
+  // Replaying a capture (-X).
+  requires(opts->replay_timed, "-x", opts->replay != NULL, "-X");
+  conflict(opts->replay != NULL, "-X", opts->stateless, "-S");
+  conflict(opts->replay != NULL, "-X", opts->path_cache != NULL, "-C");
+  conflict(opts->replay != NULL, "-X", opts->graph != NULL, "-G");
+  conflict(opts->replay != NULL, "-X", opts->pmtu, "-M");
+  conflict(opts->replay != NULL, "-X", opts->bulk, "-D");
+  conflict(opts->replay != NULL, "-X", opts->rate != 0, "-r");
+  conflict(opts->replay != NULL, "-X", opts->busy_cpu >= 0, "-B");
+  conflict(opts->replay != NULL, "-X", opts->capture != NULL, "-O");
+  conflict(opts->replay != NULL, "-X", opts->distance, "-d");
+  conflict(opts->replay != NULL, "-X", scheduled, "-T or -P");
+  conflict(opts->replay != NULL, "-X", opts->checkpoint != NULL, "-K");
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  long cpu;
+  struct tr_opts opts;
+
+  addr_hash_init();
+  opts.family = AF_UNSPEC;
+  opts.stateless = 0;
+  opts.permute = 0;
+  opts.rate = 0;
+  opts.asn_table = NULL;
+  opts.path_cache = NULL;
+  opts.graph = NULL;
+  opts.archive = NULL;
+  opts.pmtu = 0;
+  opts.distance = 0;
+  opts.bulk = 0;
+  opts.busy_cpu = -1;
+  opts.xdp = 0;
+  opts.deadline = 0;
+  opts.replay = NULL;
+  opts.targets_file = NULL;
+  opts.coordinate = NULL;
+  opts.join = NULL;
+  opts.exclude = NULL;
+  opts.gran4 = TARGETS_GRAN4;
+  opts.gran6 = TARGETS_GRAN6;
+  opts.shard = 0;
+  opts.nshards = 1;
+  opts.checkpoint = NULL;
+  opts.resume = 0;
+  opts.replay_timed = 0;
+  opts.capture = NULL;
+  opts.capture_mb = CAPTURE_ROTATE_MB;
+  opts.budget = 0;
+  opts.all_addrs = 0;
+  opts.nprobes = 3;
+  opts.timeout = 5;
+  opts.max_ttl = 64;
+  opts.probe_size = sizeof("message");
+  opts.dport = 33434;
+
+  while ((ch = getopt(argc, argv, "46A:B:C:DG:J:K:L:MO:P:RST:W:X:Zade:f:g:kn:o:r:x")) != -1) {
+    switch (ch) {
+    case '4':
+      opts.family = AF_INET;
+      break;
+    case '6':
+      opts.family = AF_INET6;
+      break;
+    case 'A':
+      opts.asn_table = optarg;
+      break;
+    case 'B':
+      cpu = parse_number(ch, optarg, CPU_SETSIZE - 1);
+      invalid(cpu >= sysconf(_SC_NPROCESSORS_ONLN), "-B CPU is not online");
+      opts.busy_cpu = cpu;
+      break;
+    case 'C':
+      opts.path_cache = optarg;
+      break;
+    case 'D':
+      opts.bulk = 1;
+      break;
+    case 'G':
+      opts.graph = optarg;
+      break;
+    case 'J':
+      opts.join = optarg;
+      break;
+    case 'K':
+      opts.checkpoint = optarg;
+      break;
+    case 'L':
+      opts.coordinate = optarg;
+      break;
+    case 'M':
+      opts.pmtu = 1;
+      break;
+    case 'O':
+      opts.capture = optarg;
+      break;
+    case 'P':
+      opts.budget = parse_number(ch, optarg, LONG_MAX);
+      break;
+    case 'R':
+      opts.permute = 1;
+      break;
+    case 'S':
+      opts.stateless = 1;
+      break;
+    case 'T':
+      opts.deadline = parse_number(ch, optarg, INT_MAX);
+      break;
+    case 'W':
+      opts.archive = optarg;
+      break;
+    case 'X':
+      opts.replay = optarg;
+      break;
+    case 'Z':
+      opts.xdp = 1;
+      break;
+    case 'a':
+      opts.all_addrs = 1;
+      break;
+    case 'd':
+      opts.distance = 1;
+      break;
+    case 'e':
+      opts.exclude = optarg;
+      break;
+    case 'f':
+      opts.targets_file = optarg;
+      break;
+    case 'g':
+      if (sscanf(optarg, "%d,%d", &opts.gran4, &opts.gran6) < 1) {
+        usage();
+      }
+      break;
+    case 'k':
+      opts.resume = 1;
+      break;
+    case 'n':
+      if (sscanf(optarg, "%ld/%ld", &opts.shard, &opts.nshards) != 2) {
+        usage();
+      }
+      break;
+    case 'o':
+      opts.capture_mb = parse_number(ch, optarg, LONG_MAX);
+      break;
+    case 'r':
+      opts.rate = parse_number(ch, optarg, INT_MAX);
+      break;
+    case 'x':
+      opts.replay_timed = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  check_opts(&opts, argc - optind);
+
+  opts.hostnames = argv + optind;
+  opts.nhostnames = argc - optind;
+
+  traceroute(&opts);
+  return 0;
+}
@@ -1,4 +1,6 @@
+#include <netinet/icmp6.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/udp.h>
 #include <netinet/ip_icmp.h>
 #include <stdint.h>
@@ -10,8 +12,85 @@
 // rather than choosing an arbitrarily large buffer.
 #define MAXDATASIZE4 IP4_IHL_MAX + ICMP_ADVLENMIN + IP4_IHL_MAX + sizeof(struct udphdr)
 
+// Raw ICMPv6 sockets do not deliver the IPv6 header, so a reply
+// starts at the ICMPv6 header followed by the quoted probe.
+#define MAXDATASIZE6 (sizeof(struct icmp6_hdr) + sizeof(struct ip6_hdr) + sizeof(struct udphdr))
+
+// How long the kernel may busy poll a device queue on a read, in µs.
+#define BUSY_POLL_USEC 50
+// Iterations timed to report the overhead of busy polling.
+#define BUSY_POLL_CALIBRATION 1000
+
+// Probes that may be outstanding at once when tracing on a deadline.
+#define SCHEDULE_WINDOW 64
+
+// Ports from opts->dport that probes numbered by a running count take in
+// turn (see PORT_SEQ()). A power of two of at least SCHEDULE_WINDOW and
+// PROBE_TABLE_SIZE, so outstanding probes never share a port or a slot.
+// Scheduled mode holds a port for twice the timeout after its last probe,
+// which caps it at this many probes per two timeouts.
+#define PROBE_PORT_SPAN 8192
+
+// Targets a stateless walk of a targets file permutes at a time,
+// and how many it reads ahead, of which up to a batch of names resolve
+// before the resolver is reset.
+#define STREAM_CHUNK 65536
+#define FEED_WINDOW 256
+#define FEED_BATCH 4096
+
+// Records each ring between the stages of the reply pipeline holds, and
+// how long an idle stage yields before it sleeps PIPELINE_IDLE_USEC.
+#define PIPELINE_RING 4096
+#define PIPELINE_SPINS 64
+#define PIPELINE_IDLE_USEC 100
+
+// Targets a coordinator hands a worker at a time, and how long it waits
+// for one that connects to say which campaign it was started on.
+#define WORK_UNIT_TARGETS 64
+#define WORK_HELLO_TIMEOUT 5
+
+// Targets whose distance is estimated at once (-d). At most
+// PROBE_PORT_SPAN, so each has a port of its own.
+#define DISTANCE_BATCH 1024
+
+// Megabytes a capture file (-O) is rotated at, unless -o says otherwise.
+#define CAPTURE_ROTATE_MB 64
+
+#define MAXDATASIZE (MAXDATASIZE4 > MAXDATASIZE6 ? MAXDATASIZE4 : MAXDATASIZE6)
+
 struct tr_opts {
-  char *hostname;
+  char **hostnames;
+  int nhostnames;
+  char *targets_file; // File to stream targets from instead, or NULL.
+  char *exclude; // File of prefixes never to probe, or NULL.
+  int gran4; // Prefixes in targets_file stand for a target per /gran4
+  int gran6; // (or /gran6 in IPv6) block within them.
+  long shard; // Of the targets in targets_file, trace those numbered
+  long nshards; // shard modulo nshards.
+  int bulk; // Resolve hostnames concurrently, tracing each as it resolves.
+  int all_addrs; // Trace every address a hostname resolves to, not just one.
+  int family; // AF_INET, AF_INET6 or AF_UNSPEC to use whatever resolves first.
+  int stateless; // Encode probe state in the probes instead of a probe table.
+  int permute; // Walk the (target, TTL) space in a keyed random order.
+  int rate; // Probes per second in stateless mode, or 0 for no limit.
+  char *asn_table; // Table built by lpmbuild to annotate hops with, or NULL.
+  char *path_cache; // File of known paths to verify rather than re-trace.
+  char *graph; // File to aggregate the traced topology into, or NULL.
+  char *archive; // Archive to append every probe's outcome to, or NULL.
+  int pmtu; // Discover the path MTU alongside the hops, with DF set.
+  int distance; // Estimate how far targets are and probe no further.
+  int busy_cpu; // CPU to pin to while busy polling for replies, or -1.
+  int xdp; // Send and receive stateless IPv4 probes through AF_XDP.
+  int deadline; // Seconds to trace the batch in, or 0 for no limit.
+  long budget; // Probes to trace the batch with, or 0 for no limit.
+  char *replay; // Capture to replay instead of probing, or NULL.
+  int replay_timed; // Replay at the pace the capture was recorded.
+  char *capture; // Prefix of pcapng files to capture packets to, or NULL.
+  long capture_mb; // Megabytes each capture file is rotated at.
+  char *checkpoint; // File to checkpoint the campaign's progress to, or NULL.
+  int resume; // Carry on from the checkpoint rather than start over.
+  char *coordinate; // Hand targets_file out to workers connecting here.
+  char *join; // Trace targets_file for the coordinator here instead.
   int nprobes;
   int timeout;
   int max_ttl;
@@ -20,5 +99,14 @@ struct tr_opts {
   u_short sport;
 };
 
-void traceroute4(struct tr_opts *opts);
+// Whether a batch is traced on a deadline or probe budget
+// rather than one target after another.
+#define SCHEDULED(opts) ((opts)->deadline > 0 || (opts)->budget > 0)
+
+// The sequence number, sent as the port past opts->dport, of the probe
+// numbered `n` by a count that runs for longer than the ports do.
+#define PORT_SEQ(n) ((u_short)((n) % PROBE_PORT_SPAN))
 
+void traceroute(struct tr_opts *opts);
+void traceroute4(struct tr_opts *opts);
+void traceroute6(struct tr_opts *opts);
@@ -0,0 +1,185 @@
+/**
+ * trquery [-t target] [-r responder] [-p prefix/len] [-s start] [-e end]
+ *         archive ... -- print the records of traceroute -W archives
+ *
+ * Filters combine with "and"; -p matches records whose target or responder
+ * falls within the prefix, and -s and -e bound the send time in seconds
+ * since the epoch. Chunks that cannot match, going by their time range and
+ * address dictionary, are skipped without being decoded.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "archive.h"
+#include "utils.h"
+
+struct tr_query {
+  int has_target, has_responder, prefix_len;
+  struct tr_addr target, responder, prefix;
+  uint64_t start, end;
+};
+
+static void usage(void) {
+  fprintf(stderr, "usage: trquery [-t target] [-r responder] [-p prefix/len] "
+                  "[-s start] [-e end] archive ...\n");
+  exit(1);
+}
+
+static uint64_t parse_time(const char *s) {
+  char *end;
+  double t = strtod(s, &end);
+  if (*end != '\0' || t < 0) {
+    usage();
+  }
+  return (uint64_t)(t * 1000000);
+}
+
+static void parse_addr(struct tr_addr *addr, const char *s) {
+  if (addr_pton(addr, s) == -1 || addr->family == 0) {
+    usage();
+  }
+}
+
+static void parse_prefix(struct tr_query *q, char *s) {
+  char *slash = strchr(s, '/');
+  if (slash == NULL) {
+    usage();
+  }
+  *slash = '\0';
+  parse_addr(&q->prefix, s);
+  q->prefix_len = atoi(slash + 1);
+  if (q->prefix_len < 0 ||
+      q->prefix_len > (q->prefix.family == AF_INET6 ? 128 : 32)) {
+    usage();
+  }
+}
+
+/**
+ * Returns whether any record of `chunk` could match `q`.
+ */
+static int chunk_matches(const struct tr_query *q,
+                         const struct archive_chunk *chunk) {
+  uint32_t i;
+
+  if (chunk->header->time_max < q->start || chunk->header->time_min > q->end) {
+    return 0;
+  }
+  if (q->has_target && archive_dict_find(chunk, &q->target) == -1) {
+    return 0;
+  }
+  if (q->has_responder && archive_dict_find(chunk, &q->responder) == -1) {
+    return 0;
+  }
+  if (q->prefix_len >= 0) {
+    for (i = 0; i < chunk->header->ndict; i++) {
+      if (addr_in_prefix(&chunk->dict[i], &q->prefix, q->prefix_len)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  return 1;
+}
+
+static int record_matches(const struct tr_query *q,
+                          const struct archive_record *r) {
+  return r->time_us >= q->start && r->time_us <= q->end &&
+         (!q->has_target || addr_eq(&r->target, &q->target)) &&
+         (!q->has_responder || addr_eq(&r->responder, &q->responder)) &&
+         (q->prefix_len < 0 ||
+          addr_in_prefix(&r->target, &q->prefix, q->prefix_len) ||
+          addr_in_prefix(&r->responder, &q->prefix, q->prefix_len));
+}
+
+static void print_record(const struct archive_record *r) {
+  char t[INET6_ADDRSTRLEN], s[INET6_ADDRSTRLEN];
+
+  addr_ntop(&r->target, t, sizeof(t));
+  addr_ntop(&r->responder, s, sizeof(s));
+  printf("%llu.%06llu %s %2d  %s", (unsigned long long)(r->time_us / 1000000),
+         (unsigned long long)(r->time_us % 1000000), t, r->ttl, s);
+  if (r->responder.family != 0) {
+    printf(" %.3f ms %d/%d", r->rtt_us / 1000.0, r->icmp_type, r->icmp_code);
+  }
+  printf("\n");
+}
+
+static void query(const struct tr_query *q, const char *file) {
+  int rv;
+  uint32_t i;
+  size_t off = 0;
+  struct tr_archive a;
+  struct archive_chunk chunk;
+  static struct archive_record records[ARCHIVE_CHUNK];
+
+  if (archive_map(&a, file) == -1) {
+    errorf("trquery: failed to open %s\n", file);
+  }
+  while ((rv = archive_next_chunk(&a, &off, &chunk)) == 1) {
+    if (!chunk_matches(q, &chunk)) {
+      continue;
+    }
+    if (chunk.header->nrecords > ARCHIVE_CHUNK ||
+        archive_decode(&chunk, records) == -1) {
+      errno = EINVAL;
+      errorf("trquery: corrupt chunk in %s\n", file);
+    }
+    for (i = 0; i < chunk.header->nrecords; i++) {
+      if (record_matches(q, &records[i])) {
+        print_record(&records[i]);
+      }
+    }
+  }
+  if (rv == -1) {
+    errorf("trquery: corrupt chunk in %s\n", file);
+  }
+  archive_unmap(&a);
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  struct tr_query q;
+
+  addr_hash_init();
+  memset(&q, 0, sizeof(q));
+  q.prefix_len = -1;
+  q.end = UINT64_MAX;
+
+  while ((ch = getopt(argc, argv, "t:r:p:s:e:")) != -1) {
+    switch (ch) {
+    case 't':
+      parse_addr(&q.target, optarg);
+      q.has_target = 1;
+      break;
+    case 'r':
+      parse_addr(&q.responder, optarg);
+      q.has_responder = 1;
+      break;
+    case 'p':
+      parse_prefix(&q, optarg);
+      break;
+    case 's':
+      q.start = parse_time(optarg);
+      break;
+    case 'e':
+      q.end = parse_time(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind == argc) {
+    usage();
+  }
+
+  for (; optind < argc; optind++) {
+    query(&q, argv[optind]);
+  }
+  return 0;
+}
@@ -3,10 +3,12 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <unistd.h>
 
 #if defined(__MACH__) && !defined(CLOCK_MONOTONIC)
 #include <mach/clock.h>
@@ -164,3 +166,83 @@ void sock_set_port(struct sockaddr *sa, u_short port) {
   }
 }
 
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0, v1, v2, v3) \
+  do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+  } while (0)
+
+static uint64_t load64_le(const uint8_t *p) {
+  int i;
+  uint64_t v = 0;
+  for (i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+/**
+ * SipHash-2-4 of `in` under the 16 byte `key`.
+ * A keyed pseudorandom function that is cheap enough to run per packet,
+ * used wherever probes or schedules must not be predictable by others.
+ */
+uint64_t siphash24(const uint8_t key[16], const void *in, size_t len) {
+  const uint8_t *p = in;
+  const uint8_t *end = p + len - (len % 8);
+  uint64_t k0 = load64_le(key), k1 = load64_le(key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+  uint64_t m, b = ((uint64_t)len) << 56;
+  int i;
+
+  for (; p != end; p += 8) {
+    m = load64_le(p);
+    v3 ^= m;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  for (i = len % 8 - 1; i >= 0; i--) {
+    b |= ((uint64_t)p[i]) << (8 * i);
+  }
+  v3 ^= b;
+  SIPROUND(v0, v1, v2, v3);
+  SIPROUND(v0, v1, v2, v3);
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  for (i = 0; i < 4; i++) {
+    SIPROUND(v0, v1, v2, v3);
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * Fills `key` with random bytes, preferring /dev/urandom.
+ */
+void random_key(uint8_t *key, size_t len) {
+  size_t i;
+  FILE *f;
+  struct timespec now;
+
+  if ((f = fopen("/dev/urandom", "r")) != NULL) {
+    if (fread(key, 1, len, f) == len) {
+      fclose(f);
+      return;
+    }
+    fclose(f);
+  }
+
+  timespec_now(&now);
+  srandom(now.tv_nsec ^ (now.tv_sec << 16) ^ getpid());
+  for (i = 0; i < len; i++) {
+    key[i] = random() & 0xff;
+  }
+}
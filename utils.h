@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -17,3 +18,7 @@ void get_host_name(const struct sockaddr *sa, char* s, int slen);
 void* get_in_addr(struct sockaddr *sa);
 void sock_set_port(struct sockaddr *sa, u_short port);
 
+
+// Hash utils
+uint64_t siphash24(const uint8_t key[16], const void *in, size_t len);
+void random_key(uint8_t *key, size_t len);
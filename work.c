@@ -0,0 +1,495 @@
+/**
+ * Handing a campaign out to worker processes.
+ *
+ * A coordinator numbers the campaign's targets in the order they are
+ * read and hands them out as ranges, a unit at a time. Workers report the
+ * results of each target as it is traced, which is also how far they
+ * have got, so when one goes away the rest of its range is handed to
+ * the next worker to ask, and none of its targets are reported twice.
+ * Once nothing is left to hand out, an idle worker steals the second half
+ * of what remains of the busiest one's range, so a campaign is not left
+ * waiting on its slowest worker.
+ *
+ * Messages are framed with a type and length, and results are records
+ * of the archive packed without padding or unused address bytes.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "work.h"
+
+// Waiting on a steal on behalf of a thief that has since gone.
+#define NOBODY -2
+
+void work_init(struct tr_work *w, uint64_t ntargets, uint64_t unit) {
+  int i;
+
+  memset(w, 0, sizeof(*w));
+  w->ntargets = ntargets;
+  w->unit = unit;
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    w->workers[i].thief = w->workers[i].victim = -1;
+  }
+}
+
+/**
+ * Takes on a new worker, idle to begin with.
+ *
+ * Returns its id, or -1 if there are WORK_MAX_WORKERS already.
+ */
+int work_join(struct tr_work *w) {
+  int i;
+
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    if (w->workers[i].state == WORKER_GONE) {
+      w->workers[i].state = WORKER_IDLE;
+      w->workers[i].thief = w->workers[i].victim = -1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void assign(struct tr_work_slot *s, const struct tr_range *r) {
+  s->state = WORKER_BUSY;
+  s->next = r->first;
+  s->end = r->end;
+}
+
+/**
+ * Decides what idle worker `id` does next: trace range `r` (WORK_ASSIGN),
+ * wait while `victim` is asked to end its range at `mid` or later, the
+ * rest going to `id` (WORK_STEAL_FROM), wait for something to change
+ * (WORK_WAIT), or nothing, as the campaign is over (WORK_FINISHED).
+ */
+int work_next(struct tr_work *w, int id, struct tr_range *r, int *victim,
+              uint64_t *mid) {
+  struct tr_work_slot *s = &w->workers[id], *v;
+  uint64_t most = 1;
+  int i;
+
+  // Not while a steal is in flight on either side.
+  if (s->state != WORKER_IDLE || s->victim != -1 || s->thief != -1) {
+    return WORK_WAIT;
+  }
+  if (w->npending > 0) {
+    *r = w->pending[--w->npending];
+    assign(s, r);
+    return WORK_ASSIGN;
+  }
+  if (w->fresh < w->ntargets) {
+    r->first = w->fresh;
+    r->end = w->ntargets - w->fresh > w->unit ? w->fresh + w->unit
+                                               : w->ntargets;
+    w->fresh = r->end;
+    assign(s, r);
+    return WORK_ASSIGN;
+  }
+
+  *victim = -1;
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    v = &w->workers[i];
+    // The target being traced is not reported yet, hence more than one.
+    if (v->state == WORKER_BUSY && v->thief == -1 && v->end - v->next > most) {
+      most = v->end - v->next;
+      *victim = i;
+    }
+  }
+  if (*victim != -1) {
+    v = &w->workers[*victim];
+    *mid = v->next + (v->end - v->next) / 2;
+    v->thief = id;
+    s->victim = *victim;
+    return WORK_STEAL_FROM;
+  }
+  return work_finished(w) ? WORK_FINISHED : WORK_WAIT;
+}
+
+/**
+ * Records that worker `id` has traced target `index`, and every target
+ * of its range before it.
+ *
+ * Returns 0, or -1 if the target is not one it has left to trace,
+ * in which case its results are not to be taken.
+ */
+int work_traced(struct tr_work *w, int id, uint64_t index) {
+  struct tr_work_slot *s = &w->workers[id];
+
+  if (s->state != WORKER_BUSY || index < s->next || index >= s->end) {
+    return -1;
+  }
+  s->next = index + 1;
+  return 0;
+}
+
+/**
+ * Returns whether every target is traced: none are left to hand out,
+ * and no worker is tracing any or waiting to hear how many it gave up.
+ */
+int work_finished(const struct tr_work *w) {
+  int i;
+
+  if (w->fresh < w->ntargets || w->npending > 0) {
+    return 0;
+  }
+  for (i = 0; i < WORK_MAX_WORKERS; i++) {
+    if (w->workers[i].state == WORKER_BUSY || w->workers[i].thief != -1) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int push_pending(struct tr_work *w, const struct tr_range *r) {
+  struct tr_range *p;
+  int cap;
+
+  if (w->npending == w->cap) {
+    cap = w->cap ? w->cap * 2 : 16;
+    if ((p = realloc(w->pending, cap * sizeof(*p))) == NULL) {
+      return -1;
+    }
+    w->pending = p;
+    w->cap = cap;
+  }
+  w->pending[w->npending++] = *r;
+  return 0;
+}
+
+/**
+ * Records that worker `id`, asked to end its range early, will end it
+ * at `end`, and hands what it gave up to the worker that asked for it
+ * as range `r`, which is empty if nothing was given up.
+ *
+ * Returns the id of that worker, -1 if it has gone (in which case
+ * anything given up is handed to the next worker to ask), or -2 if
+ * memory to keep what was given up ran out.
+ */
+int work_truncated(struct tr_work *w, int id, uint64_t end,
+                   struct tr_range *r) {
+  struct tr_work_slot *s = &w->workers[id];
+  int thief = s->thief;
+
+  s->thief = -1;
+  r->first = r->end = 0;
+  if (s->state == WORKER_BUSY && end < s->end) {
+    r->first = end > s->next ? end : s->next;
+    r->end = s->end;
+    s->end = r->first;
+  }
+  if (thief < 0) {
+    if (r->first < r->end && push_pending(w, r) == -1) {
+      return -2;
+    }
+    return -1;
+  }
+  w->workers[thief].victim = -1;
+  if (r->first < r->end) {
+    assign(&w->workers[thief], r);
+  }
+  return thief;
+}
+
+/**
+ * Records that worker `id` has traced its whole range.
+ */
+void work_done(struct tr_work *w, int id) {
+  struct tr_work_slot *s = &w->workers[id];
+
+  if (s->state == WORKER_BUSY) {
+    s->next = s->end;
+    s->state = WORKER_IDLE;
+  }
+}
+
+/**
+ * Hands what worker `id` had left of its range to whoever asks next.
+ *
+ * Returns the id of an idle worker that was waiting on part of that range,
+ * to decide anew what it does, -1 if there is none, or -2 if memory to
+ * keep what it had left ran out.
+ */
+int work_leave(struct tr_work *w, int id) {
+  struct tr_work_slot *s = &w->workers[id];
+  struct tr_range r;
+  int thief = s->thief;
+
+  if (s->state == WORKER_BUSY && s->next < s->end) {
+    r.first = s->next;
+    r.end = s->end;
+    if (push_pending(w, &r) == -1) {
+      return -2;
+    }
+  }
+  if (s->victim >= 0) {
+    // Its victim will still answer, but to nobody.
+    w->workers[s->victim].thief = NOBODY;
+  }
+  s->state = WORKER_GONE;
+  s->thief = s->victim = -1;
+  if (thief >= 0) {
+    w->workers[thief].victim = -1;
+    return thief;
+  }
+  return -1;
+}
+
+void work_free(struct tr_work *w) {
+  free(w->pending);
+  w->pending = NULL;
+  w->npending = w->cap = 0;
+}
+
+static size_t pack_addr(uint8_t *p, const struct tr_addr *addr) {
+  size_t len = addr->family == AF_INET    ? sizeof(addr->u.v4)
+               : addr->family == AF_INET6 ? sizeof(addr->u.v6)
+                                          : 0;
+
+  p[0] = addr->family == AF_INET ? 4 : addr->family == AF_INET6 ? 6 : 0;
+  memcpy(p + 1, &addr->u, len);
+  return 1 + len;
+}
+
+static size_t unpack_addr(const uint8_t *p, size_t len,
+                          struct tr_addr *addr) {
+  size_t n;
+
+  memset(addr, 0, sizeof(*addr));
+  if (len == 0) {
+    return 0;
+  }
+  n = p[0] == 4 ? sizeof(addr->u.v4) : p[0] == 6 ? sizeof(addr->u.v6) : 0;
+  if ((p[0] != 0 && n == 0) || len < 1 + n) {
+    return 0;
+  }
+  addr->family = p[0] == 4 ? AF_INET : p[0] == 6 ? AF_INET6 : 0;
+  memcpy(&addr->u, p + 1, n);
+  return 1 + n;
+}
+
+/**
+ * Packs `r` into at most WORK_RECORD_MAX bytes at `p`.
+ *
+ * Returns the length packed.
+ */
+size_t work_pack(uint8_t *p, const struct archive_record *r) {
+  size_t n = 0;
+
+  memcpy(p, &r->time_us, sizeof(r->time_us));
+  n += sizeof(r->time_us);
+  n += pack_addr(p + n, &r->target);
+  n += pack_addr(p + n, &r->responder);
+  memcpy(p + n, &r->rtt_us, sizeof(r->rtt_us));
+  n += sizeof(r->rtt_us);
+  p[n++] = r->ttl;
+  p[n++] = r->icmp_type;
+  p[n++] = r->icmp_code;
+  return n;
+}
+
+/**
+ * Unpacks a record packed by work_pack() from the `len` bytes at `p`.
+ *
+ * Returns the length unpacked, or 0 if it is truncated or malformed.
+ */
+size_t work_unpack(const uint8_t *p, size_t len, struct archive_record *r) {
+  size_t n = sizeof(r->time_us), a;
+
+  memset(r, 0, sizeof(*r));
+  if (len < n) {
+    return 0;
+  }
+  memcpy(&r->time_us, p, sizeof(r->time_us));
+  if ((a = unpack_addr(p + n, len - n, &r->target)) == 0) {
+    return 0;
+  }
+  n += a;
+  if ((a = unpack_addr(p + n, len - n, &r->responder)) == 0) {
+    return 0;
+  }
+  n += a;
+  if (len - n < sizeof(r->rtt_us) + 3) {
+    return 0;
+  }
+  memcpy(&r->rtt_us, p + n, sizeof(r->rtt_us));
+  n += sizeof(r->rtt_us);
+  r->ttl = p[n++];
+  r->icmp_type = p[n++];
+  r->icmp_code = p[n++];
+  return n;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = send(fd, p, len, MSG_NOSIGNAL)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+  uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = recv(fd, p, len, 0)) == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        errno = ECONNRESET;
+      }
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Sends a message of `type` with the `len` bytes at `body`.
+ *
+ * Returns 0 on success and -1 on failure.
+ */
+int work_send(int fd, uint32_t type, const void *body, uint32_t len) {
+  struct work_header h;
+
+  h.type = type;
+  h.len = len;
+  if (write_all(fd, &h, sizeof(h)) == -1 ||
+      (len > 0 && write_all(fd, body, len) == -1)) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Receives a message into `h` and up to `size` bytes of body into `body`,
+ * waiting for all of it.
+ *
+ * Returns 0 on success and -1 on failure, with errno set (ECONNRESET if
+ * the other end went away, EMSGSIZE if the body is larger than `size`).
+ */
+int work_recv(int fd, struct work_header *h, void *body, uint32_t size) {
+  if (read_all(fd, h, sizeof(*h)) == -1) {
+    return -1;
+  }
+  if (h->len > size) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return h->len > 0 ? read_all(fd, body, h->len) : 0;
+}
+
+/**
+ * Resolves `address`, a Unix socket path if it has a '/' in it
+ * and host:port otherwise, into `ss`.
+ */
+static int parse_address(const char *address, struct sockaddr_storage *ss,
+                         socklen_t *len, int passive) {
+  char host[NI_MAXHOST];
+  const char *colon;
+  struct addrinfo hints, *ai;
+  struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+
+  memset(ss, 0, sizeof(*ss));
+  if (strchr(address, '/') != NULL) {
+    if (strlen(address) >= sizeof(sun->sun_path)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, address);
+    *len = sizeof(*sun);
+    return 0;
+  }
+  if ((colon = strrchr(address, ':')) == NULL ||
+      (size_t)(colon - address) >= sizeof(host)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = '\0';
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  if (getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, &ai) !=
+      0) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(ss, ai->ai_addr, ai->ai_addrlen);
+  *len = ai->ai_addrlen;
+  freeaddrinfo(ai);
+  return 0;
+}
+
+/**
+ * Listens for workers on `address`, replacing a stale Unix socket.
+ *
+ * Returns the listening socket, or -1 on failure with errno set.
+ */
+int work_listen(const char *address) {
+  int fd, on = 1, saved;
+  struct sockaddr_storage ss;
+  socklen_t len;
+
+  if (parse_address(address, &ss, &len, 1) == -1 ||
+      (fd = socket(ss.ss_family, SOCK_STREAM, 0)) == -1) {
+    return -1;
+  }
+  if (ss.ss_family == AF_UNIX) {
+    unlink(address);
+  } else {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  }
+  if (bind(fd, (struct sockaddr *)&ss, len) == -1 ||
+      listen(fd, WORK_MAX_WORKERS) == -1) {
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Connects to a coordinator listening on `address`.
+ *
+ * Returns the connected socket, or -1 on failure with errno set.
+ */
+int work_connect(const char *address) {
+  int fd, saved;
+  struct sockaddr_storage ss;
+  socklen_t len;
+
+  if (parse_address(address, &ss, &len, 0) == -1 ||
+      (fd = socket(ss.ss_family, SOCK_STREAM, 0)) == -1) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&ss, len) == -1) {
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
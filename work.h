@@ -0,0 +1,93 @@
+#ifndef WORK_H
+#define WORK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "archive.h"
+
+// Workers a coordinator serves at once.
+#define WORK_MAX_WORKERS 64
+
+// Largest message body: the results of a target are far smaller.
+#define WORK_MAX_MSG (1 << 20)
+
+// Longest a packed record can be.
+#define WORK_RECORD_MAX (8 + 2 * 17 + 4 + 3)
+
+/**
+ * Messages between a coordinator and its workers, each a header
+ * followed by `len` bytes of body, integers in host byte order
+ * (both ends are on the same host).
+ */
+enum work_type {
+  WORK_HELLO = 1, // Worker: campaign hash. Coordinator: nothing.
+  WORK_UNIT,      // Coordinator: first and end target to trace.
+  WORK_RESULTS,   // Worker: target index, then packed records.
+  WORK_STEAL,     // Coordinator: end the unit being traced here, or later.
+  WORK_TRUNCATED, // Worker: where it will end the unit.
+  WORK_DONE,      // Worker: the unit is traced.
+  WORK_BYE,       // Coordinator: the campaign is over.
+};
+
+struct work_header {
+  uint32_t type;
+  uint32_t len;
+};
+
+/**
+ * Targets [first, end) of a campaign, numbered in the order read.
+ */
+struct tr_range {
+  uint64_t first;
+  uint64_t end;
+};
+
+enum work_state { WORKER_GONE, WORKER_IDLE, WORKER_BUSY };
+
+struct tr_work_slot {
+  int state;
+  uint64_t next; // First target of the range not yet reported traced.
+  uint64_t end;
+  int thief; // Idle worker waiting on part of this one's range, or -1.
+  int victim; // Worker this one waits on part of the range of, or -1.
+};
+
+/**
+ * What a coordinator knows of a campaign: the targets never handed out,
+ * ranges handed back by workers that left, and what each worker is on.
+ */
+struct tr_work {
+  uint64_t ntargets;
+  uint64_t unit; // Targets handed out at a time, from the fresh ones.
+  uint64_t fresh; // Targets from here on were never handed out.
+  struct tr_range *pending;
+  int npending;
+  int cap;
+  struct tr_work_slot workers[WORK_MAX_WORKERS];
+};
+
+// What an idle worker should do, according to work_next().
+enum work_action { WORK_ASSIGN, WORK_STEAL_FROM, WORK_WAIT, WORK_FINISHED };
+
+void work_init(struct tr_work *w, uint64_t ntargets, uint64_t unit);
+int work_join(struct tr_work *w);
+int work_next(struct tr_work *w, int id, struct tr_range *r, int *victim,
+              uint64_t *mid);
+int work_traced(struct tr_work *w, int id, uint64_t index);
+int work_truncated(struct tr_work *w, int id, uint64_t end,
+                   struct tr_range *r);
+void work_done(struct tr_work *w, int id);
+int work_finished(const struct tr_work *w);
+int work_leave(struct tr_work *w, int id);
+void work_free(struct tr_work *w);
+
+size_t work_pack(uint8_t *p, const struct archive_record *r);
+size_t work_unpack(const uint8_t *p, size_t len, struct archive_record *r);
+
+int work_send(int fd, uint32_t type, const void *body, uint32_t len);
+int work_recv(int fd, struct work_header *h, void *body, uint32_t size);
+int work_listen(const char *address);
+int work_connect(const char *address);
+
+#endif
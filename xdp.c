@@ -0,0 +1,564 @@
+/**
+ * An AF_XDP backend for stateless IPv4 probing.
+ *
+ * Probes are written straight into frames of a UMEM shared with the
+ * kernel and handed to the driver through the TX ring, and ICMP errors
+ * addressed to us are steered by a small XDP program into the RX ring
+ * before the kernel's IP stack ever sees them, so neither direction
+ * costs a copy through a socket buffer (none at all in zero-copy mode).
+ *
+ * The XDP program is assembled here rather than compiled, so there is no
+ * dependency on a BPF toolchain or libbpf, and it is attached through a
+ * BPF link, which detaches it when we exit however we exit.
+ */
+
+#define _GNU_SOURCE // required for struct ifreq on GNU/Linux.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "xdp.h"
+
+#ifdef __linux__
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if_arp.h>
+#include <net/route.h>
+#include <sys/syscall.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define ETH_P_IPV4 0x0800
+#define MASK (XDP_RING_SIZE - 1)
+
+// Offsets of what the XDP program reads in an Ethernet frame.
+#define ETH_TYPE_OFF 12
+#define IP_PROTO_OFF (XDP_ETH_LEN + 9)
+#define IP_DST_OFF (XDP_ETH_LEN + 16)
+
+#define INSN(code, dst, src, off, imm) \
+  ((struct bpf_insn){(code), (dst), (src), (off), (imm)})
+
+static long sys_bpf(int cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * Finds the interface and next hop of the most specific route to `dst`
+ * in `routes`, a file in the format of /proc/net/route.
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (ENETUNREACH if there is no route).
+ */
+int xdp_route(const char *routes, const struct in_addr *dst,
+              char ifname[IF_NAMESIZE], struct in_addr *next_hop) {
+  FILE *f;
+  char line[256], name[IF_NAMESIZE];
+  unsigned int dest, gw, flags, mask;
+  int metric, len, best = -1, best_metric = 0;
+
+  if ((f = fopen(routes, "r")) == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%15s %x %x %x %*d %*d %d %x", name, &dest, &gw, &flags,
+               &metric, &mask) != 6 ||
+        !(flags & RTF_UP) || (dst->s_addr & mask) != dest) {
+      continue;
+    }
+    len = __builtin_popcount(mask);
+    if (len > best || (len == best && metric < best_metric)) {
+      best = len;
+      best_metric = metric;
+      strcpy(ifname, name);
+      next_hop->s_addr = flags & RTF_GATEWAY ? gw : dst->s_addr;
+    }
+  }
+  fclose(f);
+  if (best == -1) {
+    errno = ENETUNREACH;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Finds the link-layer address of neighbour `addr` on `ifname`
+ * in `neighbors`, a file in the format of /proc/net/arp.
+ *
+ * Returns 0 on success and -1 on failure, with errno set
+ * (ENOENT if the neighbour is not resolved).
+ */
+int xdp_neighbor(const char *neighbors, const char *ifname,
+                 const struct in_addr *addr, uint8_t mac[6]) {
+  FILE *f;
+  char line[256], ip[INET_ADDRSTRLEN], hw[18], dev[IF_NAMESIZE];
+  unsigned int type, flags;
+  struct in_addr a;
+  int found = 0;
+
+  if ((f = fopen(neighbors, "r")) == NULL) {
+    return -1;
+  }
+  while (!found && fgets(line, sizeof(line), f) != NULL) {
+    found = sscanf(line, "%15s %x %x %17s %*s %15s", ip, &type, &flags, hw,
+                   dev) == 5 &&
+            (flags & ATF_COM) && strcmp(dev, ifname) == 0 &&
+            inet_pton(AF_INET, ip, &a) == 1 && a.s_addr == addr->s_addr &&
+            sscanf(hw, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1],
+                   &mac[2], &mac[3], &mac[4], &mac[5]) == 6;
+  }
+  fclose(f);
+  if (!found) {
+    errno = ENOENT;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Loads the program that redirects the ICMP time exceeded and destination
+ * unreachable messages sent to `x->src` into the socket of the queue they
+ * arrived on, passing everything else (and those, if no socket is bound
+ * to that queue) to the kernel as usual.
+ */
+static int load_program(struct tr_xdp *x) {
+  enum { PASS = 28, REDIRECT = 22 };
+  struct bpf_insn prog[] = {
+      // r6 = ctx, r2 = data, r3 = data_end.
+      INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+      INSN(BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0),
+      INSN(BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0),
+      // Ethernet and IPv4 headers in the frame?
+      INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+      INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_ETH_LEN + 20),
+      INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, PASS - 5 - 1, 0),
+      // IPv4, ICMP and to us?
+      INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, ETH_TYPE_OFF, 0),
+      INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 7 - 1, htons(ETH_P_IPV4)),
+      INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, IP_PROTO_OFF, 0),
+      INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 9 - 1, IPPROTO_ICMP),
+      INSN(BPF_LDX | BPF_W | BPF_MEM, 5, 2, IP_DST_OFF, 0),
+      INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 11 - 1,
+           (int32_t)x->src.s_addr),
+      // r2 += IHL * 4, and the ICMP type in the frame?
+      INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, XDP_ETH_LEN, 0),
+      INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, 0xf),
+      INSN(BPF_ALU64 | BPF_LSH | BPF_K, 5, 0, 0, 2),
+      INSN(BPF_ALU64 | BPF_ADD | BPF_X, 2, 5, 0, 0),
+      INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+      INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_ETH_LEN + 1),
+      INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, PASS - 18 - 1, 0),
+      INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, XDP_ETH_LEN, 0),
+      INSN(BPF_JMP32 | BPF_JEQ | BPF_K, 5, 0, REDIRECT - 20 - 1, 11),
+      INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 21 - 1, 3),
+      // REDIRECT: return bpf_redirect_map(map, ctx->rx_queue_index,
+      // XDP_PASS).
+      INSN(BPF_LDX | BPF_W | BPF_MEM, 2, 6,
+           offsetof(struct xdp_md, rx_queue_index), 0),
+      INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, 0),
+      INSN(0, 0, 0, 0, 0),
+      INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+      INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+      INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+      // PASS: return XDP_PASS.
+      INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+      INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  };
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = 64;
+  if ((x->map_fd = sys_bpf(BPF_MAP_CREATE, &attr)) == -1) {
+    return -1;
+  }
+
+  // The map's descriptor is only known now.
+  prog[REDIRECT + 1].imm = x->map_fd;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uintptr_t)prog;
+  attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+  attr.license = (uintptr_t) "Dual BSD/GPL";
+  if ((x->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr)) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Attaches the program to the interface, in the driver if it can run
+ * there and as generic XDP after the skb is built otherwise.
+ */
+static int attach_program(struct tr_xdp *x) {
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = x->prog_fd;
+  attr.link_create.target_ifindex = x->ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+  if ((x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) != -1) {
+    return 0;
+  }
+  attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+  if ((x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) == -1) {
+    return -1;
+  }
+  x->generic = 1;
+  return 0;
+}
+
+static int map_ring(struct tr_xdp *x, struct tr_xdp_ring *r,
+                    const struct xdp_ring_offset *off, size_t entry,
+                    off_t pgoff) {
+  r->map_len = off->desc + XDP_RING_SIZE * entry;
+  r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, x->fd, pgoff);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    return -1;
+  }
+  r->producer = (_Atomic uint32_t *)((uint8_t *)r->map + off->producer);
+  r->consumer = (_Atomic uint32_t *)((uint8_t *)r->map + off->consumer);
+  r->flags = (uint32_t *)((uint8_t *)r->map + off->flags);
+  r->ring = (uint8_t *)r->map + off->desc;
+  r->cached_prod = atomic_load_explicit(r->producer, memory_order_relaxed);
+  r->cached_cons = atomic_load_explicit(r->consumer, memory_order_relaxed);
+  return 0;
+}
+
+/**
+ * Returns how many entries can be produced into `r`.
+ */
+static uint32_t ring_space(struct tr_xdp_ring *r) {
+  if (r->cached_prod - r->cached_cons == XDP_RING_SIZE) {
+    r->cached_cons = atomic_load_explicit(r->consumer, memory_order_acquire);
+  }
+  return XDP_RING_SIZE - (r->cached_prod - r->cached_cons);
+}
+
+/**
+ * Returns how many entries can be consumed from `r`.
+ */
+static uint32_t ring_ready(struct tr_xdp_ring *r) {
+  if (r->cached_prod == r->cached_cons) {
+    r->cached_prod = atomic_load_explicit(r->producer, memory_order_acquire);
+  }
+  return r->cached_prod - r->cached_cons;
+}
+
+static void ring_submit(struct tr_xdp_ring *r) {
+  atomic_store_explicit(r->producer, r->cached_prod, memory_order_release);
+}
+
+static void ring_release(struct tr_xdp_ring *r) {
+  atomic_store_explicit(r->consumer, r->cached_cons, memory_order_release);
+}
+
+static int needs_wakeup(const struct tr_xdp_ring *r) {
+  return *(volatile uint32_t *)r->flags & XDP_RING_NEED_WAKEUP;
+}
+
+static int bind_socket(struct tr_xdp *x) {
+  struct sockaddr_xdp sxdp;
+
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = x->ifindex;
+  sxdp.sxdp_queue_id = 0;
+  if (!x->generic) {
+    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0) {
+      x->zerocopy = 1;
+      return 0;
+    }
+  }
+  sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+  return bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+}
+
+static int setup(struct tr_xdp *x, const char *ifname) {
+  int fd, size = XDP_RING_SIZE;
+  uint32_t i, queue = 0;
+  socklen_t optlen;
+  struct ifreq ifr;
+  struct xdp_umem_reg reg;
+  struct xdp_mmap_offsets off;
+  union bpf_attr attr;
+
+  if ((x->ifindex = if_nametoindex(ifname)) == 0) {
+    return -1;
+  }
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    return -1;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+  if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  memcpy(x->eth + 6, ifr.ifr_hwaddr.sa_data, 6);
+  x->eth[ETH_TYPE_OFF] = ETH_P_IPV4 >> 8;
+  x->eth[ETH_TYPE_OFF + 1] = ETH_P_IPV4 & 0xff;
+
+  x->umem = mmap(NULL, XDP_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (x->umem == MAP_FAILED) {
+    x->umem = NULL;
+    return -1;
+  }
+  if ((x->fd = socket(AF_XDP, SOCK_RAW, 0)) == -1) {
+    return -1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.addr = (uintptr_t)x->umem;
+  reg.len = XDP_FRAMES * XDP_FRAME_SIZE;
+  reg.chunk_size = XDP_FRAME_SIZE;
+  optlen = sizeof(off);
+  if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1 ||
+      setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ==
+          -1 ||
+      setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+                 sizeof(size)) == -1 ||
+      setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) == -1 ||
+      setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) == -1 ||
+      getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+    return -1;
+  }
+  if (map_ring(x, &x->fill, &off.fr, sizeof(uint64_t),
+               XDP_UMEM_PGOFF_FILL_RING) == -1 ||
+      map_ring(x, &x->comp, &off.cr, sizeof(uint64_t),
+               XDP_UMEM_PGOFF_COMPLETION_RING) == -1 ||
+      map_ring(x, &x->rx, &off.rx, sizeof(struct xdp_desc),
+               XDP_PGOFF_RX_RING) == -1 ||
+      map_ring(x, &x->tx, &off.tx, sizeof(struct xdp_desc),
+               XDP_PGOFF_TX_RING) == -1) {
+    return -1;
+  }
+
+  // The first half of the frames wait for replies, the rest for probes.
+  for (i = 0; i < XDP_RING_SIZE; i++) {
+    ((uint64_t *)x->fill.ring)[x->fill.cached_prod++ & MASK] =
+        (uint64_t)i * XDP_FRAME_SIZE;
+    x->free[x->nfree++] = (uint64_t)(XDP_RING_SIZE + i) * XDP_FRAME_SIZE;
+  }
+  ring_submit(&x->fill);
+
+  if (load_program(x) == -1 || attach_program(x) == -1 ||
+      bind_socket(x) == -1) {
+    return -1;
+  }
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = x->map_fd;
+  attr.key = (uintptr_t)&queue;
+  attr.value = (uintptr_t)&x->fd;
+  return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1 ? -1 : 0;
+}
+
+/**
+ * Opens an AF_XDP socket on queue 0 of `ifname` for probes from `src`,
+ * framed for the neighbour at `dst_mac`. Native zero-copy mode is used
+ * if the driver supports it, native copy mode failing that, and generic
+ * mode (which any interface, veth included, supports) as a last resort.
+ *
+ * Returns 0 on success and -1 on failure, with errno set.
+ */
+int xdp_open(struct tr_xdp *x, const char *ifname, const struct in_addr *src,
+             const uint8_t dst_mac[6]) {
+  int saved;
+
+  memset(x, 0, sizeof(*x));
+  x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+  x->src = *src;
+  memcpy(x->eth, dst_mac, 6);
+  if (setup(x, ifname) == -1) {
+    saved = errno;
+    xdp_close(x);
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Takes back the frames of probes that have been sent.
+ */
+static void reclaim(struct tr_xdp *x) {
+  uint32_t n = ring_ready(&x->comp);
+
+  while (n-- > 0) {
+    x->free[x->nfree++] = ((uint64_t *)x->comp.ring)[x->comp.cached_cons++ &
+                                                      MASK];
+  }
+  ring_release(&x->comp);
+}
+
+static void kick(struct tr_xdp *x) {
+  sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+/**
+ * Returns a free frame to write a probe into, past its Ethernet header,
+ * waiting for one if every frame is in flight.
+ */
+uint8_t *xdp_frame(struct tr_xdp *x) {
+  uint8_t *frame;
+
+  if (x->nfree == 0) {
+    reclaim(x);
+  }
+  while (x->nfree == 0) {
+    kick(x);
+    reclaim(x);
+  }
+  frame = x->umem + x->free[--x->nfree];
+  memcpy(frame, x->eth, XDP_ETH_LEN);
+  return frame + XDP_ETH_LEN;
+}
+
+/**
+ * Sends the `len` bytes of IP packet written into `frame`,
+ * which must come from xdp_frame().
+ */
+void xdp_send(struct tr_xdp *x, uint8_t *frame, size_t len) {
+  struct xdp_desc *desc;
+
+  // There is a slot for every frame.
+  ring_space(&x->tx);
+  desc = &((struct xdp_desc *)x->tx.ring)[x->tx.cached_prod++ & MASK];
+  desc->addr = frame - XDP_ETH_LEN - x->umem;
+  desc->len = len + XDP_ETH_LEN;
+  desc->options = 0;
+  ring_submit(&x->tx);
+  // Copy mode only sends when asked to.
+  if (!x->zerocopy || needs_wakeup(&x->tx)) {
+    kick(x);
+  }
+  x->nsent++;
+}
+
+/**
+ * Receives the IP packet of a steered reply into `buf`, truncated to
+ * `size` bytes, and its source address into `from`, without blocking.
+ *
+ * Returns its length, or -1 if there was none.
+ */
+int xdp_recv(struct tr_xdp *x, void *buf, size_t size, struct in_addr *from) {
+  uint64_t addr;
+  uint32_t len;
+  const struct xdp_desc *desc;
+  const struct ip *ip;
+
+  if (ring_ready(&x->rx) == 0) {
+    if (needs_wakeup(&x->fill)) {
+      recvfrom(x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+  desc = &((const struct xdp_desc *)x->rx.ring)[x->rx.cached_cons & MASK];
+  addr = desc->addr;
+  len = desc->len - XDP_ETH_LEN; // The program checked there is an IP header.
+  ip = (const struct ip *)(x->umem + addr + XDP_ETH_LEN);
+  from->s_addr = ip->ip_src.s_addr;
+  if (len > size) {
+    len = size;
+  }
+  memcpy(buf, ip, len);
+  x->rx.cached_cons++;
+  ring_release(&x->rx);
+
+  // Hand the frame back for the next reply.
+  ring_space(&x->fill);
+  ((uint64_t *)x->fill.ring)[x->fill.cached_prod++ & MASK] =
+      addr - addr % XDP_FRAME_SIZE;
+  ring_submit(&x->fill);
+  x->nreceived++;
+  return len;
+}
+
+static void unmap_ring(struct tr_xdp_ring *r) {
+  if (r->map != NULL) {
+    munmap(r->map, r->map_len);
+  }
+  r->map = NULL;
+}
+
+void xdp_close(struct tr_xdp *x) {
+  // Closing the link detaches the program.
+  if (x->link_fd != -1) {
+    close(x->link_fd);
+  }
+  if (x->prog_fd != -1) {
+    close(x->prog_fd);
+  }
+  if (x->map_fd != -1) {
+    close(x->map_fd);
+  }
+  unmap_ring(&x->fill);
+  unmap_ring(&x->comp);
+  unmap_ring(&x->rx);
+  unmap_ring(&x->tx);
+  if (x->fd != -1) {
+    close(x->fd);
+  }
+  if (x->umem != NULL) {
+    munmap(x->umem, XDP_FRAMES * XDP_FRAME_SIZE);
+  }
+  x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+  x->umem = NULL;
+}
+
+#else
+
+int xdp_route(const char *routes, const struct in_addr *dst,
+              char ifname[IF_NAMESIZE], struct in_addr *next_hop) {
+  errno = ENOTSUP;
+  return -1;
+}
+
+int xdp_neighbor(const char *neighbors, const char *ifname,
+                 const struct in_addr *addr, uint8_t mac[6]) {
+  errno = ENOTSUP;
+  return -1;
+}
+
+int xdp_open(struct tr_xdp *x, const char *ifname, const struct in_addr *src,
+             const uint8_t dst_mac[6]) {
+  errno = ENOTSUP;
+  return -1;
+}
+
+uint8_t *xdp_frame(struct tr_xdp *x) { return NULL; }
+
+void xdp_send(struct tr_xdp *x, uint8_t *frame, size_t len) {}
+
+int xdp_recv(struct tr_xdp *x, void *buf, size_t size, struct in_addr *from) {
+  errno = EAGAIN;
+  return -1;
+}
+
+void xdp_close(struct tr_xdp *x) {}
+
+#endif
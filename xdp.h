@@ -0,0 +1,70 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define XDP_ROUTES "/proc/net/route"
+#define XDP_NEIGHBORS "/proc/net/arp"
+
+// UMEM frames, the first half of which receive while the rest send,
+// and the size of each ring.
+#define XDP_FRAMES 4096
+#define XDP_FRAME_SIZE 2048
+#define XDP_RING_SIZE (XDP_FRAMES / 2)
+
+#define XDP_ETH_LEN 14
+
+/**
+ * One of the four rings an AF_XDP socket shares with the kernel.
+ * The side that produces owns `cached_prod`, the other `cached_cons`.
+ */
+struct tr_xdp_ring {
+  _Atomic uint32_t *producer;
+  _Atomic uint32_t *consumer;
+  uint32_t *flags;
+  void *ring; // Of descriptors for RX and TX, of frame addresses otherwise.
+  uint32_t cached_prod;
+  uint32_t cached_cons;
+  void *map;
+  size_t map_len;
+};
+
+/**
+ * An AF_XDP socket on queue 0 of an interface, with an XDP program
+ * steering the ICMP errors sent to `src` into it and letting everything
+ * else through to the kernel. Frames are sent with `eth` prepended.
+ */
+struct tr_xdp {
+  int fd;
+  int map_fd;
+  int prog_fd;
+  int link_fd;
+  int ifindex;
+  int generic; // The program runs after the driver hands over an skb.
+  int zerocopy; // Frames are DMAed to and from the UMEM directly.
+  struct in_addr src;
+  uint8_t eth[XDP_ETH_LEN];
+  uint8_t *umem;
+  struct tr_xdp_ring fill, comp, rx, tx;
+  uint64_t free[XDP_RING_SIZE]; // TX frames not in flight.
+  uint32_t nfree;
+  uint64_t nsent;
+  uint64_t nreceived;
+};
+
+int xdp_route(const char *routes, const struct in_addr *dst,
+              char ifname[IF_NAMESIZE], struct in_addr *next_hop);
+int xdp_neighbor(const char *neighbors, const char *ifname,
+                 const struct in_addr *addr, uint8_t mac[6]);
+
+int xdp_open(struct tr_xdp *x, const char *ifname, const struct in_addr *src,
+             const uint8_t dst_mac[6]);
+uint8_t *xdp_frame(struct tr_xdp *x);
+void xdp_send(struct tr_xdp *x, uint8_t *frame, size_t len);
+int xdp_recv(struct tr_xdp *x, void *buf, size_t size, struct in_addr *from);
+void xdp_close(struct tr_xdp *x);
+
+#endif